@@ -0,0 +1,157 @@
+// Copyright 2018 Tihran Katolikian
+// here are the helpers of the compact (quantized) vertex layout:
+// @ CompactVertex (generated from CompactVertexFormat) - 20 byte GPU vertex:
+//   - position quantized to 16-bit unorm relative to the mesh AABB,
+//   - tangent frame packed as a QTangent (quaternion in 4 x snorm16, the
+//     sign of w stores the bitangent handedness),
+//   - texture coords as half floats;
+// @ PositionQuantization - AABB that maps the unorm positions back to
+//   model space, the same constants are passed to the vertex shader;
+// @ packing functions.
+
+#ifndef COMPACT_VERTEX_HPP
+#define COMPACT_VERTEX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "VertexFormat.hpp"
+
+// ------------------------------
+// position = offset + unorm_position * scale
+struct PositionQuantization
+{
+    glm::vec3 offset{0.f, 0.f, 0.f};
+    glm::vec3 scale{1.f, 1.f, 1.f};
+};
+
+namespace VertexPacking
+{
+// ------------------------------
+// IEEE 754 binary32 -> binary16, round to nearest even
+inline std::uint16_t floatToHalf(const float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const std::uint32_t sign = (bits >> 16) & 0x8000u;
+    const std::int32_t exponent = static_cast <std::int32_t>((bits >> 23) & 0xffu) - 127 + 15;
+    std::uint32_t mantissa = bits & 0x7fffffu;
+
+    if (((bits >> 23) & 0xffu) == 0xffu)  // inf or nan
+        return static_cast <std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+    if (exponent >= 0x1f)  // overflow
+        return static_cast <std::uint16_t>(sign | 0x7c00u);
+    if (exponent <= 0) {  // subnormal or zero
+        if (exponent < -10)
+            return static_cast <std::uint16_t>(sign);
+        mantissa |= 0x800000u;
+        const std::uint32_t shift = static_cast <std::uint32_t>(14 - exponent);
+        std::uint32_t half = mantissa >> shift;
+        const std::uint32_t rest = mantissa & ((1u << shift) - 1u);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u)))
+            ++half;
+        return static_cast <std::uint16_t>(sign | half);
+    }
+
+    std::uint32_t half = (static_cast <std::uint32_t>(exponent) << 10) | (mantissa >> 13);
+    const std::uint32_t rest = mantissa & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+        ++half;  // may carry into the exponent, which is still correct
+    return static_cast <std::uint16_t>(sign | half);
+}
+
+inline std::uint16_t toUnorm16(const float value)
+{
+    return static_cast <std::uint16_t>(std::lround(std::clamp(value, 0.f, 1.f) * 65535.f));
+}
+
+inline std::int16_t toSnorm16(const float value)
+{
+    return static_cast <std::int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+// ------------------------------
+// builds the QTangent of an orthonormalized tangent frame. Degenerate
+// tangents are replaced by an arbitrary vector perpendicular to the
+// normal, so the normal is always preserved.
+inline glm::vec4 makeQTangent(const glm::vec3 &normal, const glm::vec3 &tangent,
+                              const glm::vec3 &bitangent)
+{
+    glm::vec3 n = glm::length(normal) > 0.f ? glm::normalize(normal) : glm::vec3(0.f, 0.f, 1.f);
+    glm::vec3 t = tangent - n * glm::dot(n, tangent);
+    if (glm::length(t) < 1e-6f)
+        t = std::abs(n.x) < 0.9f ? glm::cross(n, glm::vec3(1.f, 0.f, 0.f))
+                                 : glm::cross(n, glm::vec3(0.f, 1.f, 0.f));
+    t = glm::normalize(t);
+    const glm::vec3 b = glm::cross(n, t);
+    const float handedness = glm::dot(b, bitangent) < 0.f ? -1.f : 1.f;
+
+    // ------------------------------
+    // rotation matrix with columns t, b, n -> quaternion
+    const float m00 = t.x, m01 = b.x, m02 = n.x;
+    const float m10 = t.y, m11 = b.y, m12 = n.y;
+    const float m20 = t.z, m21 = b.z, m22 = n.z;
+    glm::vec4 q;
+    const float trace = m00 + m11 + m22;
+    if (trace > 0.f) {
+        const float s = std::sqrt(trace + 1.f) * 2.f;
+        q = {(m21 - m12) / s, (m02 - m20) / s, (m10 - m01) / s, 0.25f * s};
+    }
+    else if (m00 > m11 && m00 > m22) {
+        const float s = std::sqrt(1.f + m00 - m11 - m22) * 2.f;
+        q = {0.25f * s, (m01 + m10) / s, (m02 + m20) / s, (m21 - m12) / s};
+    }
+    else if (m11 > m22) {
+        const float s = std::sqrt(1.f + m11 - m00 - m22) * 2.f;
+        q = {(m01 + m10) / s, 0.25f * s, (m12 + m21) / s, (m02 - m20) / s};
+    }
+    else {
+        const float s = std::sqrt(1.f + m22 - m00 - m11) * 2.f;
+        q = {(m02 + m20) / s, (m12 + m21) / s, 0.25f * s, (m10 - m01) / s};
+    }
+    q = glm::normalize(q);
+
+    // ------------------------------
+    // q and -q are the same rotation: keep w positive and away from
+    // zero, so its sign survives snorm16 quantization
+    if (q.w < 0.f)
+        q = -q;
+    const float bias = 1.f / 32767.f;
+    if (q.w < bias) {
+        const float xyz_scale = std::sqrt(1.f - bias * bias);
+        q = {q.x * xyz_scale, q.y * xyz_scale, q.z * xyz_scale, bias};
+    }
+    return handedness < 0.f ? -q : q;
+}
+
+// ------------------------------
+// packs one vertex given the quantization box of its mesh
+inline CompactVertex pack(const glm::vec3 &position, const glm::vec3 &normal,
+                          const glm::vec2 &texture_coords, const glm::vec3 &tangent,
+                          const glm::vec3 &bitangent,
+                          const PositionQuantization &quantization)
+{
+    CompactVertex packed;
+    for (int i = 0; i < 3; ++i) {
+        const float scale = quantization.scale[i];
+        packed.position[i] = toUnorm16(scale > 0.f ? (position[i] - quantization.offset[i]) / scale : 0.f);
+    }
+    packed.position[3] = 0;
+
+    const glm::vec4 q = makeQTangent(normal, tangent, bitangent);
+    for (int i = 0; i < 4; ++i)
+        packed.qtangent[i] = toSnorm16(q[i]);
+
+    packed.texture_coords[0] = floatToHalf(texture_coords.x);
+    packed.texture_coords[1] = floatToHalf(texture_coords.y);
+    return packed;
+}
+}
+
+#endif  // COMPACT_VERTEX_HPP
@@ -0,0 +1,587 @@
+// Copyright 2018 Tihran Katolikian
+// class CrowdScene - benchmark scene: a grid of instances of one model.
+// Every frame one 1/64 slice of the crowd turns around, so the instance
+// buffer gets a small incremental update. The crowd is drawn either
+// with one instanced draw per mesh or through the render queue with one
+// draw per instance and mesh, for comparison.
+// Instances are frustum culled first (bounding spheres in SoA arrays,
+// SIMD kernel, parallel chunks), see FrustumCuller.hpp, through a loose
+// octree of the spheres (LooseOctree.hpp), or on the GPU by a GPUCuller
+// if one is set. CPU culled instances can also go
+// through the software occlusion culler (OcclusionCuller.hpp) with the
+// instances nearest to the viewer as occluders, and through hardware
+// occlusion queries on their bounding boxes (OcclusionQueries.hpp). With
+// queries, one draw per instance goes front to back, hidden instances
+// under conditional rendering; instanced draws leave out the instances
+// whose last query result says they are hidden.
+// With levels of detail on, every CPU culled instance gets the level
+// its screen size calls for (LodSelector.hpp); instanced draws go one
+// per level and mesh.
+// Instances farther than a distance can be drawn as octahedral
+// impostors (Impostor.hpp) instead, one instanced quad each. To measure
+// what they save, they can be switched off every other stats window.
+// pick() finds the instance under a ray with the triangle BVHs of the
+// model, taking the candidates from the octree when it is enabled.
+// CPU submit time (from the first call of the scene to the end of its
+// last GL call, culling included), frame time and the visible share are
+// averaged and printed every second.
+
+#ifndef CROWD_SCENE_HPP
+#define CROWD_SCENE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Frustum.hpp"
+#include "FrustumCuller.hpp"
+#include "GPUCuller.hpp"
+#include "Impostor.hpp"
+#include "InstanceSet.hpp"
+#include "LodSelector.hpp"
+#include "LooseOctree.hpp"
+#include "Model.hpp"
+#include "OcclusionCuller.hpp"
+#include "OcclusionQueries.hpp"
+#include "RenderQueue.hpp"
+#include "shader.hpp"
+#include "ThreadPool.hpp"
+
+class CrowdScene
+{
+public:
+    static constexpr unsigned update_slices = 64;
+
+    CrowdScene(const std::size_t instances_num, const bool use_instancing,
+               const BoundingSphere &instance_bounds, const float spacing = 1.f)
+    :   instancing(use_instancing),
+        model_bounds(instance_bounds)
+    {
+        std::mt19937 random(7);
+        std::uniform_real_distribution <float> angle_distribution(0.f, 360.f);
+        std::uniform_real_distribution <float> tint_distribution(0.6f, 1.f);
+
+        // ------------------------
+        // a square grid in front of the default camera
+        const std::size_t side = static_cast <std::size_t>(
+                                 std::ceil(std::sqrt(static_cast <double>(instances_num))));
+        positions.reserve(instances_num);
+        angles.reserve(instances_num);
+        instances.reserve(instances_num);
+        bounds.resize(instances_num);
+        for (std::size_t i = 0; i < instances_num; ++i) {
+            positions.emplace_back((static_cast <float>(i % side) - side / 2.f) * spacing, -0.5f,
+                                   -static_cast <float>(i / side) * spacing);
+            angles.push_back(angle_distribution(random));
+            instances.add(transform(i), glm::vec4(tint_distribution(random),
+                                                  tint_distribution(random),
+                                                  tint_distribution(random), 1.f));
+            bounds.set(i, model_bounds.transformed(transform(i)));
+        }
+        lods.assign(instances_num, 0);
+    }
+    ~CrowdScene() = default;
+
+    // ------------------------
+    // turns the next slice of the crowd
+    void update(const float delta_time)
+    {
+        const std::size_t slice_size = (positions.size() + update_slices - 1) / update_slices;
+        const std::size_t first = slice * slice_size;
+        const std::size_t last = std::min(first + slice_size, positions.size());
+        for (std::size_t i = first; i < last; ++i) {
+            angles[i] += 90.f * delta_time * update_slices;
+            instances.set(i, transform(i));
+            bounds.set(i, model_bounds.transformed(transform(i)));
+            if (spatial_index)
+                spatial_index->move(static_cast <std::uint32_t>(i), bounds.get(i));
+        }
+        slice = (slice + 1) % update_slices;
+    }
+
+    // ------------------------
+    // culls the instanced crowd on the GPU, nullptr goes back to the
+    // CPU. Used only with instancing.
+    void setGPUCuller(GPUCuller *culler)
+    {
+        gpu_culler = instancing ? culler : nullptr;
+    }
+
+    // ------------------------
+    // frustum culling on the CPU through a loose octree of the
+    // instance spheres instead of testing all of them. The root cell
+    // is the square around the crowd.
+    void enableSpatialIndex()
+    {
+        BoundingBox box;
+        box.min = box.max = positions.empty() ? glm::vec3(0.f) : positions.front();
+        for (const glm::vec3 &position : positions) {
+            box.min = glm::min(box.min, position);
+            box.max = glm::max(box.max, position);
+        }
+        const glm::vec3 extent = box.max - box.min;
+        const float half_size = std::max({extent.x, extent.y, extent.z}) * 0.5f +
+                                glm::length(model_bounds.center) + model_bounds.radius;
+        spatial_index.reset(new LooseOctree(box.center(), half_size));
+        for (std::size_t i = 0; i < positions.size(); ++i)
+            spatial_index->insert(static_cast <std::uint32_t>(i), bounds.get(i));
+    }
+
+    const LooseOctree *getSpatialIndex() const
+    {
+        return spatial_index.get();
+    }
+
+    // ------------------------
+    // the instance the ray from origin along direction (unit length)
+    // hits first within max_distance, and where on model. The
+    // candidates come from the spatial index if it is enabled, in the
+    // order they are met; otherwise every instance is tested.
+    bool pick(const Model &model, const glm::vec3 &origin, const glm::vec3 &direction,
+              const float max_distance, std::uint32_t &instance, ModelHit &hit) const
+    {
+        hit.hit.distance = max_distance;
+        bool found = false;
+        auto test = [&](const std::uint32_t i)
+        {
+            const glm::mat4 inverse = glm::inverse(instances[i].model);
+            ModelHit instance_hit;
+            if (model.intersect(glm::vec3(inverse * glm::vec4(origin, 1.f)),
+                                glm::mat3(inverse) * direction, instance_hit,
+                                hit.hit.distance)) {
+                hit = instance_hit;
+                instance = i;
+                found = true;
+            }
+        };
+        if (spatial_index) {
+            spatial_index->visitRay(origin, direction, max_distance,
+                                    [&](const std::uint32_t i, const float distance)
+                                    {
+                                        if (distance < hit.hit.distance)
+                                            test(i);
+                                    });
+            return found;
+        }
+        for (std::size_t i = 0; i < instances.size(); ++i)
+            test(static_cast <std::uint32_t>(i));
+        return found;
+    }
+
+    // ------------------------
+    // occlusion culling after the frustum culling on the CPU. The
+    // occluders are coarse proxies of the model.
+    void enableOcclusionCulling(const Model &model, const std::size_t occluder_triangles = 256,
+                                const std::size_t occluders = 32)
+    {
+        occluder_proxy = OccluderProxy(model.getMeshes(), occluder_triangles);
+        occluders_num = occluders;
+        occlusion_culler.reset(new OcclusionCuller());
+    }
+
+    // ------------------------
+    // hardware occlusion queries after the frustum culling on the CPU.
+    // Instances found visible are queried again every visible_interval
+    // frames.
+    void enableOcclusionQueries(const unsigned visible_interval = 8)
+    {
+        occlusion_queries.reset(new OcclusionQueryScheduler(instances.size(), visible_interval));
+        occlusion_boxes.reset(new OcclusionBoxRenderer());
+    }
+
+    // ------------------------
+    // levels of detail of the CPU culled crowd. The GPU culler keeps
+    // drawing the full detail.
+    void enableLod(const Model &model, const LodSettings &settings = LodSettings())
+    {
+        lod_selector.reset(new LodSelector(settings));
+        lod_instances.clear();
+        for (std::size_t level = 0; level < model.getLevelsNum(); ++level)
+            lod_instances.emplace_back(new InstanceSet());
+    }
+
+    // ------------------------
+    // call when the camera or the viewport changes
+    void setLodView(const glm::vec3 &viewer_pos, const float fov_y_radians,
+                    const float screen_height)
+    {
+        if (lod_selector)
+            lod_selector->setView(viewer_pos, fov_y_radians, screen_height);
+    }
+
+    // ------------------------
+    // CPU culled instances farther than distance from the viewer are
+    // drawn by renderer. With compare they are drawn in full every
+    // other second, and the frame times of both are printed.
+    void enableImpostors(ImpostorRenderer &renderer, const float distance,
+                         const bool compare = false)
+    {
+        impostor_renderer = &renderer;
+        impostor_distance = distance;
+        compare_impostors = compare;
+        impostors_on = true;
+    }
+
+    // ------------------------
+    // impostor_shader is built from Impostor.vs and Impostor.fs, it is
+    // only used with impostors enabled
+    void render(const Model &model, Shader &instanced_shader, Shader &shader,
+                RenderQueue &queue, const glm::vec3 &viewer_pos, const Frustum &frustum,
+                const glm::mat4 &view_projection, Shader *impostor_shader = nullptr)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        if (gpu_culler) {
+            gpu_culler->cull(instances, frustum);
+            gpu_culler->draw(instanced_shader);
+            submit_ms += std::chrono::duration <double, std::milli>(
+                         std::chrono::steady_clock::now() - start).count();
+            return;
+        }
+        if (spatial_index)
+            spatial_index->queryFrustum(frustum, visible);
+        else
+            FrustumCuller::cull(frustum, bounds, visible, FrustumCuller::bestKernel(),
+                                &ThreadPool::shared());
+        if (occlusion_culler)
+            cullOccluded(model, viewer_pos, view_projection);
+        if (occlusion_queries) {
+            occlusion_queries->beginFrame();
+            queried.assign(visible.cbegin(), visible.cend());
+            // ------------------------
+            // instanced draws cannot be made conditional per instance,
+            // the instances known to be hidden are left out instead
+            if (instancing) {
+                visible.erase(std::remove_if(visible.begin(), visible.end(),
+                                             [this](const std::uint32_t i)
+                                             {
+                                                 return occlusion_queries->visit(i);
+                                             }), visible.end());
+            }
+        }
+        visible_sum += visible.size();
+        const bool draw_impostors = impostor_renderer && impostor_shader && impostors_on;
+        if (draw_impostors)
+            splitImpostors(viewer_pos);
+        const unsigned common_lod = lod_selector ? selectLods(model) : 0;
+        if (instancing) {
+            instanced_shader.use();
+            // ------------------------
+            // with everything visible at one level the full set keeps
+            // its incremental updates, otherwise the visible instances
+            // are gathered into sets of their own
+            if (visible.size() == instances.size() && common_lod != mixed_lods) {
+                model.drawInstanced(instanced_shader, instances, common_lod);
+            }
+            else if (lod_selector) {
+                for (const std::unique_ptr <InstanceSet> &level_instances : lod_instances)
+                    level_instances->clear();
+                for (const std::uint32_t i : visible)
+                    lod_instances[lods[i]]->add(instances[i].model, instances[i].tint);
+                for (unsigned level = 0; level < lod_instances.size(); ++level) {
+                    if (lod_instances[level]->size() > 0)
+                        model.drawInstanced(instanced_shader, *lod_instances[level], level);
+                }
+            }
+            else {
+                visible_instances.clear();
+                for (const std::uint32_t i : visible)
+                    visible_instances.add(instances[i].model, instances[i].tint);
+                model.drawInstanced(instanced_shader, visible_instances);
+            }
+        }
+        else if (occlusion_queries) {
+            drawQueried(model, shader, frustum, viewer_pos);
+        }
+        else {
+            for (const std::uint32_t i : visible)
+                model.submit(queue, shader, instances[i].model, viewer_pos,
+                             RenderQueue::OPAQUE_PASS, nullptr, lods[i]);
+            queue.flush();
+        }
+        if (draw_impostors)
+            impostor_renderer->draw(*impostor_shader, impostor_instances);
+        if (occlusion_queries)
+            queryOcclusion(model, viewer_pos);
+        submit_ms += std::chrono::duration <double, std::milli>(
+                     std::chrono::steady_clock::now() - start).count();
+    }
+
+    // ------------------------
+    // call once per frame with the frame time
+    void frameDone(const float frame_seconds)
+    {
+        ++frames;
+        elapsed_seconds += frame_seconds;
+        if (elapsed_seconds < 1.0)
+            return;
+        std::cout << "Crowd: " << instances.size() << " instances, "
+                  << (instancing ? "instanced" : "one draw per instance");
+        if (gpu_culler)
+            std::cout << ", GPU culling";
+        else
+            std::cout << ", " << visible_sum / frames << " visible ("
+                      << (spatial_index ? "octree"
+                                        : FrustumCuller::getKernelName(FrustumCuller::bestKernel()))
+                      << " culling)";
+        std::cout << ": CPU submit " << submit_ms / frames << " ms, frame "
+                  << elapsed_seconds * 1000.0 / frames << " ms\n";
+        if (occlusion_culler) {
+            std::cout << "Occlusion: " << occlusion_stats.culled / frames << " of "
+                      << occlusion_stats.tested / frames << " culled, "
+                      << occlusion_stats.rasterized_triangles / frames
+                      << " occluder triangles, raster " << occlusion_stats.raster_ms / frames
+                      << " ms, test " << occlusion_stats.test_ms / frames << " ms per frame\n";
+            occlusion_stats = OcclusionCuller::Stats();
+        }
+        if (occlusion_queries) {
+            const OcclusionQueryScheduler::Stats &query_stats = occlusion_queries->getStats();
+            std::cout << "Occlusion queries ("
+                      << (occlusion_queries->isConservative() ? "conservative" : "exact")
+                      << "): " << query_stats.hidden / frames << " hidden, "
+                      << query_stats.conditional_draws / frames << " conditional draws, "
+                      << query_stats.queries_issued / frames << " issued and "
+                      << query_stats.results_read / frames << " read per frame, "
+                      << occlusion_queries->getPool().getCreatedNum() << " in the pool\n";
+            occlusion_queries->resetStats();
+        }
+        if (lod_selector) {
+            const LodSelector::Stats &lod_stats = lod_selector->getStats();
+            std::cout << "LOD (bias " << lod_selector->getSettings().bias << "):";
+            for (std::size_t level = 0; level < lod_instances.size(); ++level)
+                std::cout << ' ' << lod_stats.objects[level] / frames;
+            std::cout << " instances per level, " << lod_stats.triangles / frames << " of "
+                      << lod_stats.full_detail_triangles / frames
+                      << " full detail triangles per frame\n";
+            lod_selector->resetStats();
+        }
+        if (impostor_renderer)
+            reportImpostors();
+        frames = 0;
+        elapsed_seconds = 0.0;
+        submit_ms = 0.0;
+        visible_sum = 0;
+    }
+
+private:
+    bool instancing;
+    GPUCuller *gpu_culler = nullptr;
+    InstanceSet instances;
+    InstanceSet visible_instances;
+    BoundingSphere model_bounds;
+    SphereBoundsSoA bounds;
+    std::unique_ptr <LooseOctree> spatial_index;
+    std::vector <std::uint32_t> visible;
+    std::vector <glm::vec3> positions;
+    std::vector <float> angles;
+    unsigned slice = 0;
+
+    unsigned frames = 0;
+    double elapsed_seconds = 0.0;
+    double submit_ms = 0.0;
+    std::size_t visible_sum = 0;
+
+    // ------------------------
+    // software occlusion culling, enabled by enableOcclusionCulling()
+    std::unique_ptr <OcclusionCuller> occlusion_culler;
+    OccluderProxy occluder_proxy;
+    std::size_t occluders_num = 0;
+    std::vector <std::uint32_t> occluders;
+    OcclusionCuller::Stats occlusion_stats = OcclusionCuller::Stats();
+
+    // ------------------------
+    // hardware occlusion queries, enabled by enableOcclusionQueries()
+    std::unique_ptr <OcclusionQueryScheduler> occlusion_queries;
+    std::unique_ptr <OcclusionBoxRenderer> occlusion_boxes;
+    std::vector <std::uint32_t> queried;
+
+    // ------------------------
+    // levels of detail, enabled by enableLod(). lods holds the level
+    // of every instance picked the last time it was visible, all 0
+    // without them.
+    static constexpr unsigned mixed_lods = LodSelector::max_levels;
+    std::unique_ptr <LodSelector> lod_selector;
+    std::vector <std::uint8_t> lods;
+    std::vector <std::unique_ptr <InstanceSet>> lod_instances;
+
+    // ------------------------
+    // picks the level of every visible instance. Returns the level
+    // they all share, mixed_lods if they do not.
+    unsigned selectLods(const Model &model)
+    {
+        const std::size_t full_detail_triangles = model.getLevelTriangles(0);
+        unsigned common_lod = mixed_lods;
+        for (const std::uint32_t i : visible) {
+            const unsigned level = model.selectLod(*lod_selector, instances[i].model, lods[i]);
+            lods[i] = static_cast <std::uint8_t>(level);
+            lod_selector->record(level, model.getLevelTriangles(level), full_detail_triangles);
+            if (i == visible.front())
+                common_lod = level;
+            else if (level != common_lod)
+                common_lod = mixed_lods;
+        }
+        return common_lod;
+    }
+
+    // ------------------------
+    // impostors, enabled by enableImpostors(). The frame time of the
+    // last stats window with and without them is kept for compare.
+    ImpostorRenderer *impostor_renderer = nullptr;
+    float impostor_distance = 0.f;
+    bool compare_impostors = false;
+    bool impostors_on = false;
+    InstanceSet impostor_instances;
+    std::size_t impostor_sum = 0;
+    double frame_ms_with_impostors = 0.0;
+    double frame_ms_without_impostors = 0.0;
+
+    // ------------------------
+    // moves the visible instances past the impostor distance from
+    // visible to impostor_instances
+    void splitImpostors(const glm::vec3 &viewer_pos)
+    {
+        impostor_instances.clear();
+        const float distance_squared = impostor_distance * impostor_distance;
+        visible.erase(std::remove_if(visible.begin(), visible.end(),
+                                     [&](const std::uint32_t i)
+                                     {
+                                         const glm::vec3 offset = bounds.get(i).center -
+                                                                  viewer_pos;
+                                         if (glm::dot(offset, offset) <= distance_squared)
+                                             return false;
+                                         impostor_instances.add(instances[i].model,
+                                                                instances[i].tint);
+                                         return true;
+                                     }), visible.end());
+        impostor_sum += impostor_instances.size();
+    }
+
+    // ------------------------
+    // prints the impostor stats of the window that ends and switches
+    // them on or off for the next one
+    void reportImpostors()
+    {
+        const double frame_ms = elapsed_seconds * 1000.0 / frames;
+        if (!impostors_on) {
+            frame_ms_without_impostors = frame_ms;
+            impostors_on = true;
+            return;
+        }
+        frame_ms_with_impostors = frame_ms;
+        std::cout << "Impostors: " << impostor_sum / frames << " per frame beyond "
+                  << impostor_distance;
+        if (frame_ms_without_impostors > 0.0) {
+            const double saving = frame_ms_without_impostors - frame_ms_with_impostors;
+            std::cout << ", frame " << frame_ms_with_impostors << " ms vs "
+                      << frame_ms_without_impostors << " ms without (saving " << saving
+                      << " ms, " << saving * 100.0 / frame_ms_without_impostors << "%)";
+        }
+        std::cout << '\n';
+        impostor_sum = 0;
+        impostors_on = !compare_impostors;
+    }
+
+    // ------------------------
+    // draws the visible instances one by one, nearest first so they
+    // occlude the ones behind. The queue is bypassed: it would reorder
+    // the draws out of the conditional rendering.
+    void drawQueried(const Model &model, Shader &shader, const Frustum &frustum,
+                     const glm::vec3 &viewer_pos)
+    {
+        static constexpr UniformName model_name("model");
+        std::sort(visible.begin(), visible.end(),
+                  [this, &viewer_pos](const std::uint32_t a, const std::uint32_t b)
+                  {
+                      return glm::distance(positions[a], viewer_pos) <
+                             glm::distance(positions[b], viewer_pos);
+                  });
+        shader.use();
+        for (const std::uint32_t i : visible) {
+            occlusion_queries->visit(i);
+            occlusion_queries->draw(i, [&]()
+            {
+                shader.setMat4(model_name, instances[i].model);
+                model.draw(shader, &frustum, instances[i].model, lods[i]);
+            });
+        }
+    }
+
+    // ------------------------
+    // queries the boxes of the instances inside the frustum that are
+    // due, after everything is drawn
+    void queryOcclusion(const Model &model, const glm::vec3 &viewer_pos)
+    {
+        // ------------------------
+        // a box around the viewer would be clipped by the near plane
+        static constexpr float near_margin = 0.1f;
+        occlusion_boxes->begin();
+        for (const std::uint32_t i : queried) {
+            if (!occlusion_queries->needsQuery(i))
+                continue;
+            const BoundingSphere sphere = bounds.get(i);
+            if (glm::distance(sphere.center, viewer_pos) < sphere.radius + near_margin) {
+                occlusion_queries->markVisible(i);
+                continue;
+            }
+            occlusion_queries->query(i, [&]()
+            {
+                occlusion_boxes->draw(model.getBoundingBox(), instances[i].model);
+            });
+        }
+        occlusion_boxes->end();
+    }
+
+    // ------------------------
+    // rasterizes the visible instances nearest to the viewer and drops
+    // the visible ones hidden behind them
+    void cullOccluded(const Model &model, const glm::vec3 &viewer_pos,
+                      const glm::mat4 &view_projection)
+    {
+        occlusion_culler->beginFrame();
+        occluders.assign(visible.cbegin(), visible.cend());
+        const std::size_t nearest_num = std::min(occluders_num, occluders.size());
+        std::partial_sort(occluders.begin(), occluders.begin() + nearest_num, occluders.end(),
+                          [this, &viewer_pos](const std::uint32_t a, const std::uint32_t b)
+                          {
+                              return glm::distance(positions[a], viewer_pos) <
+                                     glm::distance(positions[b], viewer_pos);
+                          });
+        for (std::size_t i = 0; i < nearest_num; ++i) {
+            occlusion_culler->addOccluder(occluder_proxy,
+                                          view_projection * instances[occluders[i]].model);
+        }
+        occlusion_culler->rasterize(&ThreadPool::shared());
+
+        visible.erase(std::remove_if(visible.begin(), visible.end(),
+                                     [&](const std::uint32_t i)
+                                     {
+                                         return occlusion_culler->isOccluded(
+                                                model.getBoundingBox(),
+                                                view_projection * instances[i].model);
+                                     }), visible.end());
+
+        const OcclusionCuller::Stats &frame_stats = occlusion_culler->getStats();
+        occlusion_stats.occluder_triangles += frame_stats.occluder_triangles;
+        occlusion_stats.rasterized_triangles += frame_stats.rasterized_triangles;
+        occlusion_stats.tested += frame_stats.tested;
+        occlusion_stats.culled += frame_stats.culled;
+        occlusion_stats.raster_ms += frame_stats.raster_ms;
+        occlusion_stats.test_ms += frame_stats.test_ms;
+    }
+
+    glm::mat4 transform(const std::size_t i) const
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.f), positions[i]);
+        return glm::rotate(model, glm::radians(angles[i]), {0, 1, 0});
+    }
+};
+
+#endif  // CROWD_SCENE_HPP
@@ -0,0 +1,150 @@
+// Copyright 2018 Tihran Katolikian
+// here are the bounding volumes and the view frustum they are tested
+// against:
+// @ BoundingBox - axis-aligned box, min and max corners;
+// @ BoundingSphere - center and radius;
+// @ Frustum - the six planes of a view-projection matrix, extracted
+//   the Gribb/Hartmann way. Normals point inside, so a point p is
+//   inside a plane if dot(plane.xyz, p) + plane.w >= 0.
+
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+struct BoundingBox
+{
+    glm::vec3 min = glm::vec3(0.f);
+    glm::vec3 max = glm::vec3(0.f);
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    void extend(const BoundingBox &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    // ------------------------
+    // the box around the transformed one (Arvo - "Transforming
+    // Axis-Aligned Bounding Boxes", Graphics Gems 1990)
+    BoundingBox transformed(const glm::mat4 &transform) const
+    {
+        BoundingBox box;
+        box.min = box.max = glm::vec3(transform[3]);
+        for (int column = 0; column < 3; ++column) {
+            const glm::vec3 axis(transform[column]);
+            const glm::vec3 a = axis * min[column];
+            const glm::vec3 b = axis * max[column];
+            box.min += glm::min(a, b);
+            box.max += glm::max(a, b);
+        }
+        return box;
+    }
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center = glm::vec3(0.f);
+    float radius = 0.f;
+
+    // ------------------------
+    // the sphere around the transformed one. The radius is scaled by
+    // the largest axis scale, so the result is conservative for
+    // non-uniform scales too.
+    BoundingSphere transformed(const glm::mat4 &transform) const
+    {
+        const float scale = std::sqrt(std::max({glm::dot(glm::vec3(transform[0]),
+                                                         glm::vec3(transform[0])),
+                                                glm::dot(glm::vec3(transform[1]),
+                                                         glm::vec3(transform[1])),
+                                                glm::dot(glm::vec3(transform[2]),
+                                                         glm::vec3(transform[2]))}));
+        return {glm::vec3(transform * glm::vec4(center, 1.f)), radius * scale};
+    }
+};
+
+class Frustum
+{
+public:
+    enum Plane {LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANES_NUM};
+
+    Frustum() = default;
+
+    // ------------------------
+    // planes of the clip volume of a projection * view (* model)
+    // matrix, normalized so plane distances are in world units
+    static Frustum fromMatrix(const glm::mat4 &matrix)
+    {
+        // ------------------------
+        // glm is column-major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        const glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+        const glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+        const glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+        const glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+        Frustum frustum;
+        frustum.planes[LEFT] = row3 + row0;
+        frustum.planes[RIGHT] = row3 - row0;
+        frustum.planes[BOTTOM] = row3 + row1;
+        frustum.planes[TOP] = row3 - row1;
+        frustum.planes[NEAR_PLANE] = row3 + row2;
+        frustum.planes[FAR_PLANE] = row3 - row2;
+        for (glm::vec4 &plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    // ------------------------
+    // the planes in the model space of transform, for testing boxes
+    // without transforming them. The planes are not normalized
+    // afterwards: only box tests are exact with them.
+    Frustum transformed(const glm::mat4 &transform) const
+    {
+        Frustum frustum;
+        const glm::mat4 transposed = glm::transpose(transform);
+        for (int i = 0; i < PLANES_NUM; ++i)
+            frustum.planes[i] = transposed * planes[i];
+        return frustum;
+    }
+
+    bool intersects(const BoundingSphere &sphere) const
+    {
+        for (const glm::vec4 &plane : planes) {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+
+    // ------------------------
+    // the box is outside if its corner farthest along the plane
+    // normal is outside of any plane
+    bool intersects(const BoundingBox &box) const
+    {
+        for (const glm::vec4 &plane : planes) {
+            const glm::vec3 farthest(plane.x >= 0.f ? box.max.x : box.min.x,
+                                     plane.y >= 0.f ? box.max.y : box.min.y,
+                                     plane.z >= 0.f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.f)
+                return false;
+        }
+        return true;
+    }
+
+    const glm::vec4 &getPlane(const int plane) const
+    {
+        return planes[plane];
+    }
+
+private:
+    glm::vec4 planes[PLANES_NUM];
+};
+
+#endif  // FRUSTUM_HPP
@@ -0,0 +1,310 @@
+// Copyright 2018 Tihran Katolikian
+// here are the batched frustum culling classes:
+// @ SphereBoundsSoA - bounding spheres stored as four float arrays
+//   (x, y, z, radius), padded to a multiple of 8 with spheres that
+//   never pass, so the SIMD kernels work on whole groups;
+// @ FrustumCuller - tests the spheres against the six planes and writes
+//   the indices of the visible ones. Kernels: scalar, SSE (4 spheres
+//   per step) and AVX2 (8 per step). AVX2 is compiled with a target
+//   attribute and picked at runtime if the CPU has it, so the build
+//   flags do not change. Large arrays are split into chunks culled in
+//   parallel on a ThreadPool.
+
+#ifndef FRUSTUM_CULLER_HPP
+#define FRUSTUM_CULLER_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define FRUSTUM_CULLER_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRUSTUM_CULLER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include "Frustum.hpp"
+#include "ThreadPool.hpp"
+
+class SphereBoundsSoA
+{
+public:
+    static constexpr std::size_t group_size = 8;
+
+    void resize(const std::size_t new_size)
+    {
+        const std::size_t padded = (new_size + group_size - 1) / group_size * group_size;
+        x.resize(padded, 0.f);
+        y.resize(padded, 0.f);
+        z.resize(padded, 0.f);
+        radius.resize(padded, -FLT_MAX);
+        // ------------------------
+        // shrinking turns the dropped spheres into padding
+        std::fill(radius.begin() + new_size, radius.end(), -FLT_MAX);
+        count = new_size;
+    }
+
+    void set(const std::size_t index, const BoundingSphere &sphere)
+    {
+        x[index] = sphere.center.x;
+        y[index] = sphere.center.y;
+        z[index] = sphere.center.z;
+        radius[index] = sphere.radius;
+    }
+
+    BoundingSphere get(const std::size_t index) const
+    {
+        return {{x[index], y[index], z[index]}, radius[index]};
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    std::size_t paddedSize() const
+    {
+        return radius.size();
+    }
+
+private:
+    friend class FrustumCuller;
+
+    std::vector <float> x;
+    std::vector <float> y;
+    std::vector <float> z;
+    std::vector <float> radius;
+    std::size_t count = 0;
+};
+
+class FrustumCuller
+{
+public:
+    enum Kernel {SCALAR, SSE, AVX2};
+
+    // ------------------------
+    // spheres per parallel chunk, a multiple of the group size
+    static constexpr std::size_t chunk_size = 16384;
+
+    // ------------------------
+    // the widest kernel this CPU can run
+    static Kernel bestKernel()
+    {
+#ifdef FRUSTUM_CULLER_AVX2
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+#endif
+#ifdef FRUSTUM_CULLER_SSE
+        return SSE;
+#else
+        return SCALAR;
+#endif
+    }
+
+    static bool isSupported(const Kernel kernel)
+    {
+        switch (kernel) {
+#ifdef FRUSTUM_CULLER_AVX2
+            case AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef FRUSTUM_CULLER_SSE
+            case SSE:
+            return true;
+#endif
+            case SCALAR:
+            return true;
+            default:
+            return false;
+        }
+    }
+
+    static const char *getKernelName(const Kernel kernel)
+    {
+        switch (kernel) {
+            case SSE:
+            return "SSE";
+            case AVX2:
+            return "AVX2";
+            default:
+            return "scalar";
+        }
+    }
+
+    // ------------------------
+    // indices of the visible spheres in ascending order. With a pool,
+    // arrays larger than one chunk are culled in parallel.
+    static void cull(const Frustum &frustum, const SphereBoundsSoA &bounds,
+                     std::vector <std::uint32_t> &visible, const Kernel kernel = bestKernel(),
+                     ThreadPool *pool = nullptr)
+    {
+        visible.resize(bounds.paddedSize());
+        if (!pool || bounds.paddedSize() <= chunk_size) {
+            visible.resize(cullRange(frustum, bounds, 0, bounds.paddedSize(),
+                                     visible.data(), kernel));
+            return;
+        }
+
+        // ------------------------
+        // every chunk writes to its own part of the output, the parts
+        // are joined afterwards
+        const std::size_t chunks_num = (bounds.paddedSize() + chunk_size - 1) / chunk_size;
+        std::vector <std::size_t> chunk_counts(chunks_num);
+        pool->parallelFor(bounds.paddedSize(), chunk_size,
+                          [&](const std::size_t begin, const std::size_t end)
+        {
+            chunk_counts[begin / chunk_size] = cullRange(frustum, bounds, begin, end,
+                                                         visible.data() + begin, kernel);
+        });
+        std::size_t visible_num = chunk_counts[0];
+        for (std::size_t chunk = 1; chunk < chunks_num; ++chunk) {
+            std::memmove(visible.data() + visible_num, visible.data() + chunk * chunk_size,
+                         chunk_counts[chunk] * sizeof(std::uint32_t));
+            visible_num += chunk_counts[chunk];
+        }
+        visible.resize(visible_num);
+    }
+
+    // ------------------------
+    // [begin, end) must be whole groups; returns the visible count
+    static std::size_t cullRange(const Frustum &frustum, const SphereBoundsSoA &bounds,
+                                 const std::size_t begin, const std::size_t end,
+                                 std::uint32_t *visible, const Kernel kernel)
+    {
+        switch (kernel) {
+#ifdef FRUSTUM_CULLER_AVX2
+            case AVX2:
+            return cullAVX2(frustum, bounds, begin, end, visible);
+#endif
+#ifdef FRUSTUM_CULLER_SSE
+            case SSE:
+            return cullSSE(frustum, bounds, begin, end, visible);
+#endif
+            default:
+            return cullScalar(frustum, bounds, begin, end, visible);
+        }
+    }
+
+    static std::size_t cullScalar(const Frustum &frustum, const SphereBoundsSoA &bounds,
+                                  const std::size_t begin, const std::size_t end,
+                                  std::uint32_t *visible)
+    {
+        std::size_t visible_num = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            bool inside = true;
+            for (int p = 0; p < Frustum::PLANES_NUM; ++p) {
+                const glm::vec4 &plane = frustum.getPlane(p);
+                const float distance = plane.x * bounds.x[i] + plane.y * bounds.y[i] +
+                                       plane.z * bounds.z[i] + plane.w;
+                inside = inside && distance >= -bounds.radius[i];
+            }
+            if (inside)
+                visible[visible_num++] = static_cast <std::uint32_t>(i);
+        }
+        return visible_num;
+    }
+
+#ifdef FRUSTUM_CULLER_SSE
+    static std::size_t cullSSE(const Frustum &frustum, const SphereBoundsSoA &bounds,
+                               const std::size_t begin, const std::size_t end,
+                               std::uint32_t *visible)
+    {
+        __m128 plane_x[Frustum::PLANES_NUM], plane_y[Frustum::PLANES_NUM];
+        __m128 plane_z[Frustum::PLANES_NUM], plane_w[Frustum::PLANES_NUM];
+        for (int p = 0; p < Frustum::PLANES_NUM; ++p) {
+            plane_x[p] = _mm_set1_ps(frustum.getPlane(p).x);
+            plane_y[p] = _mm_set1_ps(frustum.getPlane(p).y);
+            plane_z[p] = _mm_set1_ps(frustum.getPlane(p).z);
+            plane_w[p] = _mm_set1_ps(frustum.getPlane(p).w);
+        }
+        const __m128 sign = _mm_set1_ps(-0.f);
+
+        std::size_t visible_num = 0;
+        for (std::size_t i = begin; i < end; i += 4) {
+            const __m128 x = _mm_loadu_ps(bounds.x.data() + i);
+            const __m128 y = _mm_loadu_ps(bounds.y.data() + i);
+            const __m128 z = _mm_loadu_ps(bounds.z.data() + i);
+            const __m128 negative_radius = _mm_xor_ps(_mm_loadu_ps(bounds.radius.data() + i),
+                                                      sign);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANES_NUM; ++p) {
+                const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x),
+                                                              _mm_mul_ps(plane_y[p], y)),
+                                                   _mm_add_ps(_mm_mul_ps(plane_z[p], z),
+                                                              plane_w[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+            }
+            unsigned mask = static_cast <unsigned>(_mm_movemask_ps(inside));
+            while (mask) {
+                visible[visible_num++] = static_cast <std::uint32_t>(i + lowestBit(mask));
+                mask &= mask - 1;
+            }
+        }
+        return visible_num;
+    }
+#endif
+
+#ifdef FRUSTUM_CULLER_AVX2
+    __attribute__((target("avx2")))
+    static std::size_t cullAVX2(const Frustum &frustum, const SphereBoundsSoA &bounds,
+                                const std::size_t begin, const std::size_t end,
+                                std::uint32_t *visible)
+    {
+        __m256 plane_x[Frustum::PLANES_NUM], plane_y[Frustum::PLANES_NUM];
+        __m256 plane_z[Frustum::PLANES_NUM], plane_w[Frustum::PLANES_NUM];
+        for (int p = 0; p < Frustum::PLANES_NUM; ++p) {
+            plane_x[p] = _mm256_set1_ps(frustum.getPlane(p).x);
+            plane_y[p] = _mm256_set1_ps(frustum.getPlane(p).y);
+            plane_z[p] = _mm256_set1_ps(frustum.getPlane(p).z);
+            plane_w[p] = _mm256_set1_ps(frustum.getPlane(p).w);
+        }
+        const __m256 sign = _mm256_set1_ps(-0.f);
+
+        std::size_t visible_num = 0;
+        for (std::size_t i = begin; i < end; i += 8) {
+            const __m256 x = _mm256_loadu_ps(bounds.x.data() + i);
+            const __m256 y = _mm256_loadu_ps(bounds.y.data() + i);
+            const __m256 z = _mm256_loadu_ps(bounds.z.data() + i);
+            const __m256 negative_radius = _mm256_xor_ps(
+                                           _mm256_loadu_ps(bounds.radius.data() + i), sign);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANES_NUM; ++p) {
+                const __m256 distance = _mm256_add_ps(
+                                        _mm256_add_ps(_mm256_mul_ps(plane_x[p], x),
+                                                      _mm256_mul_ps(plane_y[p], y)),
+                                        _mm256_add_ps(_mm256_mul_ps(plane_z[p], z),
+                                                      plane_w[p]));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius,
+                                                             _CMP_GE_OQ));
+            }
+            unsigned mask = static_cast <unsigned>(_mm256_movemask_ps(inside));
+            while (mask) {
+                visible[visible_num++] = static_cast <std::uint32_t>(i + lowestBit(mask));
+                mask &= mask - 1;
+            }
+        }
+        return visible_num;
+    }
+#endif
+
+private:
+    static unsigned lowestBit(const unsigned mask)
+    {
+#ifdef __GNUC__
+        return static_cast <unsigned>(__builtin_ctz(mask));
+#else
+        unsigned bit = 0;
+        while (!(mask & (1u << bit)))
+            ++bit;
+        return bit;
+#endif
+    }
+};
+
+#endif  // FRUSTUM_CULLER_HPP
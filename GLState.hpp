@@ -0,0 +1,285 @@
+// Copyright 2018 Tihran Katolikian
+// class GLState - shadow copy of the GL state we change most often:
+// current program, VAO, 2D texture bound to each unit, generic and
+// indexed buffer bindings, enable bits and stencil state. A call that
+// would set the state to what it already is issues nothing.
+// Counters of the calls issued and elided are kept.
+//
+// Code that changes this state behind the cache's back (e.g. texture
+// loading binds the new texture) has to call invalidate() afterwards.
+// GL_ELEMENT_ARRAY_BUFFER is part of the VAO, so it is not tracked.
+
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include <cstddef>
+#include <initializer_list>
+
+#include <glad/glad.h>
+
+class GLState
+{
+public:
+    GLState() = delete;
+
+    static constexpr unsigned max_texture_units = 32;
+    static constexpr unsigned max_buffer_bindings = 16;
+
+    struct Counters
+    {
+        std::size_t issued;
+        std::size_t elided;
+    };
+
+    // ------------------------
+    // program and vertex array
+    static void useProgram(const GLuint program)
+    {
+        if (track(current_program, program))
+            glUseProgram(program);
+    }
+
+    static void bindVertexArray(const GLuint vao)
+    {
+        if (track(current_vao, vao))
+            glBindVertexArray(vao);
+    }
+
+    // ------------------------
+    // textures. bindTexture2D switches the active unit only when the
+    // unit's binding actually has to change.
+    static void activeTexture(const unsigned unit)
+    {
+        if (track(active_unit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    static void bindTexture2D(const unsigned unit, const GLuint texture)
+    {
+        if (unit < max_texture_units) {
+            if (texture_units[unit] == texture) {
+                ++counters.elided;
+                return;
+            }
+            texture_units[unit] = texture;
+        }
+        activeTexture(unit);
+        ++counters.issued;
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    // ------------------------
+    // generic buffer bindings
+    static void bindBuffer(const GLenum target, const GLuint buffer)
+    {
+        GLuint *binding = genericBinding(target);
+        if (binding == nullptr) {
+            ++counters.issued;
+            glBindBuffer(target, buffer);
+            return;
+        }
+        if (track(*binding, buffer))
+            glBindBuffer(target, buffer);
+    }
+
+    // ------------------------
+    // indexed uniform buffer bindings. Like GL, this also changes the
+    // generic GL_UNIFORM_BUFFER binding.
+    static void bindBufferRange(const GLenum target, const GLuint index, const GLuint buffer,
+                                const GLintptr offset, const GLsizeiptr size)
+    {
+        if (target == GL_UNIFORM_BUFFER && index < max_buffer_bindings) {
+            IndexedBinding &binding = uniform_bindings[index];
+            if (binding.buffer == buffer && binding.offset == offset && binding.size == size) {
+                ++counters.elided;
+                return;
+            }
+            binding = {buffer, offset, size};
+            uniform_buffer = buffer;
+        }
+        ++counters.issued;
+        glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    // ------------------------
+    // enable bits
+    static void enable(const GLenum cap)
+    {
+        setCapability(cap, true);
+    }
+
+    static void disable(const GLenum cap)
+    {
+        setCapability(cap, false);
+    }
+
+    // ------------------------
+    // stencil state
+    static void stencilOp(const GLenum sfail, const GLenum dpfail, const GLenum dppass)
+    {
+        const StencilOp op = {sfail, dpfail, dppass};
+        if (stencil_op_known && op.sfail == stencil_op.sfail &&
+            op.dpfail == stencil_op.dpfail && op.dppass == stencil_op.dppass) {
+            ++counters.elided;
+            return;
+        }
+        stencil_op = op;
+        stencil_op_known = true;
+        ++counters.issued;
+        glStencilOp(sfail, dpfail, dppass);
+    }
+
+    static void stencilMask(const GLuint mask)
+    {
+        if (track(stencil_mask, mask))
+            glStencilMask(mask);
+    }
+
+    // ------------------------
+    // must be called when a buffer is deleted: GL unbinds it, and its
+    // name may be reused for a new buffer
+    static void forgetBuffer(const GLuint buffer)
+    {
+        for (GLuint *binding : {&array_buffer, &uniform_buffer,
+                                &copy_read_buffer, &copy_write_buffer}) {
+            if (*binding == buffer)
+                *binding = unknown;
+        }
+        for (IndexedBinding &binding : uniform_bindings) {
+            if (binding.buffer == buffer)
+                binding = {unknown, 0, 0};
+        }
+    }
+
+    // ------------------------
+    // forgets everything, the next call of every kind is issued
+    static void invalidate()
+    {
+        current_program = unknown;
+        current_vao = unknown;
+        active_unit = unknown;
+        array_buffer = unknown;
+        uniform_buffer = unknown;
+        copy_read_buffer = unknown;
+        copy_write_buffer = unknown;
+        stencil_mask = unknown;
+        stencil_op_known = false;
+        for (GLuint &texture : texture_units)
+            texture = unknown;
+        for (IndexedBinding &binding : uniform_bindings)
+            binding = {unknown, 0, 0};
+        for (signed char &capability : capabilities)
+            capability = -1;
+    }
+
+    static const Counters &getCounters()
+    {
+        return counters;
+    }
+
+    static void resetCounters()
+    {
+        counters = {0, 0};
+    }
+
+private:
+    // ------------------------
+    // no GL object name or mask we track takes this value in practice
+    static constexpr GLuint unknown = ~0u;
+
+    struct IndexedBinding
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    struct StencilOp
+    {
+        GLenum sfail;
+        GLenum dpfail;
+        GLenum dppass;
+    };
+
+    static constexpr GLenum tracked_capabilities[] = {GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND,
+                                                      GL_CULL_FACE, GL_SCISSOR_TEST,
+                                                      GL_POLYGON_OFFSET_FILL};
+    static constexpr std::size_t capabilities_num = sizeof(tracked_capabilities) /
+                                                    sizeof(tracked_capabilities[0]);
+
+    inline static GLuint current_program = unknown;
+    inline static GLuint current_vao = unknown;
+    inline static GLuint active_unit = unknown;
+    inline static GLuint texture_units[max_texture_units] = {
+        unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+        unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+        unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+        unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown
+    };
+    inline static GLuint array_buffer = unknown;
+    inline static GLuint uniform_buffer = unknown;
+    inline static GLuint copy_read_buffer = unknown;
+    inline static GLuint copy_write_buffer = unknown;
+    inline static IndexedBinding uniform_bindings[max_buffer_bindings] = {
+        {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0},
+        {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0},
+        {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0},
+        {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0}, {unknown, 0, 0}
+    };
+    // -1 unknown, 0 disabled, 1 enabled
+    inline static signed char capabilities[capabilities_num] = {-1, -1, -1, -1, -1, -1};
+    inline static GLuint stencil_mask = unknown;
+    inline static StencilOp stencil_op = {0, 0, 0};
+    inline static bool stencil_op_known = false;
+    inline static Counters counters = {0, 0};
+
+    // ------------------------
+    // updates the shadow value, returns true if the GL call is needed
+    static bool track(GLuint &shadow, const GLuint value)
+    {
+        if (shadow == value) {
+            ++counters.elided;
+            return false;
+        }
+        shadow = value;
+        ++counters.issued;
+        return true;
+    }
+
+    static GLuint *genericBinding(const GLenum target)
+    {
+        switch (target) {
+            case GL_ARRAY_BUFFER:
+            return &array_buffer;
+            case GL_UNIFORM_BUFFER:
+            return &uniform_buffer;
+            case GL_COPY_READ_BUFFER:
+            return &copy_read_buffer;
+            case GL_COPY_WRITE_BUFFER:
+            return &copy_write_buffer;
+            default:
+            return nullptr;
+        }
+    }
+
+    static void setCapability(const GLenum cap, const bool enabled)
+    {
+        for (std::size_t i = 0; i < capabilities_num; ++i) {
+            if (tracked_capabilities[i] != cap)
+                continue;
+            if (capabilities[i] == static_cast <signed char>(enabled)) {
+                ++counters.elided;
+                return;
+            }
+            capabilities[i] = enabled;
+            break;
+        }
+        ++counters.issued;
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+};
+
+#endif  // GL_STATE_HPP
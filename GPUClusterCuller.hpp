@@ -0,0 +1,163 @@
+// Copyright 2018 Tihran Katolikian
+// class GPUClusterCuller - culling of the meshlets of a model on the GPU
+// (GL 4.3), see Meshlets.hpp for the tests. The meshlets of the model
+// are stored in a shader storage buffer, and CullClusters.cs writes one
+// indirect draw command per meshlet, with no indices if it is culled.
+// The model is then drawn with one glMultiDrawElementsIndirect per
+// batch from those commands, nothing is read back.
+// Every draw() of a frame writes its own range of the command buffer,
+// so drawing a model several times a frame does not overwrite commands
+// the GPU has not consumed yet; beginFrame() starts over.
+// Needs a model whose meshes live in a GeometryArena. Check
+// isSupported() before creating one; on older contexts use
+// Model::drawClusters() instead.
+
+#ifndef GPU_CLUSTER_CULLER_HPP
+#define GPU_CLUSTER_CULLER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "gl_extensions.hpp"
+#include "GLState.hpp"
+#include "Meshlets.hpp"
+#include "Model.hpp"
+#include "shader.hpp"
+
+class GPUClusterCuller
+{
+public:
+    static constexpr GLuint group_size = 64;
+
+    static bool isSupported(const Model &model)
+    {
+        return GLExt::has_compute_shader && GLExt::has_multi_draw_indirect &&
+               model.getArena() && model.getMeshletsNum() > 0;
+    }
+
+    explicit GPUClusterCuller(const Model &culled_model)
+    :   model(culled_model),
+        program(Shader::COMPUTE_STAGE, "CullClusters.cs")
+    {
+        std::vector <Meshlet> meshlets;
+        std::vector <GLExt::DrawElementsIndirectCommand> commands;
+        model.getClusters(meshlets, commands);
+        clusters_num = meshlets.size();
+
+        std::vector <Cluster> clusters;
+        clusters.reserve(clusters_num);
+        for (std::size_t i = 0; i < clusters_num; ++i) {
+            const Meshlet &meshlet = meshlets[i];
+            clusters.push_back({glm::vec4(meshlet.sphere.center, meshlet.sphere.radius),
+                                glm::vec4(meshlet.cone_axis, meshlet.cone_cutoff),
+                                {commands[i].count, commands[i].first_index,
+                                 static_cast <std::uint32_t>(commands[i].base_vertex), 0}});
+        }
+        glGenBuffers(1, &clusters_buffer);
+        glGenBuffers(1, &commands_buffer);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, clusters_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, clusters.size() * sizeof(Cluster), clusters.data(),
+                     GL_STATIC_DRAW);
+    }
+
+    ~GPUClusterCuller()
+    {
+        GLState::forgetBuffer(clusters_buffer);
+        GLState::forgetBuffer(commands_buffer);
+        glDeleteBuffers(1, &clusters_buffer);
+        glDeleteBuffers(1, &commands_buffer);
+    }
+
+    GPUClusterCuller(const GPUClusterCuller &) = delete;
+    GPUClusterCuller &operator=(const GPUClusterCuller &) = delete;
+
+    void beginFrame()
+    {
+        draws_num = 0;
+    }
+
+    // ------------------------
+    // culls the meshlets of the model drawn with transform and draws
+    // the visible ones with shader. The caller sets the "model"
+    // uniform of shader.
+    void draw(Shader &shader, const glm::mat4 &view_projection, const glm::mat4 &transform,
+              const glm::vec3 &viewer_pos)
+    {
+        const Frustum local_frustum = Frustum::fromMatrix(view_projection * transform);
+        if (clusters_num == 0 || !local_frustum.intersects(model.getBoundingSphere()))
+            return;
+        const std::size_t first_command = draws_num++ * clusters_num;
+        reserveCommands(first_command + clusters_num);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusters_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commands_buffer);
+
+        static constexpr UniformName viewer_pos_name("viewer_pos");
+        static constexpr UniformName clusters_num_name("clusters_num");
+        static constexpr UniformName first_command_name("first_command");
+        program.use();
+        for (unsigned i = 0; i < Frustum::PLANES_NUM; ++i) {
+            UniformName plane_name("planes[");
+            plane_name.append(i).append("]");
+            program.setVec4(plane_name, local_frustum.getPlane(static_cast <int>(i)));
+        }
+        program.setVec3(viewer_pos_name,
+                        glm::vec3(glm::inverse(transform) * glm::vec4(viewer_pos, 1.f)));
+        program.setInt(clusters_num_name, static_cast <int>(clusters_num));
+        program.setInt(first_command_name, static_cast <int>(first_command));
+        GLExt::dispatchCompute(static_cast <GLuint>((clusters_num + group_size - 1) / group_size),
+                               1, 1);
+        GLExt::memoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+        shader.use();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+        model.drawClustersIndirect(shader, first_command);
+    }
+
+    std::size_t getClustersNum() const
+    {
+        return clusters_num;
+    }
+
+private:
+    // ------------------------
+    // a meshlet as CullClusters.cs reads it, 48 bytes in std430:
+    // sphere center and radius, cone axis and cutoff, and the count,
+    // first index and base vertex of its command
+    struct Cluster
+    {
+        glm::vec4 sphere;
+        glm::vec4 cone;
+        std::uint32_t draw[4];
+    };
+
+    const Model &model;
+    Shader program;
+    unsigned clusters_buffer = 0;
+    unsigned commands_buffer = 0;
+    std::size_t clusters_num = 0;
+    std::size_t commands_capacity = 0;
+    std::size_t draws_num = 0;
+
+    // ------------------------
+    // the buffer grows by reallocation: draws issued before keep
+    // reading the storage they were issued with
+    void reserveCommands(const std::size_t commands_num)
+    {
+        if (commands_num <= commands_capacity)
+            return;
+        commands_capacity = std::max(commands_num, commands_capacity * 2);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, commands_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER,
+                     commands_capacity * sizeof(GLExt::DrawElementsIndirectCommand),
+                     nullptr, GL_DYNAMIC_COPY);
+    }
+};
+
+#endif  // GPU_CLUSTER_CULLER_HPP
@@ -0,0 +1,151 @@
+// Copyright 2018 Tihran Katolikian
+// class GPUCuller - frustum culling of instances on the GPU (GL 4.3).
+// The instance buffer of an InstanceSet is read as a shader storage
+// buffer by CullInstances.cs, which tests the bounding sphere of every
+// mesh of every instance and appends the visible instances to a region
+// of its own buffer per mesh, counting them in the indirect draw
+// command of that mesh. Command m draws its region through
+// base_instance = m * capacity. The model is then drawn with
+// glMultiDrawElementsIndirect from that buffer, so the CPU never
+// touches per-instance visibility and nothing is read back.
+// Needs a model whose meshes live in a GeometryArena. Check
+// isSupported() before creating one; on older contexts use the CPU
+// culling of FrustumCuller.hpp instead.
+
+#ifndef GPU_CULLER_HPP
+#define GPU_CULLER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "gl_extensions.hpp"
+#include "GLState.hpp"
+#include "InstanceSet.hpp"
+#include "Model.hpp"
+#include "shader.hpp"
+
+class GPUCuller
+{
+public:
+    static constexpr GLuint group_size = 64;
+
+    static bool isSupported(const Model &model)
+    {
+        return GLExt::has_compute_shader && GLExt::has_multi_draw_indirect && model.getArena();
+    }
+
+    explicit GPUCuller(const Model &culled_model)
+    :   model(culled_model),
+        program(Shader::COMPUTE_STAGE, "CullInstances.cs"),
+        commands(culled_model.getIndirectCommands())
+    {
+        glGenBuffers(1, &commands_buffer);
+        glGenBuffers(1, &visible_buffer);
+        glGenBuffers(1, &bounds_buffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     commands.size() * sizeof(GLExt::DrawElementsIndirectCommand),
+                     commands.data(), GL_DYNAMIC_DRAW);
+        const std::vector <glm::vec4> bounds = culled_model.getIndirectBounds();
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, bounds_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(),
+                     GL_STATIC_DRAW);
+    }
+
+    ~GPUCuller()
+    {
+        GLState::forgetBuffer(commands_buffer);
+        GLState::forgetBuffer(visible_buffer);
+        GLState::forgetBuffer(bounds_buffer);
+        glDeleteBuffers(1, &commands_buffer);
+        glDeleteBuffers(1, &visible_buffer);
+        glDeleteBuffers(1, &bounds_buffer);
+    }
+
+    GPUCuller(const GPUCuller &) = delete;
+    GPUCuller &operator=(const GPUCuller &) = delete;
+
+    // ------------------------
+    // uploads the pending changes of the set and culls it. The result
+    // is used by the next draw().
+    void cull(InstanceSet &instances, const Frustum &frustum)
+    {
+        instances.upload();
+        instances_num = instances.size();
+        if (instances_num == 0 || commands.empty())
+            return;
+        if (instances_num > visible_capacity) {
+            visible_capacity = instances_num;
+            GLState::bindBuffer(GL_COPY_WRITE_BUFFER, visible_buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER,
+                         commands.size() * visible_capacity * sizeof(InstanceData),
+                         nullptr, GL_DYNAMIC_COPY);
+            for (std::size_t i = 0; i < commands.size(); ++i)
+                commands[i].base_instance = static_cast <GLuint>(i * visible_capacity);
+        }
+
+        // ------------------------
+        // restart the counts, commands holds zero instances
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+                        commands.size() * sizeof(GLExt::DrawElementsIndirectCommand),
+                        commands.data());
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instances.getBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commands_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bounds_buffer);
+
+        static constexpr UniformName instances_num_name("instances_num");
+        static constexpr UniformName commands_num_name("commands_num");
+        program.use();
+        for (unsigned i = 0; i < Frustum::PLANES_NUM; ++i) {
+            UniformName plane_name("planes[");
+            plane_name.append(i).append("]");
+            program.setVec4(plane_name, frustum.getPlane(static_cast <int>(i)));
+        }
+        program.setInt(instances_num_name, static_cast <int>(instances_num));
+        program.setInt(commands_num_name, static_cast <int>(commands.size()));
+
+        // ------------------------
+        // one invocation per (instance, mesh) pair
+        const std::size_t pairs_num = instances_num * commands.size();
+        GLExt::dispatchCompute(static_cast <GLuint>((pairs_num + group_size - 1) / group_size),
+                               1, 1);
+        GLExt::memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // ------------------------
+    // draws the visible instances of the last cull() with the
+    // instanced shader
+    void draw(Shader &shader) const
+    {
+        if (instances_num == 0 || commands.empty())
+            return;
+        shader.use();
+        GeometryArena <StandardVertexFormat> &arena = *model.getArena();
+        GLState::bindVertexArray(arena.getVertexArray());
+        if (arena.instanceBinding() != visible_buffer) {
+            InstanceSet::setupAttributes(visible_buffer);
+            arena.instanceBinding() = visible_buffer;
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_buffer);
+        model.drawIndirect(shader);
+    }
+
+private:
+    const Model &model;
+    Shader program;
+    std::vector <GLExt::DrawElementsIndirectCommand> commands;
+    unsigned commands_buffer = 0;
+    unsigned visible_buffer = 0;
+    unsigned bounds_buffer = 0;
+    std::size_t visible_capacity = 0;
+    std::size_t instances_num = 0;
+};
+
+#endif  // GPU_CULLER_HPP
@@ -0,0 +1,483 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes that let many meshes share their GPU buffers:
+// @ RangeAllocator - first-fit free-list allocator of element ranges,
+//   freed ranges are merged with their free neighbours;
+// @ GeometryArena - one large vertex buffer and one large index buffer
+//   of a vertex format, suballocated per mesh, and the single VAO every
+//   mesh of the format is drawn with. Meshes address their range with
+//   baseVertex + firstIndex, so indices stay relative to the mesh.
+//   Draws take a part of an allocation's indices, so the levels of
+//   detail of a mesh share its allocation.
+//   A list of meshes is drawn with one glMultiDrawElementsIndirect
+//   (GL 4.3) or one glMultiDrawElementsBaseVertex (GL 3.2) call.
+//   When the buffers run out of space they grow; compact() moves the
+//   live ranges to the front and leaves one free block at the end.
+
+#ifndef GEOMETRY_ARENA_HPP
+#define GEOMETRY_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "gl_extensions.hpp"
+#include "GLState.hpp"
+
+class RangeAllocator
+{
+public:
+    static constexpr std::size_t invalid_offset = ~static_cast <std::size_t>(0);
+
+    explicit RangeAllocator(const std::size_t init_capacity = 0)
+    {
+        grow(init_capacity);
+    }
+
+    // ------------------------
+    // returns the offset of the range or invalid_offset if no free
+    // block is large enough
+    std::size_t allocate(const std::size_t size)
+    {
+        if (size == 0)
+            return 0;
+        for (auto block = free_blocks.begin(); block != free_blocks.end(); ++block) {
+            if (block->second < size)
+                continue;
+            const std::size_t offset = block->first;
+            const std::size_t rest = block->second - size;
+            free_blocks.erase(block);
+            if (rest > 0)
+                free_blocks.emplace(offset + size, rest);
+            used += size;
+            return offset;
+        }
+        return invalid_offset;
+    }
+
+    void free(const std::size_t offset, const std::size_t size)
+    {
+        if (size == 0)
+            return;
+        used -= size;
+        insertFree(offset, size);
+    }
+
+    // ------------------------
+    // appends [capacity, new_capacity) to the free space
+    void grow(const std::size_t new_capacity)
+    {
+        if (new_capacity > capacity)
+            insertFree(capacity, new_capacity - capacity);
+        capacity = std::max(capacity, new_capacity);
+    }
+
+    // ------------------------
+    // forgets all ranges: [0, used_size) is used, the rest is free
+    void reset(const std::size_t used_size)
+    {
+        free_blocks.clear();
+        used = used_size;
+        if (capacity > used_size)
+            free_blocks.emplace(used_size, capacity - used_size);
+    }
+
+    // -----------------------------
+    // getters
+    std::size_t getCapacity() const
+    {
+        return capacity;
+    }
+
+    std::size_t getUsed() const
+    {
+        return used;
+    }
+
+    std::size_t getLargestFreeBlock() const
+    {
+        std::size_t largest = 0;
+        for (const auto &block : free_blocks)
+            largest = std::max(largest, block.second);
+        return largest;
+    }
+
+    std::size_t getFreeBlocksNum() const
+    {
+        return free_blocks.size();
+    }
+
+private:
+    // ------------------------
+    // offset -> size of every free block, neighbours are always merged
+    std::map <std::size_t, std::size_t> free_blocks;
+    std::size_t capacity = 0;
+    std::size_t used = 0;
+
+    void insertFree(std::size_t offset, std::size_t size)
+    {
+        auto next = free_blocks.lower_bound(offset);
+        if (next != free_blocks.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                free_blocks.erase(previous);
+            }
+        }
+        if (next != free_blocks.end() && offset + size == next->first) {
+            size += next->second;
+            free_blocks.erase(next);
+        }
+        free_blocks.emplace(offset, size);
+    }
+};
+
+template <class Format>
+class GeometryArena
+{
+public:
+    using Vertex = typename Format::Vertex;
+    using Handle = std::uint32_t;
+
+    static constexpr Handle invalid_handle = ~0u;
+
+    // ------------------------
+    // vertex and index range of one mesh, in elements
+    struct Allocation
+    {
+        std::size_t first_vertex;
+        std::size_t vertices_num;
+        std::size_t first_index;
+        std::size_t indices_num;
+        bool live;
+    };
+
+    // ------------------------
+    // indices_num indices of an allocation starting at its index
+    // first_index, e.g. one level of detail of a mesh
+    struct DrawRange
+    {
+        Handle handle;
+        std::size_t first_index;
+        std::size_t indices_num;
+    };
+
+    // ------------------------
+    // capacities are in vertices and indices; the buffers double
+    // when an allocation does not fit
+    GeometryArena(const std::size_t vertex_capacity = 1 << 18,
+                  const std::size_t index_capacity = 1 << 20)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &indirect_buffer);
+        reallocate(vertex_capacity, index_capacity, false);
+    }
+
+    ~GeometryArena()
+    {
+        for (const unsigned buffer : {VBO, EBO, indirect_buffer})
+            GLState::forgetBuffer(buffer);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &indirect_buffer);
+        // ------------------------
+        // unbind first, so the state cache does not keep a deleted name
+        GLState::bindVertexArray(0);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena &operator=(const GeometryArena &) = delete;
+
+    // ------------------------
+    // reserves the ranges of a mesh and uploads its data
+    Handle allocate(const Vertex *vertices, const std::size_t vertices_num,
+                    const unsigned *indices, const std::size_t indices_num)
+    {
+        std::size_t first_vertex = vertex_ranges.allocate(vertices_num);
+        std::size_t first_index = index_ranges.allocate(indices_num);
+        if (first_vertex == RangeAllocator::invalid_offset ||
+            first_index == RangeAllocator::invalid_offset) {
+            if (first_vertex != RangeAllocator::invalid_offset)
+                vertex_ranges.free(first_vertex, vertices_num);
+            if (first_index != RangeAllocator::invalid_offset)
+                index_ranges.free(first_index, indices_num);
+            // ------------------------
+            // grow by at least 2x, so a run of allocations copies the
+            // buffers only a logarithmic number of times
+            reallocate(vertex_ranges.getCapacity() + std::max(vertex_ranges.getCapacity(),
+                                                              vertices_num),
+                       index_ranges.getCapacity() + std::max(index_ranges.getCapacity(),
+                                                             indices_num), true);
+            first_vertex = vertex_ranges.allocate(vertices_num);
+            first_index = index_ranges.allocate(indices_num);
+        }
+
+        Handle handle;
+        if (!free_handles.empty()) {
+            handle = free_handles.back();
+            free_handles.pop_back();
+        }
+        else {
+            handle = static_cast <Handle>(allocations.size());
+            allocations.emplace_back();
+        }
+        allocations[handle] = {first_vertex, vertices_num, first_index, indices_num, true};
+
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, first_vertex * sizeof(Vertex),
+                        vertices_num * sizeof(Vertex), vertices);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, first_index * sizeof(unsigned),
+                        indices_num * sizeof(unsigned), indices);
+        return handle;
+    }
+
+    void free(const Handle handle)
+    {
+        Allocation &allocation = allocations[handle];
+        if (!allocation.live)
+            return;
+        vertex_ranges.free(allocation.first_vertex, allocation.vertices_num);
+        index_ranges.free(allocation.first_index, allocation.indices_num);
+        allocation.live = false;
+        free_handles.push_back(handle);
+    }
+
+    // ------------------------
+    // moves every live range to the front of new buffers of the same
+    // capacity. Indices are relative to the base vertex, so they are
+    // copied as they are; handles stay valid.
+    void compact()
+    {
+        std::vector <Handle> order;
+        for (Handle handle = 0; handle < allocations.size(); ++handle) {
+            if (allocations[handle].live)
+                order.push_back(handle);
+        }
+        std::sort(order.begin(), order.end(), [this](const Handle a, const Handle b) {
+            return allocations[a].first_vertex < allocations[b].first_vertex;
+        });
+
+        unsigned new_VBO = 0;
+        unsigned new_EBO = 0;
+        glGenBuffers(1, &new_VBO);
+        glGenBuffers(1, &new_EBO);
+        allocateStorage(new_VBO, vertex_ranges.getCapacity() * sizeof(Vertex));
+        allocateStorage(new_EBO, index_ranges.getCapacity() * sizeof(unsigned));
+
+        std::size_t next_vertex = 0;
+        std::size_t next_index = 0;
+        for (const Handle handle : order) {
+            Allocation &allocation = allocations[handle];
+            copyRange(VBO, new_VBO, allocation.first_vertex * sizeof(Vertex),
+                      next_vertex * sizeof(Vertex), allocation.vertices_num * sizeof(Vertex));
+            copyRange(EBO, new_EBO, allocation.first_index * sizeof(unsigned),
+                      next_index * sizeof(unsigned), allocation.indices_num * sizeof(unsigned));
+            allocation.first_vertex = next_vertex;
+            allocation.first_index = next_index;
+            next_vertex += allocation.vertices_num;
+            next_index += allocation.indices_num;
+        }
+        vertex_ranges.reset(next_vertex);
+        index_ranges.reset(next_index);
+        replaceBuffers(new_VBO, new_EBO);
+    }
+
+    // ------------------------
+    // 1 - largest free block / free space, of the vertex buffer.
+    // 0 means all the free space is one block.
+    float getFragmentation() const
+    {
+        const std::size_t free_space = vertex_ranges.getCapacity() - vertex_ranges.getUsed();
+        if (free_space == 0)
+            return 0.f;
+        return 1.f - static_cast <float>(vertex_ranges.getLargestFreeBlock()) / free_space;
+    }
+
+    // ------------------------
+    // the whole index range of an allocation
+    DrawRange getDrawRange(const Handle handle) const
+    {
+        return {handle, 0, allocations[handle].indices_num};
+    }
+
+    // ------------------------
+    // draws one mesh. Expects the arena's VAO to be bound.
+    void drawElements(const DrawRange &range) const
+    {
+        const Allocation &allocation = allocations[range.handle];
+        glDrawElementsBaseVertex(GL_TRIANGLES, static_cast <GLsizei>(range.indices_num),
+                                 GL_UNSIGNED_INT, indexOffset(allocation, range),
+                                 static_cast <GLint>(allocation.first_vertex));
+    }
+
+    void drawElementsInstanced(const DrawRange &range, const GLsizei instances_num) const
+    {
+        const Allocation &allocation = allocations[range.handle];
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast <GLsizei>(range.indices_num),
+                                          GL_UNSIGNED_INT, indexOffset(allocation, range),
+                                          instances_num,
+                                          static_cast <GLint>(allocation.first_vertex));
+    }
+
+    // ------------------------
+    // draws all ranges of the list with one call. Every draw uses the
+    // state set up for the first one (program, textures, uniforms).
+    void multiDraw(const std::vector <DrawRange> &ranges) const
+    {
+        if (ranges.empty())
+            return;
+        GLState::bindVertexArray(VAO);
+        if (GLExt::has_multi_draw_indirect) {
+            commands.clear();
+            for (const DrawRange &range : ranges) {
+                const Allocation &allocation = allocations[range.handle];
+                commands.push_back({static_cast <GLuint>(range.indices_num), 1,
+                                    static_cast <GLuint>(allocation.first_index +
+                                                         range.first_index),
+                                    static_cast <GLint>(allocation.first_vertex), 0});
+            }
+            // ------------------------
+            // the draw indirect binding is not tracked by GLState
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                         commands.size() * sizeof(GLExt::DrawElementsIndirectCommand),
+                         commands.data(), GL_STREAM_DRAW);
+            GLExt::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                             static_cast <GLsizei>(commands.size()), 0);
+            return;
+        }
+
+        counts.clear();
+        offsets.clear();
+        base_vertices.clear();
+        for (const DrawRange &range : ranges) {
+            const Allocation &allocation = allocations[range.handle];
+            counts.push_back(static_cast <GLsizei>(range.indices_num));
+            offsets.push_back(indexOffset(allocation, range));
+            base_vertices.push_back(static_cast <GLint>(allocation.first_vertex));
+        }
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT,
+                                      offsets.data(), static_cast <GLsizei>(counts.size()),
+                                      base_vertices.data());
+    }
+
+    // -----------------------------
+    // getters
+    unsigned getVertexArray() const
+    {
+        return VAO;
+    }
+
+    const Allocation &getAllocation(const Handle handle) const
+    {
+        return allocations[handle];
+    }
+
+    const RangeAllocator &getVertexRanges() const
+    {
+        return vertex_ranges;
+    }
+
+    const RangeAllocator &getIndexRanges() const
+    {
+        return index_ranges;
+    }
+
+    // ------------------------
+    // instance buffer the VAO's instance attributes point at, shared
+    // by all meshes of the arena (see BasicMesh::drawInstanced)
+    unsigned &instanceBinding() const
+    {
+        return instance_buffer;
+    }
+
+private:
+    unsigned VAO = 0;
+    unsigned VBO = 0;
+    unsigned EBO = 0;
+    unsigned indirect_buffer = 0;
+    mutable unsigned instance_buffer = 0;
+
+    RangeAllocator vertex_ranges;
+    RangeAllocator index_ranges;
+    std::vector <Allocation> allocations;
+    std::vector <Handle> free_handles;
+
+    // ------------------------
+    // scratch arrays of multiDraw
+    mutable std::vector <GLExt::DrawElementsIndirectCommand> commands;
+    mutable std::vector <GLsizei> counts;
+    mutable std::vector <const void *> offsets;
+    mutable std::vector <GLint> base_vertices;
+
+    static const void *indexOffset(const Allocation &allocation, const DrawRange &range)
+    {
+        return reinterpret_cast <const void *>((allocation.first_index + range.first_index) *
+                                               sizeof(unsigned));
+    }
+
+    static void allocateStorage(const unsigned buffer, const std::size_t size)
+    {
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+    }
+
+    static void copyRange(const unsigned source, const unsigned destination,
+                          const std::size_t source_offset, const std::size_t destination_offset,
+                          const std::size_t size)
+    {
+        if (size == 0)
+            return;
+        GLState::bindBuffer(GL_COPY_READ_BUFFER, source);
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, destination);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            source_offset, destination_offset, size);
+    }
+
+    // ------------------------
+    // new buffers of the given capacities; with keep_contents the old
+    // data is copied to the same offsets
+    void reallocate(const std::size_t vertex_capacity, const std::size_t index_capacity,
+                    const bool keep_contents)
+    {
+        unsigned new_VBO = 0;
+        unsigned new_EBO = 0;
+        glGenBuffers(1, &new_VBO);
+        glGenBuffers(1, &new_EBO);
+        allocateStorage(new_VBO, vertex_capacity * sizeof(Vertex));
+        allocateStorage(new_EBO, index_capacity * sizeof(unsigned));
+        if (keep_contents) {
+            copyRange(VBO, new_VBO, 0, 0, vertex_ranges.getCapacity() * sizeof(Vertex));
+            copyRange(EBO, new_EBO, 0, 0, index_ranges.getCapacity() * sizeof(unsigned));
+        }
+        vertex_ranges.grow(vertex_capacity);
+        index_ranges.grow(index_capacity);
+        replaceBuffers(new_VBO, new_EBO);
+    }
+
+    // ------------------------
+    // deletes the old buffers and points the VAO at the new ones
+    void replaceBuffers(const unsigned new_VBO, const unsigned new_EBO)
+    {
+        GLState::forgetBuffer(VBO);
+        GLState::forgetBuffer(EBO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VBO = new_VBO;
+        EBO = new_EBO;
+
+        GLState::bindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
+        Format::setupAttributes();
+    }
+};
+
+#endif  // GEOMETRY_ARENA_HPP
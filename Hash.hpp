@@ -0,0 +1,58 @@
+// Copyright 2018 Tihran Katolikian
+// 64-bit FNV-1a hashing helpers. Used to key the on-disk caches
+// by the content they were built from.
+
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Hash
+{
+constexpr std::uint64_t fnv_offset = 14695981039346656037ull;
+constexpr std::uint64_t fnv_prime  = 1099511628211ull;
+
+// ------------------------------
+// hashes size bytes starting from data, continuing from seed
+inline std::uint64_t fnv1a(const void *data, const std::size_t size,
+                           std::uint64_t seed = fnv_offset)
+{
+    const unsigned char *bytes = static_cast <const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        seed ^= bytes[i];
+        seed *= fnv_prime;
+    }
+    return seed;
+}
+
+inline std::uint64_t fnv1a(const std::string &str,
+                           const std::uint64_t seed = fnv_offset)
+{
+    return fnv1a(str.data(), str.size(), seed);
+}
+
+// ------------------------------
+// constexpr version for null-terminated strings, so that names known
+// at compile time can be hashed at compile time
+constexpr std::uint64_t fnv1aString(const char *str,
+                                    std::uint64_t seed = fnv_offset)
+{
+    for (; *str; ++str) {
+        seed ^= static_cast <unsigned char>(*str);
+        seed *= fnv_prime;
+    }
+    return seed;
+}
+
+// ------------------------------
+// mixes a trivially copyable value into the hash
+template <class T>
+std::uint64_t combine(const std::uint64_t seed, const T &value)
+{
+    return fnv1a(&value, sizeof(T), seed);
+}
+}
+
+#endif  // HASH_HPP
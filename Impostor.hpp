@@ -0,0 +1,448 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the octahedral impostors, which stand in for
+// distant instances of a model:
+// @ ImpostorSettings - the grid of views and the size of one view;
+// @ ImpostorAtlas - the model rendered offscreen, orthographically,
+//   from the directions of a hemi-octahedral grid over the upper
+//   hemisphere (Brucks - "Octahedral Impostors", 2018). Every view
+//   takes one frame of two atlases: albedo with coverage in alpha, and
+//   the model space normal with the depth in alpha. The atlases are
+//   cached next to the asset (<asset>.impostor), keyed by the content
+//   of the asset, of its material libraries and of the textures the
+//   bake samples, the model load options and the settings, so only
+//   the first start bakes them;
+// @ ImpostorRenderer - draws the instances of an InstanceSet as camera
+//   facing quads (Impostor.vs, Impostor.fs). Every quad blends the four
+//   frames nearest to its view direction, lights the normals and
+//   writes the depth of the baked surface.
+// Instances are taken to have a uniform scale.
+
+#ifndef IMPOSTOR_HPP
+#define IMPOSTOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Frustum.hpp"
+#include "GLState.hpp"
+#include "Hash.hpp"
+#include "InstanceSet.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "Model.hpp"
+#include "shader.hpp"
+#include "UniformBuffer.hpp"
+
+struct ImpostorSettings
+{
+    // ------------------------
+    // views per side of the grid
+    unsigned grid_size = 8;
+    // ------------------------
+    // pixels per side of one view
+    unsigned frame_size = 128;
+
+    std::uint64_t hash() const
+    {
+        return Hash::combine(Hash::combine(Hash::fnv_offset, grid_size), frame_size);
+    }
+};
+
+class ImpostorAtlas
+{
+public:
+    static constexpr std::uint32_t format_version = 1;
+
+    // ------------------------
+    // loads the atlases of the model loaded from source_path from the
+    // cache, or bakes and caches them
+    ImpostorAtlas(const Model &model, const std::string &source_path,
+                  const ImpostorSettings &init_settings = ImpostorSettings())
+    :   settings(init_settings),
+        sphere(model.getBoundingSphere()),
+        cache_path(source_path + ".impostor")
+    {
+        const auto start = std::chrono::steady_clock::now();
+        key = sourceHash(model, source_path);
+        key = Hash::combine(Hash::combine(key, model.getLoadOptions().hash()), settings.hash());
+
+        const std::size_t size = atlasSize();
+        std::vector <unsigned char> albedo_pixels;
+        std::vector <unsigned char> normal_depth_pixels;
+        if (load(albedo_pixels, normal_depth_pixels)) {
+            albedo = createTexture(albedo_pixels.data());
+            normal_depth = createTexture(normal_depth_pixels.data());
+            std::cout << "Impostor: " << size << "x" << size << " atlases loaded from "
+                      << cache_path << " in " << millisecondsSince(start) << " ms\n";
+            return;
+        }
+
+        albedo = createTexture(nullptr);
+        normal_depth = createTexture(nullptr);
+        if (!bake(model))
+            return;
+        baked = true;
+        albedo_pixels.resize(size * size * 4);
+        normal_depth_pixels.resize(size * size * 4);
+        readTexture(albedo, albedo_pixels.data());
+        readTexture(normal_depth, normal_depth_pixels.data());
+        if (!store(albedo_pixels, normal_depth_pixels))
+            std::cout << "WARNING::IMPOSTOR:: failed to store " << cache_path << '\n';
+        std::cout << "Impostor: " << settings.grid_size * settings.grid_size << " views baked into "
+                  << size << "x" << size << " atlases in " << millisecondsSince(start) << " ms\n";
+    }
+
+    ~ImpostorAtlas()
+    {
+        glDeleteTextures(1, &albedo);
+        glDeleteTextures(1, &normal_depth);
+        GLState::invalidate();
+    }
+
+    ImpostorAtlas(const ImpostorAtlas &) = delete;
+    ImpostorAtlas &operator=(const ImpostorAtlas &) = delete;
+
+    // ------------------------
+    // direction from the model to the viewer of the view in column x,
+    // row y of the grid. Matches hemiOctDecode() of Impostor.vs.
+    static glm::vec3 frameDirection(const unsigned x, const unsigned y, const unsigned grid_size)
+    {
+        const glm::vec2 grid(static_cast <float>(x), static_cast <float>(y));
+        const glm::vec2 octahedral = grid / static_cast <float>(grid_size - 1) * 2.f - 1.f;
+        const glm::vec2 p((octahedral.x + octahedral.y) * 0.5f,
+                          (octahedral.x - octahedral.y) * 0.5f);
+        return glm::normalize(glm::vec3(p.x, 1.f - std::abs(p.x) - std::abs(p.y), p.y));
+    }
+
+    // -----------------------------
+    // getters
+    unsigned getAlbedo() const
+    {
+        return albedo;
+    }
+
+    unsigned getNormalDepth() const
+    {
+        return normal_depth;
+    }
+
+    const ImpostorSettings &getSettings() const
+    {
+        return settings;
+    }
+
+    // ------------------------
+    // model space sphere the views were framed on
+    const BoundingSphere &getBoundingSphere() const
+    {
+        return sphere;
+    }
+
+    // ------------------------
+    // false if the atlases came from the cache
+    bool wasBaked() const
+    {
+        return baked;
+    }
+
+private:
+    struct FileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t grid_size;
+        std::uint32_t frame_size;
+        std::uint32_t reserved;
+        std::uint64_t key;
+    };
+
+    static constexpr char magic[8] = {'S', 'Y', 'L', 'I', 'M', 'P', 'O', '\0'};
+
+    ImpostorSettings settings;
+    BoundingSphere sphere;
+    std::string cache_path;
+    std::uint64_t key = 0;
+    unsigned albedo = 0;
+    unsigned normal_depth = 0;
+    bool baked = false;
+
+    // ------------------------
+    // hash of everything the bake reads from disk: the asset, its
+    // material libraries and the textures of its meshes, see
+    // MeshCache::sourceHash()
+    static std::uint64_t sourceHash(const Model &model, const std::string &source_path)
+    {
+        std::vector <std::string> textures;
+        for (const Mesh &mesh : model.getMeshes()) {
+            for (const Texture &texture : mesh.getTextures())
+                textures.push_back(texture.path);
+        }
+        return MeshCache::sourceHash(source_path, textures);
+    }
+
+    std::size_t atlasSize() const
+    {
+        return static_cast <std::size_t>(settings.grid_size) * settings.frame_size;
+    }
+
+    // ------------------------
+    // RGBA8 atlas with mipmaps down to 8 pixels per frame. The frames
+    // hold the model inside their inscribed circle, so the coarse
+    // levels barely bleed between frames.
+    unsigned createTexture(const void *pixels) const
+    {
+        const GLsizei size = static_cast <GLsizei>(atlasSize());
+        int max_level = 0;
+        while ((settings.frame_size >> (max_level + 1)) >= 8)
+            ++max_level;
+        unsigned texture = 0;
+        glGenTextures(1, &texture);
+        GLState::bindTexture2D(0, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+        if (pixels)
+            glGenerateMipmap(GL_TEXTURE_2D);
+        return texture;
+    }
+
+    static void readTexture(const unsigned texture, unsigned char *pixels)
+    {
+        GLState::bindTexture2D(0, texture);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    // ------------------------
+    // renders every view into its frame. The framebuffer, viewport and
+    // clear color of the caller are restored afterwards.
+    bool bake(const Model &model)
+    {
+        GLint old_framebuffer = 0;
+        GLint old_viewport[4];
+        GLfloat old_clear_color[4];
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+        glGetIntegerv(GL_VIEWPORT, old_viewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, old_clear_color);
+
+        const GLsizei size = static_cast <GLsizei>(atlasSize());
+        unsigned framebuffer = 0;
+        unsigned depth_buffer = 0;
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &depth_buffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  depth_buffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                               normal_depth, 0);
+        const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, draw_buffers);
+
+        const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (complete) {
+            // ------------------------
+            // no coverage is black with 0 alpha, no normal is the zero
+            // vector at the far end of the depth range
+            const GLfloat no_albedo[] = {0.f, 0.f, 0.f, 0.f};
+            const GLfloat no_normal[] = {0.5f, 0.5f, 0.5f, 1.f};
+            const GLfloat far_depth = 1.f;
+            glViewport(0, 0, size, size);
+            GLState::enable(GL_DEPTH_TEST);
+            glClearBufferfv(GL_COLOR, 0, no_albedo);
+            glClearBufferfv(GL_COLOR, 1, no_normal);
+            glClearBufferfv(GL_DEPTH, 0, &far_depth);
+            renderViews(model);
+        }
+        else {
+            std::cout << "ERROR::IMPOSTOR:: the bake framebuffer is incomplete\n";
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, static_cast <GLuint>(old_framebuffer));
+        glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+        glClearColor(old_clear_color[0], old_clear_color[1], old_clear_color[2],
+                     old_clear_color[3]);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &depth_buffer);
+        if (!complete)
+            return false;
+
+        GLState::bindTexture2D(0, albedo);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        GLState::bindTexture2D(0, normal_depth);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        return true;
+    }
+
+    // ------------------------
+    // the view of direction d looks at the sphere center from d, with
+    // the near plane touching the sphere. The window depth is the
+    // distance from that plane over the sphere diameter.
+    void renderViews(const Model &model) const
+    {
+        static constexpr UniformName view_projection_name("view_projection");
+        Shader shader("ImpostorBake.vs", "ImpostorBake.fs");
+        UniformBlocks::bind(shader);
+        shader.use();
+
+        const float radius = sphere.radius;
+        const glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius,
+                                                0.f, 2.f * radius);
+        const GLsizei frame = static_cast <GLsizei>(settings.frame_size);
+        for (unsigned y = 0; y < settings.grid_size; ++y) {
+            for (unsigned x = 0; x < settings.grid_size; ++x) {
+                const glm::vec3 direction = frameDirection(x, y, settings.grid_size);
+                const glm::vec3 up = std::abs(direction.y) > 0.999f ? glm::vec3(0.f, 0.f, -1.f)
+                                                                    : glm::vec3(0.f, 1.f, 0.f);
+                const glm::mat4 view = glm::lookAt(sphere.center + direction * radius,
+                                                   sphere.center, up);
+                glViewport(static_cast <GLint>(x) * frame, static_cast <GLint>(y) * frame,
+                           frame, frame);
+                shader.setMat4(view_projection_name, projection * view);
+                model.draw(shader);
+            }
+        }
+    }
+
+    bool load(std::vector <unsigned char> &albedo_pixels,
+              std::vector <unsigned char> &normal_depth_pixels) const
+    {
+        MappedFile file(cache_path);
+        const std::size_t pixels_size = atlasSize() * atlasSize() * 4;
+        if (!file.isOpen() || file.size() != sizeof(FileHeader) + 2 * pixels_size)
+            return false;
+        FileHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+            header.version != format_version ||
+            header.grid_size != settings.grid_size ||
+            header.frame_size != settings.frame_size ||
+            header.key != key)
+            return false;
+        const unsigned char *pixels = file.data() + sizeof(header);
+        albedo_pixels.assign(pixels, pixels + pixels_size);
+        normal_depth_pixels.assign(pixels + pixels_size, pixels + 2 * pixels_size);
+        return true;
+    }
+
+    // ------------------------
+    // written to a temporary path first, like the mesh cache
+    bool store(const std::vector <unsigned char> &albedo_pixels,
+               const std::vector <unsigned char> &normal_depth_pixels) const
+    {
+        const std::string tmp_path = cache_path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        FileHeader header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = format_version;
+        header.grid_size = settings.grid_size;
+        header.frame_size = settings.frame_size;
+        header.reserved = 0;
+        header.key = key;
+        out.write(reinterpret_cast <const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast <const char *>(albedo_pixels.data()), albedo_pixels.size());
+        out.write(reinterpret_cast <const char *>(normal_depth_pixels.data()),
+                  normal_depth_pixels.size());
+        out.close();
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        std::remove(cache_path.c_str());
+        return std::rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+    }
+
+    static double millisecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration <double, std::milli>(
+               std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+class ImpostorRenderer
+{
+public:
+    explicit ImpostorRenderer(const ImpostorAtlas &init_atlas)
+    :   atlas(init_atlas)
+    {
+        static const float corners[] = {-1.f, -1.f,  1.f, -1.f,  1.f, 1.f,  -1.f, 1.f};
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        GLState::bindVertexArray(vao);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+        GLState::bindVertexArray(0);
+    }
+
+    ~ImpostorRenderer()
+    {
+        GLState::bindVertexArray(0);
+        GLState::forgetBuffer(vbo);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+    }
+
+    ImpostorRenderer(const ImpostorRenderer &) = delete;
+    ImpostorRenderer &operator=(const ImpostorRenderer &) = delete;
+
+    // ------------------------
+    // one quad per instance of the set, with a program built from
+    // Impostor.vs and Impostor.fs. Pending changes of the set are
+    // uploaded first.
+    void draw(Shader &shader, InstanceSet &instances)
+    {
+        if (instances.size() == 0)
+            return;
+        instances.upload();
+        shader.use();
+        GLState::bindVertexArray(vao);
+        if (bound_instances != instances.getBuffer()) {
+            instances.setupAttributes();
+            bound_instances = instances.getBuffer();
+        }
+
+        static constexpr UniformName albedo_name("albedo_atlas");
+        static constexpr UniformName normal_depth_name("normal_depth_atlas");
+        static constexpr UniformName sphere_name("sphere");
+        static constexpr UniformName grid_size_name("grid_size");
+        GLState::bindTexture2D(0, atlas.getAlbedo());
+        GLState::bindTexture2D(1, atlas.getNormalDepth());
+        shader.setInt(albedo_name, 0);
+        shader.setInt(normal_depth_name, 1);
+        const BoundingSphere &sphere = atlas.getBoundingSphere();
+        shader.setVec4(sphere_name, glm::vec4(sphere.center, sphere.radius));
+        shader.setFloat(grid_size_name, static_cast <float>(atlas.getSettings().grid_size));
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, static_cast <GLsizei>(instances.size()));
+    }
+
+private:
+    const ImpostorAtlas &atlas;
+    unsigned vao = 0;
+    unsigned vbo = 0;
+    // ------------------------
+    // instance buffer the VAO's instance attributes point at
+    unsigned bound_instances = 0;
+};
+
+#endif  // IMPOSTOR_HPP
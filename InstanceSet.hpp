@@ -0,0 +1,188 @@
+// Copyright 2018 Tihran Katolikian
+// class InstanceSet - per-instance data of an instanced draw (model
+// matrix and tint) kept on the CPU and mirrored in a GL buffer.
+// Changes only mark the range of instances they touch, upload() sends
+// the dirty range with one glBufferSubData, or reallocates the buffer
+// if the set outgrew it.
+// The data is read by the vertex shader from attribute locations 5-8
+// (the matrix columns) and 9 (the tint) with divisor 1, see
+// SylvanasInstancedVS.vs.
+
+#ifndef INSTANCE_SET_HPP
+#define INSTANCE_SET_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.hpp"
+
+struct InstanceData
+{
+    glm::mat4 model;
+    glm::vec4 tint;
+};
+
+class InstanceSet
+{
+public:
+    static constexpr GLuint model_location = 5;
+    static constexpr GLuint tint_location = 9;
+
+    InstanceSet()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    ~InstanceSet()
+    {
+        GLState::forgetBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    InstanceSet(const InstanceSet &) = delete;
+    InstanceSet &operator=(const InstanceSet &) = delete;
+
+    // ------------------------
+    // returns the index of the new instance
+    std::size_t add(const glm::mat4 &model, const glm::vec4 &tint = glm::vec4(1.f))
+    {
+        instances.push_back({model, tint});
+        markDirty(instances.size() - 1);
+        return instances.size() - 1;
+    }
+
+    void set(const std::size_t index, const glm::mat4 &model)
+    {
+        instances[index].model = model;
+        markDirty(index);
+    }
+
+    void setTint(const std::size_t index, const glm::vec4 &tint)
+    {
+        instances[index].tint = tint;
+        markDirty(index);
+    }
+
+    // ------------------------
+    // the last instance takes the place of the removed one
+    void remove(const std::size_t index)
+    {
+        instances[index] = instances.back();
+        instances.pop_back();
+        if (index < instances.size())
+            markDirty(index);
+    }
+
+    void clear()
+    {
+        instances.clear();
+        dirty_first = dirty_last = 0;
+    }
+
+    void reserve(const std::size_t capacity)
+    {
+        instances.reserve(capacity);
+    }
+
+    // ------------------------
+    // sends the changes to the GPU. Called by the instanced draws.
+    void upload()
+    {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (instances.size() > gpu_capacity) {
+            // ------------------------
+            // grow geometrically, so adding instances one by one does
+            // not reallocate every frame
+            gpu_capacity = std::max(instances.size(), gpu_capacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, gpu_capacity * sizeof(InstanceData), nullptr,
+                         GL_DYNAMIC_DRAW);
+            dirty_first = 0;
+            dirty_last = instances.size();
+        }
+        dirty_last = std::min(dirty_last, instances.size());
+        if (dirty_first < dirty_last) {
+            glBufferSubData(GL_ARRAY_BUFFER, dirty_first * sizeof(InstanceData),
+                            (dirty_last - dirty_first) * sizeof(InstanceData),
+                            instances.data() + dirty_first);
+            uploaded_bytes += (dirty_last - dirty_first) * sizeof(InstanceData);
+        }
+        dirty_first = dirty_last = 0;
+    }
+
+    // ------------------------
+    // points the instance attributes of the bound VAO at the buffer
+    void setupAttributes() const
+    {
+        setupAttributes(buffer);
+    }
+
+    // ------------------------
+    // same for any buffer of InstanceData, e.g. one written on the GPU
+    static void setupAttributes(const GLuint buffer)
+    {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint column = 0; column < 4; ++column) {
+            glEnableVertexAttribArray(model_location + column);
+            glVertexAttribPointer(model_location + column, 4, GL_FLOAT, GL_FALSE,
+                                  sizeof(InstanceData),
+                                  reinterpret_cast <void *>(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(model_location + column, 1);
+        }
+        glEnableVertexAttribArray(tint_location);
+        glVertexAttribPointer(tint_location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              reinterpret_cast <void *>(offsetof(InstanceData, tint)));
+        glVertexAttribDivisor(tint_location, 1);
+    }
+
+    // -----------------------------
+    // getters
+    std::size_t size() const
+    {
+        return instances.size();
+    }
+
+    const InstanceData &operator[](const std::size_t index) const
+    {
+        return instances[index];
+    }
+
+    unsigned getBuffer() const
+    {
+        return buffer;
+    }
+
+    // -----------------------------
+    // bytes sent by upload() so far
+    std::size_t getUploadedBytes() const
+    {
+        return uploaded_bytes;
+    }
+
+private:
+    std::vector <InstanceData> instances;
+    unsigned buffer = 0;
+    std::size_t gpu_capacity = 0;
+    std::size_t uploaded_bytes = 0;
+
+    // ------------------------
+    // [dirty_first, dirty_last) has to be uploaded
+    std::size_t dirty_first = 0;
+    std::size_t dirty_last = 0;
+
+    void markDirty(const std::size_t index)
+    {
+        if (dirty_first == dirty_last) {
+            dirty_first = index;
+            dirty_last = index + 1;
+            return;
+        }
+        dirty_first = std::min(dirty_first, index);
+        dirty_last = std::max(dirty_last, index + 1);
+    }
+};
+
+#endif  // INSTANCE_SET_HPP
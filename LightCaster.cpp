@@ -1,5 +1,8 @@
 /*Copywrite [2018] <Tihran Katolikian>*/
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <string>
 #include "LightCaster.h"
 
@@ -65,14 +68,36 @@ glm::vec3 LightCaster::getSpecular() const
     return specular;
 }
 
-void LightCaster::setUpForShader(Shader &shader, const unsigned index) const
+float LightCaster::getRadius() const
 {
-    std::string uniform_address("plight[" + std::to_string(index) + ']');
-    shader.use();
-    shader.setInt("current_lights_num", light_casters_num);
-    shader.setVec3(uniform_address + ".position", position);
-    shader.setVec3(uniform_address + ".attenuation", attenuation);
-    shader.setVec3(uniform_address + ".ambient", ambient);
-    shader.setVec3(uniform_address + ".diffuse", diffuse);
-    shader.setVec3(uniform_address + ".specular", specular);
-}
\ No newline at end of file
+    // attenuation is 1 / (constant + linear * d + quadratic * d^2), the
+    // radius is where intensity times it reaches the cutoff
+    const glm::vec3 brightest = glm::max(glm::max(ambient, diffuse), specular);
+    const float intensity = std::max({brightest.x, brightest.y, brightest.z});
+    const float constant = attenuation.x - intensity / influence_cutoff;
+    if (constant >= 0.f)
+        return 0.f;
+    if (attenuation.z > 0.f)
+        return (-attenuation.y + std::sqrt(attenuation.y * attenuation.y -
+                                           4.f * attenuation.z * constant)) /
+               (2.f * attenuation.z);
+    if (attenuation.y > 0.f)
+        return -constant / attenuation.y;
+    return FLT_MAX;
+}
+
+PointLightBlock LightCaster::toBlock() const
+{
+    PointLightBlock block;
+    block.position = glm::vec4(position, getRadius());
+    block.attenuation = glm::vec4(attenuation, 0.f);
+    block.diffuse = glm::vec4(diffuse, 0.f);
+    block.ambient = glm::vec4(ambient, 0.f);
+    block.specular = glm::vec4(specular, 0.f);
+    return block;
+}
+
+unsigned LightCaster::getLightCastersNum()
+{
+    return light_casters_num;
+}
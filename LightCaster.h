@@ -6,7 +6,7 @@
 #define LIGHT_CASTER
 
 #include <glm/glm.hpp>
-#include "shader.hpp"
+#include "UniformBuffer.hpp"
 #include "LightCaster.h"
 
 class LightCaster
@@ -29,11 +29,26 @@ public:
     glm::vec3 getAmbient() const;
     glm::vec3 getDiffuse() const;
     glm::vec3 getSpecular() const;
+
+    //---------------------------
+    // distance at which the light fades below influence_cutoff of the
+    // brightest of its components, FLT_MAX if it never does. Clustered
+    // lighting leaves the light out of the clusters farther than that.
+    float getRadius() const;
     
     //---------------------------
-    // function sets up shader uniform fields
-    // to the values from this class
-    void setUpForShader(Shader &shader, const unsigned index) const;
+    // function returns this light caster in the std140 layout of
+    // the LightData uniform block
+    PointLightBlock toBlock() const;
+
+    //---------------------------
+    // number of light casters alive
+    static unsigned getLightCastersNum();
+
+    //---------------------------
+    // the smallest contribution of a light that still shows in an
+    // 8 bit color channel
+    static constexpr float influence_cutoff = 1.f / 256.f;
 private:
     //---------------------------
     // position of light caster in
@@ -54,9 +69,8 @@ private:
     glm::vec3 specular;
     
     //---------------------------
-    // this is the static counter of light caster instances which will
-    // help to keep light_casters_num uniform value corrent in the
-    // fragment shader
+    // this is the static counter of light caster instances, the
+    // number of point lights the shader variants are built for
     static unsigned light_casters_num;
 };
 
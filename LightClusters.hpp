@@ -0,0 +1,525 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of clustered forward lighting (Olsson, Billeter,
+// Assarsson - "Clustered Deferred and Forward Shading", 2012):
+// @ LightClusters - the view frustum cut into grid_x * grid_y screen
+//   tiles and grid_z depth slices. Slices are spaced exponentially
+//   between the near and far planes, so clusters keep about the same
+//   shape at every depth. A point light is a sphere with the radius at
+//   which its attenuation fades out (LightCaster::getRadius(), kept in
+//   position.w of its block). assign() lists for every cluster the
+//   lights whose sphere touches the view space bounding box of the
+//   cluster. Slices are independent and run on a ThreadPool. A slice
+//   keeps the lights reaching its depth range, then for each row the
+//   ones reaching the row, and tests those against the boxes of the
+//   row 4 at a time with SSE. No GL calls, so it runs anywhere;
+// @ ClusteredLighting - uploads the lists to texture buffers (GL 3.3
+//   has them) for SylvanasFS.fs built with CLUSTERED_LIGHTS: the light
+//   blocks, the light indices, and the offset and count of every
+//   cluster. A fragment finds its cluster from gl_FragCoord and its
+//   view depth and walks only that list. The number of lights is not
+//   capped, and a pixel pays only for the lights that reach it.
+
+#ifndef LIGHT_CLUSTERS_HPP
+#define LIGHT_CLUSTERS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LIGHT_CLUSTERS_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "GLState.hpp"
+#include "shader.hpp"
+#include "ThreadPool.hpp"
+#include "UniformBuffer.hpp"
+
+class LightClusters
+{
+public:
+    static constexpr unsigned grid_x = 16;
+    static constexpr unsigned grid_y = 9;
+    static constexpr unsigned grid_z = 24;
+    static constexpr unsigned clusters_num = grid_x * grid_y * grid_z;
+
+    // ------------------------
+    // the lights of cluster (x, y, z) are indices[offset, offset +
+    // count) of ranges[(z * grid_y + y) * grid_x + x]. x grows to the
+    // right and y upwards, like gl_FragCoord.
+    struct Range
+    {
+        std::uint32_t offset;
+        std::uint32_t count;
+    };
+
+    // ------------------------
+    // what the last assign() did
+    struct Stats
+    {
+        std::size_t lights;
+        std::size_t indices;
+        std::size_t lit_clusters;
+        std::size_t max_cluster_lights;
+    };
+
+    LightClusters()
+    :   ranges(clusters_num, Range{0, 0}),
+        boxes(clusters_num),
+        slices(grid_z)
+    {}
+
+    // ------------------------
+    // the frustum of a perspective projection; the cluster boxes are
+    // rebuilt only when it changes
+    void setProjection(const float fov_y, const float aspect, const float near_plane,
+                       const float far_plane)
+    {
+        if (fov_y == projection_fov && aspect == projection_aspect &&
+            near_plane == projection_near && far_plane == projection_far)
+            return;
+        projection_fov = fov_y;
+        projection_aspect = aspect;
+        projection_near = near_plane;
+        projection_far = far_plane;
+
+        tan_y = std::tan(fov_y / 2.f);
+        tan_x = tan_y * aspect;
+        const float depth_ratio = std::log(far_plane / near_plane);
+        slice_scale = grid_z / depth_ratio;
+        slice_bias = -slice_scale * std::log(near_plane);
+
+        for (unsigned z = 0; z < grid_z; ++z) {
+            const float slice_near = near_plane * std::pow(far_plane / near_plane,
+                                                           static_cast <float>(z) / grid_z);
+            const float slice_far = near_plane * std::pow(far_plane / near_plane,
+                                                          static_cast <float>(z + 1) / grid_z);
+            for (unsigned y = 0; y < grid_y; ++y) {
+                const float bottom = (-1.f + 2.f * y / grid_y) * tan_y;
+                const float top = (-1.f + 2.f * (y + 1) / grid_y) * tan_y;
+                for (unsigned x = 0; x < grid_x; ++x) {
+                    const float left = (-1.f + 2.f * x / grid_x) * tan_x;
+                    const float right = (-1.f + 2.f * (x + 1) / grid_x) * tan_x;
+                    BoundingBox &box = boxes[(z * grid_y + y) * grid_x + x];
+                    box.min = glm::vec3(std::min(left * slice_near, left * slice_far),
+                                        std::min(bottom * slice_near, bottom * slice_far),
+                                        -slice_far);
+                    box.max = glm::vec3(std::max(right * slice_near, right * slice_far),
+                                        std::max(top * slice_near, top * slice_far),
+                                        -slice_near);
+                }
+            }
+        }
+    }
+
+    // ------------------------
+    // fills the cluster lists with lights seen through view, on pool
+    // if given. The index of a light is its position in lights.
+    void assign(const std::vector <PointLightBlock> &lights, const glm::mat4 &view,
+                ThreadPool *pool = nullptr)
+    {
+        stats = Stats();
+        stats.lights = lights.size();
+        indices.clear();
+        std::fill(ranges.begin(), ranges.end(), Range{0, 0});
+        if (lights.empty() || projection_far <= 0.f)
+            return;
+
+        view_lights.resize(lights.size());
+        for (std::size_t i = 0; i < lights.size(); ++i) {
+            const glm::vec3 position(view * glm::vec4(glm::vec3(lights[i].position), 1.f));
+            const float radius = lights[i].position.w;
+            ViewLight &light = view_lights[i];
+            light.position = position;
+            light.radius = radius;
+            light.first_slice = 1;
+            light.last_slice = 0;
+            if (-position.z - radius > projection_far || -position.z + radius < projection_near)
+                continue;
+            light.first_slice = sliceOf(std::max(-position.z - radius, projection_near));
+            light.last_slice = sliceOf(std::min(-position.z + radius, projection_far));
+        }
+
+        if (pool && pool->getThreadsNum() > 1 && lights.size() >= parallel_threshold) {
+            pool->parallelFor(grid_z, 1, [this](const std::size_t begin, const std::size_t end)
+            {
+                for (std::size_t z = begin; z < end; ++z)
+                    assignSlice(static_cast <unsigned>(z));
+            });
+        }
+        else {
+            for (unsigned z = 0; z < grid_z; ++z)
+                assignSlice(z);
+        }
+
+        // ------------------------
+        // the slices are concatenated in order
+        for (unsigned z = 0; z < grid_z; ++z) {
+            const std::uint32_t base = static_cast <std::uint32_t>(indices.size());
+            for (unsigned cluster = z * grid_x * grid_y; cluster < (z + 1) * grid_x * grid_y;
+                 ++cluster) {
+                ranges[cluster].offset += base;
+                stats.lit_clusters += ranges[cluster].count > 0;
+                stats.max_cluster_lights = std::max <std::size_t>(stats.max_cluster_lights,
+                                                                  ranges[cluster].count);
+            }
+            indices.insert(indices.end(), slices[z].indices.begin(), slices[z].indices.end());
+        }
+        stats.indices = indices.size();
+    }
+
+    // ------------------------
+    // the cluster of a view space point in front of the camera, found
+    // the same way SylvanasFS.fs finds it
+    unsigned clusterOf(const glm::vec3 &view_position) const
+    {
+        const float depth = -view_position.z;
+        const int x = static_cast <int>(std::floor((view_position.x / (depth * tan_x) + 1.f) *
+                                                   0.5f * grid_x));
+        const int y = static_cast <int>(std::floor((view_position.y / (depth * tan_y) + 1.f) *
+                                                   0.5f * grid_y));
+        return (sliceOf(depth) * grid_y + std::clamp(y, 0, static_cast <int>(grid_y) - 1)) *
+               grid_x + std::clamp(x, 0, static_cast <int>(grid_x) - 1);
+    }
+
+    // -----------------------------
+    // getters
+    const std::vector <Range> &getRanges() const
+    {
+        return ranges;
+    }
+
+    const std::vector <std::uint32_t> &getIndices() const
+    {
+        return indices;
+    }
+
+    // ------------------------
+    // the slice of view depth d is log(d) * x + y
+    glm::vec2 getSliceParams() const
+    {
+        return glm::vec2(slice_scale, slice_bias);
+    }
+
+    const Stats &getStats() const
+    {
+        return stats;
+    }
+
+private:
+    // ------------------------
+    // with fewer lights the slices are assigned faster than the pool
+    // wakes up
+    static constexpr std::size_t parallel_threshold = 64;
+
+    struct ViewLight
+    {
+        glm::vec3 position;
+        float radius;
+        unsigned first_slice;
+        unsigned last_slice;
+    };
+
+    // ------------------------
+    // lights of a row in SoA arrays, padded to a multiple of 4 with
+    // lights of negative squared radius, which touch nothing
+    struct RowLights
+    {
+        std::vector <float> x;
+        std::vector <float> y;
+        std::vector <float> z;
+        std::vector <float> radius2;
+        std::vector <std::uint32_t> ids;
+
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            radius2.clear();
+            ids.clear();
+        }
+
+        void push(const glm::vec3 &position, const float radius_squared, const std::uint32_t id)
+        {
+            x.push_back(position.x);
+            y.push_back(position.y);
+            z.push_back(position.z);
+            radius2.push_back(radius_squared);
+            ids.push_back(id);
+        }
+    };
+
+    // ------------------------
+    // scratch of one slice, touched only by the task assigning it
+    struct Slice
+    {
+        std::vector <std::uint32_t> lights;
+        RowLights row;
+        std::vector <std::uint32_t> indices;
+    };
+
+    std::vector <Range> ranges;
+    std::vector <std::uint32_t> indices;
+    std::vector <BoundingBox> boxes;
+    std::vector <ViewLight> view_lights;
+    std::vector <Slice> slices;
+    float projection_fov = 0.f;
+    float projection_aspect = 0.f;
+    float projection_near = 0.f;
+    float projection_far = 0.f;
+    float tan_x = 1.f;
+    float tan_y = 1.f;
+    float slice_scale = 0.f;
+    float slice_bias = 0.f;
+    Stats stats = Stats();
+
+    unsigned sliceOf(const float depth) const
+    {
+        const int slice = static_cast <int>(std::floor(std::log(depth) * slice_scale +
+                                                       slice_bias));
+        return static_cast <unsigned>(std::clamp(slice, 0, static_cast <int>(grid_z) - 1));
+    }
+
+    void assignSlice(const unsigned z)
+    {
+        Slice &slice = slices[z];
+        slice.lights.clear();
+        slice.indices.clear();
+        for (std::size_t i = 0; i < view_lights.size(); ++i) {
+            if (view_lights[i].first_slice <= z && z <= view_lights[i].last_slice)
+                slice.lights.push_back(static_cast <std::uint32_t>(i));
+        }
+
+        for (unsigned y = 0; y < grid_y; ++y) {
+            const unsigned first_cluster = (z * grid_y + y) * grid_x;
+            // ------------------------
+            // the boxes of a row share their y and z ranges, the row
+            // box spans from its first box to its last
+            const float row_min_y = boxes[first_cluster].min.y;
+            const float row_max_y = boxes[first_cluster].max.y;
+            const float row_min_x = boxes[first_cluster].min.x;
+            const float row_max_x = boxes[first_cluster + grid_x - 1].max.x;
+            slice.row.clear();
+            for (const std::uint32_t id : slice.lights) {
+                const ViewLight &light = view_lights[id];
+                if (light.position.y + light.radius < row_min_y ||
+                    light.position.y - light.radius > row_max_y ||
+                    light.position.x + light.radius < row_min_x ||
+                    light.position.x - light.radius > row_max_x)
+                    continue;
+                slice.row.push(light.position, light.radius * light.radius, id);
+            }
+            while (slice.row.ids.size() % 4 != 0)
+                slice.row.push(glm::vec3(0.f), -1.f, 0);
+
+            for (unsigned cluster = first_cluster; cluster < first_cluster + grid_x; ++cluster) {
+                ranges[cluster].offset = static_cast <std::uint32_t>(slice.indices.size());
+                assignCluster(boxes[cluster], slice.row, slice.indices);
+                ranges[cluster].count = static_cast <std::uint32_t>(slice.indices.size()) -
+                                        ranges[cluster].offset;
+            }
+        }
+    }
+
+    // ------------------------
+    // appends the lights of row touching box: the squared distance from
+    // the light to the box is at most its squared radius
+    static void assignCluster(const BoundingBox &box, const RowLights &row,
+                              std::vector <std::uint32_t> &out)
+    {
+#ifdef LIGHT_CLUSTERS_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 min_x = _mm_set1_ps(box.min.x);
+        const __m128 min_y = _mm_set1_ps(box.min.y);
+        const __m128 min_z = _mm_set1_ps(box.min.z);
+        const __m128 max_x = _mm_set1_ps(box.max.x);
+        const __m128 max_y = _mm_set1_ps(box.max.y);
+        const __m128 max_z = _mm_set1_ps(box.max.z);
+        for (std::size_t i = 0; i < row.ids.size(); i += 4) {
+            const __m128 x = _mm_loadu_ps(&row.x[i]);
+            const __m128 y = _mm_loadu_ps(&row.y[i]);
+            const __m128 z = _mm_loadu_ps(&row.z[i]);
+            const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_x, x), _mm_sub_ps(x, max_x)),
+                                         zero);
+            const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_y, y), _mm_sub_ps(y, max_y)),
+                                         zero);
+            const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(min_z, z), _mm_sub_ps(z, max_z)),
+                                         zero);
+            const __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                                                           _mm_mul_ps(dy, dy)),
+                                                _mm_mul_ps(dz, dz));
+            int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&row.radius2[i])));
+            for (std::size_t lane = i; mask != 0; ++lane, mask >>= 1) {
+                if (mask & 1)
+                    out.push_back(row.ids[lane]);
+            }
+        }
+#else
+        for (std::size_t i = 0; i < row.ids.size(); ++i) {
+            const glm::vec3 position(row.x[i], row.y[i], row.z[i]);
+            const glm::vec3 offset = glm::max(glm::max(box.min - position, position - box.max),
+                                              glm::vec3(0.f));
+            if (glm::dot(offset, offset) <= row.radius2[i])
+                out.push_back(row.ids[i]);
+        }
+#endif
+    }
+};
+
+class ClusteredLighting
+{
+public:
+    // ------------------------
+    // texture units of the three texture buffers, above the ones the
+    // materials use
+    static constexpr unsigned ranges_unit = 13;
+    static constexpr unsigned indices_unit = 14;
+    static constexpr unsigned lights_unit = 15;
+
+    ClusteredLighting()
+    :   cluster_buffer(UniformBlocks::clusters_binding)
+    {
+        GLint max_texels = 65536;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+        max_texture_buffer_size = static_cast <std::size_t>(max_texels);
+
+        glGenBuffers(buffers_num, buffers);
+        glGenTextures(buffers_num, textures);
+        const GLenum formats[buffers_num] = {GL_RG32UI, GL_R32UI, GL_RGBA32F};
+        for (unsigned i = 0; i < buffers_num; ++i) {
+            GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]);
+            glBufferData(GL_COPY_WRITE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            GLState::activeTexture(ranges_unit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+    }
+
+    ~ClusteredLighting()
+    {
+        for (unsigned i = 0; i < buffers_num; ++i)
+            GLState::forgetBuffer(buffers[i]);
+        glDeleteBuffers(buffers_num, buffers);
+        glDeleteTextures(buffers_num, textures);
+    }
+
+    ClusteredLighting(const ClusteredLighting &) = delete;
+    ClusteredLighting &operator=(const ClusteredLighting &) = delete;
+
+    // ------------------------
+    // assigns lights to the clusters of the frame seen through view
+    // with a perspective projection, and uploads the lists. What does
+    // not fit in a texture buffer is left out: the lights past the
+    // limit, and the last lights of the clusters whose lists end past
+    // it, so those get fewer lights instead of reading past the end.
+    void update(const std::vector <PointLightBlock> &lights, const glm::mat4 &view,
+                const float fov_y, const unsigned screen_w, const unsigned screen_h,
+                const float near_plane, const float far_plane, ThreadPool *pool = nullptr)
+    {
+        clusters.setProjection(fov_y, static_cast <float>(screen_w) / screen_h, near_plane,
+                               far_plane);
+        const std::size_t max_lights = max_texture_buffer_size /
+                                       (sizeof(PointLightBlock) / sizeof(glm::vec4));
+        const std::vector <PointLightBlock> *assigned = &lights;
+        if (lights.size() > max_lights) {
+            reportOverflow(lights.size(), "lights", max_lights);
+            clamped_lights.assign(lights.begin(), lights.begin() + max_lights);
+            assigned = &clamped_lights;
+        }
+        clusters.assign(*assigned, view, pool);
+
+        const std::vector <LightClusters::Range> *ranges = &clusters.getRanges();
+        std::size_t indices_num = clusters.getIndices().size();
+        if (indices_num > max_texture_buffer_size) {
+            reportOverflow(indices_num, "light indices", max_texture_buffer_size);
+            indices_num = max_texture_buffer_size;
+            const std::uint32_t limit = static_cast <std::uint32_t>(indices_num);
+            clamped_ranges = *ranges;
+            for (LightClusters::Range &range : clamped_ranges) {
+                range.offset = std::min(range.offset, limit);
+                range.count = std::min(range.count, limit - range.offset);
+            }
+            ranges = &clamped_ranges;
+        }
+        upload(buffers[0], ranges->data(), ranges->size() * sizeof(LightClusters::Range));
+        upload(buffers[1], clusters.getIndices().data(), indices_num * sizeof(std::uint32_t));
+        upload(buffers[2], assigned->data(), assigned->size() * sizeof(PointLightBlock));
+
+        ClusterBlock block;
+        block.grid_size = glm::ivec4(LightClusters::grid_x, LightClusters::grid_y,
+                                     LightClusters::grid_z, 0);
+        block.params = glm::vec4(clusters.getSliceParams(),
+                                 static_cast <float>(LightClusters::grid_x) / screen_w,
+                                 static_cast <float>(LightClusters::grid_y) / screen_h);
+        cluster_buffer.update(block);
+    }
+
+    // ------------------------
+    // binds the texture buffers to their units and points the
+    // samplers of shader at them
+    void bind(Shader &shader) const
+    {
+        static constexpr UniformName ranges_name("cluster_ranges");
+        static constexpr UniformName indices_name("cluster_lights");
+        static constexpr UniformName lights_name("light_data");
+        shader.use();
+        shader.setInt(ranges_name, ranges_unit);
+        shader.setInt(indices_name, indices_unit);
+        shader.setInt(lights_name, lights_unit);
+        for (unsigned i = 0; i < buffers_num; ++i) {
+            GLState::activeTexture(ranges_unit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+    }
+
+    const LightClusters &getClusters() const
+    {
+        return clusters;
+    }
+
+private:
+    static constexpr unsigned buffers_num = 3;
+
+    LightClusters clusters;
+    UniformBuffer <ClusterBlock> cluster_buffer;
+    // ------------------------
+    // cluster ranges, light indices and light blocks
+    GLuint buffers[buffers_num] = {0, 0, 0};
+    GLuint textures[buffers_num] = {0, 0, 0};
+    std::size_t max_texture_buffer_size = 0;
+    bool overflow_reported = false;
+    std::vector <PointLightBlock> clamped_lights;
+    std::vector <LightClusters::Range> clamped_ranges;
+
+    void reportOverflow(const std::size_t size, const char *what, const std::size_t limit)
+    {
+        if (overflow_reported)
+            return;
+        std::cout << "WARNING::CLUSTERED_LIGHTING:: " << size << ' ' << what
+                  << ", a texture buffer holds " << limit << ", dropping the rest\n";
+        overflow_reported = true;
+    }
+
+    // ------------------------
+    // new storage every frame, the draws of the last frame may still
+    // read the old one
+    static void upload(const GLuint buffer, const void *data, const std::size_t size)
+    {
+        GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max <std::size_t>(size, 16), nullptr,
+                     GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, data);
+    }
+};
+
+#endif  // LIGHT_CLUSTERS_HPP
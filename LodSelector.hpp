@@ -0,0 +1,138 @@
+// Copyright 2018 Tihran Katolikian
+// here is the level of detail selection at draw time:
+// @ LodSettings - the error allowed on screen, the bias and the
+//   hysteresis;
+// @ LodSelector - picks the level of an object from the projected size
+//   of its bounding sphere. The sphere gives the pixels per model unit
+//   at the object's distance, the error of every level (model units,
+//   see MeshSimplifier.hpp) is scaled by it, and the coarsest level
+//   whose error stays under the allowed number of pixels is taken.
+//   The picks are counted for the stats.
+
+#ifndef LOD_SELECTOR_HPP
+#define LOD_SELECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+
+struct LodSettings
+{
+    // ------------------------
+    // largest error of a level on screen, in pixels
+    float error_pixels = 1.f;
+    // ------------------------
+    // scales the allowed error: above 1 coarser levels come in closer
+    // to the viewer, below 1 farther away
+    float bias = 1.f;
+    // ------------------------
+    // share of the allowed error a coarser level has to stay under
+    // before it is taken, so an object sitting at a switch distance
+    // does not flip between two levels every frame
+    float hysteresis = 0.25f;
+};
+
+class LodSelector
+{
+public:
+    static constexpr unsigned max_levels = 8;
+
+    // ------------------------
+    // counters since the last resetStats()
+    struct Stats
+    {
+        std::size_t objects[max_levels];
+        std::size_t triangles;
+        std::size_t full_detail_triangles;
+    };
+
+    explicit LodSelector(const LodSettings &init_settings = LodSettings())
+    :   settings(init_settings)
+    {
+    }
+
+    // ------------------------
+    // call when the camera or the viewport changes
+    void setView(const glm::vec3 &init_viewer_pos, const float fov_y_radians,
+                 const float screen_height)
+    {
+        viewer_pos = init_viewer_pos;
+        projection_scale = screen_height / (2.f * std::tan(fov_y_radians * 0.5f));
+    }
+
+    // ------------------------
+    // the level for an object whose model space bounding sphere is
+    // model_sphere, drawn with transform. errors[level] is the error of
+    // every level, the full detail one (0) first; current is the level
+    // picked the frame before.
+    unsigned select(const BoundingSphere &model_sphere, const glm::mat4 &transform,
+                    const std::vector <float> &errors, const unsigned current) const
+    {
+        const unsigned levels_num = static_cast <unsigned>(std::min <std::size_t>(errors.size(),
+                                                                                  max_levels));
+        if (levels_num <= 1 || model_sphere.radius <= 0.f)
+            return 0;
+        const BoundingSphere sphere = model_sphere.transformed(transform);
+        const float distance = glm::length(sphere.center - viewer_pos) - sphere.radius;
+        if (distance <= 0.f)
+            return 0;
+        // ------------------------
+        // projected radius of the sphere over its radius in model units
+        const float pixels_per_unit = projection_scale * sphere.radius /
+                                      (distance * model_sphere.radius);
+        const float allowed = settings.error_pixels * settings.bias;
+
+        unsigned level = std::min(current, levels_num - 1);
+        while (level > 0 && errors[level] * pixels_per_unit > allowed)
+            --level;
+        while (level + 1 < levels_num &&
+               errors[level + 1] * pixels_per_unit <= allowed * (1.f - settings.hysteresis))
+            ++level;
+        return level;
+    }
+
+    // ------------------------
+    // counts one object drawn at level with the given triangles
+    void record(const unsigned level, const std::size_t triangles,
+                const std::size_t full_detail_triangles)
+    {
+        ++stats.objects[std::min(level, max_levels - 1)];
+        stats.triangles += triangles;
+        stats.full_detail_triangles += full_detail_triangles;
+    }
+
+    // -----------------------------
+    // getters and setters
+    const LodSettings &getSettings() const
+    {
+        return settings;
+    }
+
+    void setSettings(const LodSettings &new_settings)
+    {
+        settings = new_settings;
+    }
+
+    const Stats &getStats() const
+    {
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats = Stats();
+    }
+
+private:
+    LodSettings settings;
+    glm::vec3 viewer_pos = glm::vec3(0.f);
+    float projection_scale = 1.f;
+    Stats stats = Stats();
+};
+
+#endif  // LOD_SELECTOR_HPP
@@ -0,0 +1,386 @@
+// Copyright 2018 Tihran Katolikian
+// class LooseOctree - dynamic spatial index over the bounding spheres of
+// scene instances (Ulrich - "Loose Octrees", Game Programming Gems,
+// 2000). Every node's bounds are its cell grown to twice the size, so
+// an object goes into the deepest cell that holds its center and is at
+// least as large as its radius, found straight from the center and the
+// radius. Insert, remove and move are O(depth) and allocate only when a
+// cell is visited for the first time: objects are linked into their
+// node with intrusive lists indexed by object id, and a move within the
+// same cell only updates the sphere. Objects outside of the root cell
+// stay in the root, which is never culled.
+// Frustum, sphere and ray queries walk the nodes with a fixed stack and
+// skip empty subtrees; the visit*() ones call a function for every id
+// and never allocate, the query*() ones fill a vector that allocates
+// only while it grows. Queries take a shared lock, so any number of
+// threads can run them at a time; changes take an exclusive one.
+
+#ifndef LOOSE_OCTREE_HPP
+#define LOOSE_OCTREE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+
+class LooseOctree
+{
+public:
+    static constexpr unsigned max_depth = 8;
+
+    // ------------------------
+    // the cell of the root is center +- half_size. Objects are ids
+    // from 0, the arrays indexed by them grow to the largest one.
+    LooseOctree(const glm::vec3 &center, const float half_size, const unsigned depth = 6)
+    :   depth_limit(std::min(depth, max_depth))
+    {
+        nodes.push_back(makeNode(center, half_size, no_node));
+    }
+
+    LooseOctree(const LooseOctree &) = delete;
+    LooseOctree &operator=(const LooseOctree &) = delete;
+
+    // ------------------------
+    // adds object id with sphere, moves it if it is already in
+    void insert(const std::uint32_t id, const BoundingSphere &sphere)
+    {
+        std::unique_lock <std::shared_mutex> lock(mutex);
+        if (id >= object_nodes.size()) {
+            spheres.resize(id + 1);
+            object_nodes.resize(id + 1, no_node);
+            next_objects.resize(id + 1, no_object);
+            previous_objects.resize(id + 1, no_object);
+        }
+        spheres[id] = sphere;
+        const std::uint32_t node = findNode(sphere);
+        if (object_nodes[id] == node)
+            return;
+        if (object_nodes[id] != no_node)
+            unlink(id);
+        link(id, node);
+    }
+
+    void remove(const std::uint32_t id)
+    {
+        std::unique_lock <std::shared_mutex> lock(mutex);
+        if (id < object_nodes.size() && object_nodes[id] != no_node)
+            unlink(id);
+    }
+
+    // ------------------------
+    // a moved object that still fits its cell stays in it
+    void move(const std::uint32_t id, const BoundingSphere &sphere)
+    {
+        insert(id, sphere);
+    }
+
+    // ------------------------
+    // calls visitor(id) for every object whose sphere intersects the
+    // frustum. Objects in nodes fully inside it are not tested. The
+    // visitor must not change the octree.
+    template <class Visitor>
+    void visitFrustum(const Frustum &frustum, Visitor &&visitor) const
+    {
+        std::shared_lock <std::shared_mutex> lock(mutex);
+        Entry stack[stack_size];
+        std::size_t stack_top = 0;
+        stack[stack_top++] = {0, false};
+        while (stack_top > 0) {
+            const Entry entry = stack[--stack_top];
+            const Node &node = nodes[entry.node];
+            for (std::uint32_t id = node.first_object; id != no_object; id = next_objects[id]) {
+                if (entry.inside || frustum.intersects(spheres[id]))
+                    visitor(id);
+            }
+            for (const std::uint32_t child : node.children) {
+                if (child == no_node || nodes[child].objects_num == 0)
+                    continue;
+                if (entry.inside) {
+                    stack[stack_top++] = {child, true};
+                    continue;
+                }
+                const Containment containment = classify(frustum, looseBox(nodes[child]));
+                if (containment != OUTSIDE)
+                    stack[stack_top++] = {child, containment == INSIDE};
+            }
+        }
+    }
+
+    // ------------------------
+    // calls visitor(id) for every object whose sphere intersects the
+    // query sphere
+    template <class Visitor>
+    void visitSphere(const BoundingSphere &sphere, Visitor &&visitor) const
+    {
+        std::shared_lock <std::shared_mutex> lock(mutex);
+        Entry stack[stack_size];
+        std::size_t stack_top = 0;
+        stack[stack_top++] = {0, false};
+        while (stack_top > 0) {
+            const Node &node = nodes[stack[--stack_top].node];
+            for (std::uint32_t id = node.first_object; id != no_object; id = next_objects[id]) {
+                const float distance = sphere.radius + spheres[id].radius;
+                const glm::vec3 offset = spheres[id].center - sphere.center;
+                if (glm::dot(offset, offset) <= distance * distance)
+                    visitor(id);
+            }
+            for (const std::uint32_t child : node.children) {
+                if (child == no_node || nodes[child].objects_num == 0)
+                    continue;
+                const BoundingBox box = looseBox(nodes[child]);
+                const glm::vec3 offset = glm::clamp(sphere.center, box.min, box.max) -
+                                         sphere.center;
+                if (glm::dot(offset, offset) <= sphere.radius * sphere.radius)
+                    stack[stack_top++] = {child, false};
+            }
+        }
+    }
+
+    // ------------------------
+    // calls visitor(id, distance) for every object whose sphere the ray
+    // from origin along direction (unit length) enters within
+    // max_distance, distance is where it does, 0 if the origin is
+    // inside. The order is the order of the nodes, not of distance.
+    template <class Visitor>
+    void visitRay(const glm::vec3 &origin, const glm::vec3 &direction,
+                  const float max_distance, Visitor &&visitor) const
+    {
+        std::shared_lock <std::shared_mutex> lock(mutex);
+        const glm::vec3 inverse_direction(1.f / direction.x, 1.f / direction.y,
+                                          1.f / direction.z);
+        Entry stack[stack_size];
+        std::size_t stack_top = 0;
+        stack[stack_top++] = {0, false};
+        while (stack_top > 0) {
+            const Node &node = nodes[stack[--stack_top].node];
+            for (std::uint32_t id = node.first_object; id != no_object; id = next_objects[id]) {
+                float distance;
+                if (raySphere(origin, direction, spheres[id], distance) &&
+                    distance <= max_distance)
+                    visitor(id, distance);
+            }
+            for (const std::uint32_t child : node.children) {
+                if (child == no_node || nodes[child].objects_num == 0)
+                    continue;
+                if (rayBox(origin, inverse_direction, looseBox(nodes[child]), max_distance))
+                    stack[stack_top++] = {child, false};
+            }
+        }
+    }
+
+    // ------------------------
+    // the ids the visit*() calls find, in result. Cleared first; no
+    // allocation once result has the capacity.
+    void queryFrustum(const Frustum &frustum, std::vector <std::uint32_t> &result) const
+    {
+        result.clear();
+        visitFrustum(frustum, [&result](const std::uint32_t id) { result.push_back(id); });
+    }
+
+    void querySphere(const BoundingSphere &sphere, std::vector <std::uint32_t> &result) const
+    {
+        result.clear();
+        visitSphere(sphere, [&result](const std::uint32_t id) { result.push_back(id); });
+    }
+
+    void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, const float max_distance,
+                  std::vector <std::uint32_t> &result) const
+    {
+        result.clear();
+        visitRay(origin, direction, max_distance,
+                 [&result](const std::uint32_t id, float) { result.push_back(id); });
+    }
+
+    // -----------------------------
+    // getters
+    std::size_t getObjectsNum() const
+    {
+        std::shared_lock <std::shared_mutex> lock(mutex);
+        return nodes.front().objects_num;
+    }
+
+    std::size_t getNodesNum() const
+    {
+        std::shared_lock <std::shared_mutex> lock(mutex);
+        return nodes.size();
+    }
+
+private:
+    static constexpr std::uint32_t no_node = 0xffffffffu;
+    static constexpr std::uint32_t no_object = 0xffffffffu;
+    // ------------------------
+    // a walk keeps at most 7 siblings of every node on its path, and
+    // the 8 children of the deepest one
+    static constexpr std::size_t stack_size = max_depth * 7 + 8 + 1;
+
+    enum Containment {OUTSIDE, INTERSECTS, INSIDE};
+
+    struct Node
+    {
+        glm::vec3 center;
+        float half_size;
+        std::uint32_t parent;
+        std::uint32_t children[8];
+        std::uint32_t first_object;
+        // ------------------------
+        // objects in the node and below it
+        std::uint32_t objects_num;
+    };
+
+    struct Entry
+    {
+        std::uint32_t node;
+        bool inside;
+    };
+
+    unsigned depth_limit;
+    std::vector <Node> nodes;
+    std::vector <BoundingSphere> spheres;
+    std::vector <std::uint32_t> object_nodes;
+    std::vector <std::uint32_t> next_objects;
+    std::vector <std::uint32_t> previous_objects;
+    mutable std::shared_mutex mutex;
+
+    static Node makeNode(const glm::vec3 &center, const float half_size,
+                         const std::uint32_t parent)
+    {
+        Node node;
+        node.center = center;
+        node.half_size = half_size;
+        node.parent = parent;
+        std::fill(std::begin(node.children), std::end(node.children), no_node);
+        node.first_object = no_object;
+        node.objects_num = 0;
+        return node;
+    }
+
+    static BoundingBox looseBox(const Node &node)
+    {
+        const glm::vec3 extent(node.half_size * 2.f);
+        return {node.center - extent, node.center + extent};
+    }
+
+    // ------------------------
+    // the deepest cell that holds the center and is at least as large
+    // as the radius, created on the way down if needed
+    std::uint32_t findNode(const BoundingSphere &sphere)
+    {
+        const Node &root = nodes.front();
+        const glm::vec3 offset = glm::abs(sphere.center - root.center);
+        if (std::max({offset.x, offset.y, offset.z}) > root.half_size)
+            return 0;
+        std::uint32_t node = 0;
+        for (unsigned depth = 0; depth < depth_limit; ++depth) {
+            const float child_half_size = nodes[node].half_size * 0.5f;
+            if (sphere.radius > child_half_size)
+                break;
+            const glm::vec3 &center = nodes[node].center;
+            const unsigned child = (sphere.center.x >= center.x ? 1u : 0u) |
+                                   (sphere.center.y >= center.y ? 2u : 0u) |
+                                   (sphere.center.z >= center.z ? 4u : 0u);
+            if (nodes[node].children[child] == no_node) {
+                const glm::vec3 child_center(
+                    center.x + ((child & 1u) ? child_half_size : -child_half_size),
+                    center.y + ((child & 2u) ? child_half_size : -child_half_size),
+                    center.z + ((child & 4u) ? child_half_size : -child_half_size));
+                nodes.push_back(makeNode(child_center, child_half_size, node));
+                nodes[node].children[child] = static_cast <std::uint32_t>(nodes.size() - 1);
+            }
+            node = nodes[node].children[child];
+        }
+        return node;
+    }
+
+    void link(const std::uint32_t id, const std::uint32_t node)
+    {
+        object_nodes[id] = node;
+        previous_objects[id] = no_object;
+        next_objects[id] = nodes[node].first_object;
+        if (nodes[node].first_object != no_object)
+            previous_objects[nodes[node].first_object] = id;
+        nodes[node].first_object = id;
+        for (std::uint32_t i = node; i != no_node; i = nodes[i].parent)
+            ++nodes[i].objects_num;
+    }
+
+    void unlink(const std::uint32_t id)
+    {
+        const std::uint32_t node = object_nodes[id];
+        if (previous_objects[id] != no_object)
+            next_objects[previous_objects[id]] = next_objects[id];
+        else
+            nodes[node].first_object = next_objects[id];
+        if (next_objects[id] != no_object)
+            previous_objects[next_objects[id]] = previous_objects[id];
+        for (std::uint32_t i = node; i != no_node; i = nodes[i].parent)
+            --nodes[i].objects_num;
+        object_nodes[id] = no_node;
+    }
+
+    static Containment classify(const Frustum &frustum, const BoundingBox &box)
+    {
+        Containment containment = INSIDE;
+        for (int i = 0; i < Frustum::PLANES_NUM; ++i) {
+            const glm::vec4 &plane = frustum.getPlane(i);
+            const glm::vec3 normal(plane);
+            const glm::vec3 farthest(plane.x >= 0.f ? box.max.x : box.min.x,
+                                     plane.y >= 0.f ? box.max.y : box.min.y,
+                                     plane.z >= 0.f ? box.max.z : box.min.z);
+            if (glm::dot(normal, farthest) + plane.w < 0.f)
+                return OUTSIDE;
+            const glm::vec3 nearest(plane.x >= 0.f ? box.min.x : box.max.x,
+                                    plane.y >= 0.f ? box.min.y : box.max.y,
+                                    plane.z >= 0.f ? box.min.z : box.max.z);
+            if (glm::dot(normal, nearest) + plane.w < 0.f)
+                containment = INTERSECTS;
+        }
+        return containment;
+    }
+
+    static bool raySphere(const glm::vec3 &origin, const glm::vec3 &direction,
+                          const BoundingSphere &sphere, float &distance)
+    {
+        const glm::vec3 offset = origin - sphere.center;
+        const float b = glm::dot(offset, direction);
+        const float c = glm::dot(offset, offset) - sphere.radius * sphere.radius;
+        if (c > 0.f && b > 0.f)
+            return false;
+        const float discriminant = b * b - c;
+        if (discriminant < 0.f)
+            return false;
+        distance = std::max(0.f, -b - std::sqrt(discriminant));
+        return true;
+    }
+
+    // ------------------------
+    // slab test. A zero direction component has an infinite inverse:
+    // the ray runs parallel to that slab, inside it or not, and is not
+    // put through 0 * inf, which is NaN when the origin is on a plane.
+    static bool rayBox(const glm::vec3 &origin, const glm::vec3 &inverse_direction,
+                       const BoundingBox &box, const float max_distance)
+    {
+        float enter = 0.f;
+        float leave = max_distance;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (std::isinf(inverse_direction[axis])) {
+                if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis])
+                    return false;
+                continue;
+            }
+            const float t0 = (box.min[axis] - origin[axis]) * inverse_direction[axis];
+            const float t1 = (box.max[axis] - origin[axis]) * inverse_direction[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+        return enter <= leave;
+    }
+};
+
+#endif  // LOOSE_OCTREE_HPP
@@ -1,18 +1,24 @@
 // Copyright 2018 Tihran Katolikian
 // here are the implementations of few
 // important classes:
-// @ Vertex class - stores all vertex data
 // @ Texture class - stores all texture (map) data
-// @ Mesh class - implements Mesh and provides options
+// @ BasicMesh class - implements Mesh and provides options
 // to store mesh logical data, maniputate it and render
-// it
+// it. It is templated on the vertex format (see VertexFormat.hpp),
+// Mesh is the mesh of the standard float Vertex.
 
 #ifndef MESH_HPP
 #define MESH_HPP
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cassert>
+#include <cstring>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <glad/glad.h>
@@ -20,16 +26,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "GeometryArena.hpp"
+#include "GLState.hpp"
+#include "InstanceSet.hpp"
 #include "shader.hpp"
-
-struct Vertex
-{
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texture_coords;
-    glm::vec3 tangent;
-    glm::vec3 bitangent;
-};
+#include "VertexFormat.hpp"
+#include "CompactVertex.hpp"
+#include "Frustum.hpp"
 
 class Texture
 {
@@ -70,123 +73,520 @@ void Texture::setTypeByName(const std::string &stype)
         type = heightType;
 }
 
-class Mesh
+// -----------------------
+// how the GPU copy of a mesh is built
+struct MeshUploadOptions
+{
+    // -----------------------
+    // use the quantized CompactVertex layout. Only meshes of the
+    // standard format can be packed, other formats ignore it.
+    bool compact = false;
+    // -----------------------
+    // bit N set - attribute location N is uploaded. Usually taken from
+    // Shader::getAttributeMask() of the program that draws the mesh,
+    // the rest of the streams are not stored on the GPU at all.
+    unsigned attribute_mask = ~0u;
+    // -----------------------
+    // suballocate the mesh from this arena instead of giving it its own
+    // buffers and VAO. The arena stores every attribute of the float
+    // layout, so compact and attribute_mask do not apply; meshes of
+    // other formats ignore it.
+    GeometryArena <StandardVertexFormat> *arena = nullptr;
+};
+
+// -----------------------
+// a level of detail of a mesh: a range of its indices and the error of
+// the simplification in model units. All levels index the same
+// vertices.
+struct LevelOfDetail
+{
+    std::uint32_t first_index;
+    std::uint32_t indices_num;
+    float error;
+};
+
+// -----------------------
+// the levels coarser than the full detail mesh, see MeshSimplifier.hpp.
+// Their indices follow the full detail ones in the index buffer, and
+// first_index counts from the first full detail index.
+struct MeshLods
+{
+    std::vector <unsigned> indices;
+    std::vector <LevelOfDetail> levels;
+};
+
+template <class Format>
+class BasicMesh
 {
 public:
-    Mesh(const std::vector <Vertex> &init_vertices,
-         const std::vector <unsigned> &init_indices,
-         const std::vector <Texture> &init_textures)
+    using Vertex = typename Format::Vertex;
+
+    BasicMesh(const std::vector <Vertex> &init_vertices,
+              const std::vector <unsigned> &init_indices,
+              const std::vector <Texture> &init_textures,
+              const MeshUploadOptions &upload = MeshUploadOptions(),
+              const MeshLods &init_lods = MeshLods())
     :   vertices(init_vertices),
         indices(init_indices),
-        textures(init_textures)
+        textures(init_textures),
+        lods(init_lods),
+        compact_layout(upload.compact && std::is_same <Format, StandardVertexFormat>::value),
+        attribute_mask(upload.attribute_mask)
     {
         // -----------------------
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(upload.arena);
     }
-    Mesh(std::vector <Vertex> &&init_vertices,
-         std::vector <unsigned> &&init_indices,
-         std::vector <Texture> &&init_textures)
-    :   vertices(init_vertices),
-        indices(init_indices),
-        textures(init_textures)
+    BasicMesh(std::vector <Vertex> &&init_vertices,
+              std::vector <unsigned> &&init_indices,
+              std::vector <Texture> &&init_textures,
+              const MeshUploadOptions &upload = MeshUploadOptions(),
+              MeshLods &&init_lods = MeshLods())
+    :   vertices(std::move(init_vertices)),
+        indices(std::move(init_indices)),
+        textures(std::move(init_textures)),
+        lods(std::move(init_lods)),
+        compact_layout(upload.compact && std::is_same <Format, StandardVertexFormat>::value),
+        attribute_mask(upload.attribute_mask)
     {
         // -----------------------
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(upload.arena);
     }
-    ~Mesh() = default;
+    // -----------------------
+    // constructs the mesh from raw arrays, e.g. straight from a mapped
+    // mesh cache file
+    BasicMesh(const Vertex *init_vertices, const std::size_t vertices_num,
+              const unsigned *init_indices, const std::size_t indices_num,
+              std::vector <Texture> &&init_textures,
+              const MeshUploadOptions &upload = MeshUploadOptions(),
+              MeshLods &&init_lods = MeshLods())
+    :   vertices(init_vertices, init_vertices + vertices_num),
+        indices(init_indices, init_indices + indices_num),
+        textures(std::move(init_textures)),
+        lods(std::move(init_lods)),
+        compact_layout(upload.compact && std::is_same <Format, StandardVertexFormat>::value),
+        attribute_mask(upload.attribute_mask)
+    {
+        setupMesh(upload.arena);
+    }
+    ~BasicMesh() = default;
 
-    // render the mesh
-    void draw(Shader &shader) const
+    // render the mesh at a level of detail, clamped to the levels it has
+    void draw(Shader &shader, const unsigned lod = 0) const
     {
-        // bind appropriate textures
-        unsigned diffuse_num  = 1;
-        unsigned specular_num = 1;
-        unsigned normal_num   = 1;
-        unsigned height_num   = 1;
-        for(unsigned i = 0; i < textures.size(); ++i) {
-            // -------------------------
-            // active proper texture unit before binding
-            glActiveTexture(GL_TEXTURE0 + i);
-            // -------------------------
-            // retrieve texture number (the N in diffuse_textureN)
-            std::string number;
-            std::string name = textures[i].getTypeString();
+        prepare(shader);
+        // draw mesh. The VAO stays bound: the next draw of the same
+        // mesh does not have to bind it again.
+        GLState::bindVertexArray(VAO);
+        if (arena) {
+            arena->drawElements(getDrawRange(lod));
+            return;
+        }
+        const LevelOfDetail &level = getLevel(lod);
+        glDrawElements(GL_TRIANGLES, level.indices_num, index_type, indexOffset(level));
+    }
+
+    // -----------------------
+    // renders all instances of the set with one draw call. The set
+    // must have been uploaded (see Model::drawInstanced).
+    void drawInstanced(Shader &shader, const InstanceSet &instances,
+                       const unsigned lod = 0) const
+    {
+        if (instances.size() == 0)
+            return;
+        prepare(shader);
+        GLState::bindVertexArray(VAO);
+        // -------------------------
+        // the instance attributes are VAO state: point them at the
+        // set's buffer once. Meshes of an arena share its VAO.
+        unsigned &bound_instances = arena ? arena->instanceBinding() : instance_buffer;
+        if (bound_instances != instances.getBuffer()) {
+            instances.setupAttributes();
+            bound_instances = instances.getBuffer();
+        }
+        if (arena) {
+            arena->drawElementsInstanced(getDrawRange(lod),
+                                         static_cast <GLsizei>(instances.size()));
+            return;
+        }
+        const LevelOfDetail &level = getLevel(lod);
+        glDrawElementsInstanced(GL_TRIANGLES, level.indices_num, index_type, indexOffset(level),
+                                static_cast <GLsizei>(instances.size()));
+    }
 
-            if (name == "texture_diffuse")
-				number = std::to_string(diffuse_num++);
-			else if (name == "texture_specular")
-				number = std::to_string(specular_num++);
-            else if (name == "texture_normal")
-				number = std::to_string(normal_num++);
-            else if (name == "texture_height")
-			    number = std::to_string(height_num++);
+    // -----------------------
+    // renders parts of the mesh's indices with one draw call, e.g. the
+    // meshlets that survived culling. The ranges come from
+    // getDrawRange() or are parts of one.
+    void drawRanges(Shader &shader,
+                    const std::vector <GeometryArena <StandardVertexFormat>::DrawRange> &ranges) const
+    {
+        if (ranges.empty())
+            return;
+        prepare(shader);
+        GLState::bindVertexArray(VAO);
+        if (arena) {
+            arena->multiDraw(ranges);
+            return;
+        }
+        range_counts.clear();
+        range_offsets.clear();
+        for (const GeometryArena <StandardVertexFormat>::DrawRange &range : ranges) {
+            range_counts.push_back(static_cast <GLsizei>(range.indices_num));
+            range_offsets.push_back(indexOffset(range.first_index));
+        }
+        glMultiDrawElements(GL_TRIANGLES, range_counts.data(), index_type, range_offsets.data(),
+                            static_cast <GLsizei>(range_counts.size()));
+    }
 
-            glUniform1i(glGetUniformLocation(shader.getid(), ("material." + name + number).c_str()), i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);   // is it needed?!!!!!!!
+    // -----------------------
+    // binds the textures and sets the per-mesh uniforms. draw() calls
+    // it, batched arena draws call it once for all meshes of a batch.
+    void prepare(Shader &shader) const
+    {
+        // -------------------------
+        // the program reads a stream that was stripped at upload:
+        // rebuild the vertex buffer with it
+        const unsigned missing = shader.getAttributeMask() & ~attribute_mask;
+        if (missing & availableAttributes()) {
+            attribute_mask |= missing;
+            uploadVertices();
         }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        // bind appropriate textures. The state cache skips the units
+        // that already hold them, the shader skips unchanged samplers.
+        for(unsigned i = 0; i < textures.size(); ++i) {
+            shader.setInt(sampler_names[i], i);
+            GLState::bindTexture2D(i, textures[i].id);
+        }
+
+        // -------------------------
+        // dequantization constants of the compact layout; identity for
+        // the float layout
+        static constexpr UniformName pos_offset_name("pos_offset");
+        static constexpr UniformName pos_scale_name("pos_scale");
+        static constexpr UniformName qtangent_normals_name("qtangent_normals");
+        shader.setVec3(pos_offset_name, quantization.offset);
+        shader.setVec3(pos_scale_name, quantization.scale);
+        shader.setBool(qtangent_normals_name, compact_layout);
+    }
+
+    // -----------------------
+    // getters
+    const std::vector <Vertex> &getVertices() const
+    {
+        return vertices;
+    }
+
+    const std::vector <unsigned> &getIndices() const
+    {
+        return indices;
+    }
+
+    const std::vector <Texture> &getTextures() const
+    {
+        return textures;
+    }
+
+    // -----------------------
+    // levels of detail, the full detail mesh first. There is always
+    // at least that one.
+    std::size_t getLevelsNum() const
+    {
+        return levels.size();
+    }
+
+    const LevelOfDetail &getLevel(const unsigned lod) const
+    {
+        return levels[std::min <std::size_t>(lod, levels.size() - 1)];
+    }
+
+    // -----------------------
+    // the indices of the coarser levels, as given to the constructor
+    const MeshLods &getLods() const
+    {
+        return lods;
+    }
+
+    // -----------------------
+    // specular exponent of the material as stored in the asset,
+    // 0 if the asset does not specify it
+    float getShininess() const
+    {
+        return shininess;
+    }
+
+    void setShininess(const float new_shininess)
+    {
+        shininess = new_shininess;
+    }
+
+    // -----------------------
+    // model space bounds, computed when the mesh is set up
+    const BoundingBox &getBoundingBox() const
+    {
+        return bounding_box;
+    }
+
+    const BoundingSphere &getBoundingSphere() const
+    {
+        return bounding_sphere;
+    }
+
+    // -----------------------
+    // GL names used to build render queue sort keys
+    unsigned getVertexArray() const
+    {
+        return VAO;
+    }
+
+    unsigned getTextureSetId() const
+    {
+        return textures.empty() ? 0 : textures.front().id;
+    }
+
+    // -----------------------
+    // range of the mesh in its arena, invalid_handle if the mesh has
+    // its own buffers
+    GeometryArena <StandardVertexFormat> *getArena() const
+    {
+        return arena;
+    }
+
+    GeometryArena <StandardVertexFormat>::Handle getArenaHandle() const
+    {
+        return arena_handle;
+    }
+
+    GeometryArena <StandardVertexFormat>::DrawRange getDrawRange(const unsigned lod = 0) const
+    {
+        const LevelOfDetail &level = getLevel(lod);
+        return {arena_handle, level.first_index, level.indices_num};
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // -----------------------
+    // size of the vertex buffer currently stored on the GPU
+    std::size_t getVertexBufferSize() const
+    {
+        return vertex_buffer_size;
     }
 
 private:
-    unsigned VBO;
-    unsigned EBO;
-    unsigned VAO;
+    unsigned VBO = 0;
+    unsigned EBO = 0;
+    unsigned VAO = 0;
+    GeometryArena <StandardVertexFormat> *arena = nullptr;
+    GeometryArena <StandardVertexFormat>::Handle arena_handle =
+        GeometryArena <StandardVertexFormat>::invalid_handle;
     
     std::vector <Vertex> vertices;
     std::vector <unsigned> indices;
     std::vector <Texture> textures;
+    MeshLods lods;
+    // -----------------------
+    // the full detail level followed by lods.levels
+    std::vector <LevelOfDetail> levels;
+    float shininess = 0.f;
+    BoundingBox bounding_box;
+    BoundingSphere bounding_sphere;
+
+    // -----------------------
+    // GPU layout: the float Vertex or CompactVertex, 32 or 16 bit indices.
+    // attribute_mask and the buffer size change when draw() finds a
+    // program that needs more streams.
+    bool compact_layout;
+    mutable unsigned attribute_mask;
+    mutable std::size_t vertex_buffer_size = 0;
+    GLenum index_type = GL_UNSIGNED_INT;
+    // -----------------------
+    // instance buffer the VAO's instance attributes point at
+    mutable unsigned instance_buffer = 0;
+    PositionQuantization quantization;
+    // -----------------------
+    // scratch arrays of drawRanges
+    mutable std::vector <GLsizei> range_counts;
+    mutable std::vector <const void *> range_offsets;
+
+    // -----------------------
+    // hashed "material.texture_<type>N" sampler name of every texture,
+    // where N counts textures of the same type from 1
+    std::vector <UniformName> sampler_names;
+
+    void setupSamplerNames()
+    {
+        unsigned type_counters[4] = {1, 1, 1, 1};
+        for (const Texture &texture : textures) {
+            UniformName name("material.");
+            name.append(texture.getTypeString().c_str());
+            name.append(type_counters[texture.type]++);
+            sampler_names.push_back(name);
+        }
+    }
 
-    void setupMesh()
+    void setupMesh(GeometryArena <StandardVertexFormat> *upload_arena)
     {
+        setupSamplerNames();
+        computeBounds();
+        levels.clear();
+        levels.push_back({0, static_cast <std::uint32_t>(indices.size()), 0.f});
+        levels.insert(levels.end(), lods.levels.cbegin(), lods.levels.cend());
+        if constexpr (std::is_same <Format, StandardVertexFormat>::value) {
+            if (upload_arena) {
+                arena = upload_arena;
+                const std::vector <unsigned> all_indices = allIndices();
+                arena_handle = arena->allocate(vertices.data(), vertices.size(),
+                                               all_indices.data(), all_indices.size());
+                VAO = arena->getVertexArray();
+                compact_layout = false;
+                attribute_mask = Format::attribute_mask;
+                vertex_buffer_size = vertices.size() * sizeof(Vertex);
+                return;
+            }
+        }
+
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                     vertices.data(), GL_STATIC_DRAW);
+        if constexpr (std::is_same <Format, StandardVertexFormat>::value) {
+            if (compact_layout)
+                computeQuantization();
+        }
+
+        GLState::bindVertexArray(VAO);
+        uploadIndices();
+        uploadVertices();
+    }
+
+    // -----------------------
+    // the full detail indices followed by the ones of the other levels
+    std::vector <unsigned> allIndices() const
+    {
+        std::vector <unsigned> all_indices;
+        all_indices.reserve(indices.size() + lods.indices.size());
+        all_indices.insert(all_indices.end(), indices.cbegin(), indices.cend());
+        all_indices.insert(all_indices.end(), lods.indices.cbegin(), lods.indices.cend());
+        return all_indices;
+    }
 
+    // -----------------------
+    // 16-bit indices are used by the compact layout when they fit
+    void uploadIndices()
+    {
+        const std::vector <unsigned> all_indices = allIndices();
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                     indices.data(), GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              reinterpret_cast <void *>(0));
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              reinterpret_cast <void *>(offsetof(Vertex, normal)));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              reinterpret_cast <void *>(offsetof(Vertex, texture_coords)));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              reinterpret_cast <void *>(offsetof(Vertex, tangent)));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              reinterpret_cast <void *>(offsetof(Vertex, bitangent)));
-
-        glBindVertexArray(0);
+        if (compact_layout && vertices.size() <= 65536) {
+            const std::vector <std::uint16_t> short_indices(all_indices.cbegin(),
+                                                            all_indices.cend());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(std::uint16_t),
+                         short_indices.data(), GL_STATIC_DRAW);
+            index_type = GL_UNSIGNED_SHORT;
+        }
+        else {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, all_indices.size() * sizeof(unsigned int),
+                         all_indices.data(), GL_STATIC_DRAW);
+            index_type = GL_UNSIGNED_INT;
+        }
+    }
+
+    // -----------------------
+    // byte offset of an index in the mesh's own index buffer
+    const void *indexOffset(const std::size_t first_index) const
+    {
+        const std::size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(std::uint16_t)
+                                                                       : sizeof(unsigned);
+        return reinterpret_cast <const void *>(first_index * index_size);
+    }
+
+    const void *indexOffset(const LevelOfDetail &level) const
+    {
+        return indexOffset(level.first_index);
+    }
+
+    // -----------------------
+    // (re)builds the vertex buffer in the chosen layout
+    void uploadVertices() const
+    {
+        if constexpr (std::is_same <Format, StandardVertexFormat>::value) {
+            if (compact_layout) {
+                std::vector <CompactVertex> packed;
+                packed.reserve(vertices.size());
+                for (const Vertex &vertex : vertices) {
+                    packed.push_back(VertexPacking::pack(vertex.position, vertex.normal,
+                                                         vertex.texture_coords, vertex.tangent,
+                                                         vertex.bitangent, quantization));
+                }
+                uploadVertices <CompactVertexFormat>(packed.data(), packed.size());
+                return;
+            }
+        }
+        uploadVertices <Format>(vertices.data(), vertices.size());
+    }
+
+    // -----------------------
+    // uploads the attributes of UploadFormat selected by attribute_mask
+    // interleaved and points the VAO at them. If all of them are
+    // selected the source array is uploaded as it is.
+    template <class UploadFormat>
+    void uploadVertices(const typename UploadFormat::Vertex *source,
+                        const std::size_t count) const
+    {
+        const unsigned mask = attribute_mask & UploadFormat::attribute_mask;
+        const std::size_t stride = UploadFormat::strideOf(mask);
+
+        std::vector <unsigned char> interleaved;
+        const void *upload = source;
+        if (mask != UploadFormat::attribute_mask) {
+            interleaved.resize(count * stride);
+            UploadFormat::interleave(source, count, mask, interleaved.data());
+            upload = interleaved.data();
+        }
+        vertex_buffer_size = count * stride;
+
+        GLState::bindVertexArray(VAO);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertex_buffer_size, upload, GL_STATIC_DRAW);
+        UploadFormat::setupAttributes(mask);
+    }
+
+    unsigned availableAttributes() const
+    {
+        if (compact_layout)
+            return CompactVertexFormat::attribute_mask;
+        return Format::attribute_mask;
+    }
+
+    // -----------------------
+    // the AABB and the sphere around its center that holds every
+    // vertex, which is tighter than the sphere around the box
+    void computeBounds()
+    {
+        if (vertices.empty())
+            return;
+        bounding_box.min = bounding_box.max = vertices.front().position;
+        for (const Vertex &vertex : vertices) {
+            bounding_box.min = glm::min(bounding_box.min, vertex.position);
+            bounding_box.max = glm::max(bounding_box.max, vertex.position);
+        }
+        bounding_sphere.center = bounding_box.center();
+        float radius_squared = 0.f;
+        for (const Vertex &vertex : vertices) {
+            const glm::vec3 offset = vertex.position - bounding_sphere.center;
+            radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+        }
+        bounding_sphere.radius = std::sqrt(radius_squared);
+    }
+
+    // -----------------------
+    // the AABB of the mesh maps the unorm16 positions to model space
+    void computeQuantization()
+    {
+        quantization.offset = bounding_box.min;
+        quantization.scale = bounding_box.max - bounding_box.min;
     }
 };
 
+using Mesh = BasicMesh <StandardVertexFormat>;
+
 #endif  // MESH_HPP
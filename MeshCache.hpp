@@ -0,0 +1,448 @@
+// Copyright 2018 Tihran Katolikian
+// class MeshCache - versioned binary cache of the final Vertex/index
+// arrays produced by Model::loadModel. The cache lives next to the
+// source asset (<asset>.meshcache) and is keyed by a hash of the asset
+// content with its material libraries and their textures, the format
+// version, the Assimp import flags and the hash of the post-import
+// processing options, so any change of them silently falls back to a
+// cold import and re-bakes the cache. A cache that does not hold
+// together (node parents, index ranges) is re-imported as well.
+//
+// File layout (all values little-endian, 4-byte aligned):
+// @ FileHeader, with the cold import time and weld counts, so a warm
+//   start can report them too
+// @ the nodes of the model, ModelNode records with parents first
+// @ for every mesh: MeshRecord (counts, node and material shininess), texture
+//   references, vertices, indices, then the levels of detail past the
+//   full detail one (LevelOfDetail records) and their indices
+
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Hash.hpp"
+#include "MappedFile.hpp"
+#include "Mesh.hpp"
+#include "SceneGraph.hpp"
+#include "VertexWelder.hpp"
+
+class MeshCache
+{
+public:
+    // ------------------------
+    // texture reference as stored in the cache: textures are
+    // reloaded by path, GL ids are never cached
+    struct TextureRef
+    {
+        Texture::TexType type;
+        std::string path;
+    };
+
+    // ------------------------
+    // view of one cached mesh. Vertex and index pointers point
+    // directly into the mapped file and stay valid while the
+    // MeshCache object is alive.
+    struct MeshView
+    {
+        const Vertex *vertices;
+        std::uint32_t vertices_num;
+        const unsigned *indices;
+        std::uint32_t indices_num;
+        std::vector <TextureRef> textures;
+        float shininess;
+        const LevelOfDetail *lods;
+        std::uint32_t lods_num;
+        const unsigned *lod_indices;
+        std::uint32_t lod_indices_num;
+        std::uint32_t node;
+    };
+
+    static constexpr std::uint32_t format_version = 7;
+    static_assert(sizeof(LevelOfDetail) == 12, "LevelOfDetail is stored as it is");
+    static_assert(sizeof(ModelNode) == 44, "ModelNode is stored as it is");
+
+    MeshCache(const std::string &source_path, const unsigned import_flags,
+              const std::uint64_t processing_hash)
+    :   cache_path(source_path + ".meshcache"),
+        flags(import_flags),
+        options_hash(processing_hash)
+    {
+        key = Hash::combine(Hash::combine(Hash::combine(sourceHash(source_path),
+                                                        format_version), flags), options_hash);
+    }
+    ~MeshCache() = default;
+
+    // ------------------------
+    // maps the cache file and validates it against the source asset.
+    // Returns false if there is no usable cache.
+    bool load()
+    {
+        meshes.clear();
+        nodes.clear();
+        file.reset(new MappedFile(cache_path));
+        if (!file->isOpen() || file->size() < sizeof(FileHeader))
+            return false;
+
+        const unsigned char *cursor = file->data();
+        const unsigned char *end = cursor + file->size();
+
+        FileHeader header;
+        std::memcpy(&header, cursor, sizeof(header));
+        cursor += sizeof(header);
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+            header.version != format_version ||
+            header.vertex_size != sizeof(Vertex) ||
+            header.import_flags != flags ||
+            header.options_hash != options_hash ||
+            header.key != key)
+            return false;
+
+        cold_load_ms = header.cold_load_ms;
+        weld_stats.vertices_before = static_cast <std::size_t>(header.welded_vertices_before);
+        weld_stats.vertices_after = static_cast <std::size_t>(header.welded_vertices_after);
+        if (static_cast <std::size_t>(end - cursor) < header.nodes_num * sizeof(ModelNode))
+            return invalidate();
+        nodes.resize(header.nodes_num);
+        std::memcpy(nodes.data(), cursor, header.nodes_num * sizeof(ModelNode));
+        cursor += header.nodes_num * sizeof(ModelNode);
+        // ------------------------
+        // parents first: only the root has no parent
+        for (std::uint32_t i = 0; i < header.nodes_num; ++i) {
+            const std::int32_t parent = nodes[i].parent;
+            if (i == 0 ? parent != -1 : parent < 0 || parent >= static_cast <std::int32_t>(i))
+                return invalidate();
+        }
+
+        for (std::uint32_t i = 0; i < header.meshes_num; ++i) {
+            MeshRecord record;
+            if (!read(cursor, end, &record, sizeof(record)) || record.node >= header.nodes_num)
+                return invalidate();
+
+            MeshView view;
+            view.vertices_num = record.vertices_num;
+            view.indices_num = record.indices_num;
+            view.shininess = record.shininess;
+            view.lods_num = record.lods_num;
+            view.lod_indices_num = record.lod_indices_num;
+            view.node = record.node;
+            for (std::uint32_t t = 0; t < record.textures_num; ++t) {
+                std::uint32_t type, length;
+                if (!read(cursor, end, &type, sizeof(type)) ||
+                    !read(cursor, end, &length, sizeof(length)) ||
+                    static_cast <std::size_t>(end - cursor) < padded(length))
+                    return invalidate();
+                view.textures.push_back({static_cast <Texture::TexType>(type),
+                                         std::string(reinterpret_cast <const char *>(cursor), length)});
+                cursor += padded(length);
+            }
+
+            const std::size_t vertices_size = view.vertices_num * sizeof(Vertex);
+            const std::size_t indices_size = view.indices_num * sizeof(unsigned);
+            const std::size_t lods_size = view.lods_num * sizeof(LevelOfDetail);
+            const std::size_t lod_indices_size = view.lod_indices_num * sizeof(unsigned);
+            if (static_cast <std::size_t>(end - cursor) <
+                vertices_size + indices_size + lods_size + lod_indices_size)
+                return invalidate();
+            view.vertices = reinterpret_cast <const Vertex *>(cursor);
+            cursor += vertices_size;
+            view.indices = reinterpret_cast <const unsigned *>(cursor);
+            cursor += indices_size;
+            view.lods = reinterpret_cast <const LevelOfDetail *>(cursor);
+            cursor += lods_size;
+            view.lod_indices = reinterpret_cast <const unsigned *>(cursor);
+            cursor += lod_indices_size;
+            if (!isConsistent(view))
+                return invalidate();
+
+            meshes.push_back(std::move(view));
+        }
+        return true;
+    }
+
+    // ------------------------
+    // writes the nodes and the meshes, with the node of every mesh,
+    // into the cache file, along with the statistics of the cold
+    // import. The file is written to a temporary path first, so a
+    // crash never leaves a half-baked cache.
+    bool store(const std::vector <ModelNode> &nodes_to_store,
+               const std::vector <Mesh> &to_store,
+               const std::vector <std::uint32_t> &mesh_nodes, const double cold_ms,
+               const VertexWelder::Stats &welded)
+    {
+        // release our own mapping: on Windows a mapped file cannot be replaced
+        file.reset();
+
+        const std::string tmp_path = cache_path + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "WARNING::MESH_CACHE:: cannot write " << tmp_path << '\n';
+            return false;
+        }
+
+        FileHeader header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = format_version;
+        header.import_flags = flags;
+        header.options_hash = options_hash;
+        header.key = key;
+        header.vertex_size = sizeof(Vertex);
+        header.meshes_num = static_cast <std::uint32_t>(to_store.size());
+        header.nodes_num = static_cast <std::uint32_t>(nodes_to_store.size());
+        header.padding = 0;
+        header.cold_load_ms = cold_ms;
+        header.welded_vertices_before = welded.vertices_before;
+        header.welded_vertices_after = welded.vertices_after;
+        out.write(reinterpret_cast <const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast <const char *>(nodes_to_store.data()),
+                  nodes_to_store.size() * sizeof(ModelNode));
+
+        for (std::size_t i = 0; i < to_store.size(); ++i) {
+            const Mesh &mesh = to_store[i];
+            const std::vector <Vertex> &vertices = mesh.getVertices();
+            const std::vector <unsigned> &indices = mesh.getIndices();
+            const std::vector <Texture> &textures = mesh.getTextures();
+            const MeshLods &lods = mesh.getLods();
+
+            MeshRecord record;
+            record.vertices_num = static_cast <std::uint32_t>(vertices.size());
+            record.indices_num = static_cast <std::uint32_t>(indices.size());
+            record.textures_num = static_cast <std::uint32_t>(textures.size());
+            record.shininess = mesh.getShininess();
+            record.lods_num = static_cast <std::uint32_t>(lods.levels.size());
+            record.lod_indices_num = static_cast <std::uint32_t>(lods.indices.size());
+            record.node = mesh_nodes[i];
+            out.write(reinterpret_cast <const char *>(&record), sizeof(record));
+
+            for (const Texture &texture : textures) {
+                const std::uint32_t type = texture.type;
+                const std::uint32_t length = static_cast <std::uint32_t>(texture.path.size());
+                const char zeros[4] = {};
+                out.write(reinterpret_cast <const char *>(&type), sizeof(type));
+                out.write(reinterpret_cast <const char *>(&length), sizeof(length));
+                out.write(texture.path.data(), length);
+                out.write(zeros, padded(length) - length);
+            }
+
+            out.write(reinterpret_cast <const char *>(vertices.data()),
+                      vertices.size() * sizeof(Vertex));
+            out.write(reinterpret_cast <const char *>(indices.data()),
+                      indices.size() * sizeof(unsigned));
+            out.write(reinterpret_cast <const char *>(lods.levels.data()),
+                      lods.levels.size() * sizeof(LevelOfDetail));
+            out.write(reinterpret_cast <const char *>(lods.indices.data()),
+                      lods.indices.size() * sizeof(unsigned));
+        }
+        out.close();
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+
+        std::remove(cache_path.c_str());
+        return std::rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+    }
+
+    // -----------------------------
+    // getters
+    const std::vector <MeshView> &getMeshes() const
+    {
+        return meshes;
+    }
+
+    const std::vector <ModelNode> &getNodes() const
+    {
+        return nodes;
+    }
+
+    double getColdLoadTime() const
+    {
+        return cold_load_ms;
+    }
+
+    // ------------------------
+    // what welding did during the cold import that baked the cache
+    const VertexWelder::Stats &getWeldStats() const
+    {
+        return weld_stats;
+    }
+
+    const std::string &getCachePath() const
+    {
+        return cache_path;
+    }
+
+    // ------------------------
+    // hash of the asset and of the files it pulls in: the material
+    // libraries named by its mtllib lines, the textures they name, and
+    // extra_paths, relative to the asset like those. Missing files hash
+    // their path only.
+    static std::uint64_t sourceHash(const std::string &source_path,
+                                    const std::vector <std::string> &extra_paths = {})
+    {
+        MappedFile source(source_path);
+        if (!source.isOpen())
+            return Hash::fnv1a(source_path);
+        const std::string directory = source_path.substr(0, source_path.find_last_of('/'));
+        std::vector <std::string> libraries;
+        forEachStatement(source, [&](const std::string &keyword, const std::string &argument)
+        {
+            if (keyword == "mtllib")
+                libraries.push_back(directory + '/' + argument);
+        });
+        std::vector <std::string> paths = libraries;
+        for (const std::string &library_path : libraries) {
+            MappedFile library(library_path);
+            forEachStatement(library, [&](const std::string &keyword, const std::string &argument)
+            {
+                // ------------------------
+                // options may come before the file name
+                if (keyword.compare(0, 4, "map_") == 0 || keyword == "bump" ||
+                    keyword == "disp" || keyword == "decal" || keyword == "norm" ||
+                    keyword == "refl")
+                    paths.push_back(directory + '/' +
+                                    argument.substr(argument.find_last_of(" \t") + 1));
+            });
+        }
+        for (const std::string &path : extra_paths)
+            paths.push_back(directory + '/' + path);
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+        std::uint64_t hash = Hash::fnv1a(source.data(), source.size());
+        for (const std::string &path : paths) {
+            MappedFile file(path);
+            hash = Hash::fnv1a(path, hash);
+            if (file.isOpen())
+                hash = Hash::fnv1a(file.data(), file.size(), hash);
+        }
+        return hash;
+    }
+
+private:
+    struct FileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t import_flags;
+        std::uint64_t options_hash;
+        std::uint64_t key;
+        std::uint32_t vertex_size;
+        std::uint32_t meshes_num;
+        std::uint32_t nodes_num;
+        std::uint32_t padding;
+        double cold_load_ms;
+        std::uint64_t welded_vertices_before;
+        std::uint64_t welded_vertices_after;
+    };
+
+    struct MeshRecord
+    {
+        std::uint32_t vertices_num;
+        std::uint32_t indices_num;
+        std::uint32_t textures_num;
+        float shininess;
+        std::uint32_t lods_num;
+        std::uint32_t lod_indices_num;
+        std::uint32_t node;
+    };
+
+    static constexpr char magic[8] = {'S', 'Y', 'L', 'M', 'E', 'S', 'H', '\0'};
+
+    std::string cache_path;
+    unsigned flags;
+    std::uint64_t options_hash;
+    std::uint64_t key = 0;
+    double cold_load_ms = 0.0;
+    VertexWelder::Stats weld_stats;
+
+    std::unique_ptr <MappedFile> file;
+    std::vector <MeshView> meshes;
+    std::vector <ModelNode> nodes;
+
+    static std::size_t padded(const std::size_t size)
+    {
+        return (size + 3) & ~static_cast <std::size_t>(3);
+    }
+
+    static bool read(const unsigned char *&cursor, const unsigned char *end,
+                     void *dst, const std::size_t size)
+    {
+        if (static_cast <std::size_t>(end - cursor) < size)
+            return false;
+        std::memcpy(dst, cursor, size);
+        cursor += size;
+        return true;
+    }
+
+    // ------------------------
+    // calls statement(keyword, argument) for every line of a text
+    // file, the argument being the rest of the line without the
+    // surrounding blanks
+    template <class Function>
+    static void forEachStatement(const MappedFile &file, Function statement)
+    {
+        if (!file.isOpen())
+            return;
+        const char *text = reinterpret_cast <const char *>(file.data());
+        const char *end = text + file.size();
+        static constexpr char blanks[] = " \t\r";
+        for (const char *line = text; line < end; ) {
+            const char *line_end = std::find(line, end, '\n');
+            const std::string content(line, line_end);
+            const std::size_t keyword_begin = content.find_first_not_of(blanks);
+            if (keyword_begin != std::string::npos) {
+                const std::size_t keyword_end = content.find_first_of(blanks, keyword_begin);
+                const std::size_t argument_begin = content.find_first_not_of(blanks, keyword_end);
+                if (argument_begin != std::string::npos) {
+                    const std::size_t argument_end = content.find_last_not_of(blanks) + 1;
+                    statement(content.substr(keyword_begin, keyword_end - keyword_begin),
+                              content.substr(argument_begin, argument_end - argument_begin));
+                }
+            }
+            line = line_end + 1;
+        }
+    }
+
+    // ------------------------
+    // every index must point at a vertex and every level of detail
+    // must lie in the index data of its mesh
+    static bool isConsistent(const MeshView &view)
+    {
+        if (view.indices_num > 0 &&
+            *std::max_element(view.indices, view.indices + view.indices_num) >= view.vertices_num)
+            return false;
+        if (view.lod_indices_num > 0 &&
+            *std::max_element(view.lod_indices, view.lod_indices + view.lod_indices_num) >=
+            view.vertices_num)
+            return false;
+        const std::uint64_t all_indices_num = static_cast <std::uint64_t>(view.indices_num) +
+                                              view.lod_indices_num;
+        for (std::uint32_t i = 0; i < view.lods_num; ++i) {
+            const LevelOfDetail &level = view.lods[i];
+            if (static_cast <std::uint64_t>(level.first_index) + level.indices_num >
+                all_indices_num)
+                return false;
+        }
+        return true;
+    }
+
+    bool invalidate()
+    {
+        std::cout << "WARNING::MESH_CACHE:: " << cache_path
+                  << " is truncated or corrupt, re-importing\n";
+        meshes.clear();
+        nodes.clear();
+        return false;
+    }
+};
+
+#endif  // MESH_CACHE_HPP
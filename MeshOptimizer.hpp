@@ -0,0 +1,387 @@
+// Copyright 2018 Tihran Katolikian
+// class MeshOptimizer - reorders an indexed triangle list for the GPU:
+// @ triangles are reordered for the post-transform vertex cache with
+//   Tipsify (Sander, Nehab, Barczak - "Fast Triangle Reordering for
+//   Vertex Locality and Reduced Overdraw", 2007);
+// @ the clusters Tipsify produces are split further where the cache
+//   can be flushed at little cost, and sorted so that the outward
+//   facing ones are drawn first, which reduces overdraw;
+// @ vertices are renumbered in order of first use, which makes vertex
+//   fetch sequential.
+// ACMR (average cache miss ratio, misses per triangle) and ATVR
+// (average transform to vertex ratio, misses per vertex) are measured
+// with a FIFO cache simulation before and after.
+
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+class MeshOptimizer
+{
+public:
+    // ------------------------
+    // size of the simulated post-transform cache. 16 entries is a
+    // conservative value for the hardware we care about.
+    static constexpr unsigned cache_size = 16;
+
+    // ------------------------
+    // result of the FIFO cache simulation
+    struct CacheStats
+    {
+        std::size_t misses = 0;
+        std::size_t triangles = 0;
+        std::size_t vertices = 0;
+
+        float acmr() const
+        {
+            return triangles ? static_cast <float>(misses) / triangles : 0.f;
+        }
+
+        float atvr() const
+        {
+            return vertices ? static_cast <float>(misses) / vertices : 0.f;
+        }
+
+        CacheStats &operator+=(const CacheStats &other)
+        {
+            misses += other.misses;
+            triangles += other.triangles;
+            vertices += other.vertices;
+            return *this;
+        }
+    };
+
+    struct Stats
+    {
+        CacheStats before;
+        CacheStats after;
+
+        Stats &operator+=(const Stats &other)
+        {
+            before += other.before;
+            after += other.after;
+            return *this;
+        }
+    };
+
+    MeshOptimizer() = delete;
+
+    // ------------------------
+    // runs the whole pass in place
+    static Stats optimize(std::vector <Vertex> &vertices,
+                          std::vector <unsigned> &indices)
+    {
+        Stats stats;
+        stats.before = simulateCache(indices, vertices.size());
+
+        std::vector <std::size_t> cluster_starts;
+        tipsify(indices, vertices.size(), cluster_starts);
+        splitClusters(indices, vertices.size(), cluster_starts);
+        sortClustersForOverdraw(vertices, indices, cluster_starts);
+        optimizeVertexFetch(vertices, indices);
+
+        stats.after = simulateCache(indices, vertices.size());
+        return stats;
+    }
+
+    // ------------------------
+    // reorders the triangles only, the vertices keep their numbers.
+    // For index lists sharing the vertices of another one, like the
+    // levels of detail of a mesh.
+    static Stats optimizeTriangles(const std::vector <Vertex> &vertices,
+                                   std::vector <unsigned> &indices)
+    {
+        Stats stats;
+        stats.before = simulateCache(indices, vertices.size());
+
+        std::vector <std::size_t> cluster_starts;
+        tipsify(indices, vertices.size(), cluster_starts);
+        splitClusters(indices, vertices.size(), cluster_starts);
+        sortClustersForOverdraw(vertices, indices, cluster_starts);
+
+        stats.after = simulateCache(indices, vertices.size());
+        return stats;
+    }
+
+    // ------------------------
+    // FIFO post-transform cache simulation
+    static CacheStats simulateCache(const std::vector <unsigned> &indices,
+                                    const std::size_t vertices_num)
+    {
+        CacheStats stats;
+        stats.triangles = indices.size() / 3;
+        stats.vertices = vertices_num;
+
+        // ------------------------
+        // a vertex is in the cache if it was inserted less than
+        // cache_size misses ago
+        std::vector <std::size_t> inserted_at(vertices_num, 0);
+        for (const unsigned index : indices) {
+            if (inserted_at[index] == 0 ||
+                stats.misses - inserted_at[index] >= cache_size) {
+                ++stats.misses;
+                inserted_at[index] = stats.misses;
+            }
+        }
+        return stats;
+    }
+
+private:
+    // ------------------------
+    // Tipsify. Writes the reordered triangles back into indices and
+    // records where a new cluster starts (an index into the triangle
+    // list), i.e. each place the fan had to jump to a non-adjacent
+    // vertex.
+    static void tipsify(std::vector <unsigned> &indices,
+                        const std::size_t vertices_num,
+                        std::vector <std::size_t> &cluster_starts)
+    {
+        const std::size_t triangles_num = indices.size() / 3;
+        if (triangles_num == 0)
+            return;
+
+        // ------------------------
+        // vertex -> triangle adjacency in CSR form
+        std::vector <unsigned> live(vertices_num, 0);
+        for (const unsigned index : indices)
+            ++live[index];
+        std::vector <std::size_t> offsets(vertices_num + 1, 0);
+        for (std::size_t v = 0; v < vertices_num; ++v)
+            offsets[v + 1] = offsets[v] + live[v];
+        std::vector <unsigned> adjacency(indices.size());
+        {
+            std::vector <std::size_t> fill(offsets.begin(), offsets.end() - 1);
+            for (std::size_t i = 0; i < indices.size(); ++i)
+                adjacency[fill[indices[i]]++] = static_cast <unsigned>(i / 3);
+        }
+
+        std::vector <unsigned> output;
+        output.reserve(indices.size());
+        std::vector <std::size_t> cache_time(vertices_num, 0);
+        std::vector <char> emitted(triangles_num, 0);
+        std::vector <unsigned> dead_end;
+        std::vector <unsigned> candidates;
+
+        std::size_t timestamp = cache_size + 1;
+        std::size_t cursor = 0;
+        long fanning = 0;
+        bool jumped = true;
+
+        while (fanning >= 0) {
+            if (jumped)
+                cluster_starts.push_back(output.size() / 3);
+            candidates.clear();
+
+            for (std::size_t a = offsets[fanning]; a < offsets[fanning + 1]; ++a) {
+                const unsigned triangle = adjacency[a];
+                if (emitted[triangle])
+                    continue;
+                for (unsigned k = 0; k < 3; ++k) {
+                    const unsigned v = indices[triangle * 3 + k];
+                    output.push_back(v);
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    --live[v];
+                    if (timestamp - cache_time[v] > cache_size)
+                        cache_time[v] = timestamp++;
+                }
+                emitted[triangle] = 1;
+            }
+
+            // ------------------------
+            // pick the candidate that will still be in the cache after
+            // all its remaining triangles are emitted, preferring the
+            // oldest one
+            long best = -1;
+            std::size_t best_priority = 0;
+            for (const unsigned v : candidates) {
+                if (live[v] == 0)
+                    continue;
+                std::size_t priority = 0;
+                if (timestamp - cache_time[v] + 2 * live[v] <= cache_size)
+                    priority = timestamp - cache_time[v];
+                if (priority > best_priority || best < 0) {
+                    best_priority = priority;
+                    best = v;
+                }
+            }
+
+            jumped = best < 0;
+            if (jumped)
+                best = skipDeadEnd(live, dead_end, cursor);
+            fanning = best;
+        }
+
+        indices = std::move(output);
+    }
+
+    // ------------------------
+    // Tipsify only breaks clusters at dead ends, which are rare on well
+    // connected meshes, so the overdraw sort would get a few huge
+    // clusters. As in the paper, a cluster is also ended wherever its
+    // ACMR, counted from an empty cache at its start, is within
+    // split_threshold of the ACMR of the whole list: reordering such
+    // clusters costs about that much vertex cache efficiency at most.
+    static void splitClusters(const std::vector <unsigned> &indices,
+                              const std::size_t vertices_num,
+                              std::vector <std::size_t> &cluster_starts)
+    {
+        static constexpr float split_threshold = 1.05f;
+        const std::size_t triangles_num = indices.size() / 3;
+        if (triangles_num == 0)
+            return;
+        const float limit = simulateCache(indices, vertices_num).acmr() * split_threshold;
+
+        std::vector <std::size_t> split;
+        split.reserve(cluster_starts.size());
+        // ------------------------
+        // FIFO cache as in simulateCache(), emptied at every start by
+        // forgetting the entries inserted before flushed_at
+        std::vector <std::size_t> inserted_at(vertices_num, 0);
+        std::size_t misses = 0;
+        std::size_t flushed_at = 0;
+        std::size_t cluster_misses = 0;
+        std::size_t cluster_first = 0;
+        std::size_t next_hard = 0;
+        for (std::size_t t = 0; t < triangles_num; ++t) {
+            const bool hard = next_hard < cluster_starts.size() && cluster_starts[next_hard] == t;
+            if (hard)
+                ++next_hard;
+            const bool soft = t > cluster_first &&
+                              cluster_misses <= limit * static_cast <float>(t - cluster_first);
+            if (hard || soft) {
+                split.push_back(t);
+                flushed_at = misses;
+                cluster_misses = 0;
+                cluster_first = t;
+            }
+            for (unsigned k = 0; k < 3; ++k) {
+                const unsigned index = indices[t * 3 + k];
+                if (inserted_at[index] <= flushed_at || misses - inserted_at[index] >= cache_size) {
+                    ++misses;
+                    ++cluster_misses;
+                    inserted_at[index] = misses;
+                }
+            }
+        }
+        cluster_starts = std::move(split);
+    }
+
+    static long skipDeadEnd(const std::vector <unsigned> &live,
+                            std::vector <unsigned> &dead_end,
+                            std::size_t &cursor)
+    {
+        // ------------------------
+        // recently referenced vertices first, then scan in input order
+        while (!dead_end.empty()) {
+            const unsigned v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0)
+                return v;
+        }
+        for (; cursor < live.size(); ++cursor) {
+            if (live[cursor] > 0)
+                return static_cast <long>(cursor);
+        }
+        return -1;
+    }
+
+    // ------------------------
+    // sorts the clusters by how much they face away from the mesh
+    // centroid: clusters on the outside of the mesh occlude the rest,
+    // so drawing them first lets early-z reject more fragments
+    static void sortClustersForOverdraw(const std::vector <Vertex> &vertices,
+                                        std::vector <unsigned> &indices,
+                                        const std::vector <std::size_t> &cluster_starts)
+    {
+        const std::size_t triangles_num = indices.size() / 3;
+        if (cluster_starts.size() < 2)
+            return;
+
+        glm::vec3 mesh_centroid(0.f);
+        for (const Vertex &vertex : vertices)
+            mesh_centroid += vertex.position;
+        mesh_centroid /= static_cast <float>(vertices.size());
+
+        struct Cluster
+        {
+            std::size_t first;
+            std::size_t last;
+            float sort_key;
+        };
+        std::vector <Cluster> clusters;
+        clusters.reserve(cluster_starts.size());
+
+        for (std::size_t c = 0; c < cluster_starts.size(); ++c) {
+            Cluster cluster;
+            cluster.first = cluster_starts[c];
+            cluster.last = c + 1 < cluster_starts.size() ? cluster_starts[c + 1] : triangles_num;
+
+            glm::vec3 centroid(0.f);
+            glm::vec3 normal(0.f);
+            float area = 0.f;
+            for (std::size_t t = cluster.first; t < cluster.last; ++t) {
+                const glm::vec3 &p0 = vertices[indices[t * 3 + 0]].position;
+                const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].position;
+                const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].position;
+                // area weighted
+                const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                const float a = glm::length(n);
+                centroid += (p0 + p1 + p2) * (a / 3.f);
+                normal += n;
+                area += a;
+            }
+            if (area > 0.f)
+                centroid /= area;
+            const float normal_length = glm::length(normal);
+            if (normal_length > 0.f)
+                normal /= normal_length;
+
+            cluster.sort_key = glm::dot(centroid - mesh_centroid, normal);
+            clusters.push_back(cluster);
+        }
+
+        std::stable_sort(clusters.begin(), clusters.end(),
+                         [](const Cluster &a, const Cluster &b)
+                         {
+                             return a.sort_key > b.sort_key;
+                         });
+
+        std::vector <unsigned> sorted;
+        sorted.reserve(indices.size());
+        for (const Cluster &cluster : clusters)
+            sorted.insert(sorted.end(), indices.begin() + cluster.first * 3,
+                          indices.begin() + cluster.last * 3);
+        indices = std::move(sorted);
+    }
+
+    // ------------------------
+    // renumbers vertices in order of first reference. Vertices not
+    // referenced by any triangle are dropped.
+    static void optimizeVertexFetch(std::vector <Vertex> &vertices,
+                                    std::vector <unsigned> &indices)
+    {
+        constexpr unsigned unused = ~0u;
+        std::vector <unsigned> remap(vertices.size(), unused);
+        std::vector <Vertex> reordered;
+        reordered.reserve(vertices.size());
+
+        for (unsigned &index : indices) {
+            if (remap[index] == unused) {
+                remap[index] = static_cast <unsigned>(reordered.size());
+                reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices = std::move(reordered);
+    }
+};
+
+#endif  // MESH_OPTIMIZER_HPP
@@ -0,0 +1,426 @@
+// Copyright 2018 Tihran Katolikian
+// class MeshSimplifier - builds the levels of detail of an indexed
+// triangle list with quadric error metrics (Garland, Heckbert -
+// "Surface Simplification Using Quadric Error Metrics", 1997).
+// Edges are collapsed into one of their two vertices (half-edge
+// collapse), so every level indexes the vertices of the full detail
+// mesh and all levels share one vertex buffer.
+// Vertices on a border of the index topology are locked, and so are
+// vertices sharing their position with another vertex. That covers UV
+// seams and normal creases (the welder keeps the two sides of them as
+// separate vertices) as well as the border of the mesh, which is where
+// its material ends, so none of them ever opens or moves. Collapses
+// that would flip a triangle or make the surface non-manifold are
+// rejected.
+
+#ifndef MESH_SIMPLIFIER_HPP
+#define MESH_SIMPLIFIER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+class MeshSimplifier
+{
+public:
+    // ------------------------
+    // a coarser copy of the index list and its error: the square root
+    // of the largest quadric error of the collapses so far, about the
+    // largest distance of the level from the full detail surface, in
+    // model units
+    struct Level
+    {
+        std::vector <unsigned> indices;
+        float error;
+    };
+
+    struct Stats
+    {
+        std::size_t triangles_before = 0;
+        std::size_t triangles_after = 0;
+        std::size_t vertices = 0;
+        std::size_t locked_vertices = 0;
+
+        Stats &operator+=(const Stats &other)
+        {
+            triangles_before += other.triangles_before;
+            triangles_after += other.triangles_after;
+            vertices += other.vertices;
+            locked_vertices += other.locked_vertices;
+            return *this;
+        }
+    };
+
+    // ------------------------
+    // a level is dropped unless it has at most this share of the
+    // triangles of the level before
+    static constexpr float min_reduction = 0.85f;
+
+    MeshSimplifier() = delete;
+
+    // ------------------------
+    // up to levels_num levels past the full detail one, each with
+    // ratio of the triangles of the one before. Fewer levels come
+    // back when the locked vertices keep the mesh from shrinking.
+    static Stats buildLevels(const std::vector <Vertex> &vertices,
+                             const std::vector <unsigned> &indices,
+                             const unsigned levels_num, const float ratio,
+                             std::vector <Level> &levels)
+    {
+        levels.clear();
+        Stats stats;
+        stats.triangles_before = indices.size() / 3;
+        stats.vertices = vertices.size();
+        if (levels_num == 0 || stats.triangles_before == 0)
+            return stats;
+
+        State state(vertices, indices);
+        stats.locked_vertices = static_cast <std::size_t>(
+                                std::count(state.locked.cbegin(), state.locked.cend(), 1));
+
+        std::size_t previous_triangles = stats.triangles_before;
+        for (unsigned level = 0; level < levels_num; ++level) {
+            const std::size_t target = static_cast <std::size_t>(previous_triangles * ratio);
+            state.collapseTo(target);
+            if (state.alive_triangles > previous_triangles * min_reduction)
+                break;
+            levels.push_back({state.aliveIndices(), static_cast <float>(std::sqrt(state.max_error))});
+            previous_triangles = state.alive_triangles;
+        }
+        stats.triangles_after = levels.empty() ? stats.triangles_before : previous_triangles;
+        return stats;
+    }
+
+private:
+    // ------------------------
+    // symmetric 4x4 matrix of a sum of squared plane distances, the
+    // upper triangle stored row by row
+    struct Quadric
+    {
+        double m[10] = {};
+
+        void addPlane(const glm::dvec3 &normal, const double distance)
+        {
+            const double plane[4] = {normal.x, normal.y, normal.z, distance};
+            int k = 0;
+            for (int row = 0; row < 4; ++row) {
+                for (int column = row; column < 4; ++column)
+                    m[k++] += plane[row] * plane[column];
+            }
+        }
+
+        Quadric &operator+=(const Quadric &other)
+        {
+            for (int i = 0; i < 10; ++i)
+                m[i] += other.m[i];
+            return *this;
+        }
+
+        double evaluate(const glm::vec3 &point) const
+        {
+            const double x = point.x;
+            const double y = point.y;
+            const double z = point.z;
+            return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+                   m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y +
+                   m[7] * z * z + 2.0 * m[8] * z + m[9];
+        }
+    };
+
+    // ------------------------
+    // collapse of from into to. The versions of both ends at push time
+    // tell stale entries apart.
+    struct Collapse
+    {
+        double cost;
+        unsigned from;
+        unsigned to;
+        unsigned from_version;
+        unsigned to_version;
+
+        bool operator>(const Collapse &other) const
+        {
+            return cost > other.cost;
+        }
+    };
+
+    // ------------------------
+    // the mesh being simplified. Triangles keep their slots, collapsed
+    // ones are marked dead, so a level lists the alive ones in their
+    // original order.
+    struct State
+    {
+        const std::vector <Vertex> &vertices;
+        std::vector <unsigned> triangles;
+        std::vector <char> alive;
+        std::vector <std::vector <unsigned>> vertex_triangles;
+        std::vector <Quadric> quadrics;
+        std::vector <char> locked;
+        std::vector <char> removed;
+        std::vector <unsigned> versions;
+        std::priority_queue <Collapse, std::vector <Collapse>, std::greater <Collapse>> heap;
+        std::size_t alive_triangles;
+        double max_error = 0.0;
+        // ------------------------
+        // scratch of canCollapse
+        std::vector <unsigned> from_neighbours;
+        std::vector <unsigned> to_neighbours;
+
+        State(const std::vector <Vertex> &init_vertices, const std::vector <unsigned> &indices)
+        :   vertices(init_vertices),
+            triangles(indices.cbegin(), indices.cend() - indices.size() % 3),
+            alive(triangles.size() / 3, 1),
+            vertex_triangles(init_vertices.size()),
+            quadrics(init_vertices.size()),
+            locked(init_vertices.size(), 0),
+            removed(init_vertices.size(), 0),
+            versions(init_vertices.size(), 0),
+            alive_triangles(triangles.size() / 3)
+        {
+            for (std::size_t t = 0; t < alive.size(); ++t) {
+                const glm::vec3 &a = position(triangles[t * 3]);
+                const glm::vec3 &b = position(triangles[t * 3 + 1]);
+                const glm::vec3 &c = position(triangles[t * 3 + 2]);
+                const glm::dvec3 normal = glm::cross(glm::dvec3(b - a), glm::dvec3(c - a));
+                const double length = glm::length(normal);
+                Quadric quadric;
+                if (length > 0.0) {
+                    const glm::dvec3 unit = normal / length;
+                    quadric.addPlane(unit, -glm::dot(unit, glm::dvec3(a)));
+                }
+                for (int corner = 0; corner < 3; ++corner) {
+                    const unsigned vertex = triangles[t * 3 + corner];
+                    quadrics[vertex] += quadric;
+                    vertex_triangles[vertex].push_back(static_cast <unsigned>(t));
+                }
+            }
+            lockBorders();
+            lockSharedPositions();
+            for (unsigned vertex = 0; vertex < vertices.size(); ++vertex)
+                pushCollapses(vertex);
+        }
+
+        const glm::vec3 &position(const unsigned vertex) const
+        {
+            return vertices[vertex].position;
+        }
+
+        // ------------------------
+        // edges used by one triangle are borders, edges used by more
+        // than two are not manifold. Both ends of them are locked.
+        void lockBorders()
+        {
+            std::unordered_map <std::uint64_t, unsigned> edge_uses;
+            edge_uses.reserve(triangles.size());
+            for (std::size_t i = 0; i < triangles.size(); i += 3) {
+                for (int edge = 0; edge < 3; ++edge)
+                    ++edge_uses[edgeKey(triangles[i + edge], triangles[i + (edge + 1) % 3])];
+            }
+            for (const auto &edge : edge_uses) {
+                if (edge.second != 2) {
+                    locked[static_cast <unsigned>(edge.first >> 32)] = 1;
+                    locked[static_cast <unsigned>(edge.first & 0xffffffffu)] = 1;
+                }
+            }
+        }
+
+        // ------------------------
+        // vertices with the same position and different attributes sit
+        // on a seam: moving one of them would tear it open
+        void lockSharedPositions()
+        {
+            std::vector <unsigned> order(vertices.size());
+            for (unsigned i = 0; i < order.size(); ++i)
+                order[i] = i;
+            auto less = [this](const unsigned a, const unsigned b)
+            {
+                const glm::vec3 &p = position(a);
+                const glm::vec3 &q = position(b);
+                if (p.x != q.x)
+                    return p.x < q.x;
+                if (p.y != q.y)
+                    return p.y < q.y;
+                return p.z < q.z;
+            };
+            std::sort(order.begin(), order.end(), less);
+            for (std::size_t i = 1; i < order.size(); ++i) {
+                if (position(order[i]) == position(order[i - 1]))
+                    locked[order[i]] = locked[order[i - 1]] = 1;
+            }
+        }
+
+        static std::uint64_t edgeKey(const unsigned a, const unsigned b)
+        {
+            return static_cast <std::uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+        }
+
+        void pushCollapse(const unsigned from, const unsigned to)
+        {
+            if (locked[from])
+                return;
+            Quadric quadric = quadrics[from];
+            quadric += quadrics[to];
+            heap.push({std::max(quadric.evaluate(position(to)), 0.0), from, to,
+                       versions[from], versions[to]});
+        }
+
+        // ------------------------
+        // both directions of every edge around the vertex
+        void pushCollapses(const unsigned vertex)
+        {
+            for (const unsigned t : vertex_triangles[vertex]) {
+                if (!alive[t])
+                    continue;
+                for (int corner = 0; corner < 3; ++corner) {
+                    const unsigned other = triangles[t * 3 + corner];
+                    if (other == vertex)
+                        continue;
+                    pushCollapse(vertex, other);
+                    pushCollapse(other, vertex);
+                }
+            }
+        }
+
+        void collapseTo(const std::size_t target_triangles)
+        {
+            while (alive_triangles > target_triangles && !heap.empty()) {
+                const Collapse collapse = heap.top();
+                heap.pop();
+                if (removed[collapse.from] || removed[collapse.to] ||
+                    versions[collapse.from] != collapse.from_version ||
+                    versions[collapse.to] != collapse.to_version ||
+                    !canCollapse(collapse.from, collapse.to))
+                    continue;
+                apply(collapse.from, collapse.to);
+                max_error = std::max(max_error, collapse.cost);
+            }
+        }
+
+        void collectNeighbours(const unsigned vertex, std::vector <unsigned> &neighbours) const
+        {
+            neighbours.clear();
+            for (const unsigned t : vertex_triangles[vertex]) {
+                if (!alive[t])
+                    continue;
+                for (int corner = 0; corner < 3; ++corner) {
+                    if (triangles[t * 3 + corner] != vertex)
+                        neighbours.push_back(triangles[t * 3 + corner]);
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        }
+
+        // ------------------------
+        // the edge has to exist and to pass the link condition (the
+        // common neighbours of its ends are the opposite corners of its
+        // triangles), and no triangle of from may turn over
+        bool canCollapse(const unsigned from, const unsigned to)
+        {
+            std::size_t shared_triangles = 0;
+            for (const unsigned t : vertex_triangles[from]) {
+                if (alive[t] && containsVertex(t, to))
+                    ++shared_triangles;
+            }
+            if (shared_triangles == 0)
+                return false;
+
+            collectNeighbours(from, from_neighbours);
+            collectNeighbours(to, to_neighbours);
+            std::size_t common = 0;
+            for (std::size_t i = 0, j = 0; i < from_neighbours.size() && j < to_neighbours.size();) {
+                if (from_neighbours[i] < to_neighbours[j]) {
+                    ++i;
+                }
+                else if (to_neighbours[j] < from_neighbours[i]) {
+                    ++j;
+                }
+                else {
+                    ++common;
+                    ++i;
+                    ++j;
+                }
+            }
+            if (common != shared_triangles)
+                return false;
+
+            // ------------------------
+            // the triangles kept have their corner moved to the
+            // position of to; they must keep facing about the same way
+            static constexpr float min_cosine = 0.2f;
+            for (const unsigned t : vertex_triangles[from]) {
+                if (!alive[t] || containsVertex(t, to))
+                    continue;
+                glm::vec3 corners[3];
+                glm::vec3 moved[3];
+                for (int corner = 0; corner < 3; ++corner) {
+                    const unsigned vertex = triangles[t * 3 + corner];
+                    corners[corner] = position(vertex);
+                    moved[corner] = vertex == from ? position(to) : corners[corner];
+                }
+                const glm::vec3 before = glm::cross(corners[1] - corners[0],
+                                                    corners[2] - corners[0]);
+                const glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                const float lengths = glm::length(before) * glm::length(after);
+                if (lengths <= 0.f || glm::dot(before, after) < min_cosine * lengths)
+                    return false;
+            }
+            return true;
+        }
+
+        bool containsVertex(const unsigned t, const unsigned vertex) const
+        {
+            return triangles[t * 3] == vertex || triangles[t * 3 + 1] == vertex ||
+                   triangles[t * 3 + 2] == vertex;
+        }
+
+        void apply(const unsigned from, const unsigned to)
+        {
+            for (const unsigned t : vertex_triangles[from]) {
+                if (!alive[t])
+                    continue;
+                if (containsVertex(t, to)) {
+                    alive[t] = 0;
+                    --alive_triangles;
+                    continue;
+                }
+                for (int corner = 0; corner < 3; ++corner) {
+                    if (triangles[t * 3 + corner] == from)
+                        triangles[t * 3 + corner] = to;
+                }
+                vertex_triangles[to].push_back(t);
+            }
+            vertex_triangles[from].clear();
+            std::vector <unsigned> &to_triangles = vertex_triangles[to];
+            to_triangles.erase(std::remove_if(to_triangles.begin(), to_triangles.end(),
+                                              [this](const unsigned t) { return !alive[t]; }),
+                               to_triangles.end());
+            quadrics[to] += quadrics[from];
+            removed[from] = 1;
+            ++versions[to];
+            pushCollapses(to);
+        }
+
+        std::vector <unsigned> aliveIndices() const
+        {
+            std::vector <unsigned> indices;
+            indices.reserve(alive_triangles * 3);
+            for (std::size_t t = 0; t < alive.size(); ++t) {
+                if (alive[t])
+                    indices.insert(indices.end(), triangles.cbegin() + t * 3,
+                                   triangles.cbegin() + t * 3 + 3);
+            }
+            return indices;
+        }
+    };
+};
+
+#endif  // MESH_SIMPLIFIER_HPP
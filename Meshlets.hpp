@@ -0,0 +1,178 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the cluster culling:
+// @ Meshlet - a run of at most max_triangles triangles of a mesh
+//   indexing at most max_vertices vertices, with the bounding sphere of
+//   its vertices and the cone of its triangle normals;
+// @ MeshletBuilder - splits the full detail index list of a mesh into
+//   meshlets. The triangles are taken in the order they are in, which
+//   after MeshOptimizer is a spatially coherent one, so the indices
+//   are not touched and every meshlet is a range of them;
+// @ ClusterCuller - the tests: a meshlet is culled if its sphere is
+//   outside the frustum, or if the viewer sees the back of every
+//   triangle of it (Wihlidal - "Optimizing the Graphics Pipeline with
+//   Compute", GDC 2016).
+
+#ifndef MESHLETS_HPP
+#define MESHLETS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "Mesh.hpp"
+
+struct Meshlet
+{
+    BoundingSphere sphere;
+    // ------------------------
+    // the normals of the triangles are within the cone around
+    // cone_axis; cone_cutoff is the sine of its half angle, 1 if the
+    // cone is too wide to ever cull
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+    // ------------------------
+    // range of the mesh's full detail indices
+    std::uint32_t first_index;
+    std::uint32_t indices_num;
+};
+
+class MeshletBuilder
+{
+public:
+    static constexpr std::size_t max_vertices = 64;
+    static constexpr std::size_t max_triangles = 124;
+
+    MeshletBuilder() = delete;
+
+    static void build(const std::vector <Vertex> &vertices,
+                      const std::vector <unsigned> &indices,
+                      std::vector <Meshlet> &meshlets)
+    {
+        meshlets.clear();
+        // ------------------------
+        // the meshlet each vertex was last counted in, +1
+        std::vector <std::uint32_t> last_meshlet(vertices.size(), 0);
+        std::vector <unsigned> meshlet_vertices;
+        meshlet_vertices.reserve(max_vertices);
+        std::size_t first_index = 0;
+        const std::size_t indices_num = indices.size() - indices.size() % 3;
+        for (std::size_t i = 0; i < indices_num; i += 3) {
+            const std::uint32_t meshlet = static_cast <std::uint32_t>(meshlets.size()) + 1;
+            std::size_t new_vertices = 0;
+            for (std::size_t corner = 0; corner < 3; ++corner) {
+                if (last_meshlet[indices[i + corner]] != meshlet)
+                    ++new_vertices;
+            }
+            if (meshlet_vertices.size() + new_vertices > max_vertices ||
+                (i - first_index) / 3 == max_triangles) {
+                meshlets.push_back(makeMeshlet(vertices, indices, first_index, i,
+                                               meshlet_vertices));
+                meshlet_vertices.clear();
+                first_index = i;
+            }
+            const std::uint32_t current = static_cast <std::uint32_t>(meshlets.size()) + 1;
+            for (std::size_t corner = 0; corner < 3; ++corner) {
+                const unsigned vertex = indices[i + corner];
+                if (last_meshlet[vertex] != current) {
+                    last_meshlet[vertex] = current;
+                    meshlet_vertices.push_back(vertex);
+                }
+            }
+        }
+        if (first_index < indices_num)
+            meshlets.push_back(makeMeshlet(vertices, indices, first_index, indices_num,
+                                           meshlet_vertices));
+    }
+
+private:
+    // ------------------------
+    // cones narrower than this are kept, wider ones are disabled: they
+    // would be culled only from a small range of directions
+    static constexpr float min_cone_cosine = 0.1f;
+
+    static Meshlet makeMeshlet(const std::vector <Vertex> &vertices,
+                               const std::vector <unsigned> &indices,
+                               const std::size_t first_index, const std::size_t last_index,
+                               const std::vector <unsigned> &meshlet_vertices)
+    {
+        Meshlet meshlet;
+        meshlet.first_index = static_cast <std::uint32_t>(first_index);
+        meshlet.indices_num = static_cast <std::uint32_t>(last_index - first_index);
+
+        // ------------------------
+        // the sphere around the center of the box of the vertices
+        glm::vec3 min(vertices[meshlet_vertices.front()].position);
+        glm::vec3 max(min);
+        for (const unsigned vertex : meshlet_vertices) {
+            min = glm::min(min, vertices[vertex].position);
+            max = glm::max(max, vertices[vertex].position);
+        }
+        meshlet.sphere.center = (min + max) * 0.5f;
+        float radius_squared = 0.f;
+        for (const unsigned vertex : meshlet_vertices) {
+            const glm::vec3 offset = vertices[vertex].position - meshlet.sphere.center;
+            radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+        }
+        meshlet.sphere.radius = std::sqrt(radius_squared);
+
+        // ------------------------
+        // the cone axis is the mean of the triangle normals, its angle
+        // the widest one between the axis and a normal
+        std::vector <glm::vec3> normals;
+        normals.reserve(meshlet.indices_num / 3);
+        glm::vec3 normal_sum(0.f);
+        for (std::size_t i = first_index; i < last_index; i += 3) {
+            const glm::vec3 &a = vertices[indices[i]].position;
+            const glm::vec3 &b = vertices[indices[i + 1]].position;
+            const glm::vec3 &c = vertices[indices[i + 2]].position;
+            const glm::vec3 normal = glm::cross(b - a, c - a);
+            const float length = glm::length(normal);
+            if (length == 0.f)
+                continue;
+            normals.push_back(normal / length);
+            normal_sum += normals.back();
+        }
+        const float sum_length = glm::length(normal_sum);
+        meshlet.cone_axis = sum_length > 0.f ? normal_sum / sum_length : glm::vec3(0.f, 0.f, 1.f);
+        float min_cosine = sum_length > 0.f ? 1.f : -1.f;
+        for (const glm::vec3 &normal : normals)
+            min_cosine = std::min(min_cosine, glm::dot(normal, meshlet.cone_axis));
+        meshlet.cone_cutoff = min_cosine < min_cone_cosine
+                              ? 1.f : std::sqrt(1.f - min_cosine * min_cosine);
+        return meshlet;
+    }
+};
+
+class ClusterCuller
+{
+public:
+    // ------------------------
+    // counters of the culled meshlets and of the triangles drawn
+    struct Stats
+    {
+        std::size_t meshlets;
+        std::size_t frustum_culled;
+        std::size_t cone_culled;
+        std::size_t triangles;
+        std::size_t drawn_triangles;
+    };
+
+    ClusterCuller() = delete;
+
+    // ------------------------
+    // true if viewer_pos, in the space of the meshlet, sees the back of
+    // every triangle of it from anywhere in its sphere
+    static bool isBackfacing(const Meshlet &meshlet, const glm::vec3 &viewer_pos)
+    {
+        const glm::vec3 to_center = meshlet.sphere.center - viewer_pos;
+        return glm::dot(to_center, meshlet.cone_axis) >=
+               meshlet.cone_cutoff * glm::length(to_center) + meshlet.sphere.radius;
+    }
+};
+
+#endif  // MESHLETS_HPP
@@ -1,11 +1,17 @@
 #ifndef MODEL_HPP
 #define MODEL_HPP
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <glad/glad.h> 
@@ -16,9 +22,85 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "Frustum.hpp"
+#include "FrustumCuller.hpp"
 #include "gl_image.hpp"
+#include "Hash.hpp"
+#include "LodSelector.hpp"
 #include "shader.hpp"
-#include "mesh.hpp"
+#include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "Meshlets.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "RenderQueue.hpp"
+#include "SceneGraph.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleBVH.hpp"
+#include "UniformBuffer.hpp"
+#include "VertexWelder.hpp"
+
+//----------------------
+// options of the post-import processing done by Model. They affect the
+// produced vertex data, so they are part of the mesh cache key.
+struct ModelLoadOptions
+{
+    //----------------------
+    // vertices whose attributes all snap to the same epsilon-sized grid
+    // cell are merged into one. 0 merges exact duplicates only,
+    // a negative value disables welding.
+    float weld_epsilon = 1e-5f;
+    //----------------------
+    // reorder triangles and vertices of every mesh for the
+    // post-transform cache, overdraw and vertex fetch
+    bool optimize_meshes = true;
+    //----------------------
+    // levels of detail built for every mesh past the full detail one,
+    // each with lod_ratio of the triangles of the level before. 0
+    // builds none.
+    unsigned lod_levels = 3;
+    float lod_ratio = 0.5f;
+    //----------------------
+    // upload meshes in the quantized CompactVertex layout. Only the GPU
+    // copy is affected, so this is not part of the cache key.
+    bool compact_vertices = false;
+    //----------------------
+    // vertex attribute locations stored on the GPU, see
+    // MeshUploadOptions::attribute_mask
+    unsigned attribute_mask = ~0u;
+    //----------------------
+    // specular exponent used for materials that do not specify one.
+    // Applied at draw time, so this is not part of the cache key.
+    float default_shininess = 8.f;
+    //----------------------
+    // suballocate all meshes from this arena, see
+    // MeshUploadOptions::arena. Must outlive the model. The arena holds
+    // the full float layout, so compact_vertices and attribute_mask
+    // have no effect on meshes in it.
+    GeometryArena <StandardVertexFormat> *arena = nullptr;
+    //----------------------
+    // split the full detail level of every mesh into meshlets for
+    // cluster culling, see Model::drawClusters(). Built at every load,
+    // so this is not part of the cache key.
+    bool build_meshlets = false;
+
+    std::uint64_t hash() const
+    {
+        std::uint64_t seed = Hash::combine(Hash::fnv_offset, weld_epsilon);
+        seed = Hash::combine(seed, optimize_meshes);
+        seed = Hash::combine(seed, lod_levels);
+        seed = Hash::combine(seed, lod_ratio);
+        return seed;
+    }
+};
+
+//----------------------
+// the nearest hit of a ray on a model, in the mesh it hit
+struct ModelHit
+{
+    RayHit hit;
+    std::uint32_t mesh;
+};
 
 class Model 
 {
@@ -26,17 +108,433 @@ public:
     //----------------------
     //constructor expects the filepath to
     // 3d model
-    Model(const std::string &path, const bool gamma = false)
-    :   gamma_correction(gamma)
+    Model(const std::string &path, const bool gamma = false,
+          const ModelLoadOptions &load_options = ModelLoadOptions())
+    :   gamma_correction(gamma),
+        options(load_options)
     {
         loadModel(path);
     }
-    ~Model() = default;
+    ~Model()
+    {
+        for (const Mesh &mesh : meshes) {
+            if (mesh.getArena())
+                mesh.getArena()->free(mesh.getArenaHandle());
+        }
+    }
+
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
 
-    void draw(Shader &shader) const
+    //----------------------
+    // draws every instance of the set with one call per mesh. Pending
+    // changes of the set are uploaded first.
+    void drawInstanced(Shader &shader, InstanceSet &instances, const unsigned lod = 0) const
     {
-        for (const Mesh &mesh : meshes)
-            mesh.draw(shader);
+        instances.upload();
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            material_buffer->bind(mesh_materials[i]);
+            meshes[i].drawInstanced(shader, instances, lod);
+        }
+    }
+
+    //----------------------
+    // submits every mesh to the queue instead of drawing it now. The
+    // distance of the model origin to the viewer is the depth of all
+    // its meshes. With a frustum, meshes outside of it are skipped;
+    // returns the number of meshes submitted.
+    std::size_t submit(RenderQueue &queue, Shader &shader, const glm::mat4 &transform,
+                       const glm::vec3 &viewer_pos,
+                       const RenderQueue::Pass pass = RenderQueue::OPAQUE_PASS,
+                       const Frustum *frustum = nullptr, const unsigned lod = 0) const
+    {
+        Frustum local_frustum;
+        if (frustum) {
+            if (!frustum->intersects(bounding_sphere.transformed(transform)))
+                return 0;
+            local_frustum = frustum->transformed(transform);
+        }
+
+        std::uint32_t transform_index = 0;
+        std::size_t submitted = 0;
+        const float distance = glm::length(glm::vec3(transform[3]) - viewer_pos);
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            if (frustum && !local_frustum.intersects(meshes[i].getBoundingBox()))
+                continue;
+            if (submitted++ == 0)
+                transform_index = queue.addTransform(transform);
+            queue.submit(pass, shader, meshes[i], transform_index, distance,
+                         material_buffer.get(), mesh_materials[i], lod);
+        }
+        return submitted;
+    }
+
+    //----------------------
+    // appends the nodes of the model under parent, see SceneGraph.hpp.
+    // Returns the node of the model root; the model's own nodes follow
+    // it in the order of getNodes().
+    SceneGraph::NodeId instantiate(SceneGraph &graph, const SceneGraph::NodeId parent) const
+    {
+        if (nodes.empty())
+            return graph.addNode(parent);
+        const SceneGraph::NodeId root = static_cast <SceneGraph::NodeId>(graph.getNodesNum());
+        for (const ModelNode &node : nodes)
+            graph.addNode(node.parent < 0 ? parent : root + node.parent, node.local);
+        return root;
+    }
+
+    //----------------------
+    // submit() of an instance added by instantiate(): every mesh is
+    // drawn with the world matrix of its own node, so the transforms
+    // of the model's nodes are applied. The graph must be updated.
+    std::size_t submit(RenderQueue &queue, Shader &shader, const SceneGraph &graph,
+                       const SceneGraph::NodeId root, const glm::vec3 &viewer_pos,
+                       const RenderQueue::Pass pass = RenderQueue::OPAQUE_PASS,
+                       const Frustum *frustum = nullptr, const unsigned lod = 0) const
+    {
+        const glm::mat4 &root_world = graph.getWorld(root);
+        if (frustum && !frustum->intersects(bounding_sphere.transformed(root_world)))
+            return 0;
+
+        Frustum local_frustum;
+        SceneGraph::NodeId current_node = SceneGraph::no_parent;
+        std::uint32_t transform_index = 0;
+        std::size_t submitted = 0;
+        const float distance = glm::length(glm::vec3(root_world[3]) - viewer_pos);
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            const SceneGraph::NodeId node = root + mesh_nodes[i];
+            const glm::mat4 &world = graph.getWorld(node);
+            if (node != current_node) {
+                if (frustum)
+                    local_frustum = frustum->transformed(world);
+                transform_index = no_transform;
+                current_node = node;
+            }
+            if (frustum && !local_frustum.intersects(meshes[i].getBoundingBox()))
+                continue;
+            if (transform_index == no_transform)
+                transform_index = queue.addTransform(world);
+            queue.submit(pass, shader, meshes[i], transform_index, distance,
+                         material_buffer.get(), mesh_materials[i], lod);
+            ++submitted;
+        }
+        return submitted;
+    }
+
+    //----------------------
+    // model space bounds of all meshes, with the transforms of the
+    // nodes below the model root applied
+    const BoundingSphere &getBoundingSphere() const
+    {
+        return bounding_sphere;
+    }
+
+    const BoundingBox &getBoundingBox() const
+    {
+        return bounding_box;
+    }
+
+    const std::vector <Mesh> &getMeshes() const
+    {
+        return meshes;
+    }
+
+    //----------------------
+    // the aiNode hierarchy, parents first, and the node of every
+    // mesh. The draw calls that take the model transform from the
+    // caller (draw(), drawInstanced(), drawClusters() and the
+    // indirect ones) draw every mesh in model space: they are right
+    // for models whose nodes below the root have no transforms, like
+    // OBJ files. Use instantiate() and the SceneGraph submit()
+    // otherwise.
+    const std::vector <ModelNode> &getNodes() const
+    {
+        return nodes;
+    }
+
+    std::uint32_t getMeshNode(const std::size_t mesh) const
+    {
+        return mesh_nodes[mesh];
+    }
+
+    //----------------------
+    // levels of detail of the model: level N draws level N of every
+    // mesh (or its coarsest one). The error of a level is the largest
+    // of its meshes, in model units.
+    std::size_t getLevelsNum() const
+    {
+        return lod_errors.size();
+    }
+
+    const std::vector <float> &getLodErrors() const
+    {
+        return lod_errors;
+    }
+
+    std::size_t getLevelTriangles(const unsigned lod) const
+    {
+        return lod_triangles[std::min <std::size_t>(lod, lod_triangles.size() - 1)];
+    }
+
+    //----------------------
+    // the level to draw the model with transform at, see LodSelector
+    unsigned selectLod(const LodSelector &selector, const glm::mat4 &transform,
+                       const unsigned current = 0) const
+    {
+        return selector.select(bounding_sphere, transform, lod_errors, current);
+    }
+
+    //----------------------
+    // true if any mesh has a specular map, selects the shader variant
+    bool hasSpecularMaps() const
+    {
+        for (const Mesh &mesh : meshes) {
+            for (const Texture &texture : mesh.getTextures()) {
+                if (texture.type == Texture::specularType)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    //----------------------
+    // binds the MaterialData range of every mesh before drawing it.
+    // Meshes of an arena are drawn with one multi-draw per batch of
+    // meshes that share textures and material. With a frustum, meshes
+    // whose box is outside of it (the frustum is taken to the model
+    // space of transform, the "model" uniform the caller set) are
+    // skipped.
+    void draw(Shader &shader, const Frustum *frustum = nullptr,
+              const glm::mat4 &transform = glm::mat4(1.f), const unsigned lod = 0) const
+    {
+        Frustum local_frustum;
+        if (frustum) {
+            if (!frustum->intersects(bounding_sphere.transformed(transform)))
+                return;
+            local_frustum = frustum->transformed(transform);
+        }
+
+        if (!batches.empty()) {
+            for (const Batch &batch : batches) {
+                draw_ranges.clear();
+                for (const std::size_t mesh : batch.meshes) {
+                    if (!frustum || local_frustum.intersects(meshes[mesh].getBoundingBox()))
+                        draw_ranges.push_back(meshes[mesh].getDrawRange(lod));
+                }
+                if (draw_ranges.empty())
+                    continue;
+                material_buffer->bind(batch.material);
+                meshes[batch.meshes.front()].prepare(shader);
+                options.arena->multiDraw(draw_ranges);
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            if (frustum && !local_frustum.intersects(meshes[i].getBoundingBox()))
+                continue;
+            material_buffer->bind(mesh_materials[i]);
+            meshes[i].draw(shader, lod);
+        }
+    }
+
+    //----------------------
+    // draws the meshlets of the full detail meshes that pass the
+    // frustum and backface cone tests, see Meshlets.hpp. Meshlets next
+    // to each other in the index buffer are merged into one range, and
+    // the ranges are drawn with one multi-draw per batch of an arena
+    // (per mesh without one). The tests run in model space: the planes
+    // come from view_projection * transform and the viewer is taken
+    // there. The caller sets the "model" uniform. Counts into stats if
+    // given. Needs ModelLoadOptions::build_meshlets, draws nothing
+    // without.
+    void drawClusters(Shader &shader, const glm::mat4 &view_projection,
+                      const glm::mat4 &transform, const glm::vec3 &viewer_pos,
+                      ClusterCuller::Stats *stats = nullptr) const
+    {
+        const Frustum local_frustum = Frustum::fromMatrix(view_projection * transform);
+        if (!local_frustum.intersects(bounding_sphere)) {
+            if (stats) {
+                stats->meshlets += meshlets_num;
+                stats->frustum_culled += meshlets_num;
+                stats->triangles += lod_triangles.front();
+            }
+            return;
+        }
+        const glm::vec3 local_viewer(glm::inverse(transform) * glm::vec4(viewer_pos, 1.f));
+
+        if (!batches.empty()) {
+            for (const Batch &batch : batches) {
+                draw_ranges.clear();
+                for (const std::size_t mesh : batch.meshes)
+                    appendClusters(mesh, local_frustum, local_viewer, stats);
+                if (draw_ranges.empty())
+                    continue;
+                material_buffer->bind(batch.material);
+                meshes[batch.meshes.front()].prepare(shader);
+                options.arena->multiDraw(draw_ranges);
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            draw_ranges.clear();
+            appendClusters(i, local_frustum, local_viewer, stats);
+            if (draw_ranges.empty())
+                continue;
+            material_buffer->bind(mesh_materials[i]);
+            meshes[i].drawRanges(shader, draw_ranges);
+        }
+    }
+
+    //----------------------
+    // the meshlets of all arena meshes in batch order, and one command
+    // per meshlet drawing it once. See GPUClusterCuller.hpp.
+    void getClusters(std::vector <Meshlet> &clusters,
+                     std::vector <GLExt::DrawElementsIndirectCommand> &commands) const
+    {
+        clusters.clear();
+        commands.clear();
+        for (const Batch &batch : batches) {
+            for (const std::size_t mesh : batch.meshes) {
+                const GeometryArena <StandardVertexFormat>::Allocation &allocation =
+                    options.arena->getAllocation(meshes[mesh].getArenaHandle());
+                for (const Meshlet &meshlet : meshlets[mesh]) {
+                    clusters.push_back(meshlet);
+                    commands.push_back({meshlet.indices_num, 1,
+                                        static_cast <GLuint>(allocation.first_index +
+                                                             meshlet.first_index),
+                                        static_cast <GLint>(allocation.first_vertex), 0});
+                }
+            }
+        }
+    }
+
+    //----------------------
+    // draws the commands of getClusters() from the bound
+    // GL_DRAW_INDIRECT_BUFFER, starting at first_command, one
+    // multi-draw per batch
+    void drawClustersIndirect(Shader &shader, const std::size_t first_command) const
+    {
+        std::size_t command = first_command;
+        for (const Batch &batch : batches) {
+            std::size_t batch_meshlets = 0;
+            for (const std::size_t mesh : batch.meshes)
+                batch_meshlets += meshlets[mesh].size();
+            material_buffer->bind(batch.material);
+            meshes[batch.meshes.front()].prepare(shader);
+            GLState::bindVertexArray(options.arena->getVertexArray());
+            GLExt::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                             reinterpret_cast <const void *>(
+                                             command *
+                                             sizeof(GLExt::DrawElementsIndirectCommand)),
+                                             static_cast <GLsizei>(batch_meshlets), 0);
+            command += batch_meshlets;
+        }
+    }
+
+    std::size_t getMeshletsNum() const
+    {
+        return meshlets_num;
+    }
+
+    //----------------------
+    // the nearest triangle of the full detail meshes the ray hits
+    // closer than max_distance, in model space. The distance is in
+    // units of the length of direction, so a ray taken to model space
+    // by the inverse model matrix keeps its world distances. The
+    // triangle BVHs are built by the first call, so models that are
+    // never picked do not pay for them at load.
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, ModelHit &hit,
+                   const float max_distance = FLT_MAX) const
+    {
+        std::call_once(bvhs_built, [this]() { buildBVHs(); });
+        hit.hit = {max_distance, TriangleBVH::no_triangle, 0.f, 0.f};
+        hit.mesh = 0;
+        bool found = false;
+        for (std::size_t i = 0; i < bvhs.size(); ++i) {
+            RayHit mesh_hit;
+            if (bvhs[i].intersect(origin, direction, mesh_hit, hit.hit.distance)) {
+                hit.hit = mesh_hit;
+                hit.mesh = static_cast <std::uint32_t>(i);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    const TriangleBVH &getBVH(const std::size_t mesh) const
+    {
+        std::call_once(bvhs_built, [this]() { buildBVHs(); });
+        return bvhs[mesh];
+    }
+
+    //----------------------
+    // one command per arena mesh at full detail, in batch order, with
+    // no instances.
+    // The instance counts are filled in on the GPU, see GPUCuller.hpp.
+    std::vector <GLExt::DrawElementsIndirectCommand> getIndirectCommands() const
+    {
+        std::vector <GLExt::DrawElementsIndirectCommand> commands;
+        for (const Batch &batch : batches) {
+            for (const std::size_t mesh : batch.meshes) {
+                const GeometryArena <StandardVertexFormat>::Allocation &allocation =
+                    options.arena->getAllocation(meshes[mesh].getArenaHandle());
+                commands.push_back({meshes[mesh].getLevel(0).indices_num, 0,
+                                    static_cast <GLuint>(allocation.first_index),
+                                    static_cast <GLint>(allocation.first_vertex), 0});
+            }
+        }
+        return commands;
+    }
+
+    //----------------------
+    // model space bounding spheres of the meshes, center xyz and
+    // radius w, in the order of getIndirectCommands()
+    std::vector <glm::vec4> getIndirectBounds() const
+    {
+        std::vector <glm::vec4> bounds;
+        for (const Batch &batch : batches) {
+            for (const std::size_t mesh : batch.meshes) {
+                const BoundingSphere &sphere = meshes[mesh].getBoundingSphere();
+                bounds.push_back(glm::vec4(sphere.center, sphere.radius));
+            }
+        }
+        return bounds;
+    }
+
+    //----------------------
+    // draws the commands of getIndirectCommands() from the bound
+    // GL_DRAW_INDIRECT_BUFFER, one multi-draw per batch. Expects the
+    // arena's VAO to be bound with its instance attributes set up.
+    void drawIndirect(Shader &shader) const
+    {
+        std::size_t first_command = 0;
+        for (const Batch &batch : batches) {
+            material_buffer->bind(batch.material);
+            meshes[batch.meshes.front()].prepare(shader);
+            GLExt::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                             reinterpret_cast <const void *>(
+                                             first_command *
+                                             sizeof(GLExt::DrawElementsIndirectCommand)),
+                                             static_cast <GLsizei>(batch.meshes.size()), 0);
+            first_command += batch.meshes.size();
+        }
+    }
+
+    GeometryArena <StandardVertexFormat> *getArena() const
+    {
+        return options.arena;
+    }
+
+    const ModelLoadOptions &getLoadOptions() const
+    {
+        return options;
+    }
+
+    //----------------------
+    // draw calls draw() issues, one per mesh without an arena
+    std::size_t getDrawCallsNum() const
+    {
+        return batches.empty() ? meshes.size() : batches.size();
     }
 private:
     //----------------------
@@ -44,21 +542,105 @@ private:
     // to make sure textures aren't loaded more than once.
     std::vector <Texture> textures_loaded;
     std::vector <Mesh> meshes;
+    std::vector <ModelNode> nodes;
+    std::vector <std::uint32_t> mesh_nodes;
     std::string directory;
     bool gamma_correction;
+    ModelLoadOptions options;
+    //----------------------
+    // MaterialData block of every distinct material, one aligned
+    // element each, and the element every mesh uses
+    std::unique_ptr <UniformBuffer <MaterialBlock>> material_buffer;
+    std::vector <std::uint32_t> mesh_materials;
+    //----------------------
+    // arena meshes with the same textures and material, drawn by a
+    // single multi-draw. The first mesh sets up the state for all of
+    // them.
+    struct Batch
+    {
+        std::vector <std::size_t> meshes;
+        std::uint32_t material;
+    };
+    std::vector <Batch> batches;
+    mutable std::vector <GeometryArena <StandardVertexFormat>::DrawRange> draw_ranges;
+    std::vector <float> lod_errors;
+    std::vector <std::size_t> lod_triangles;
+    //----------------------
+    // meshlets of the full detail level of every mesh and their
+    // spheres for FrustumCuller
+    std::vector <std::vector <Meshlet>> meshlets;
+    std::vector <SphereBoundsSoA> meshlet_bounds;
+    std::size_t meshlets_num = 0;
+    mutable std::vector <std::uint32_t> visible_meshlets;
+    //----------------------
+    // triangle BVH of the full detail level of every mesh, built on
+    // the first ray query
+    mutable std::vector <TriangleBVH> bvhs;
+    mutable std::once_flag bvhs_built;
+    BoundingSphere bounding_sphere;
+    BoundingBox bounding_box;
+    //----------------------
+    // accumulated over all meshes during a cold import
+    VertexWelder::Stats weld_stats;
+    MeshOptimizer::Stats optimizer_stats;
+    MeshSimplifier::Stats simplifier_stats;
+
+    static constexpr std::uint32_t no_transform = 0xffffffffu;
+
+    //----------------------
+    // Assimp post-processing steps. They are part of the mesh cache
+    // key, because they change the produced vertex data.
+    static constexpr unsigned import_flags = aiProcess_Triangulate |
+                                             aiProcess_FlipUVs |
+                                             aiProcess_CalcTangentSpace |
+                                             aiProcess_GenSmoothNormals;
     //----------------------
     // loads a model with supported ASSIMP extensions from file
     // and stores the resulting meshes in the meshes vector.
     void loadModel(const std::string &path)
     {
+        const auto start = std::chrono::steady_clock::now();
+        //----------------------
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        //----------------------
+        // warm start: the binary cache holds the final vertex and
+        // index arrays, so Assimp is not needed at all
+        MeshCache cache(path, import_flags, options.hash());
+        if (cache.load()) {
+            nodes = cache.getNodes();
+            for (const MeshCache::MeshView &view : cache.getMeshes()) {
+                std::vector <Texture> textures;
+                for (const MeshCache::TextureRef &ref : view.textures)
+                    textures.push_back(loadTexture(ref.path, ref.type));
+                MeshLods lods;
+                lods.indices.assign(view.lod_indices, view.lod_indices + view.lod_indices_num);
+                lods.levels.assign(view.lods, view.lods + view.lods_num);
+                meshes.emplace_back(view.vertices, view.vertices_num,
+                                    view.indices, view.indices_num,
+                                    std::move(textures), uploadOptions(), std::move(lods));
+                meshes.back().setShininess(view.shininess);
+                mesh_nodes.push_back(view.node);
+            }
+            std::cout << "Model: " << path << " loaded from "
+                      << cache.getCachePath() << " in "
+                      << millisecondsSince(start) << " ms (cold import: "
+                      << cache.getColdLoadTime() << " ms)\n";
+            weld_stats = cache.getWeldStats();
+            reportWeld();
+            setupMaterials();
+            computeBounds();
+            setupLods();
+            setupMeshlets();
+            reportVertexBuffers();
+            return;
+        }
+
         //----------------------
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path,
-                                                 aiProcess_Triangulate |
-                                                 aiProcess_FlipUVs |
-                                                 aiProcess_CalcTangentSpace |
-                                                 aiProcess_GenSmoothNormals);
+        const aiScene* scene = importer.ReadFile(path, import_flags);
         //----------------------
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
@@ -67,21 +649,291 @@ private:
                       << '\n';
             return;
         }
-        //----------------------
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         //----------------------
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, scene, -1);
+
+        //----------------------
+        // bake the cache for the next start
+        const double cold_ms = millisecondsSince(start);
+        if (!cache.store(nodes, meshes, mesh_nodes, cold_ms, weld_stats))
+            std::cout << "WARNING::MESH_CACHE:: failed to store "
+                      << cache.getCachePath() << '\n';
+        std::cout << "Model: " << path << " imported via Assimp in "
+                  << cold_ms << " ms (cold import, no valid cache)\n";
+        reportWeld();
+        if (options.optimize_meshes) {
+            std::cout << "Model: vertex cache (FIFO " << MeshOptimizer::cache_size
+                      << ") ACMR " << optimizer_stats.before.acmr() << " -> "
+                      << optimizer_stats.after.acmr() << ", ATVR "
+                      << optimizer_stats.before.atvr() << " -> "
+                      << optimizer_stats.after.atvr() << '\n';
+        }
+        if (options.lod_levels > 0) {
+            std::cout << "Model: levels of detail " << simplifier_stats.triangles_before
+                      << " -> " << simplifier_stats.triangles_after
+                      << " triangles at the coarsest level, "
+                      << simplifier_stats.locked_vertices << " of "
+                      << simplifier_stats.vertices << " vertices locked on seams and borders\n";
+        }
+        setupMaterials();
+        computeBounds();
+        setupLods();
+        setupMeshlets();
+        reportVertexBuffers();
+    }
+
+    //----------------------
+    // the weld counts of the cold import, also when they come from the
+    // cache, so runs can be compared either way
+    void reportWeld() const
+    {
+        if (options.weld_epsilon >= 0.f) {
+            std::cout << "Model: welded " << weld_stats.vertices_before
+                      << " -> " << weld_stats.vertices_after
+                      << " vertices, VBO bytes saved: "
+                      << weld_stats.savedBytes() << '\n';
+        }
+    }
+
+    //----------------------
+    // logs GPU vertex memory against what the full float layout
+    // would take
+    void reportVertexBuffers() const
+    {
+        std::size_t uploaded = 0;
+        std::size_t full = 0;
+        for (const Mesh &mesh : meshes) {
+            uploaded += mesh.getVertexBufferSize();
+            full += mesh.getVertices().size() * sizeof(Vertex);
+        }
+        std::cout << "Model: " << uploaded << " bytes of vertex data on the GPU (full layout: "
+                  << full << " bytes, attribute mask 0x" << std::hex
+                  << options.attribute_mask << std::dec << ")\n";
+    }
+
+    //----------------------
+    // uploads the distinct materials of all meshes with a single
+    // update, then groups arena meshes into batches
+    void setupMaterials()
+    {
+        std::vector <MaterialBlock> materials;
+        mesh_materials.clear();
+        for (const Mesh &mesh : meshes) {
+            MaterialBlock material = {};
+            material.shininess = mesh.getShininess() > 0.f ? mesh.getShininess()
+                                                           : options.default_shininess;
+            std::size_t element = 0;
+            while (element < materials.size() && materials[element].shininess != material.shininess)
+                ++element;
+            if (element == materials.size())
+                materials.push_back(material);
+            mesh_materials.push_back(static_cast <std::uint32_t>(element));
+        }
+        material_buffer.reset(new UniformBuffer <MaterialBlock>(UniformBlocks::material_binding,
+                                                                std::max <std::size_t>(
+                                                                materials.size(), 1)));
+        material_buffer->update(materials);
+        setupBatches();
+    }
+
+    //----------------------
+    // sphere around the mesh boxes, centered on the model box. Meshes
+    // are taken to model space by the nodes between them and the root.
+    void computeBounds()
+    {
+        if (meshes.empty())
+            return;
+        std::vector <glm::mat4> node_matrices(nodes.size());
+        for (std::size_t i = 1; i < nodes.size(); ++i)
+            node_matrices[i] = node_matrices[nodes[i].parent] * nodes[i].local.matrix();
+
+        bounding_box = meshes.front().getBoundingBox().transformed(node_matrices[mesh_nodes[0]]);
+        for (std::size_t i = 0; i < meshes.size(); ++i)
+            bounding_box.extend(meshes[i].getBoundingBox().transformed(
+                                node_matrices[mesh_nodes[i]]));
+        bounding_sphere.center = bounding_box.center();
+        bounding_sphere.radius = 0.f;
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            const BoundingSphere sphere =
+                meshes[i].getBoundingSphere().transformed(node_matrices[mesh_nodes[i]]);
+            bounding_sphere.radius = std::max(bounding_sphere.radius,
+                                              glm::length(sphere.center - bounding_sphere.center) +
+                                              sphere.radius);
+        }
+    }
+
+    //----------------------
+    // the error and the triangles of every model level
+    void setupLods()
+    {
+        std::size_t levels_num = 1;
+        for (const Mesh &mesh : meshes)
+            levels_num = std::max(levels_num, mesh.getLevelsNum());
+        lod_errors.assign(levels_num, 0.f);
+        lod_triangles.assign(levels_num, 0);
+        for (unsigned lod = 0; lod < levels_num; ++lod) {
+            for (const Mesh &mesh : meshes) {
+                lod_errors[lod] = std::max(lod_errors[lod], mesh.getLevel(lod).error);
+                lod_triangles[lod] += mesh.getLevel(lod).indices_num / 3;
+            }
+        }
+        std::cout << "Model: " << levels_num << " levels of detail, triangles:";
+        for (const std::size_t triangles : lod_triangles)
+            std::cout << ' ' << triangles;
+        std::cout << '\n';
+    }
+
+    void setupMeshlets()
+    {
+        meshlets.assign(meshes.size(), std::vector <Meshlet>());
+        meshlet_bounds.assign(meshes.size(), SphereBoundsSoA());
+        meshlets_num = 0;
+        if (!options.build_meshlets)
+            return;
+        std::size_t with_cone = 0;
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            MeshletBuilder::build(meshes[i].getVertices(), meshes[i].getIndices(), meshlets[i]);
+            meshlet_bounds[i].resize(meshlets[i].size());
+            for (std::size_t m = 0; m < meshlets[i].size(); ++m) {
+                meshlet_bounds[i].set(m, meshlets[i][m].sphere);
+                if (meshlets[i][m].cone_cutoff < 1.f)
+                    ++with_cone;
+            }
+            meshlets_num += meshlets[i].size();
+        }
+        std::cout << "Model: " << meshlets_num << " meshlets (up to "
+                  << MeshletBuilder::max_vertices << " vertices and "
+                  << MeshletBuilder::max_triangles << " triangles), " << with_cone
+                  << " with a backface cone\n";
+    }
+
+    void buildBVHs() const
+    {
+        const auto start = std::chrono::steady_clock::now();
+        bvhs.resize(meshes.size());
+        std::size_t nodes_num = 0;
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            bvhs[i].build(meshes[i].getVertices(), meshes[i].getIndices(), &ThreadPool::shared());
+            nodes_num += bvhs[i].getNodesNum();
+        }
+        std::cout << "Model: triangle BVHs built in " << millisecondsSince(start) << " ms ("
+                  << nodes_num << " nodes, " << ThreadPool::shared().getThreadsNum()
+                  << " threads)\n";
+    }
+
+    //----------------------
+    // culls the meshlets of a mesh and appends the ranges of the
+    // visible ones to draw_ranges
+    void appendClusters(const std::size_t mesh, const Frustum &local_frustum,
+                        const glm::vec3 &local_viewer, ClusterCuller::Stats *stats) const
+    {
+        const std::vector <Meshlet> &mesh_meshlets = meshlets[mesh];
+        if (stats) {
+            stats->meshlets += mesh_meshlets.size();
+            stats->triangles += meshes[mesh].getLevel(0).indices_num / 3;
+        }
+        if (!local_frustum.intersects(meshes[mesh].getBoundingBox())) {
+            if (stats)
+                stats->frustum_culled += mesh_meshlets.size();
+            return;
+        }
+        FrustumCuller::cull(local_frustum, meshlet_bounds[mesh], visible_meshlets);
+        if (stats)
+            stats->frustum_culled += mesh_meshlets.size() - visible_meshlets.size();
+
+        const GeometryArena <StandardVertexFormat>::Handle handle = meshes[mesh].getArenaHandle();
+        const std::size_t first_range = draw_ranges.size();
+        for (const std::uint32_t m : visible_meshlets) {
+            const Meshlet &meshlet = mesh_meshlets[m];
+            if (ClusterCuller::isBackfacing(meshlet, local_viewer)) {
+                if (stats)
+                    ++stats->cone_culled;
+                continue;
+            }
+            if (stats)
+                stats->drawn_triangles += meshlet.indices_num / 3;
+            if (draw_ranges.size() > first_range &&
+                draw_ranges.back().first_index + draw_ranges.back().indices_num ==
+                meshlet.first_index) {
+                draw_ranges.back().indices_num += meshlet.indices_num;
+                continue;
+            }
+            draw_ranges.push_back({handle, meshlet.first_index, meshlet.indices_num});
+        }
+    }
+
+    void setupBatches()
+    {
+        batches.clear();
+        if (!options.arena)
+            return;
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            auto batch = batches.begin();
+            for (; batch != batches.end(); ++batch) {
+                if (batch->material == mesh_materials[i] &&
+                    sameTextures(meshes[batch->meshes.front()], meshes[i]))
+                    break;
+            }
+            if (batch == batches.end())
+                batch = batches.insert(batches.end(), Batch{{}, mesh_materials[i]});
+            batch->meshes.push_back(i);
+        }
+        std::cout << "Model: " << meshes.size() << " meshes in " << batches.size()
+                  << " multi-draw batches ("
+                  << (GLExt::has_multi_draw_indirect ? "glMultiDrawElementsIndirect"
+                                                     : "glMultiDrawElementsBaseVertex")
+                  << ")\n";
+    }
+
+    static bool sameTextures(const Mesh &a, const Mesh &b)
+    {
+        const std::vector <Texture> &a_textures = a.getTextures();
+        const std::vector <Texture> &b_textures = b.getTextures();
+        if (a_textures.size() != b_textures.size())
+            return false;
+        for (std::size_t i = 0; i < a_textures.size(); ++i) {
+            if (a_textures[i].id != b_textures[i].id || a_textures[i].type != b_textures[i].type)
+                return false;
+        }
+        return true;
+    }
+
+    MeshUploadOptions uploadOptions() const
+    {
+        MeshUploadOptions upload;
+        upload.compact = options.compact_vertices;
+        upload.attribute_mask = options.attribute_mask;
+        upload.arena = options.arena;
+        return upload;
+    }
+
+    static double millisecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration <double, std::milli>(
+               std::chrono::steady_clock::now() - start).count();
     }
 
     //----------------------
     // processes a node in a recursive fashion. Processes each
     // individual mesh located at the node and repeats this
-    // process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // process on its children nodes (if any). The node is kept with
+    // its transform split into translation, rotation and scale
+    // (a shear, if any, is lost).
+    void processNode(aiNode *node, const aiScene *scene, const std::int32_t parent)
     {
+        const std::int32_t index = static_cast <std::int32_t>(nodes.size());
+        aiVector3D scaling, position;
+        aiQuaternion rotation;
+        node->mTransformation.Decompose(scaling, rotation, position);
+        ModelNode model_node;
+        model_node.parent = parent;
+        model_node.local.translation = glm::vec3(position.x, position.y, position.z);
+        model_node.local.rotation = glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+        model_node.local.scale = glm::vec3(scaling.x, scaling.y, scaling.z);
+        nodes.push_back(model_node);
+
         //----------------------
         // process each mesh located at the current node
         for(unsigned i = 0; i < node->mNumMeshes; ++i) {
@@ -92,11 +944,12 @@ private:
             //to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
             meshes.push_back(processMesh(mesh, scene));
+            mesh_nodes.push_back(static_cast <std::uint32_t>(index));
         }
         // after we've processed all of the meshes (if any) we then
         // recursively process each of the children nodes
         for(unsigned i = 0; i < node->mNumChildren; ++i) {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, index);
         }
     }
 
@@ -150,6 +1003,34 @@ private:
                 indices.push_back(face.mIndices[j]);
         }
         
+        //----------------------
+        // merge the duplicated vertices Assimp produces for every face
+        if (options.weld_epsilon >= 0.f)
+            weld_stats += VertexWelder::weld(vertices, indices, options.weld_epsilon);
+        //----------------------
+        // reorder for the post-transform cache, overdraw and vertex fetch
+        if (options.optimize_meshes)
+            optimizer_stats += MeshOptimizer::optimize(vertices, indices);
+        //----------------------
+        // coarser levels, their indices appended after the full
+        // detail ones
+        MeshLods lods;
+        if (options.lod_levels > 0) {
+            std::vector <MeshSimplifier::Level> levels;
+            simplifier_stats += MeshSimplifier::buildLevels(vertices, indices, options.lod_levels,
+                                                            options.lod_ratio, levels);
+            for (MeshSimplifier::Level &level : levels) {
+                if (options.optimize_meshes)
+                    MeshOptimizer::optimizeTriangles(vertices, level.indices);
+                lods.levels.push_back({static_cast <std::uint32_t>(indices.size() +
+                                                                   lods.indices.size()),
+                                       static_cast <std::uint32_t>(level.indices.size()),
+                                       level.error});
+                lods.indices.insert(lods.indices.end(), level.indices.cbegin(),
+                                    level.indices.cend());
+            }
+        }
+
         //----------------------
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -184,9 +1065,15 @@ private:
                                                                  "texture_height");
         textures.insert(textures.end(), height_maps.cbegin(), height_maps.cend());
         
+        float shininess = 0.f;
+        material->Get(AI_MATKEY_SHININESS, shininess);
+
         //----------------------
         // return a mesh object created from the extracted mesh data
-        return Mesh(std::move(vertices), std::move(indices), std::move(textures));
+        Mesh result(std::move(vertices), std::move(indices), std::move(textures),
+                    uploadOptions(), std::move(lods));
+        result.setShininess(shininess);
+        return result;
     }
 
     // -----------------------
@@ -199,33 +1086,37 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // -----------------------
-            // check if texture was loaded before and if so, continue to next iteration:
-            // skip loading a new texture
-            bool skip = false;
-            for(auto &texture : textures_loaded) {
-                if(std::strcmp(texture.path.data(), str.C_Str()) == 0) {
-                    textures.push_back(texture);
-                    // -----------------------
-                    // a texture with the same filepath has already been loaded,
-                    // continue to next one. (optimization)
-                    skip = true;
-                    break;
-                }
-            }
-            if(!skip) {
-                // -----------------------
-                // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = GLTextureGenerator::generateTexture2D(directory + '/' + str.C_Str());
-                texture.setTypeByName(type_name);
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);
-            }
+            Texture texture;
+            texture.setTypeByName(type_name);
+            textures.push_back(loadTexture(str.C_Str(), texture.type));
         }
         return textures;
     }
+
+    // -----------------------
+    // loads a single texture unless a texture with the same path has
+    // already been loaded.
+    Texture loadTexture(const std::string &path, const Texture::TexType type)
+    {
+        // -----------------------
+        // check if texture was loaded before and if so, reuse it
+        // (optimization)
+        for (const Texture &texture : textures_loaded) {
+            if (texture.path == path)
+                return texture;
+        }
+        // -----------------------
+        // if texture hasn't been loaded already, load it
+        Texture texture;
+        texture.id = GLTextureGenerator::generateTexture2D(directory + '/' + path);
+        // -----------------------
+        // the generator binds the new texture to the active unit
+        GLState::invalidate();
+        texture.type = type;
+        texture.path = path;
+        textures_loaded.push_back(texture);
+        return texture;
+    }
 };
 
 #endif  // MODEL_HPP
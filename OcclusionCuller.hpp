@@ -0,0 +1,437 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the software occlusion culling:
+// @ OccluderProxy - a coarse copy of a model used as occluder: the
+//   largest triangles of its meshes, up to a budget;
+// @ OcclusionCuller - rasterizes occluders into a low resolution depth
+//   buffer on the CPU and tests screen-space bounds of candidates
+//   against it. The screen is split into bands of rows rasterized in
+//   parallel on a ThreadPool; rows are filled 4 pixels at a time with
+//   SSE. The rasterization is conservative: the edges are moved
+//   inward by half a pixel's extent along their normals, so only
+//   pixels the triangle covers entirely are written, and the depth
+//   written is the farthest depth of the triangle over the pixel, so
+//   occluders never hide more than they do, nor come closer than they
+//   are. The price is cracks along edges shared by triangles, which
+//   only cost some culling. Each 8x8 tile keeps its farthest depth, so
+//   most tests do not look at single pixels.
+// Depth is window depth (0 near, 1 far).
+
+#ifndef OCCLUSION_CULLER_HPP
+#define OCCLUSION_CULLER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define OCCLUSION_CULLER_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+class OccluderProxy
+{
+public:
+    OccluderProxy() = default;
+
+    // ------------------------
+    // keeps the max_triangles largest triangles of the meshes, which
+    // are the ones that hide the most
+    OccluderProxy(const std::vector <Mesh> &meshes, const std::size_t max_triangles)
+    {
+        struct Triangle
+        {
+            float area;
+            glm::vec3 corners[3];
+        };
+        std::vector <Triangle> triangles;
+        for (const Mesh &mesh : meshes) {
+            const std::vector <Vertex> &vertices = mesh.getVertices();
+            const std::vector <unsigned> &indices = mesh.getIndices();
+            for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+                const glm::vec3 &a = vertices[indices[i]].position;
+                const glm::vec3 &b = vertices[indices[i + 1]].position;
+                const glm::vec3 &c = vertices[indices[i + 2]].position;
+                triangles.push_back({glm::length(glm::cross(b - a, c - a)), {a, b, c}});
+            }
+        }
+        const std::size_t kept = std::min(max_triangles, triangles.size());
+        std::partial_sort(triangles.begin(), triangles.begin() + kept, triangles.end(),
+                          [](const Triangle &a, const Triangle &b) { return a.area > b.area; });
+        positions.reserve(kept * 3);
+        for (std::size_t i = 0; i < kept; ++i)
+            positions.insert(positions.end(), triangles[i].corners, triangles[i].corners + 3);
+    }
+
+    // ------------------------
+    // three corners per triangle, not indexed
+    const std::vector <glm::vec3> &getPositions() const
+    {
+        return positions;
+    }
+
+    std::size_t getTrianglesNum() const
+    {
+        return positions.size() / 3;
+    }
+
+private:
+    std::vector <glm::vec3> positions;
+};
+
+class OcclusionCuller
+{
+public:
+    static constexpr int tile_size = 8;
+    static constexpr int band_height = 16;
+
+    // ------------------------
+    // counters of the current frame, reset by beginFrame()
+    struct Stats
+    {
+        std::size_t occluder_triangles;
+        std::size_t rasterized_triangles;
+        std::size_t tested;
+        std::size_t culled;
+        double raster_ms;
+        double test_ms;
+    };
+
+    // ------------------------
+    // the size is rounded up to whole tiles
+    OcclusionCuller(const int init_width = 256, const int init_height = 144)
+    :   width((init_width + tile_size - 1) / tile_size * tile_size),
+        height((init_height + tile_size - 1) / tile_size * tile_size),
+        tiles_x(width / tile_size),
+        tiles_y(height / tile_size),
+        depth(static_cast <std::size_t>(width) * height, 1.f),
+        tile_depth(static_cast <std::size_t>(tiles_x) * tiles_y, 1.f)
+    {
+        beginFrame();
+    }
+
+    // ------------------------
+    // clears the depth buffer and the queued occluders
+    void beginFrame()
+    {
+        std::fill(depth.begin(), depth.end(), 1.f);
+        std::fill(tile_depth.begin(), tile_depth.end(), 1.f);
+        triangles.clear();
+        stats = Stats();
+    }
+
+    // ------------------------
+    // transforms the proxy with its model-view-projection matrix and
+    // queues its triangles. Triangles crossing the near plane are
+    // dropped, leaving holes is always safe.
+    void addOccluder(const OccluderProxy &proxy, const glm::mat4 &mvp)
+    {
+        const std::vector <glm::vec3> &positions = proxy.getPositions();
+        stats.occluder_triangles += proxy.getTrianglesNum();
+        for (std::size_t i = 0; i + 2 < positions.size(); i += 3) {
+            ScreenTriangle triangle;
+            bool in_front = true;
+            for (int corner = 0; corner < 3 && in_front; ++corner) {
+                const glm::vec4 clip = mvp * glm::vec4(positions[i + corner], 1.f);
+                in_front = clip.w > near_w;
+                if (in_front)
+                    triangle.corners[corner] = toScreen(clip);
+            }
+            if (in_front && setupTriangle(triangle))
+                triangles.push_back(triangle);
+        }
+    }
+
+    // ------------------------
+    // rasterizes the queued occluders, bands of rows in parallel
+    void rasterize(ThreadPool *pool = nullptr)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const std::size_t bands_num = static_cast <std::size_t>((height + band_height - 1) /
+                                                                band_height);
+        auto rasterize_bands = [this](const std::size_t begin, const std::size_t end)
+        {
+            for (std::size_t band = begin; band < end; ++band)
+                rasterizeBand(static_cast <int>(band) * band_height,
+                              std::min(height, static_cast <int>(band + 1) * band_height));
+        };
+        if (pool)
+            pool->parallelFor(bands_num, 1, rasterize_bands);
+        else
+            rasterize_bands(0, bands_num);
+        stats.rasterized_triangles += triangles.size();
+        stats.raster_ms += millisecondsSince(start);
+    }
+
+    // ------------------------
+    // true if the box is hidden behind the rasterized occluders. Boxes
+    // crossing the near plane are always visible.
+    bool isOccluded(const BoundingBox &box, const glm::mat4 &mvp)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        ++stats.tested;
+        const bool occluded = testBox(box, mvp);
+        if (occluded)
+            ++stats.culled;
+        stats.test_ms += millisecondsSince(start);
+        return occluded;
+    }
+
+    // -----------------------------
+    // getters
+    const Stats &getStats() const
+    {
+        return stats;
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+
+    float getDepth(const int x, const int y) const
+    {
+        return depth[static_cast <std::size_t>(y) * width + x];
+    }
+
+private:
+    // ------------------------
+    // corners closer than this (in clip w) are treated as crossing
+    // the near plane
+    static constexpr float near_w = 1e-4f;
+
+    // ------------------------
+    // window coordinates in pixels and depth, edge functions
+    // e(x, y) = a * x + b * y + c scaled so that they are >= 0 inside,
+    // and the depth plane z(x, y) = z_a * x + z_b * y + z_c
+    struct ScreenTriangle
+    {
+        glm::vec3 corners[3];
+        float edge_a[3];
+        float edge_b[3];
+        float edge_c[3];
+        float z_a;
+        float z_b;
+        float z_c;
+        int min_x;
+        int min_y;
+        int max_x;
+        int max_y;
+    };
+
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    std::vector <float> depth;
+    std::vector <float> tile_depth;
+    std::vector <ScreenTriangle> triangles;
+    Stats stats;
+
+    glm::vec3 toScreen(const glm::vec4 &clip) const
+    {
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return {(ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height,
+                ndc.z * 0.5f + 0.5f};
+    }
+
+    // ------------------------
+    // edge functions, depth plane and pixel bounds; false if the
+    // triangle is degenerate or off screen
+    bool setupTriangle(ScreenTriangle &triangle) const
+    {
+        glm::vec3 *v = triangle.corners;
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (std::fabs(area) < 1e-6f)
+            return false;
+        if (area < 0.f) {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+
+        for (int edge = 0; edge < 3; ++edge) {
+            const glm::vec3 &from = v[edge];
+            const glm::vec3 &to = v[(edge + 1) % 3];
+            triangle.edge_a[edge] = from.y - to.y;
+            triangle.edge_b[edge] = to.x - from.x;
+            // ------------------------
+            // the smallest value over a pixel is the one at its center
+            // less half the extent of the edge function over it, so the
+            // centers test inside only for fully covered pixels
+            triangle.edge_c[edge] = from.x * to.y - from.y * to.x -
+                                    0.5f * (std::fabs(triangle.edge_a[edge]) +
+                                            std::fabs(triangle.edge_b[edge]));
+        }
+
+        triangle.z_a = ((v[1].z - v[0].z) * (v[2].y - v[0].y) -
+                        (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+        triangle.z_b = ((v[2].z - v[0].z) * (v[1].x - v[0].x) -
+                        (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+        // ------------------------
+        // farthest depth over the pixel
+        triangle.z_c = v[0].z - triangle.z_a * v[0].x - triangle.z_b * v[0].y +
+                       0.5f * (std::fabs(triangle.z_a) + std::fabs(triangle.z_b));
+
+        triangle.min_x = std::max(0, static_cast <int>(std::floor(std::min({v[0].x, v[1].x,
+                                                                              v[2].x}))));
+        triangle.min_y = std::max(0, static_cast <int>(std::floor(std::min({v[0].y, v[1].y,
+                                                                              v[2].y}))));
+        triangle.max_x = std::min(width - 1, static_cast <int>(std::ceil(std::max({v[0].x,
+                                                                                     v[1].x,
+                                                                                     v[2].x}))));
+        triangle.max_y = std::min(height - 1, static_cast <int>(std::ceil(std::max({v[0].y,
+                                                                                      v[1].y,
+                                                                                      v[2].y}))));
+        return triangle.min_x <= triangle.max_x && triangle.min_y <= triangle.max_y;
+    }
+
+    void rasterizeBand(const int first_row, const int end_row)
+    {
+        for (const ScreenTriangle &triangle : triangles) {
+            const int min_y = std::max(first_row, triangle.min_y);
+            const int max_y = std::min(end_row - 1, triangle.max_y);
+            for (int y = min_y; y <= max_y; ++y)
+                rasterizeRow(triangle, y);
+        }
+        updateTiles(first_row / tile_size, (end_row + tile_size - 1) / tile_size);
+    }
+
+    void rasterizeRow(const ScreenTriangle &triangle, const int y)
+    {
+        const float center_y = y + 0.5f;
+        float *row = depth.data() + static_cast <std::size_t>(y) * width;
+        // ------------------------
+        // whole groups of 4 pixels, the width is a multiple of 8
+        const int min_x = triangle.min_x & ~3;
+#ifdef OCCLUSION_CULLER_SSE
+        __m128 edge_a[3], edge_row[3];
+        for (int edge = 0; edge < 3; ++edge) {
+            edge_a[edge] = _mm_set1_ps(triangle.edge_a[edge]);
+            edge_row[edge] = _mm_set1_ps(triangle.edge_b[edge] * center_y +
+                                         triangle.edge_c[edge]);
+        }
+        const __m128 z_a = _mm_set1_ps(triangle.z_a);
+        const __m128 z_row = _mm_set1_ps(triangle.z_b * center_y + triangle.z_c);
+        const __m128 zero = _mm_setzero_ps();
+        for (int x = min_x; x <= triangle.max_x; x += 4) {
+            const __m128 center_x = _mm_add_ps(_mm_set1_ps(static_cast <float>(x)),
+                                               _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[0], center_x),
+                                                    edge_row[0]), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[1], center_x),
+                                                                edge_row[1]), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[2], center_x),
+                                                                edge_row[2]), zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            const __m128 old_depth = _mm_loadu_ps(row + x);
+            const __m128 new_depth = _mm_min_ps(old_depth,
+                                                _mm_add_ps(_mm_mul_ps(z_a, center_x), z_row));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth),
+                                             _mm_andnot_ps(inside, old_depth)));
+        }
+#else
+        for (int x = min_x; x <= triangle.max_x; ++x) {
+            const float center_x = x + 0.5f;
+            bool inside = true;
+            for (int edge = 0; edge < 3; ++edge) {
+                inside = inside && triangle.edge_a[edge] * center_x +
+                                   triangle.edge_b[edge] * center_y + triangle.edge_c[edge] >= 0.f;
+            }
+            if (inside)
+                row[x] = std::min(row[x], triangle.z_a * center_x + triangle.z_b * center_y +
+                                          triangle.z_c);
+        }
+#endif
+    }
+
+    // ------------------------
+    // farthest depth of every tile in the rows of tiles [first, end)
+    void updateTiles(const int first_tile_row, const int end_tile_row)
+    {
+        for (int tile_y = first_tile_row; tile_y < end_tile_row && tile_y < tiles_y; ++tile_y) {
+            for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+                float farthest = 0.f;
+                for (int y = tile_y * tile_size; y < (tile_y + 1) * tile_size; ++y) {
+                    const float *row = depth.data() + static_cast <std::size_t>(y) * width +
+                                       tile_x * tile_size;
+                    farthest = std::max(farthest, *std::max_element(row, row + tile_size));
+                }
+                tile_depth[static_cast <std::size_t>(tile_y) * tiles_x + tile_x] = farthest;
+            }
+        }
+    }
+
+    bool testBox(const BoundingBox &box, const glm::mat4 &mvp) const
+    {
+        glm::vec2 min_screen(static_cast <float>(width), static_cast <float>(height));
+        glm::vec2 max_screen(0.f);
+        float nearest = 1.f;
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec3 position(corner & 1 ? box.max.x : box.min.x,
+                                     corner & 2 ? box.max.y : box.min.y,
+                                     corner & 4 ? box.max.z : box.min.z);
+            const glm::vec4 clip = mvp * glm::vec4(position, 1.f);
+            if (clip.w <= near_w)
+                return false;
+            const glm::vec3 screen = toScreen(clip);
+            min_screen = glm::min(min_screen, glm::vec2(screen));
+            max_screen = glm::max(max_screen, glm::vec2(screen));
+            nearest = std::min(nearest, screen.z);
+        }
+
+        // ------------------------
+        // pixels the box touches, clamped to the screen. A box that is
+        // off screen is left to the frustum culling.
+        const int min_x = std::max(0, static_cast <int>(std::floor(min_screen.x)));
+        const int min_y = std::max(0, static_cast <int>(std::floor(min_screen.y)));
+        const int max_x = std::min(width - 1, static_cast <int>(std::floor(max_screen.x)));
+        const int max_y = std::min(height - 1, static_cast <int>(std::floor(max_screen.y)));
+        if (min_x > max_x || min_y > max_y)
+            return false;
+
+        // ------------------------
+        // tiles first: a tile whose farthest depth is in front of the
+        // box hides all its pixels
+        for (int tile_y = min_y / tile_size; tile_y <= max_y / tile_size; ++tile_y) {
+            for (int tile_x = min_x / tile_size; tile_x <= max_x / tile_size; ++tile_x) {
+                if (tile_depth[static_cast <std::size_t>(tile_y) * tiles_x + tile_x] < nearest)
+                    continue;
+                const int first_x = std::max(min_x, tile_x * tile_size);
+                const int last_x = std::min(max_x, (tile_x + 1) * tile_size - 1);
+                const int first_y = std::max(min_y, tile_y * tile_size);
+                const int last_y = std::min(max_y, (tile_y + 1) * tile_size - 1);
+                for (int y = first_y; y <= last_y; ++y) {
+                    const float *row = depth.data() + static_cast <std::size_t>(y) * width;
+                    for (int x = first_x; x <= last_x; ++x) {
+                        if (row[x] >= nearest)
+                            return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    static double millisecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration <double, std::milli>(
+               std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif  // OCCLUSION_CULLER_HPP
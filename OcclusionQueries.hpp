@@ -0,0 +1,389 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the hardware occlusion culling:
+// @ QueryPool - GL query objects reused from frame to frame instead of
+//   being generated and deleted;
+// @ OcclusionQueryScheduler - visibility of a set of objects from
+//   occlusion queries on their bounding boxes, scheduled the way
+//   coherent hierarchical culling (CHC++) does. Results are read back
+//   only once the GPU has them, oldest first, so the CPU never waits.
+//   Objects found visible are trusted to stay so and are queried again
+//   only every few frames. Hidden ones are queried every frame and are
+//   drawn under conditional rendering on their last query: the GPU
+//   drops the draw while they stay hidden, and draws them as soon as
+//   the query passes, before the CPU reads the result;
+// @ OcclusionBoxRenderer - draws the queried boxes with color and depth
+//   writes off.
+// Queries count GL_ANY_SAMPLES_PASSED_CONSERVATIVE on GL 4.3 (or with
+// ARB_ES3_compatibility) and GL_ANY_SAMPLES_PASSED otherwise.
+
+#ifndef OCCLUSION_QUERIES_HPP
+#define OCCLUSION_QUERIES_HPP
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Frustum.hpp"
+#include "gl_extensions.hpp"
+#include "GLState.hpp"
+#include "shader.hpp"
+#include "UniformBuffer.hpp"
+
+class QueryPool
+{
+public:
+    static constexpr GLsizei block_size = 64;
+
+    QueryPool() = default;
+
+    ~QueryPool()
+    {
+        if (!queries.empty())
+            glDeleteQueries(static_cast <GLsizei>(queries.size()), queries.data());
+    }
+
+    QueryPool(const QueryPool &) = delete;
+    QueryPool &operator=(const QueryPool &) = delete;
+
+    // ------------------------
+    // a free query, new ones are generated a block at a time
+    GLuint acquire()
+    {
+        if (free_queries.empty())
+            grow();
+        const GLuint query = free_queries.back();
+        free_queries.pop_back();
+        return query;
+    }
+
+    // ------------------------
+    // the query may still be in flight, its next user begins it again
+    void release(const GLuint query)
+    {
+        free_queries.push_back(query);
+    }
+
+    std::size_t getCreatedNum() const
+    {
+        return queries.size();
+    }
+
+    std::size_t getFreeNum() const
+    {
+        return free_queries.size();
+    }
+
+private:
+    std::vector <GLuint> queries;
+    std::vector <GLuint> free_queries;
+
+    void grow()
+    {
+        const std::size_t old_size = queries.size();
+        queries.resize(old_size + block_size);
+        glGenQueries(block_size, queries.data() + old_size);
+        free_queries.insert(free_queries.end(), queries.cbegin() + old_size, queries.cend());
+    }
+};
+
+class OcclusionQueryScheduler
+{
+public:
+    // ------------------------
+    // counters of the frames since the last resetStats()
+    struct Stats
+    {
+        std::size_t queries_issued;
+        std::size_t results_read;
+        std::size_t conditional_draws;
+        std::size_t hidden;
+    };
+
+    // ------------------------
+    // visible objects are queried again after visible_interval frames,
+    // plus a per object offset so their queries spread over frames
+    explicit OcclusionQueryScheduler(const std::size_t objects_num = 0,
+                                     const unsigned init_visible_interval = 8)
+    :   objects(objects_num),
+        visible_interval(init_visible_interval > 0 ? init_visible_interval : 1),
+        target(GLExt::has_conservative_occlusion_query ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+                                                       : GL_ANY_SAMPLES_PASSED)
+    {
+    }
+
+    ~OcclusionQueryScheduler() = default;
+
+    OcclusionQueryScheduler(const OcclusionQueryScheduler &) = delete;
+    OcclusionQueryScheduler &operator=(const OcclusionQueryScheduler &) = delete;
+
+    // ------------------------
+    // new objects start as visible
+    void resize(const std::size_t objects_num)
+    {
+        for (std::size_t i = objects_num; i < objects.size(); ++i) {
+            if (objects[i].query && !objects[i].pending)
+                pool.release(objects[i].query);
+        }
+        objects.resize(objects_num);
+    }
+
+    // ------------------------
+    // starts a frame: reads back the results that are available
+    void beginFrame()
+    {
+        ++frame;
+        while (!pending.empty()) {
+            const PendingQuery &front = pending.front();
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(front.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint any_samples = 0;
+            glGetQueryObjectuiv(front.query, GL_QUERY_RESULT, &any_samples);
+            ++stats.results_read;
+            // ------------------------
+            // the object was dropped by resize() meanwhile
+            if (front.object >= objects.size() || objects[front.object].query != front.query) {
+                pool.release(front.query);
+                pending.pop_front();
+                continue;
+            }
+            ObjectState &state = objects[front.object];
+            state.pending = false;
+            state.visible = any_samples != 0;
+            if (state.visible)
+                state.next_query = frame + visible_interval +
+                                   static_cast <unsigned>(front.object % visible_interval);
+            pending.pop_front();
+        }
+    }
+
+    // ------------------------
+    // call for every object inside the view frustum, every frame,
+    // before the other calls about it. Returns true if the last result
+    // read says it is hidden. An object that was out of the frustum the
+    // frame before is taken as visible and queried again: its old
+    // result says nothing about where the viewer is now.
+    bool visit(const std::size_t object)
+    {
+        ObjectState &state = objects[object];
+        if (state.last_visit + 1 != frame) {
+            state.visible = true;
+            state.next_query = frame;
+        }
+        state.last_visit = frame;
+        if (!state.visible)
+            ++stats.hidden;
+        return !state.visible;
+    }
+
+    // ------------------------
+    // calls draw_function() to draw the object. A hidden object is
+    // drawn under conditional rendering on its last query, without
+    // waiting for it: if the GPU does not have the result yet, the
+    // object is drawn.
+    template <class DrawFunction>
+    void draw(const std::size_t object, DrawFunction &&draw_function)
+    {
+        const ObjectState &state = objects[object];
+        if (state.visible || !state.query) {
+            draw_function();
+            return;
+        }
+        ++stats.conditional_draws;
+        glBeginConditionalRender(state.query, GL_QUERY_NO_WAIT);
+        draw_function();
+        glEndConditionalRender();
+    }
+
+    // ------------------------
+    // true if a query should be issued for the object this frame
+    bool needsQuery(const std::size_t object) const
+    {
+        const ObjectState &state = objects[object];
+        return !state.pending && (!state.visible || frame >= state.next_query);
+    }
+
+    // ------------------------
+    // issues a query around draw_box(), which draws the bounds of the
+    // object. Call after the occluders are drawn, with the depth
+    // buffer they filled.
+    template <class DrawFunction>
+    void query(const std::size_t object, DrawFunction &&draw_box)
+    {
+        ObjectState &state = objects[object];
+        // ------------------------
+        // the old query is done with: its result was read, and the
+        // conditional draw using it is already issued
+        if (state.query)
+            pool.release(state.query);
+        state.query = pool.acquire();
+        state.pending = true;
+        glBeginQuery(target, state.query);
+        draw_box();
+        glEndQuery(target);
+        pending.push_back({object, state.query});
+        ++stats.queries_issued;
+    }
+
+    // ------------------------
+    // takes the object as visible without a query, e.g. when the
+    // viewer is inside its bounds and the box would be clipped away
+    void markVisible(const std::size_t object)
+    {
+        ObjectState &state = objects[object];
+        state.visible = true;
+        state.next_query = frame + visible_interval;
+    }
+
+    // -----------------------------
+    // getters
+    const Stats &getStats() const
+    {
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats = Stats();
+    }
+
+    std::size_t size() const
+    {
+        return objects.size();
+    }
+
+    std::size_t getPendingNum() const
+    {
+        return pending.size();
+    }
+
+    const QueryPool &getPool() const
+    {
+        return pool;
+    }
+
+    bool isConservative() const
+    {
+        return target == GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+    }
+
+private:
+    struct ObjectState
+    {
+        // ------------------------
+        // the last query issued, 0 if none
+        GLuint query = 0;
+        bool visible = true;
+        bool pending = false;
+        unsigned last_visit = 0;
+        unsigned next_query = 0;
+    };
+
+    struct PendingQuery
+    {
+        std::size_t object;
+        GLuint query;
+    };
+
+    std::vector <ObjectState> objects;
+    // ------------------------
+    // in issue order, results come back in the same order
+    std::deque <PendingQuery> pending;
+    QueryPool pool;
+    unsigned visible_interval;
+    GLenum target;
+    // ------------------------
+    // the first frame is 2, so the initial last_visit of 0 never looks
+    // like the frame before
+    unsigned frame = 1;
+    Stats stats = Stats();
+};
+
+class OcclusionBoxRenderer
+{
+public:
+    OcclusionBoxRenderer()
+    :   shader("OcclusionBox.vs", "OcclusionBox.fs")
+    {
+        UniformBlocks::bind(shader);
+
+        // ------------------------
+        // unit cube, both windings are drawn: with face culling on a
+        // viewer close to a box would see none of its faces
+        static const float corners[] = {
+            0.f, 0.f, 0.f,  1.f, 0.f, 0.f,  1.f, 1.f, 0.f,  0.f, 1.f, 0.f,
+            0.f, 0.f, 1.f,  1.f, 0.f, 1.f,  1.f, 1.f, 1.f,  0.f, 1.f, 1.f
+        };
+        static const GLubyte indices[] = {
+            0, 1, 2,  2, 3, 0,  4, 6, 5,  6, 4, 7,
+            0, 4, 5,  5, 1, 0,  3, 2, 6,  6, 7, 3,
+            0, 3, 7,  7, 4, 0,  1, 5, 6,  6, 2, 1
+        };
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        GLState::bindVertexArray(vao);
+        GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+        GLState::bindVertexArray(0);
+    }
+
+    ~OcclusionBoxRenderer()
+    {
+        GLState::bindVertexArray(0);
+        GLState::forgetBuffer(vbo);
+        GLState::forgetBuffer(ebo);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+    }
+
+    OcclusionBoxRenderer(const OcclusionBoxRenderer &) = delete;
+    OcclusionBoxRenderer &operator=(const OcclusionBoxRenderer &) = delete;
+
+    // ------------------------
+    // sets up the state for the boxes, the depth test stays as it is.
+    // Face culling is left off afterwards.
+    void begin()
+    {
+        shader.use();
+        GLState::bindVertexArray(vao);
+        GLState::disable(GL_CULL_FACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+    }
+
+    // ------------------------
+    // draws the box, given in the model space of transform
+    void draw(const BoundingBox &box, const glm::mat4 &transform)
+    {
+        static constexpr UniformName box_transform_name("box_transform");
+        glm::mat4 box_transform = glm::translate(transform, box.min);
+        box_transform = glm::scale(box_transform, box.max - box.min);
+        shader.setMat4(box_transform_name, box_transform);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    void end()
+    {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+    }
+
+private:
+    Shader shader;
+    unsigned vao = 0;
+    unsigned vbo = 0;
+    unsigned ebo = 0;
+};
+
+#endif  // OCCLUSION_QUERIES_HPP
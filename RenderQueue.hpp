@@ -0,0 +1,243 @@
+// Copyright 2018 Tihran Katolikian
+// class RenderQueue - collects the draws of a frame and issues them
+// sorted by a 64-bit key instead of in submission order.
+// Key layout, most significant bits first:
+// @ [63..62] pass - opaque, alpha tested, transparent;
+// @ [61..52] program;
+// @ [51..36] material (texture set);
+// @ [35..20] VAO;
+// @ [19..0]  depth bucket - front to back in the opaque passes, back to
+//   front in the transparent one.
+// So draws sharing a program, a material and a VAO end up next to each
+// other (the state cache drops the repeated binds), and inside a state
+// group opaque draws go front to back for early-z.
+// Keys are sorted with an LSD radix sort on 8-bit digits, digits equal
+// in all keys are skipped.
+
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+#include "shader.hpp"
+#include "UniformBuffer.hpp"
+
+class RenderQueue
+{
+public:
+    enum Pass {OPAQUE_PASS, ALPHA_TESTED_PASS, TRANSPARENT_PASS};
+
+    // ------------------------
+    // one draw. transform indexes the matrices added with addTransform,
+    // material_buffer may be nullptr if the program has no MaterialData,
+    // lod is the level of detail of the mesh.
+    struct DrawItem
+    {
+        Shader *shader;
+        const Mesh *mesh;
+        const UniformBuffer <MaterialBlock> *material_buffer;
+        std::uint32_t material_element;
+        std::uint32_t transform;
+        std::uint32_t lod;
+    };
+
+    struct SortEntry
+    {
+        std::uint64_t key;
+        std::uint32_t item;
+    };
+
+    // ------------------------
+    // state switches between consecutive draws, decoded from the keys
+    struct StateChanges
+    {
+        std::size_t programs = 0;
+        std::size_t materials = 0;
+        std::size_t vertex_arrays = 0;
+
+        std::size_t total() const
+        {
+            return programs + materials + vertex_arrays;
+        }
+    };
+
+    static constexpr unsigned depth_bits = 20;
+    static constexpr unsigned vao_bits = 16;
+    static constexpr unsigned material_bits = 16;
+    static constexpr unsigned program_bits = 10;
+    static constexpr unsigned vao_shift = depth_bits;
+    static constexpr unsigned material_shift = vao_shift + vao_bits;
+    static constexpr unsigned program_shift = material_shift + material_bits;
+    static constexpr unsigned pass_shift = program_shift + program_bits;
+    static_assert(pass_shift + 2 == 64, "sort key fields must fill 64 bits");
+
+    RenderQueue() = default;
+    ~RenderQueue() = default;
+
+    // ------------------------
+    // view distances mapped to the depth buckets
+    void setDepthRange(const float near_distance, const float far_distance)
+    {
+        depth_near = near_distance;
+        depth_far = far_distance;
+    }
+
+    std::uint32_t addTransform(const glm::mat4 &transform)
+    {
+        transforms.push_back(transform);
+        return static_cast <std::uint32_t>(transforms.size() - 1);
+    }
+
+    void submit(const Pass pass, Shader &shader, const Mesh &mesh, const std::uint32_t transform,
+                const float view_distance,
+                const UniformBuffer <MaterialBlock> *material_buffer = nullptr,
+                const std::uint32_t material_element = 0, const std::uint32_t lod = 0)
+    {
+        // ------------------------
+        // an empty range puts everything in the first bucket
+        const float range = depth_far - depth_near;
+        float depth = range > 0.f ? (view_distance - depth_near) / range : 0.f;
+        if (pass == TRANSPARENT_PASS)
+            depth = 1.f - depth;
+        const std::uint64_t key = makeKey(pass, shader.getid(), mesh.getTextureSetId(),
+                                          mesh.getVertexArray(), depth);
+        entries.push_back({key, static_cast <std::uint32_t>(items.size())});
+        items.push_back({&shader, &mesh, material_buffer, material_element, transform, lod});
+    }
+
+    // ------------------------
+    // sorts and issues all draws, then empties the queue
+    void flush()
+    {
+        radixSort(entries, scratch);
+        last_changes = countStateChanges(entries.data(), entries.size());
+
+        static constexpr UniformName model_name("model");
+        const Shader *current = nullptr;
+        for (const SortEntry &entry : entries) {
+            const DrawItem &item = items[entry.item];
+            if (item.shader != current) {
+                item.shader->use();
+                current = item.shader;
+            }
+            // ------------------------
+            // unchanged matrices are not uploaded again, see Shader
+            item.shader->setMat4(model_name, transforms[item.transform]);
+            if (item.material_buffer != nullptr)
+                item.material_buffer->bind(item.material_element);
+            item.mesh->draw(*item.shader, item.lod);
+        }
+        clear();
+    }
+
+    void clear()
+    {
+        items.clear();
+        entries.clear();
+        transforms.clear();
+    }
+
+    std::size_t getItemsNum() const
+    {
+        return items.size();
+    }
+
+    // ------------------------
+    // state switches of the last flush
+    const StateChanges &getLastStateChanges() const
+    {
+        return last_changes;
+    }
+
+    // ------------------------
+    // depth is clamped to [0, 1], NaN goes to 0; the other fields are
+    // truncated to their widths: GL names are small, so collisions are
+    // rare and only cost an extra state switch
+    static std::uint64_t makeKey(const Pass pass, const unsigned program, const unsigned material,
+                                 const unsigned vao, const float depth)
+    {
+        const std::uint64_t depth_max = (1ull << depth_bits) - 1;
+        const float clamped_depth = depth > 0.f ? std::min(depth, 1.f) : 0.f;
+        const std::uint64_t depth_bucket = static_cast <std::uint64_t>(clamped_depth * depth_max);
+        return static_cast <std::uint64_t>(pass) << pass_shift |
+               (program & ((1ull << program_bits) - 1)) << program_shift |
+               (material & ((1ull << material_bits) - 1)) << material_shift |
+               (vao & ((1ull << vao_bits) - 1)) << vao_shift |
+               depth_bucket;
+    }
+
+    // ------------------------
+    // stable LSD radix sort by key, 8 bits per pass. scratch is
+    // resized as needed, keep it around to avoid reallocations.
+    static void radixSort(std::vector <SortEntry> &to_sort, std::vector <SortEntry> &scratch)
+    {
+        const std::size_t size = to_sort.size();
+        if (size < 2)
+            return;
+        scratch.resize(size);
+
+        // ------------------------
+        // all eight histograms in one read of the keys
+        std::size_t histograms[8][256] = {};
+        for (const SortEntry &entry : to_sort) {
+            for (unsigned digit = 0; digit < 8; ++digit)
+                ++histograms[digit][(entry.key >> (digit * 8)) & 0xff];
+        }
+
+        SortEntry *source = to_sort.data();
+        SortEntry *destination = scratch.data();
+        for (unsigned digit = 0; digit < 8; ++digit) {
+            std::size_t *histogram = histograms[digit];
+            // ------------------------
+            // every key has the same digit: nothing to reorder
+            if (histogram[(source[0].key >> (digit * 8)) & 0xff] == size)
+                continue;
+
+            std::size_t offset = 0;
+            for (unsigned bucket = 0; bucket < 256; ++bucket) {
+                const std::size_t count = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += count;
+            }
+            for (std::size_t i = 0; i < size; ++i)
+                destination[histogram[(source[i].key >> (digit * 8)) & 0xff]++] = source[i];
+            std::swap(source, destination);
+        }
+        if (source != to_sort.data())
+            std::copy(source, source + size, to_sort.data());
+    }
+
+    static StateChanges countStateChanges(const SortEntry *sorted, const std::size_t size)
+    {
+        StateChanges changes;
+        for (std::size_t i = 1; i < size; ++i) {
+            const std::uint64_t difference = sorted[i].key ^ sorted[i - 1].key;
+            changes.programs += field(difference, program_shift, program_bits) != 0;
+            changes.materials += field(difference, material_shift, material_bits) != 0;
+            changes.vertex_arrays += field(difference, vao_shift, vao_bits) != 0;
+        }
+        return changes;
+    }
+
+private:
+    std::vector <DrawItem> items;
+    std::vector <SortEntry> entries;
+    std::vector <SortEntry> scratch;
+    std::vector <glm::mat4> transforms;
+    StateChanges last_changes;
+    float depth_near = 0.1f;
+    float depth_far = 100.f;
+
+    static std::uint64_t field(const std::uint64_t key, const unsigned shift, const unsigned bits)
+    {
+        return (key >> shift) & ((1ull << bits) - 1);
+    }
+};
+
+#endif  // RENDER_QUEUE_HPP
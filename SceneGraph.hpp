@@ -0,0 +1,322 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the transform hierarchy:
+// @ Transform - translation, rotation and scale of a node relative to
+//   its parent;
+// @ ModelNode - a node of a model's own hierarchy (the aiNode tree),
+//   with the index of its parent in the model;
+// @ SceneGraph - the hierarchy of a scene. Nodes are appended in depth
+//   first order, so the subtree of a node is the range of nodes right
+//   after it, and parents always come before their children. Local
+//   transforms are kept as separate translation, rotation and scale
+//   arrays. Changing one marks its node dirty; update() takes the
+//   dirty nodes that no other dirty node is an ancestor of and
+//   recomputes the world matrices of their subtrees only, with one
+//   linear pass each. Subtrees are independent of each other, so large
+//   updates run them on a ThreadPool, splitting big subtrees into runs
+//   of their children. A frame where nothing moved costs nothing.
+
+#ifndef SCENE_GRAPH_HPP
+#define SCENE_GRAPH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "ThreadPool.hpp"
+
+struct Transform
+{
+    glm::vec3 translation = glm::vec3(0.f);
+    glm::quat rotation = glm::quat(1.f, 0.f, 0.f, 0.f);
+    glm::vec3 scale = glm::vec3(1.f);
+
+    // ------------------------
+    // translation * rotation * scale
+    glm::mat4 matrix() const
+    {
+        const glm::mat3 basis = glm::mat3_cast(rotation);
+        glm::mat4 result;
+        result[0] = glm::vec4(basis[0] * scale.x, 0.f);
+        result[1] = glm::vec4(basis[1] * scale.y, 0.f);
+        result[2] = glm::vec4(basis[2] * scale.z, 0.f);
+        result[3] = glm::vec4(translation, 1.f);
+        return result;
+    }
+};
+
+struct ModelNode
+{
+    // ------------------------
+    // index of the parent node in the model, -1 for the root
+    std::int32_t parent;
+    Transform local;
+};
+
+class SceneGraph
+{
+public:
+    typedef std::uint32_t NodeId;
+    static constexpr NodeId no_parent = 0xffffffffu;
+
+    // ------------------------
+    // what the last update() did
+    struct Stats
+    {
+        std::size_t dirty_roots;
+        std::size_t updated_nodes;
+        std::size_t tasks;
+    };
+
+    void reserve(const std::size_t nodes_num)
+    {
+        parents.reserve(nodes_num);
+        subtree_ends.reserve(nodes_num);
+        translations.reserve(nodes_num);
+        rotations.reserve(nodes_num);
+        scales.reserve(nodes_num);
+        worlds.reserve(nodes_num);
+        dirty.reserve(nodes_num);
+    }
+
+    // ------------------------
+    // appends a node. To keep the depth first order, parent must be
+    // the last node added or one of its ancestors (or no_parent for a
+    // new root). Returns no_parent if it is not. The world matrix of
+    // the node is valid after the next update().
+    NodeId addNode(const NodeId parent, const Transform &local = Transform())
+    {
+        while (!open_path.empty() && open_path.back() != parent)
+            open_path.pop_back();
+        if (parent != no_parent && open_path.empty()) {
+            std::cout << "ERROR::SCENE_GRAPH:: node " << parent
+                      << " is not an ancestor of the last node added\n";
+            return no_parent;
+        }
+
+        const NodeId node = static_cast <NodeId>(parents.size());
+        for (const NodeId ancestor : open_path)
+            subtree_ends[ancestor] = node + 1;
+        open_path.push_back(node);
+
+        parents.push_back(parent);
+        subtree_ends.push_back(node + 1);
+        translations.push_back(local.translation);
+        rotations.push_back(local.rotation);
+        scales.push_back(local.scale);
+        worlds.push_back(glm::mat4());
+        dirty.push_back(0);
+        markDirty(node);
+        return node;
+    }
+
+    // ------------------------
+    // setters of the local transform, each marks the node dirty
+    void setLocal(const NodeId node, const Transform &local)
+    {
+        translations[node] = local.translation;
+        rotations[node] = local.rotation;
+        scales[node] = local.scale;
+        markDirty(node);
+    }
+
+    void setTranslation(const NodeId node, const glm::vec3 &translation)
+    {
+        translations[node] = translation;
+        markDirty(node);
+    }
+
+    void setRotation(const NodeId node, const glm::quat &rotation)
+    {
+        rotations[node] = rotation;
+        markDirty(node);
+    }
+
+    void setScale(const NodeId node, const glm::vec3 &scale)
+    {
+        scales[node] = scale;
+        markDirty(node);
+    }
+
+    // ------------------------
+    // recomputes the world matrices of the dirty subtrees, on pool if
+    // given and there is enough work. Must not run concurrently with
+    // the setters or addNode().
+    void update(ThreadPool *pool = nullptr)
+    {
+        stats = Stats();
+        if (dirty_nodes.empty())
+            return;
+
+        // ------------------------
+        // in index order a dirty node inside the subtree of an earlier
+        // one is updated with it
+        std::sort(dirty_nodes.begin(), dirty_nodes.end());
+        roots.clear();
+        NodeId covered_end = 0;
+        for (const NodeId node : dirty_nodes) {
+            dirty[node] = 0;
+            if (node < covered_end)
+                continue;
+            covered_end = subtree_ends[node];
+            roots.push_back({node, covered_end});
+            stats.updated_nodes += covered_end - node;
+        }
+        dirty_nodes.clear();
+        stats.dirty_roots = roots.size();
+
+        if (!pool || pool->getThreadsNum() == 1 || stats.updated_nodes < parallel_threshold) {
+            for (const Range &root : roots)
+                updateRange(root);
+            stats.tasks = 1;
+            return;
+        }
+        splitTasks(std::max <std::size_t>(min_task_size,
+                                          stats.updated_nodes / (pool->getThreadsNum() * 4)));
+        stats.tasks = tasks.size();
+        pool->parallelFor(tasks.size(), 1, [this](const std::size_t begin, const std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                updateRange(tasks[i]);
+        });
+    }
+
+    // -----------------------------
+    // getters
+    const glm::mat4 &getWorld(const NodeId node) const
+    {
+        return worlds[node];
+    }
+
+    Transform getLocal(const NodeId node) const
+    {
+        Transform local;
+        local.translation = translations[node];
+        local.rotation = rotations[node];
+        local.scale = scales[node];
+        return local;
+    }
+
+    NodeId getParent(const NodeId node) const
+    {
+        return parents[node];
+    }
+
+    // ------------------------
+    // one past the last node of the subtree of node
+    NodeId getSubtreeEnd(const NodeId node) const
+    {
+        return subtree_ends[node];
+    }
+
+    std::size_t getNodesNum() const
+    {
+        return parents.size();
+    }
+
+    const Stats &getStats() const
+    {
+        return stats;
+    }
+
+private:
+    // ------------------------
+    // below this many nodes to update, waking the pool costs more
+    // than it saves; tasks are never smaller than min_task_size
+    static constexpr std::size_t parallel_threshold = 4096;
+    static constexpr std::size_t min_task_size = 1024;
+
+    // ------------------------
+    // nodes [begin, end) whose parents outside the range are up to
+    // date, so they can be updated in order
+    struct Range
+    {
+        NodeId begin;
+        NodeId end;
+    };
+
+    std::vector <NodeId> parents;
+    std::vector <NodeId> subtree_ends;
+    std::vector <glm::vec3> translations;
+    std::vector <glm::quat> rotations;
+    std::vector <glm::vec3> scales;
+    std::vector <glm::mat4> worlds;
+    std::vector <std::uint8_t> dirty;
+    std::vector <NodeId> dirty_nodes;
+    // ------------------------
+    // the last node added and its ancestors
+    std::vector <NodeId> open_path;
+    std::vector <Range> roots;
+    std::vector <Range> tasks;
+    std::vector <Range> to_split;
+    Stats stats = Stats();
+
+    void markDirty(const NodeId node)
+    {
+        if (dirty[node])
+            return;
+        dirty[node] = 1;
+        dirty_nodes.push_back(node);
+    }
+
+    void updateRange(const Range &range)
+    {
+        for (NodeId node = range.begin; node < range.end; ++node) {
+            Transform local;
+            local.translation = translations[node];
+            local.rotation = rotations[node];
+            local.scale = scales[node];
+            worlds[node] = parents[node] == no_parent ? local.matrix()
+                                                      : worlds[parents[node]] * local.matrix();
+        }
+    }
+
+    // ------------------------
+    // cuts the dirty subtrees into tasks of about task_size nodes. A
+    // larger subtree has its root updated here, and its children are
+    // grouped into runs of consecutive siblings or split further.
+    void splitTasks(const std::size_t task_size)
+    {
+        tasks.clear();
+        to_split.clear();
+        for (const Range &root : roots) {
+            if (root.end - root.begin > task_size)
+                to_split.push_back(root);
+            else if (!tasks.empty() && tasks.back().end == root.begin &&
+                     tasks.back().end - tasks.back().begin < task_size)
+                tasks.back().end = root.end;
+            else
+                tasks.push_back(root);
+        }
+        while (!to_split.empty()) {
+            const Range subtree = to_split.back();
+            to_split.pop_back();
+            updateRange({subtree.begin, subtree.begin + 1});
+
+            Range run = {subtree.begin + 1, subtree.begin + 1};
+            for (NodeId child = subtree.begin + 1; child < subtree.end;
+                 child = subtree_ends[child]) {
+                if (subtree_ends[child] - child > task_size) {
+                    if (run.end > run.begin)
+                        tasks.push_back(run);
+                    to_split.push_back({child, subtree_ends[child]});
+                    run = {subtree_ends[child], subtree_ends[child]};
+                    continue;
+                }
+                run.end = subtree_ends[child];
+                if (run.end - run.begin >= task_size) {
+                    tasks.push_back(run);
+                    run.begin = run.end;
+                }
+            }
+            if (run.end > run.begin)
+                tasks.push_back(run);
+        }
+    }
+};
+
+#endif  // SCENE_GRAPH_HPP
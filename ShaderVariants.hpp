@@ -0,0 +1,163 @@
+// Copyright 2018 Tihran Katolikian
+// here are the shader permutation helpers:
+// @ ShaderFeatures - the scene and material properties a program is
+//   specialized for (point light count or clustered lights,
+//   directional light, specular map). They are turned into #defines,
+//   see SylvanasFS.fs;
+// @ ShaderVariants - the permutations of one vertex/fragment shader
+//   pair. A variant is compiled the first time it is asked for and
+//   cached; the uniform blocks of every variant are bound to the shared
+//   binding points. The frame loop asks with getLatest(), which never
+//   waits for a new variant once there is an older one to draw with.
+
+#ifndef SHADER_VARIANTS_HPP
+#define SHADER_VARIANTS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "shader.hpp"
+#include "UniformBuffer.hpp"
+
+struct ShaderFeatures
+{
+    unsigned point_lights = 0;
+    // ------------------------
+    // point lights come from the cluster lists (see LightClusters.hpp)
+    // instead of LightData, their number does not matter then
+    bool clustered_lights = false;
+    bool dir_light = false;
+    bool specular_map = false;
+
+    // ------------------------
+    // #define lines injected after #version
+    std::string defines() const
+    {
+        return (clustered_lights ? std::string("#define CLUSTERED_LIGHTS 1\n")
+                                 : "#define POINT_LIGHTS_NUM " +
+                                   std::to_string(clampedPointLights()) + '\n') +
+               "#define DIR_LIGHT " + (dir_light ? "1" : "0") + '\n' +
+               "#define SPECULAR_MAP " + (specular_map ? "1" : "0") + '\n';
+    }
+
+    // ------------------------
+    // unique id of the permutation
+    std::uint32_t key() const
+    {
+        return clampedPointLights() << 3 | (clustered_lights ? 4u : 0u) |
+               (dir_light ? 2u : 0u) | (specular_map ? 1u : 0u);
+    }
+
+    // ------------------------
+    // LightData holds at most max_point_lights lights
+    unsigned clampedPointLights() const
+    {
+        return clustered_lights ? 0 : std::min(point_lights, LightsBlock::max_point_lights);
+    }
+};
+
+class ShaderVariants
+{
+public:
+    ShaderVariants(const char *vs, const char *fs)
+    :   vs_name(vs),
+        fs_name(fs)
+    {}
+    ~ShaderVariants() = default;
+
+    ShaderVariants(const ShaderVariants &) = delete;
+    ShaderVariants &operator=(const ShaderVariants &) = delete;
+
+    // ------------------------
+    // returns the variant, compiling it now if it does not exist yet
+    // or waiting for it if it is still compiling
+    Shader &get(const ShaderFeatures &features)
+    {
+        Variant &variant = find(features, Shader::BLOCKING);
+        variant.shader->wait();
+        bindBlocks(variant);
+        return *variant.shader;
+    }
+
+    // ------------------------
+    // starts compiling the variant in the background (see
+    // Shader::ASYNC) and returns it once it is ready, nullptr until
+    // then. Lets the renderer keep drawing with the current variant
+    // while the next one compiles.
+    Shader *tryGet(const ShaderFeatures &features)
+    {
+        Variant &variant = find(features, Shader::ASYNC);
+        if (!variant.shader->isReady())
+            return nullptr;
+        bindBlocks(variant);
+        return variant.shader.get();
+    }
+
+    // ------------------------
+    // for the frame loop: the variant if it is ready, otherwise starts
+    // compiling it in the background and returns the variant this
+    // returned last time, so drawing goes on with the previous
+    // permutation. Waits only when there is no previous one.
+    Shader &getLatest(const ShaderFeatures &features)
+    {
+        if (Shader *ready = tryGet(features))
+            latest = ready;
+        else if (!latest)
+            latest = &get(features);
+        return *latest;
+    }
+
+    std::size_t getVariantsNum() const
+    {
+        return variants.size();
+    }
+
+private:
+    struct Variant
+    {
+        std::unique_ptr <Shader> shader;
+        bool blocks_bound;
+    };
+
+    std::string vs_name;
+    std::string fs_name;
+    std::map <std::uint32_t, Variant> variants;
+    Shader *latest = nullptr;
+
+    Variant &find(const ShaderFeatures &features, const Shader::CompileMode mode)
+    {
+        auto found = variants.find(features.key());
+        if (found != variants.end())
+            return found->second;
+
+        std::cout << "ShaderVariants: " << vs_name << '+' << fs_name << ": ";
+        if (features.clustered_lights)
+            std::cout << "clustered point lights";
+        else
+            std::cout << features.clampedPointLights() << " point lights";
+        std::cout << ", directional light "
+                  << (features.dir_light ? "on" : "off") << ", specular map "
+                  << (features.specular_map ? "on" : "off") << '\n';
+        Variant &variant = variants[features.key()];
+        variant.shader.reset(new Shader(vs_name.c_str(), fs_name.c_str(), nullptr, mode,
+                                        features.defines()));
+        variant.blocks_bound = false;
+        return variant;
+    }
+
+    // ------------------------
+    // the program must be linked, so this is done once it is ready
+    static void bindBlocks(Variant &variant)
+    {
+        if (variant.blocks_bound)
+            return;
+        UniformBlocks::bind(*variant.shader);
+        variant.blocks_bound = true;
+    }
+};
+
+#endif  // SHADER_VARIANTS_HPP
@@ -0,0 +1,156 @@
+// Copyright 2018 Tihran Katolikian
+// class ThreadPool - a fixed set of worker threads for data-parallel
+// loops. parallelFor() splits [0, count) into chunks that the workers
+// and the calling thread claim one by one, and returns when all of
+// them are done. One loop runs at a time; loops started from several
+// threads wait for each other.
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // ------------------------
+    // the calling thread works too, so the default leaves one core
+    // for it
+    explicit ThreadPool(const unsigned workers_num = defaultWorkersNum())
+    {
+        for (unsigned i = 0; i < workers_num; ++i)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake_up.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // ------------------------
+    // calls function(begin, end) for every chunk of [0, count)
+    template <class Function>
+    void parallelFor(const std::size_t count, const std::size_t chunk_size, Function &&function)
+    {
+        if (count == 0)
+            return;
+        const std::size_t chunk = std::max <std::size_t>(chunk_size, 1);
+        const std::size_t chunks_num = (count + chunk - 1) / chunk;
+        if (workers.empty() || chunks_num == 1) {
+            function(std::size_t(0), count);
+            return;
+        }
+
+        std::lock_guard <std::mutex> loop_lock(loop_mutex);
+        auto job = std::make_shared <Job>();
+        job->function = std::forward <Function>(function);
+        job->count = count;
+        job->chunk_size = chunk;
+        job->chunks_num = chunks_num;
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            current_job = job;
+        }
+        wake_up.notify_all();
+
+        runChunks(*job);
+        std::unique_lock <std::mutex> lock(mutex);
+        done.wait(lock, [&job]() { return job->chunks_done == job->chunks_num; });
+        current_job.reset();
+    }
+
+    unsigned getThreadsNum() const
+    {
+        return static_cast <unsigned>(workers.size()) + 1;
+    }
+
+    // ------------------------
+    // the pool shared by the renderer's parallel loops
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static unsigned defaultWorkersNum()
+    {
+        const unsigned cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
+
+private:
+    struct Job
+    {
+        std::function <void(std::size_t, std::size_t)> function;
+        std::size_t count = 0;
+        std::size_t chunk_size = 0;
+        std::size_t chunks_num = 0;
+        std::atomic <std::size_t> next_chunk{0};
+        // ------------------------
+        // guarded by the pool's mutex
+        std::size_t chunks_done = 0;
+    };
+
+    std::vector <std::thread> workers;
+    std::mutex loop_mutex;
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    std::condition_variable done;
+    std::shared_ptr <Job> current_job;
+    bool stopping = false;
+
+    void runChunks(Job &job)
+    {
+        std::size_t finished = 0;
+        for (std::size_t chunk = job.next_chunk++; chunk < job.chunks_num;
+             chunk = job.next_chunk++) {
+            const std::size_t begin = chunk * job.chunk_size;
+            job.function(begin, std::min(begin + job.chunk_size, job.count));
+            ++finished;
+        }
+        if (finished == 0)
+            return;
+        std::lock_guard <std::mutex> lock(mutex);
+        job.chunks_done += finished;
+        if (job.chunks_done == job.chunks_num)
+            done.notify_all();
+    }
+
+    void workerLoop()
+    {
+        std::shared_ptr <Job> last_job;
+        for (;;) {
+            std::shared_ptr <Job> job;
+            {
+                std::unique_lock <std::mutex> lock(mutex);
+                wake_up.wait(lock, [&]() {
+                    return stopping || (current_job && current_job != last_job);
+                });
+                if (stopping)
+                    return;
+                job = current_job;
+            }
+            last_job = job;
+            runChunks(*job);
+        }
+    }
+};
+
+#endif  // THREAD_POOL_HPP
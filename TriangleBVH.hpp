@@ -0,0 +1,656 @@
+// Copyright 2018 Tihran Katolikian
+// here are the classes of the ray queries on mesh geometry:
+// @ RayHit - what a ray hit: the distance along it, the triangle (the
+//   position of its first index in the mesh's index list, divided by
+//   3) and the barycentrics of the hit point, which is
+//   (1 - u - v) * p0 + u * p1 + v * p2;
+// @ TriangleBVH - bounding volume hierarchy over the triangles of a
+//   mesh. Splits are chosen by the surface area heuristic over
+//   bins_num bins per axis (Wald - "On fast Construction of SAH-based
+//   Bounding Volume Hierarchies", 2007). On a ThreadPool the upper
+//   levels are split first and the subtrees below them are built in
+//   parallel, then stitched together. The triangles are stored in leaf
+//   order as a corner and two edges for the Moller-Trumbore test, which
+//   takes both sides of a triangle. Rays are cast one at a time or in
+//   packets of 4, which go down the tree together and are tested
+//   against each triangle in the 4 lanes of an SSE register.
+
+#ifndef TRIANGLE_BVH_HPP
+#define TRIANGLE_BVH_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define TRIANGLE_BVH_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+#include "ThreadPool.hpp"
+#include "VertexFormat.hpp"
+
+struct RayHit
+{
+    float distance;
+    std::uint32_t triangle;
+    float u;
+    float v;
+};
+
+class TriangleBVH
+{
+public:
+    static constexpr std::uint32_t no_triangle = 0xffffffffu;
+    static constexpr unsigned bins_num = 16;
+    static constexpr std::uint32_t max_leaf_triangles = 4;
+
+    // ------------------------
+    // builds the tree over the triangles of indices, on pool if given
+    void build(const std::vector <Vertex> &vertices, const std::vector <unsigned> &indices,
+               ThreadPool *pool = nullptr)
+    {
+        const std::size_t triangles_num = indices.size() / 3;
+        nodes.clear();
+        if (triangles_num == 0) {
+            triangle_ids.clear();
+            corners.clear();
+            edges1.clear();
+            edges2.clear();
+            return;
+        }
+        triangle_ids.resize(triangles_num);
+        std::iota(triangle_ids.begin(), triangle_ids.end(), 0u);
+        boxes.resize(triangles_num);
+        centroids.resize(triangles_num);
+        auto compute_bounds = [&](const std::size_t begin, const std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i) {
+                const glm::vec3 &a = vertices[indices[i * 3]].position;
+                const glm::vec3 &b = vertices[indices[i * 3 + 1]].position;
+                const glm::vec3 &c = vertices[indices[i * 3 + 2]].position;
+                boxes[i].min = glm::min(glm::min(a, b), c);
+                boxes[i].max = glm::max(glm::max(a, b), c);
+                centroids[i] = boxes[i].center();
+            }
+        };
+        if (pool)
+            pool->parallelFor(triangles_num, chunk_size, compute_bounds);
+        else
+            compute_bounds(0, triangles_num);
+
+        nodes.push_back(Node());
+        tasks.clear();
+        tasks.push_back({0, 0, static_cast <std::uint32_t>(triangles_num), 0});
+        if (pool && triangles_num > 2 * min_task_triangles)
+            splitTasks(std::max <std::size_t>(min_task_triangles,
+                                              triangles_num / (pool->getThreadsNum() * 4)));
+        std::vector <std::vector <Node>> subtrees(tasks.size());
+        auto build_subtrees = [&](const std::size_t begin, const std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                buildSubtree(tasks[i], subtrees[i]);
+        };
+        if (pool)
+            pool->parallelFor(tasks.size(), 1, build_subtrees);
+        else
+            build_subtrees(0, tasks.size());
+
+        // ------------------------
+        // the root of every subtree takes the place the upper levels
+        // left for it, the rest goes to the end
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+            const std::uint32_t base = static_cast <std::uint32_t>(nodes.size()) - 1;
+            for (Node &node : subtrees[i]) {
+                if (node.count == 0)
+                    node.first += base;
+            }
+            nodes[tasks[i].node] = subtrees[i].front();
+            nodes.insert(nodes.end(), subtrees[i].begin() + 1, subtrees[i].end());
+        }
+
+        corners.resize(triangles_num);
+        edges1.resize(triangles_num);
+        edges2.resize(triangles_num);
+        for (std::size_t i = 0; i < triangles_num; ++i) {
+            const std::uint32_t triangle = triangle_ids[i];
+            const glm::vec3 &a = vertices[indices[triangle * 3]].position;
+            corners[i] = a;
+            edges1[i] = vertices[indices[triangle * 3 + 1]].position - a;
+            edges2[i] = vertices[indices[triangle * 3 + 2]].position - a;
+        }
+        std::vector <BoundingBox>().swap(boxes);
+        std::vector <glm::vec3>().swap(centroids);
+    }
+
+    // ------------------------
+    // the nearest hit of the ray closer than max_distance. The
+    // distance is in units of the length of direction.
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, RayHit &hit,
+                   const float max_distance = FLT_MAX) const
+    {
+        hit = {max_distance, no_triangle, 0.f, 0.f};
+        if (nodes.empty() || corners.empty())
+            return false;
+        const glm::vec3 inverse_direction(1.f / direction.x, 1.f / direction.y,
+                                          1.f / direction.z);
+        std::uint32_t stack[stack_size];
+        std::size_t stack_top = 0;
+        if (entryDistance(nodes.front(), origin, inverse_direction, hit.distance) < FLT_MAX)
+            stack[stack_top++] = 0;
+        while (stack_top > 0) {
+            const Node &node = nodes[stack[--stack_top]];
+            if (node.count > 0) {
+                for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+                    intersectTriangle(i, origin, direction, hit);
+                continue;
+            }
+            // ------------------------
+            // the nearer child goes on top
+            float near_distance = entryDistance(nodes[node.first], origin, inverse_direction,
+                                                hit.distance);
+            float far_distance = entryDistance(nodes[node.first + 1], origin,
+                                               inverse_direction, hit.distance);
+            std::uint32_t near_child = node.first;
+            std::uint32_t far_child = node.first + 1;
+            if (far_distance < near_distance) {
+                std::swap(near_distance, far_distance);
+                std::swap(near_child, far_child);
+            }
+            if (far_distance < FLT_MAX)
+                stack[stack_top++] = far_child;
+            if (near_distance < FLT_MAX)
+                stack[stack_top++] = near_child;
+        }
+        if (hit.triangle == no_triangle)
+            return false;
+        hit.triangle = triangle_ids[hit.triangle];
+        return true;
+    }
+
+    // ------------------------
+    // intersect() of 4 rays at once. Rays that start together and go
+    // in similar directions, like the rays of neighbouring pixels, are
+    // the fastest. Returns the mask of the rays that hit, bit i for
+    // ray i.
+    unsigned intersect4(const glm::vec3 origins[4], const glm::vec3 directions[4],
+                        RayHit hits[4], const float max_distance = FLT_MAX) const
+    {
+#ifdef TRIANGLE_BVH_SSE
+        for (int i = 0; i < 4; ++i)
+            hits[i] = {max_distance, no_triangle, 0.f, 0.f};
+        if (nodes.empty() || corners.empty())
+            return 0;
+        Packet packet;
+        packet.origin_x = _mm_setr_ps(origins[0].x, origins[1].x, origins[2].x, origins[3].x);
+        packet.origin_y = _mm_setr_ps(origins[0].y, origins[1].y, origins[2].y, origins[3].y);
+        packet.origin_z = _mm_setr_ps(origins[0].z, origins[1].z, origins[2].z, origins[3].z);
+        packet.direction_x = _mm_setr_ps(directions[0].x, directions[1].x, directions[2].x,
+                                         directions[3].x);
+        packet.direction_y = _mm_setr_ps(directions[0].y, directions[1].y, directions[2].y,
+                                         directions[3].y);
+        packet.direction_z = _mm_setr_ps(directions[0].z, directions[1].z, directions[2].z,
+                                         directions[3].z);
+        const __m128 one = _mm_set1_ps(1.f);
+        packet.inverse_x = _mm_div_ps(one, packet.direction_x);
+        packet.inverse_y = _mm_div_ps(one, packet.direction_y);
+        packet.inverse_z = _mm_div_ps(one, packet.direction_z);
+        packet.distance = _mm_set1_ps(max_distance);
+        packet.u = _mm_setzero_ps();
+        packet.v = _mm_setzero_ps();
+        packet.triangle = _mm_set1_epi32(-1);
+
+        std::uint32_t stack[stack_size];
+        std::size_t stack_top = 0;
+        if (entryDistance4(nodes.front(), packet) < FLT_MAX)
+            stack[stack_top++] = 0;
+        while (stack_top > 0) {
+            const Node &node = nodes[stack[--stack_top]];
+            if (node.count > 0) {
+                for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+                    intersectTriangle4(i, packet);
+                continue;
+            }
+            float near_distance = entryDistance4(nodes[node.first], packet);
+            float far_distance = entryDistance4(nodes[node.first + 1], packet);
+            std::uint32_t near_child = node.first;
+            std::uint32_t far_child = node.first + 1;
+            if (far_distance < near_distance) {
+                std::swap(near_distance, far_distance);
+                std::swap(near_child, far_child);
+            }
+            if (far_distance < FLT_MAX)
+                stack[stack_top++] = far_child;
+            if (near_distance < FLT_MAX)
+                stack[stack_top++] = near_child;
+        }
+
+        alignas(16) float distances[4], us[4], vs[4];
+        alignas(16) std::int32_t triangles[4];
+        _mm_store_ps(distances, packet.distance);
+        _mm_store_ps(us, packet.u);
+        _mm_store_ps(vs, packet.v);
+        _mm_store_si128(reinterpret_cast <__m128i *>(triangles), packet.triangle);
+        unsigned mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (triangles[i] < 0)
+                continue;
+            hits[i] = {distances[i], triangle_ids[static_cast <std::uint32_t>(triangles[i])],
+                       us[i], vs[i]};
+            mask |= 1u << i;
+        }
+        return mask;
+#else
+        unsigned mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (intersect(origins[i], directions[i], hits[i], max_distance))
+                mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+
+    // -----------------------------
+    // getters
+    std::size_t getNodesNum() const
+    {
+        return nodes.size();
+    }
+
+    std::size_t getTrianglesNum() const
+    {
+        return corners.size();
+    }
+
+    BoundingBox getBounds() const
+    {
+        BoundingBox box;
+        if (!nodes.empty()) {
+            box.min = nodes.front().min;
+            box.max = nodes.front().max;
+        }
+        return box;
+    }
+
+private:
+    // ------------------------
+    // an inner node has count 0, its children are first and first + 1;
+    // a leaf holds count triangles from first
+    struct Node
+    {
+        glm::vec3 min;
+        std::uint32_t first;
+        glm::vec3 max;
+        std::uint32_t count;
+    };
+
+    // ------------------------
+    // a subtree to build: triangles [begin, end) of triangle_ids, its
+    // root goes to nodes[node] at depth
+    struct Task
+    {
+        std::uint32_t node;
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::uint32_t depth;
+    };
+
+    struct Bin
+    {
+        BoundingBox box;
+        std::uint32_t count;
+    };
+
+    struct Split
+    {
+        int axis;
+        float position;
+        float cost;
+    };
+
+#ifdef TRIANGLE_BVH_SSE
+    struct Packet
+    {
+        __m128 origin_x, origin_y, origin_z;
+        __m128 direction_x, direction_y, direction_z;
+        __m128 inverse_x, inverse_y, inverse_z;
+        __m128 distance, u, v;
+        __m128i triangle;
+    };
+#endif
+
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t min_task_triangles = 4096;
+    // ------------------------
+    // nodes at max_depth are leaves whatever their size, so a walk
+    // never has more than stack_size nodes to visit
+    static constexpr std::uint32_t max_depth = 62;
+    static constexpr std::size_t stack_size = max_depth + 2;
+    // ------------------------
+    // the cost of visiting a node against testing a triangle
+    static constexpr float traversal_cost = 1.f;
+    static constexpr float determinant_epsilon = 1e-12f;
+
+    std::vector <Node> nodes;
+    std::vector <std::uint32_t> triangle_ids;
+    std::vector <glm::vec3> corners;
+    std::vector <glm::vec3> edges1;
+    std::vector <glm::vec3> edges2;
+    // ------------------------
+    // used during the build only
+    std::vector <BoundingBox> boxes;
+    std::vector <glm::vec3> centroids;
+    std::vector <Task> tasks;
+
+    // ------------------------
+    // splits the upper levels into nodes until every range is at most
+    // task_triangles large, those become the tasks
+    void splitTasks(const std::size_t task_triangles)
+    {
+        std::vector <Task> to_split;
+        to_split.swap(tasks);
+        while (!to_split.empty()) {
+            const Task task = to_split.back();
+            to_split.pop_back();
+            if (task.end - task.begin <= task_triangles) {
+                tasks.push_back(task);
+                continue;
+            }
+            std::uint32_t middle;
+            if (!splitNode(task, nodes[task.node], middle)) {
+                tasks.push_back(task);
+                continue;
+            }
+            const std::uint32_t left = static_cast <std::uint32_t>(nodes.size());
+            nodes[task.node].first = left;
+            nodes[task.node].count = 0;
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            to_split.push_back({left, task.begin, middle, task.depth + 1});
+            to_split.push_back({left + 1, middle, task.end, task.depth + 1});
+        }
+    }
+
+    void buildSubtree(const Task &root, std::vector <Node> &subtree)
+    {
+        subtree.clear();
+        subtree.push_back(Node());
+        std::vector <Task> to_split(1, {0, root.begin, root.end, root.depth});
+        while (!to_split.empty()) {
+            const Task task = to_split.back();
+            to_split.pop_back();
+            std::uint32_t middle;
+            if (!splitNode(task, subtree[task.node], middle))
+                continue;
+            const std::uint32_t left = static_cast <std::uint32_t>(subtree.size());
+            subtree[task.node].first = left;
+            subtree[task.node].count = 0;
+            subtree.push_back(Node());
+            subtree.push_back(Node());
+            to_split.push_back({left, task.begin, middle, task.depth + 1});
+            to_split.push_back({left + 1, middle, task.end, task.depth + 1});
+        }
+    }
+
+    // ------------------------
+    // sets the bounds of node over the triangles of task and either
+    // makes it a leaf of them (returns false) or partitions them at
+    // middle by the best split
+    bool splitNode(const Task &task, Node &node, std::uint32_t &middle)
+    {
+        const std::uint32_t begin = task.begin;
+        const std::uint32_t end = task.end;
+        BoundingBox box = boxes[triangle_ids[begin]];
+        BoundingBox centroid_box = {centroids[triangle_ids[begin]],
+                                    centroids[triangle_ids[begin]]};
+        for (std::uint32_t i = begin + 1; i < end; ++i) {
+            box.extend(boxes[triangle_ids[i]]);
+            centroid_box.min = glm::min(centroid_box.min, centroids[triangle_ids[i]]);
+            centroid_box.max = glm::max(centroid_box.max, centroids[triangle_ids[i]]);
+        }
+        node.min = box.min;
+        node.max = box.max;
+        node.first = begin;
+        node.count = end - begin;
+        if (node.count <= max_leaf_triangles || task.depth >= max_depth)
+            return false;
+
+        const Split split = findSplit(begin, end, centroid_box);
+        const float leaf_cost = static_cast <float>(node.count) * area(box);
+        if (split.axis < 0 || split.cost + traversal_cost * area(box) >= leaf_cost) {
+            if (node.count <= 4 * max_leaf_triangles)
+                return false;
+            // ------------------------
+            // no split pays off, but the leaf would be too large: cut
+            // at the median of the widest axis
+            const glm::vec3 extent = centroid_box.max - centroid_box.min;
+            const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                                 : (extent.y > extent.z ? 1 : 2);
+            middle = begin + node.count / 2;
+            std::nth_element(triangle_ids.begin() + begin, triangle_ids.begin() + middle,
+                             triangle_ids.begin() + end,
+                             [this, axis](const std::uint32_t a, const std::uint32_t b)
+                             {
+                                 return centroids[a][axis] < centroids[b][axis];
+                             });
+            return true;
+        }
+        middle = static_cast <std::uint32_t>(
+                 std::partition(triangle_ids.begin() + begin, triangle_ids.begin() + end,
+                                [this, &split](const std::uint32_t triangle)
+                                {
+                                    return centroids[triangle][split.axis] < split.position;
+                                }) - triangle_ids.begin());
+        if (middle == begin || middle == end)
+            middle = begin + node.count / 2;
+        return true;
+    }
+
+    // ------------------------
+    // the split between bins with the lowest area * triangles of both
+    // sides, over all three axes. axis is -1 if the centroids are all
+    // at one point.
+    Split findSplit(const std::uint32_t begin, const std::uint32_t end,
+                    const BoundingBox &centroid_box) const
+    {
+        // ------------------------
+        // one pass bins the triangles along all three axes; an axis
+        // without extent puts all of them into its first bin
+        const glm::vec3 extent = centroid_box.max - centroid_box.min;
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; ++axis)
+            scale[axis] = extent[axis] > 0.f ? bins_num / extent[axis] : 0.f;
+        Bin bins[3][bins_num];
+        for (Bin (&axis_bins)[bins_num] : bins) {
+            for (Bin &bin : axis_bins)
+                bin = {{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)}, 0};
+        }
+        for (std::uint32_t i = begin; i < end; ++i) {
+            const std::uint32_t triangle = triangle_ids[i];
+            const glm::vec3 position = (centroids[triangle] - centroid_box.min) * scale;
+            for (int axis = 0; axis < 3; ++axis) {
+                Bin &bin = bins[axis][std::min(bins_num - 1,
+                                               static_cast <unsigned>(position[axis]))];
+                ++bin.count;
+                bin.box.extend(boxes[triangle]);
+            }
+        }
+
+        Split best = {-1, 0.f, FLT_MAX};
+        for (int axis = 0; axis < 3; ++axis) {
+            if (extent[axis] <= 0.f)
+                continue;
+            // ------------------------
+            // sweep from the right for the areas of the right sides,
+            // then from the left for the costs
+            float right_areas[bins_num];
+            std::uint32_t right_counts[bins_num];
+            BoundingBox right_box = bins[axis][bins_num - 1].box;
+            std::uint32_t right_count = 0;
+            for (unsigned bin = bins_num - 1; bin > 0; --bin) {
+                right_box.extend(bins[axis][bin].box);
+                right_count += bins[axis][bin].count;
+                right_areas[bin] = right_count > 0 ? area(right_box) : 0.f;
+                right_counts[bin] = right_count;
+            }
+            BoundingBox left_box = bins[axis][0].box;
+            std::uint32_t left_count = 0;
+            for (unsigned bin = 0; bin + 1 < bins_num; ++bin) {
+                left_box.extend(bins[axis][bin].box);
+                left_count += bins[axis][bin].count;
+                if (left_count == 0 || right_counts[bin + 1] == 0)
+                    continue;
+                const float cost = area(left_box) * left_count +
+                                   right_areas[bin + 1] * right_counts[bin + 1];
+                if (cost < best.cost)
+                    best = {axis, centroid_box.min[axis] + (bin + 1) / scale[axis], cost};
+            }
+        }
+        return best;
+    }
+
+    static float area(const BoundingBox &box)
+    {
+        const glm::vec3 extent = box.max - box.min;
+        return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    // ------------------------
+    // where the ray enters the node, FLT_MAX if it misses it or enters
+    // it past max_distance
+    static float entryDistance(const Node &node, const glm::vec3 &origin,
+                               const glm::vec3 &inverse_direction, const float max_distance)
+    {
+        const glm::vec3 t0 = (node.min - origin) * inverse_direction;
+        const glm::vec3 t1 = (node.max - origin) * inverse_direction;
+        const glm::vec3 near_t = glm::min(t0, t1);
+        const glm::vec3 far_t = glm::max(t0, t1);
+        const float enter = std::max({near_t.x, near_t.y, near_t.z, 0.f});
+        const float leave = std::min({far_t.x, far_t.y, far_t.z, max_distance});
+        return enter <= leave ? enter : FLT_MAX;
+    }
+
+    void intersectTriangle(const std::uint32_t i, const glm::vec3 &origin,
+                           const glm::vec3 &direction, RayHit &hit) const
+    {
+        const glm::vec3 p = glm::cross(direction, edges2[i]);
+        const float determinant = glm::dot(edges1[i], p);
+        if (std::abs(determinant) < determinant_epsilon)
+            return;
+        const float inverse = 1.f / determinant;
+        const glm::vec3 to_origin = origin - corners[i];
+        const float u = glm::dot(to_origin, p) * inverse;
+        if (u < 0.f || u > 1.f)
+            return;
+        const glm::vec3 q = glm::cross(to_origin, edges1[i]);
+        const float v = glm::dot(direction, q) * inverse;
+        if (v < 0.f || u + v > 1.f)
+            return;
+        const float distance = glm::dot(edges2[i], q) * inverse;
+        if (distance > 0.f && distance < hit.distance)
+            hit = {distance, i, u, v};
+    }
+
+#ifdef TRIANGLE_BVH_SSE
+    // ------------------------
+    // the nearest entry of the rays that hit the node before their
+    // current hit, FLT_MAX if none does
+    static float entryDistance4(const Node &node, const Packet &packet)
+    {
+        const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), packet.origin_x),
+                                      packet.inverse_x);
+        const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), packet.origin_x),
+                                      packet.inverse_x);
+        const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), packet.origin_y),
+                                      packet.inverse_y);
+        const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), packet.origin_y),
+                                      packet.inverse_y);
+        const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), packet.origin_z),
+                                      packet.inverse_z);
+        const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), packet.origin_z),
+                                      packet.inverse_z);
+        const __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                                        _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+        const __m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                                        _mm_min_ps(_mm_max_ps(tz0, tz1), packet.distance));
+        const __m128 hit_enter = _mm_or_ps(_mm_and_ps(_mm_cmple_ps(enter, leave), enter),
+                                           _mm_andnot_ps(_mm_cmple_ps(enter, leave),
+                                                         _mm_set1_ps(FLT_MAX)));
+        const __m128 shuffled = _mm_min_ps(hit_enter, _mm_shuffle_ps(hit_enter, hit_enter,
+                                                                     _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(_mm_min_ps(shuffled, _mm_shuffle_ps(shuffled, shuffled,
+                                                                 _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+
+    void intersectTriangle4(const std::uint32_t i, Packet &packet) const
+    {
+        const __m128 e1x = _mm_set1_ps(edges1[i].x);
+        const __m128 e1y = _mm_set1_ps(edges1[i].y);
+        const __m128 e1z = _mm_set1_ps(edges1[i].z);
+        const __m128 e2x = _mm_set1_ps(edges2[i].x);
+        const __m128 e2y = _mm_set1_ps(edges2[i].y);
+        const __m128 e2z = _mm_set1_ps(edges2[i].z);
+
+        // ------------------------
+        // p = cross(direction, edge2)
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(packet.direction_y, e2z),
+                                     _mm_mul_ps(packet.direction_z, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(packet.direction_z, e2x),
+                                     _mm_mul_ps(packet.direction_x, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(packet.direction_x, e2y),
+                                     _mm_mul_ps(packet.direction_y, e2x));
+        const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px),
+                                                         _mm_mul_ps(e1y, py)),
+                                              _mm_mul_ps(e1z, pz));
+        const __m128 absolute = _mm_andnot_ps(_mm_set1_ps(-0.f), determinant);
+        const __m128 inverse = _mm_div_ps(_mm_set1_ps(1.f), determinant);
+
+        const __m128 tx = _mm_sub_ps(packet.origin_x, _mm_set1_ps(corners[i].x));
+        const __m128 ty = _mm_sub_ps(packet.origin_y, _mm_set1_ps(corners[i].y));
+        const __m128 tz = _mm_sub_ps(packet.origin_z, _mm_set1_ps(corners[i].z));
+        const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px),
+                                                          _mm_mul_ps(ty, py)),
+                                               _mm_mul_ps(tz, pz)), inverse);
+
+        // ------------------------
+        // q = cross(to_origin, edge1)
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(packet.direction_x, qx),
+                                                          _mm_mul_ps(packet.direction_y, qy)),
+                                               _mm_mul_ps(packet.direction_z, qz)), inverse);
+        const __m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+                                                                 _mm_mul_ps(e2y, qy)),
+                                                      _mm_mul_ps(e2z, qz)), inverse);
+
+        const __m128 zero = _mm_setzero_ps();
+        __m128 mask = _mm_cmpge_ps(absolute, _mm_set1_ps(determinant_epsilon));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(u, _mm_set1_ps(1.f)));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(distance, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(distance, packet.distance));
+        if (_mm_movemask_ps(mask) == 0)
+            return;
+        packet.distance = _mm_or_ps(_mm_and_ps(mask, distance),
+                                    _mm_andnot_ps(mask, packet.distance));
+        packet.u = _mm_or_ps(_mm_and_ps(mask, u), _mm_andnot_ps(mask, packet.u));
+        packet.v = _mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, packet.v));
+        const __m128i integer_mask = _mm_castps_si128(mask);
+        packet.triangle = _mm_or_si128(_mm_and_si128(integer_mask,
+                                                     _mm_set1_epi32(static_cast <int>(i))),
+                                       _mm_andnot_si128(integer_mask, packet.triangle));
+    }
+#endif
+};
+
+#endif  // TRIANGLE_BVH_HPP
@@ -0,0 +1,87 @@
+// Copyright 2018 Tihran Katolikian
+// helpers of the Shader uniform cache:
+// @ UniformName - 64-bit FNV-1a hash of a uniform name. It can be
+//   computed at compile time (constexpr UniformName) and built piece by
+//   piece without allocating, e.g. for "plight[3].position";
+// @ UniformHandle - typed handle of a uniform resolved once with
+//   Shader::getUniform <T>(name).
+
+#ifndef UNIFORM_HPP
+#define UNIFORM_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "Hash.hpp"
+
+class UniformName
+{
+public:
+    constexpr UniformName(const char *name)
+    :   hash(Hash::fnv1aString(name))
+    {
+    }
+    UniformName(const std::string &name)
+    :   hash(Hash::fnv1a(name))
+    {
+    }
+
+    // ------------------------
+    // appends a string or a decimal number to the hashed name
+    constexpr UniformName &append(const char *part)
+    {
+        hash = Hash::fnv1aString(part, hash);
+        return *this;
+    }
+    constexpr UniformName &append(unsigned number)
+    {
+        char digits[10] = {};
+        int length = 0;
+        do {
+            digits[length++] = static_cast <char>('0' + number % 10);
+            number /= 10;
+        } while (number != 0);
+        while (length > 0) {
+            hash ^= static_cast <unsigned char>(digits[--length]);
+            hash *= Hash::fnv_prime;
+        }
+        return *this;
+    }
+
+    constexpr std::uint64_t getHash() const
+    {
+        return hash;
+    }
+
+private:
+    std::uint64_t hash;
+};
+
+// ------------------------
+// T is the C++ type of the uniform value (int, float, glm::vec3,
+// glm::mat4, ...). A handle is bound to the Shader it was resolved by.
+// An invalid handle (inactive or unknown uniform) is silently ignored
+// when set, same as location -1 in OpenGL.
+template <class T>
+class UniformHandle
+{
+public:
+    UniformHandle() = default;
+
+    bool isValid() const
+    {
+        return slot >= 0;
+    }
+
+private:
+    friend class Shader;
+
+    explicit UniformHandle(const int init_slot)
+    :   slot(init_slot)
+    {
+    }
+
+    int slot = -1;
+};
+
+#endif  // UNIFORM_HPP
@@ -0,0 +1,196 @@
+// Copyright 2018 Tihran Katolikian
+// uniform buffer objects shared by all shader programs:
+// @ std140 mirrors of the GLSL uniform blocks (FrameData, LightData,
+//   MaterialData, ClusterData);
+// @ UniformBlocks::bind - attaches the blocks a program declares to
+//   their fixed binding points;
+// @ UniformBuffer - owns one buffer holding one or more instances of a
+//   block and uploads them with a single glBufferSubData.
+
+#ifndef UNIFORM_BUFFER_HPP
+#define UNIFORM_BUFFER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.hpp"
+#include "shader.hpp"
+
+// ------------------------------
+// std140 layouts. vec3 members are stored as vec4, which is where
+// std140 places them anyway.
+struct FrameBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewer_pos;
+};
+
+// ------------------------------
+// member order matches struct PointLight in SylvanasFS.fs. position.w
+// is the radius of the light, see LightCaster::getRadius().
+struct PointLightBlock
+{
+    glm::vec4 position;
+    glm::vec4 attenuation;
+    glm::vec4 diffuse;
+    glm::vec4 ambient;
+    glm::vec4 specular;
+};
+
+// ------------------------------
+// member order matches struct DirLight in SylvanasFS.fs
+struct DirLightBlock
+{
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    glm::vec4 direction;
+};
+
+struct LightsBlock
+{
+    static constexpr unsigned max_point_lights = 32;
+
+    PointLightBlock plight[max_point_lights];
+    DirLightBlock dlight;
+    // ------------------------------
+    // x - number of point lights in use
+    glm::ivec4 light_counts;
+};
+
+struct MaterialBlock
+{
+    float shininess;
+    float padding[3];
+};
+
+// ------------------------------
+// the cluster grid of clustered lighting, see LightClusters.hpp
+struct ClusterBlock
+{
+    // ------------------------------
+    // x, y, z - clusters across the screen width, height and depth
+    glm::ivec4 grid_size;
+    // ------------------------------
+    // x, y - the slice of view depth d is log(d) * x + y;
+    // z, w - the tile of a fragment is gl_FragCoord.xy * zw
+    glm::vec4 params;
+};
+
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock must match std140");
+static_assert(sizeof(PointLightBlock) == 80, "PointLightBlock must match std140");
+static_assert(sizeof(LightsBlock) == 32 * 80 + 64 + 16, "LightsBlock must match std140");
+static_assert(sizeof(MaterialBlock) == 16, "MaterialBlock must match std140");
+static_assert(sizeof(ClusterBlock) == 32, "ClusterBlock must match std140");
+
+namespace UniformBlocks
+{
+// ------------------------------
+// binding points are fixed, so every program declaring a block reads
+// the same buffer
+enum Binding : GLuint
+{
+    frame_binding = 0,
+    lights_binding = 1,
+    material_binding = 2,
+    clusters_binding = 3
+};
+
+// ------------------------------
+// attaches every known block the program declares to its binding point
+inline void bind(const Shader &shader)
+{
+    static const struct
+    {
+        const char *name;
+        GLuint binding;
+    } blocks[] = {
+        {"FrameData", frame_binding},
+        {"LightData", lights_binding},
+        {"MaterialData", material_binding},
+        {"ClusterData", clusters_binding}
+    };
+    for (const auto &block : blocks) {
+        const GLuint index = glGetUniformBlockIndex(shader.getid(), block.name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(shader.getid(), index, block.binding);
+    }
+}
+}
+
+template <class Block>
+class UniformBuffer
+{
+public:
+    // ------------------------
+    // allocates room for elements_num blocks. Each element starts at a
+    // multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, so any of them can
+    // be bound on its own with bind(element).
+    explicit UniformBuffer(const GLuint binding_point, const std::size_t elements_num = 1)
+    :   binding(binding_point),
+        elements(elements_num)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if (alignment <= 0)
+            alignment = 256;
+        stride = (sizeof(Block) + alignment - 1) / alignment * alignment;
+
+        glGenBuffers(1, &id);
+        GLState::bindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferData(GL_UNIFORM_BUFFER, stride * elements, nullptr, GL_DYNAMIC_DRAW);
+        bind();
+    }
+
+    ~UniformBuffer()
+    {
+        GLState::forgetBuffer(id);
+        glDeleteBuffers(1, &id);
+    }
+
+    UniformBuffer(const UniformBuffer &) = delete;
+    UniformBuffer &operator=(const UniformBuffer &) = delete;
+
+    // ------------------------
+    // uploads one element
+    void update(const Block &block, const std::size_t element = 0)
+    {
+        GLState::bindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferSubData(GL_UNIFORM_BUFFER, element * stride, sizeof(Block), &block);
+    }
+
+    // ------------------------
+    // uploads all elements with one call
+    void update(const std::vector <Block> &blocks)
+    {
+        staging.assign(stride * blocks.size(), 0);
+        for (std::size_t i = 0; i < blocks.size() && i < elements; ++i)
+            std::memcpy(staging.data() + i * stride, &blocks[i], sizeof(Block));
+        GLState::bindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, std::min(staging.size(), stride * elements),
+                        staging.data());
+    }
+
+    // ------------------------
+    // makes the element the one programs read at the binding point
+    void bind(const std::size_t element = 0) const
+    {
+        GLState::bindBufferRange(GL_UNIFORM_BUFFER, binding, id,
+                                 static_cast <GLintptr>(element * stride), sizeof(Block));
+    }
+
+private:
+    unsigned id = 0;
+    GLuint binding;
+    std::size_t elements;
+    std::size_t stride = 0;
+    std::vector <unsigned char> staging;
+};
+
+#endif  // UNIFORM_BUFFER_HPP
@@ -0,0 +1,282 @@
+// Copyright 2018 Tihran Katolikian
+// compile-time vertex format descriptions:
+// @ VertexAttribute - location, component type, component count and
+//   normalization of one attribute. Every concrete attribute also
+//   declares a Storage struct holding its named member, and offsetIn()
+//   telling where that member lands in a vertex struct;
+// @ VertexFormat - a typelist of attributes. It generates the vertex
+//   struct (which inherits all the Storage structs, so members keep
+//   their names), the stride, the offsets and the glVertexAttribPointer
+//   setup, all resolved at compile time;
+// @ the formats we ship: standard (float), compact (quantized),
+//   depth-only and skinned.
+
+#ifndef VERTEX_FORMAT_HPP
+#define VERTEX_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// ------------------------------
+// component type tag for half floats stored as raw 16-bit patterns
+struct HalfFloat
+{
+    std::uint16_t bits;
+};
+
+// ------------------------------
+// C++ component type -> GL type enum
+template <class Component> struct GLComponentType;
+template <> struct GLComponentType <float>         { static constexpr GLenum value = GL_FLOAT; };
+template <> struct GLComponentType <HalfFloat>     { static constexpr GLenum value = GL_HALF_FLOAT; };
+template <> struct GLComponentType <std::int8_t>   { static constexpr GLenum value = GL_BYTE; };
+template <> struct GLComponentType <std::uint8_t>  { static constexpr GLenum value = GL_UNSIGNED_BYTE; };
+template <> struct GLComponentType <std::int16_t>  { static constexpr GLenum value = GL_SHORT; };
+template <> struct GLComponentType <std::uint16_t> { static constexpr GLenum value = GL_UNSIGNED_SHORT; };
+template <> struct GLComponentType <std::int32_t>  { static constexpr GLenum value = GL_INT; };
+template <> struct GLComponentType <std::uint32_t> { static constexpr GLenum value = GL_UNSIGNED_INT; };
+
+// ------------------------------
+// base of every attribute. Integer attributes are fed to the shader
+// as ints (glVertexAttribIPointer), the rest are converted to floats.
+template <GLuint Location, class Component, GLint Count,
+          bool Normalized = false, bool Integer = false>
+struct VertexAttribute
+{
+    static constexpr GLuint location = Location;
+    static constexpr GLenum type = GLComponentType <Component>::value;
+    static constexpr GLint components = Count;
+    static constexpr GLboolean normalized = Normalized ? GL_TRUE : GL_FALSE;
+    static constexpr bool integer = Integer;
+
+    static_assert(Location < 32, "attribute masks are 32 bits wide");
+    static_assert(!(Normalized && Integer), "integer attributes cannot be normalized");
+};
+
+// ------------------------------
+// true if the Storage bases of Vertex sit one after another in the
+// order of Attributes, which is where VertexFormat expects them
+template <class Vertex, class... Attributes>
+constexpr bool storagesPacked()
+{
+    const std::size_t offsets[] = {Attributes::template offsetIn <Vertex>()...};
+    const std::size_t sizes[] = {sizeof(typename Attributes::Storage)...};
+    std::size_t expected = 0;
+    for (std::size_t i = 0; i < sizeof...(Attributes); ++i) {
+        if (offsets[i] != expected)
+            return false;
+        expected += sizes[i];
+    }
+    return true;
+}
+
+template <class... Attributes>
+class VertexFormat
+{
+public:
+    static_assert(sizeof...(Attributes) > 0, "a vertex format needs attributes");
+
+    // ------------------------
+    // the vertex struct generated from the attribute list
+    struct Vertex : Attributes::Storage... {};
+
+    static constexpr std::size_t attributes_num = sizeof...(Attributes);
+    static constexpr std::size_t stride = (sizeof(typename Attributes::Storage) + ...);
+    static constexpr unsigned attribute_mask = ((1u << Attributes::location) | ...);
+
+    static_assert(sizeof(Vertex) == stride,
+                  "attribute storages must be tightly packed, add explicit padding");
+    static_assert(storagesPacked <Vertex, Attributes...>(),
+                  "the compiler laid out the attribute storages out of order");
+
+    // ------------------------
+    // byte offset of the attribute with index I in the list
+    template <std::size_t I>
+    static constexpr std::size_t offset()
+    {
+        constexpr std::size_t sizes[] = {sizeof(typename Attributes::Storage)...};
+        std::size_t result = 0;
+        for (std::size_t i = 0; i < I; ++i)
+            result += sizes[i];
+        return result;
+    }
+
+    // ------------------------
+    // stride of a vertex that only keeps the attributes in mask
+    static constexpr std::size_t strideOf(const unsigned mask)
+    {
+        return ((mask & (1u << Attributes::location) ? sizeof(typename Attributes::Storage) : 0) + ...);
+    }
+
+    // ------------------------
+    // points the currently bound VAO at the currently bound
+    // GL_ARRAY_BUFFER holding vertices interleaved with only the
+    // attributes in mask; the other attributes of the format are
+    // disabled. With the full mask every offset is a constant.
+    static void setupAttributes(const unsigned mask = attribute_mask)
+    {
+        const GLsizei enabled_stride = static_cast <GLsizei>(strideOf(mask));
+        std::size_t offset = 0;
+        (setupAttribute <Attributes>(mask, enabled_stride, offset), ...);
+    }
+
+    // ------------------------
+    // copies the attributes in mask out of src into a tightly
+    // interleaved array (strideOf(mask) bytes per vertex)
+    static void interleave(const Vertex *src, const std::size_t count,
+                           const unsigned mask, unsigned char *dst)
+    {
+        for (std::size_t v = 0; v < count; ++v)
+            (copyAttribute <Attributes>(src[v], mask, dst), ...);
+    }
+
+private:
+    template <class Attribute>
+    static void setupAttribute(const unsigned mask, const GLsizei enabled_stride,
+                               std::size_t &offset)
+    {
+        if (!(mask & (1u << Attribute::location))) {
+            glDisableVertexAttribArray(Attribute::location);
+            return;
+        }
+        glEnableVertexAttribArray(Attribute::location);
+        if (Attribute::integer) {
+            glVertexAttribIPointer(Attribute::location, Attribute::components, Attribute::type,
+                                   enabled_stride, reinterpret_cast <void *>(offset));
+        }
+        else {
+            glVertexAttribPointer(Attribute::location, Attribute::components, Attribute::type,
+                                  Attribute::normalized, enabled_stride,
+                                  reinterpret_cast <void *>(offset));
+        }
+        offset += sizeof(typename Attribute::Storage);
+    }
+
+    template <class Attribute>
+    static void copyAttribute(const Vertex &vertex, const unsigned mask, unsigned char *&dst)
+    {
+        if (!(mask & (1u << Attribute::location)))
+            return;
+        const typename Attribute::Storage &storage = vertex;
+        std::memcpy(dst, &storage, sizeof(storage));
+        dst += sizeof(storage);
+    }
+};
+
+// ------------------------------
+// every attribute can tell the offset of its Storage in a vertex
+// struct by its member name. The vertex structs are not standard
+// layout (several bases have members), where offsetof is only
+// conditionally supported; GCC, Clang and MSVC all support it.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+#endif
+
+// ------------------------------
+// attributes of the float vertex
+struct PositionAttribute : VertexAttribute <0, float, 3>
+{
+    struct Storage { glm::vec3 position; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, position); }
+};
+
+struct NormalAttribute : VertexAttribute <1, float, 3>
+{
+    struct Storage { glm::vec3 normal; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, normal); }
+};
+
+struct TexCoordsAttribute : VertexAttribute <2, float, 2>
+{
+    struct Storage { glm::vec2 texture_coords; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, texture_coords); }
+};
+
+struct TangentAttribute : VertexAttribute <3, float, 3>
+{
+    struct Storage { glm::vec3 tangent; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, tangent); }
+};
+
+struct BitangentAttribute : VertexAttribute <4, float, 3>
+{
+    struct Storage { glm::vec3 bitangent; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, bitangent); }
+};
+
+// ------------------------------
+// attributes of the compact vertex, see CompactVertex.hpp
+struct QuantizedPositionAttribute : VertexAttribute <0, std::uint16_t, 3, true>
+{
+    // [3] is padding to keep 4-byte alignment
+    struct Storage { std::uint16_t position[4]; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, position); }
+};
+
+struct QTangentAttribute : VertexAttribute <1, std::int16_t, 4, true>
+{
+    // read by the shader from the normal slot
+    struct Storage { std::int16_t qtangent[4]; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, qtangent); }
+};
+
+struct HalfTexCoordsAttribute : VertexAttribute <2, HalfFloat, 2>
+{
+    struct Storage { std::uint16_t texture_coords[2]; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, texture_coords); }
+};
+
+// ------------------------------
+// attributes of skinned vertices. Locations 5-9 are reserved for
+// per-instance data.
+struct BoneIndicesAttribute : VertexAttribute <10, std::uint8_t, 4, false, true>
+{
+    struct Storage { std::uint8_t bone_indices[4]; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, bone_indices); }
+};
+
+struct BoneWeightsAttribute : VertexAttribute <11, std::uint8_t, 4, true>
+{
+    struct Storage { std::uint8_t bone_weights[4]; };
+    template <class Vertex>
+    static constexpr std::size_t offsetIn() { return offsetof(Vertex, bone_weights); }
+};
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+// ------------------------------
+// formats
+using StandardVertexFormat = VertexFormat <PositionAttribute, NormalAttribute,
+                                           TexCoordsAttribute, TangentAttribute,
+                                           BitangentAttribute>;
+using CompactVertexFormat = VertexFormat <QuantizedPositionAttribute, QTangentAttribute,
+                                          HalfTexCoordsAttribute>;
+using DepthOnlyVertexFormat = VertexFormat <PositionAttribute>;
+using SkinnedVertexFormat = VertexFormat <PositionAttribute, NormalAttribute,
+                                          TexCoordsAttribute, BoneIndicesAttribute,
+                                          BoneWeightsAttribute>;
+
+using Vertex = StandardVertexFormat::Vertex;
+using CompactVertex = CompactVertexFormat::Vertex;
+
+static_assert(sizeof(Vertex) == 56, "float vertex is 56 bytes");
+static_assert(sizeof(CompactVertex) == 20, "compact vertex is 20 bytes");
+
+#endif  // VERTEX_FORMAT_HPP
@@ -0,0 +1,130 @@
+// Copyright 2018 Tihran Katolikian
+// class VertexWelder - merges duplicated vertices of an indexed
+// triangle list and remaps the indices. Assimp emits three unique
+// vertices for every triangle of an OBJ file unless it is asked to join
+// them, so without this stage the index buffer does no sharing at all.
+//
+// Every attribute of the Vertex (position, normal, texture coords and
+// the tangent frame) is snapped to a grid with cell size epsilon and
+// the snapped values are hashed. Vertices with identical snapped values
+// are merged; the first one encountered is kept.
+
+#ifndef VERTEX_WELDER_HPP
+#define VERTEX_WELDER_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Hash.hpp"
+#include "Mesh.hpp"
+
+class VertexWelder
+{
+public:
+    // ------------------------
+    // numbers reported to the load log
+    struct Stats
+    {
+        std::size_t vertices_before = 0;
+        std::size_t vertices_after = 0;
+
+        std::size_t savedBytes() const
+        {
+            return (vertices_before - vertices_after) * sizeof(Vertex);
+        }
+
+        Stats &operator+=(const Stats &other)
+        {
+            vertices_before += other.vertices_before;
+            vertices_after += other.vertices_after;
+            return *this;
+        }
+    };
+
+    VertexWelder() = delete;
+
+    // ------------------------
+    // welds vertices in place. epsilon == 0 merges bit-identical
+    // vertices only.
+    static Stats weld(std::vector <Vertex> &vertices,
+                      std::vector <unsigned> &indices,
+                      const float epsilon)
+    {
+        Stats stats;
+        stats.vertices_before = vertices.size();
+
+        // ------------------------
+        // open addressing table of indices into the welded vertex
+        // array, sized to the next power of two above 2 * N
+        std::size_t table_size = 1;
+        while (table_size < vertices.size() * 2)
+            table_size <<= 1;
+        std::vector <unsigned> table(table_size, empty_slot);
+
+        std::vector <Key> keys;
+        keys.reserve(vertices.size());
+        std::vector <unsigned> remap(vertices.size());
+        std::vector <Vertex> welded;
+        welded.reserve(vertices.size());
+
+        for (std::size_t i = 0; i < vertices.size(); ++i) {
+            const Key key = makeKey(vertices[i], epsilon);
+            const std::uint64_t hash = Hash::fnv1a(key.data(), sizeof(Key));
+
+            std::size_t slot = hash & (table_size - 1);
+            while (table[slot] != empty_slot &&
+                   std::memcmp(keys[table[slot]].data(), key.data(), sizeof(Key)) != 0)
+                slot = (slot + 1) & (table_size - 1);
+
+            if (table[slot] == empty_slot) {
+                table[slot] = static_cast <unsigned>(welded.size());
+                keys.push_back(key);
+                welded.push_back(vertices[i]);
+            }
+            remap[i] = table[slot];
+        }
+
+        for (unsigned &index : indices)
+            index = remap[index];
+        vertices = std::move(welded);
+
+        stats.vertices_after = vertices.size();
+        return stats;
+    }
+
+private:
+    static constexpr unsigned empty_slot = ~0u;
+    static constexpr std::size_t floats_num = sizeof(Vertex) / sizeof(float);
+    static_assert(sizeof(Vertex) % sizeof(float) == 0,
+                  "Vertex is expected to consist of floats only");
+
+    using Key = std::array <std::int64_t, floats_num>;
+
+    static Key makeKey(const Vertex &vertex, const float epsilon)
+    {
+        float values[floats_num];
+        std::memcpy(values, &vertex, sizeof(values));
+
+        Key key;
+        for (std::size_t i = 0; i < floats_num; ++i) {
+            if (epsilon > 0.f) {
+                key[i] = std::llround(values[i] / epsilon);
+            }
+            else {
+                // ------------------------
+                // exact mode: compare bit patterns, but treat -0 as +0
+                std::int32_t bits;
+                const float value = values[i] == 0.f ? 0.f : values[i];
+                std::memcpy(&bits, &value, sizeof(bits));
+                key[i] = bits;
+            }
+        }
+        return key;
+    }
+};
+
+#endif  // VERTEX_WELDER_HPP
@@ -0,0 +1,744 @@
+/*Copyright [2018] <Tihran Katolikian>*/
+// CPU benchmarks of the renderer's building blocks. They need no GL
+// context.
+// Usage: benchmarks.exe [name]. Without a name every benchmark runs.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Frustum.hpp"
+#include "FrustumCuller.hpp"
+#include "GLState.hpp"
+#include "LightClusters.hpp"
+#include "LooseOctree.hpp"
+#include "RenderQueue.hpp"
+#include "SceneGraph.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleBVH.hpp"
+
+namespace Bench
+{
+// ------------------------------
+// best of repeats runs, in milliseconds
+template <class Function>
+double measure(Function &&function, const int repeats = 5)
+{
+    double best = 0.0;
+    for (int i = 0; i < repeats; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const double elapsed = std::chrono::duration <double, std::milli>(
+                               std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// ------------------------------
+// mock GL backend of the frame benchmarks: the glad entry points the
+// dispatch reaches are pointed at functions that only count their
+// calls. The frame time measured is then the CPU side of the renderer
+// (submission, sorting, the state cache) with a free driver; a real
+// driver adds its own cost to every call that is not elided.
+namespace MockGL
+{
+std::size_t calls = 0;
+
+void APIENTRY useProgram(GLuint) { ++calls; }
+void APIENTRY bindVertexArray(GLuint) { ++calls; }
+void APIENTRY activeTexture(GLenum) { ++calls; }
+void APIENTRY bindTexture(GLenum, GLuint) { ++calls; }
+void APIENTRY drawElements(GLenum, GLsizei, GLenum, const void *) { ++calls; }
+
+void install()
+{
+    glad_glUseProgram = useProgram;
+    glad_glBindVertexArray = bindVertexArray;
+    glad_glActiveTexture = activeTexture;
+    glad_glBindTexture = bindTexture;
+    glad_glDrawElements = drawElements;
+}
+}
+
+// ------------------------------
+// a scene of 256 meshes (one VAO each) sharing 64 materials and 8
+// programs, instanced at random depths. Compares the draw order of
+// submission with the order of the sorted queue: the sort itself
+// (checked against std::sort), the state switches of each order, and
+// a whole frame on the mock backend - submitting the draws, sorting
+// them or not, and issuing them through GLState.
+void renderQueue()
+{
+    constexpr unsigned meshes_num = 256;
+    constexpr unsigned materials_num = 64;
+    constexpr unsigned programs_num = 8;
+    MockGL::install();
+
+    std::cout << "render queue: " << meshes_num << " meshes, " << materials_num
+              << " materials, " << programs_num << " programs\n"
+              << std::setw(8) << "items" << std::setw(11) << "radix ms"
+              << std::setw(14) << "std::sort ms" << std::setw(11) << "switches"
+              << std::setw(8) << "sorted" << std::setw(18) << "frame submitted"
+              << std::setw(10) << "sorted" << std::setw(17) << "GL calls issued"
+              << std::setw(10) << "sorted" << '\n';
+
+    // ------------------------------
+    // what a submitted draw records, GL names start from 1
+    struct Draw
+    {
+        GLuint program;
+        GLuint material;
+        GLuint vao;
+        GLsizei count;
+        float depth;
+    };
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution <unsigned> mesh_distribution(0, meshes_num - 1);
+    std::uniform_real_distribution <float> depth_distribution(0.f, 1.f);
+
+    for (const std::size_t items_num : {1000, 10000, 100000}) {
+        std::vector <Draw> scene(items_num);
+        for (Draw &draw : scene) {
+            const unsigned mesh = mesh_distribution(random);
+            draw = {1 + mesh % programs_num, 1 + mesh % materials_num, 1 + mesh,
+                    static_cast <GLsizei>(300 + 3 * mesh), depth_distribution(random)};
+        }
+
+        std::vector <RenderQueue::SortEntry> submitted(items_num);
+        for (std::size_t i = 0; i < items_num; ++i) {
+            submitted[i].key = RenderQueue::makeKey(RenderQueue::OPAQUE_PASS, scene[i].program,
+                                                    scene[i].material, scene[i].vao,
+                                                    scene[i].depth);
+            submitted[i].item = static_cast <std::uint32_t>(i);
+        }
+
+        std::vector <RenderQueue::SortEntry> sorted;
+        std::vector <RenderQueue::SortEntry> scratch;
+        const double radix_ms = measure([&]()
+        {
+            sorted = submitted;
+            RenderQueue::radixSort(sorted, scratch);
+        });
+        std::vector <RenderQueue::SortEntry> reference;
+        const double std_sort_ms = measure([&]()
+        {
+            reference = submitted;
+            std::sort(reference.begin(), reference.end(),
+                      [](const RenderQueue::SortEntry &a, const RenderQueue::SortEntry &b)
+                      {
+                          return a.key < b.key;
+                      });
+        });
+        // ------------------------------
+        // std::sort is not stable, so only the keys have to agree
+        bool mismatch = false;
+        for (std::size_t i = 0; i < items_num; ++i)
+            mismatch = mismatch || sorted[i].key != reference[i].key;
+
+        const RenderQueue::StateChanges before =
+            RenderQueue::countStateChanges(submitted.data(), submitted.size());
+        const RenderQueue::StateChanges after =
+            RenderQueue::countStateChanges(sorted.data(), sorted.size());
+
+        // ------------------------------
+        // one frame: submission, the sort if asked for, and the draws
+        // in the resulting order through the state cache
+        std::vector <RenderQueue::SortEntry> entries;
+        std::vector <Draw> items;
+        std::size_t frame_calls = 0;
+        auto frame = [&](const bool sort)
+        {
+            entries.clear();
+            items.clear();
+            for (const Draw &draw : scene) {
+                entries.push_back({RenderQueue::makeKey(RenderQueue::OPAQUE_PASS, draw.program,
+                                                        draw.material, draw.vao, draw.depth),
+                                   static_cast <std::uint32_t>(items.size())});
+                items.push_back(draw);
+            }
+            if (sort)
+                RenderQueue::radixSort(entries, scratch);
+            const std::size_t calls_before = MockGL::calls;
+            for (const RenderQueue::SortEntry &entry : entries) {
+                const Draw &draw = items[entry.item];
+                GLState::useProgram(draw.program);
+                GLState::bindTexture2D(0, draw.material);
+                GLState::bindVertexArray(draw.vao);
+                glDrawElements(GL_TRIANGLES, draw.count, GL_UNSIGNED_INT, nullptr);
+            }
+            frame_calls = MockGL::calls - calls_before;
+        };
+        GLState::invalidate();
+        const double submitted_frame_ms = measure([&]() { frame(false); });
+        const std::size_t submitted_calls = frame_calls;
+        GLState::invalidate();
+        const double sorted_frame_ms = measure([&]() { frame(true); });
+        const std::size_t sorted_calls = frame_calls;
+
+        std::cout << std::setw(8) << items_num << std::setw(11) << radix_ms
+                  << std::setw(14) << std_sort_ms << std::setw(11) << before.total()
+                  << std::setw(8) << after.total() << std::setw(18) << submitted_frame_ms
+                  << std::setw(10) << sorted_frame_ms << std::setw(17) << submitted_calls
+                  << std::setw(10) << sorted_calls;
+        if (mismatch)
+            std::cout << " (MISMATCH)";
+        std::cout << '\n';
+    }
+}
+
+// ------------------------------
+// spheres scattered in a 200 units cube around a camera with a 45
+// degree, 0.1 - 100 frustum, so most of them are outside. Compares the
+// per-sphere AoS loop with the SoA kernels on one thread and the best
+// kernel on the thread pool.
+void frustumCulling()
+{
+    const FrustumCuller::Kernel kernels[] = {FrustumCuller::SCALAR, FrustumCuller::SSE,
+                                             FrustumCuller::AVX2};
+    ThreadPool &pool = ThreadPool::shared();
+    const FrustumCuller::Kernel best = FrustumCuller::bestKernel();
+
+    std::cout << "frustum culling: " << pool.getThreadsNum() << " threads, best kernel "
+              << FrustumCuller::getKernelName(best) << '\n'
+              << std::setw(9) << "spheres" << std::setw(10) << "visible"
+              << std::setw(12) << "AoS ms";
+    for (const FrustumCuller::Kernel kernel : kernels) {
+        if (FrustumCuller::isSupported(kernel))
+            std::cout << std::setw(12) << FrustumCuller::getKernelName(kernel) << " ms";
+    }
+    std::cout << std::setw(16) << "parallel ms" << '\n';
+
+    const glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 100.f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f),
+                                       glm::vec3(0.f, 1.f, 0.f));
+    const Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution <float> position_distribution(-100.f, 100.f);
+    std::uniform_real_distribution <float> radius_distribution(0.1f, 2.f);
+
+    for (const std::size_t spheres_num : {1000, 10000, 100000, 1000000}) {
+        std::vector <BoundingSphere> spheres(spheres_num);
+        SphereBoundsSoA bounds;
+        bounds.resize(spheres_num);
+        for (std::size_t i = 0; i < spheres_num; ++i) {
+            spheres[i] = {{position_distribution(random), position_distribution(random),
+                           position_distribution(random)}, radius_distribution(random)};
+            bounds.set(i, spheres[i]);
+        }
+
+        std::vector <std::uint32_t> reference;
+        const double aos_ms = measure([&]()
+        {
+            reference.clear();
+            for (std::size_t i = 0; i < spheres.size(); ++i) {
+                if (frustum.intersects(spheres[i]))
+                    reference.push_back(static_cast <std::uint32_t>(i));
+            }
+        });
+        std::cout << std::setw(9) << spheres_num << std::setw(10) << reference.size()
+                  << std::setw(12) << aos_ms;
+
+        std::vector <std::uint32_t> visible;
+        for (const FrustumCuller::Kernel kernel : kernels) {
+            if (!FrustumCuller::isSupported(kernel))
+                continue;
+            const double kernel_ms = measure([&]()
+            {
+                FrustumCuller::cull(frustum, bounds, visible, kernel);
+            });
+            std::cout << std::setw(15) << kernel_ms;
+            if (visible != reference)
+                std::cout << " (MISMATCH)";
+        }
+        const double parallel_ms = measure([&]()
+        {
+            FrustumCuller::cull(frustum, bounds, visible, best, &pool);
+        });
+        std::cout << std::setw(16) << parallel_ms;
+        if (visible != reference)
+            std::cout << " (MISMATCH)";
+        std::cout << '\n';
+    }
+}
+
+// ------------------------------
+// 1000 characters of 100 nodes each, every node attached to a random
+// ancestor of the node before it. Moves a number of random nodes per
+// frame and updates the graph, on one thread and on the thread pool.
+// Moving every character root recomputes all 100k world matrices,
+// which is what rebuilding the matrices by hand every frame costs.
+void sceneGraph()
+{
+    constexpr std::size_t characters_num = 1000;
+    constexpr std::size_t character_nodes = 100;
+    constexpr std::size_t nodes_num = characters_num * character_nodes;
+    ThreadPool &pool = ThreadPool::shared();
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution <float> offset_distribution(-1.f, 1.f);
+    SceneGraph graph;
+    graph.reserve(nodes_num);
+    std::vector <SceneGraph::NodeId> character_roots;
+    std::vector <SceneGraph::NodeId> path;
+    for (std::size_t character = 0; character < characters_num; ++character) {
+        Transform local;
+        local.translation = glm::vec3(offset_distribution(random) * 100.f, 0.f,
+                                      offset_distribution(random) * 100.f);
+        path.assign(1, graph.addNode(SceneGraph::no_parent, local));
+        character_roots.push_back(path.back());
+        for (std::size_t i = 1; i < character_nodes; ++i) {
+            path.resize(1 + random() % path.size());
+            local.translation = glm::vec3(offset_distribution(random), 0.1f,
+                                          offset_distribution(random));
+            local.rotation = glm::angleAxis(offset_distribution(random),
+                                            glm::vec3(0.f, 0.f, 1.f));
+            path.push_back(graph.addNode(path.back(), local));
+        }
+    }
+    graph.update();
+
+    std::cout << "scene graph: " << nodes_num << " nodes, " << pool.getThreadsNum()
+              << " threads\n"
+              << std::setw(10) << "moved" << std::setw(10) << "updated"
+              << std::setw(8) << "tasks" << std::setw(12) << "serial ms"
+              << std::setw(14) << "parallel ms" << '\n';
+
+    std::uniform_int_distribution <SceneGraph::NodeId> node_distribution(
+        0, static_cast <SceneGraph::NodeId>(nodes_num - 1));
+    for (const std::size_t moved_num : {std::size_t(0), std::size_t(1000), std::size_t(100),
+                                        std::size_t(10), std::size_t(1)}) {
+        std::vector <SceneGraph::NodeId> moved = character_roots;
+        if (moved_num > 0) {
+            moved.resize(moved_num);
+            for (SceneGraph::NodeId &node : moved)
+                node = node_distribution(random);
+        }
+        float offset = 0.f;
+        auto move = [&]()
+        {
+            offset += 0.01f;
+            for (const SceneGraph::NodeId node : moved)
+                graph.setTranslation(node, glm::vec3(offset, 0.1f, 0.f));
+        };
+        const double serial_ms = measure([&]()
+        {
+            move();
+            graph.update();
+        });
+        const std::size_t updated = graph.getStats().updated_nodes;
+        const double parallel_ms = measure([&]()
+        {
+            move();
+            graph.update(&pool);
+        });
+        std::cout << std::setw(10) << (moved_num > 0 ? std::to_string(moved_num) : "all")
+                  << std::setw(10) << updated << std::setw(8) << graph.getStats().tasks
+                  << std::setw(12) << serial_ms << std::setw(14) << parallel_ms << '\n';
+    }
+}
+
+// ------------------------------
+// the spheres of frustumCulling() in a loose octree against scanning
+// all of them: building it, moving 1% of the spheres, one frustum
+// query, 64 sphere queries of radius 10 and 64 rays of length 100
+// from the camera. The rays are also cast on the thread pool, as
+// concurrent readers.
+void spatialIndex()
+{
+    constexpr std::size_t queries_num = 64;
+    constexpr float query_radius = 10.f;
+    constexpr float ray_length = 100.f;
+    ThreadPool &pool = ThreadPool::shared();
+
+    std::cout << "spatial index: loose octree against a scan, " << queries_num
+              << " sphere and ray queries\n"
+              << std::setw(9) << "spheres" << std::setw(11) << "build ms"
+              << std::setw(10) << "move ms" << std::setw(14) << "frustum scan"
+              << std::setw(10) << "octree" << std::setw(13) << "sphere scan"
+              << std::setw(10) << "octree" << std::setw(11) << "ray scan"
+              << std::setw(10) << "octree" << std::setw(11) << "parallel" << '\n';
+
+    const glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 100.f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f),
+                                       glm::vec3(0.f, 1.f, 0.f));
+    const Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution <float> position_distribution(-100.f, 100.f);
+    std::uniform_real_distribution <float> radius_distribution(0.1f, 2.f);
+    std::uniform_real_distribution <float> direction_distribution(-1.f, 1.f);
+
+    std::vector <BoundingSphere> query_spheres(queries_num);
+    std::vector <glm::vec3> ray_directions(queries_num);
+    for (std::size_t i = 0; i < queries_num; ++i) {
+        query_spheres[i] = {{position_distribution(random), position_distribution(random),
+                             position_distribution(random)}, query_radius};
+        ray_directions[i] = glm::normalize(glm::vec3(direction_distribution(random),
+                                                     direction_distribution(random), -1.f));
+    }
+
+    for (const std::size_t spheres_num : {1000, 10000, 100000}) {
+        std::vector <BoundingSphere> spheres(spheres_num);
+        for (BoundingSphere &sphere : spheres)
+            sphere = {{position_distribution(random), position_distribution(random),
+                       position_distribution(random)}, radius_distribution(random)};
+
+        std::unique_ptr <LooseOctree> octree;
+        const double build_ms = measure([&]()
+        {
+            octree.reset(new LooseOctree(glm::vec3(0.f), 100.f));
+            for (std::size_t i = 0; i < spheres_num; ++i)
+                octree->insert(static_cast <std::uint32_t>(i), spheres[i]);
+        });
+        const double move_ms = measure([&]()
+        {
+            for (std::size_t i = 0; i < spheres_num; i += 100) {
+                spheres[i].center.x = -spheres[i].center.x;
+                octree->move(static_cast <std::uint32_t>(i), spheres[i]);
+            }
+        });
+
+        bool mismatch = false;
+        std::vector <std::uint32_t> reference;
+        std::vector <std::uint32_t> found;
+        reference.reserve(spheres_num);
+        found.reserve(spheres_num);
+        auto compare = [&]()
+        {
+            std::sort(found.begin(), found.end());
+            mismatch = mismatch || found != reference;
+        };
+
+        const double frustum_scan_ms = measure([&]()
+        {
+            reference.clear();
+            for (std::size_t i = 0; i < spheres_num; ++i) {
+                if (frustum.intersects(spheres[i]))
+                    reference.push_back(static_cast <std::uint32_t>(i));
+            }
+        });
+        const double frustum_octree_ms = measure([&]()
+        {
+            octree->queryFrustum(frustum, found);
+        });
+        compare();
+
+        std::size_t scan_hits = 0;
+        const double sphere_scan_ms = measure([&]()
+        {
+            scan_hits = 0;
+            for (const BoundingSphere &query : query_spheres) {
+                for (const BoundingSphere &sphere : spheres) {
+                    const float distance = query.radius + sphere.radius;
+                    const glm::vec3 offset = sphere.center - query.center;
+                    if (glm::dot(offset, offset) <= distance * distance)
+                        ++scan_hits;
+                }
+            }
+        });
+        std::size_t octree_hits = 0;
+        const double sphere_octree_ms = measure([&]()
+        {
+            octree_hits = 0;
+            for (const BoundingSphere &query : query_spheres)
+                octree->visitSphere(query, [&octree_hits](std::uint32_t) { ++octree_hits; });
+        });
+        mismatch = mismatch || scan_hits != octree_hits;
+
+        const double ray_scan_ms = measure([&]()
+        {
+            scan_hits = 0;
+            for (const glm::vec3 &direction : ray_directions) {
+                for (const BoundingSphere &sphere : spheres) {
+                    const glm::vec3 offset = -sphere.center;
+                    const float b = glm::dot(offset, direction);
+                    const float c = glm::dot(offset, offset) - sphere.radius * sphere.radius;
+                    if ((c > 0.f && b > 0.f) || b * b - c < 0.f)
+                        continue;
+                    if (std::max(0.f, -b - std::sqrt(b * b - c)) <= ray_length)
+                        ++scan_hits;
+                }
+            }
+        });
+        const double ray_octree_ms = measure([&]()
+        {
+            octree_hits = 0;
+            for (const glm::vec3 &direction : ray_directions)
+                octree->visitRay(glm::vec3(0.f), direction, ray_length,
+                                 [&octree_hits](std::uint32_t, float) { ++octree_hits; });
+        });
+        mismatch = mismatch || scan_hits != octree_hits;
+        std::vector <std::size_t> ray_hits(queries_num);
+        const double ray_parallel_ms = measure([&]()
+        {
+            pool.parallelFor(queries_num, 1, [&](const std::size_t begin, const std::size_t end)
+            {
+                for (std::size_t i = begin; i < end; ++i) {
+                    ray_hits[i] = 0;
+                    octree->visitRay(glm::vec3(0.f), ray_directions[i], ray_length,
+                                     [&ray_hits, i](std::uint32_t, float) { ++ray_hits[i]; });
+                }
+            });
+        });
+        std::size_t parallel_hits = 0;
+        for (const std::size_t hits : ray_hits)
+            parallel_hits += hits;
+        mismatch = mismatch || parallel_hits != octree_hits;
+
+        std::cout << std::setw(9) << spheres_num << std::setw(11) << build_ms
+                  << std::setw(10) << move_ms << std::setw(14) << frustum_scan_ms
+                  << std::setw(10) << frustum_octree_ms << std::setw(13) << sphere_scan_ms
+                  << std::setw(10) << sphere_octree_ms << std::setw(11) << ray_scan_ms
+                  << std::setw(10) << ray_octree_ms << std::setw(11) << ray_parallel_ms;
+        if (mismatch)
+            std::cout << " (MISMATCH)";
+        std::cout << '\n';
+    }
+}
+
+// ------------------------------
+// point lights of radius 1 to 3 scattered in a box in front of the
+// camera, assigned to the clusters of a 16:9 view. A clustered pixel
+// pays for the lights of its cluster, the last columns show how few
+// those are. Random points of the frustum check that every light
+// reaching them is listed in their cluster.
+void lightClusters()
+{
+    constexpr std::size_t points_num = 10000;
+    ThreadPool &pool = ThreadPool::shared();
+
+    std::cout << "light clusters: " << LightClusters::grid_x << 'x' << LightClusters::grid_y
+              << 'x' << LightClusters::grid_z << " clusters, " << pool.getThreadsNum()
+              << " threads\n"
+              << std::setw(8) << "lights" << std::setw(11) << "assign ms"
+              << std::setw(11) << "parallel" << std::setw(10) << "indices"
+              << std::setw(14) << "lit clusters" << std::setw(17) << "lights per lit"
+              << std::setw(6) << "max" << '\n';
+
+    const float fov_y = glm::radians(45.f);
+    const float aspect = 16.f / 9.f;
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.f, 1.f, 5.f), glm::vec3(0.f, 0.f, -10.f),
+                                       glm::vec3(0.f, 1.f, 0.f));
+    std::mt19937 random(42);
+    std::uniform_real_distribution <float> x_distribution(-20.f, 20.f);
+    std::uniform_real_distribution <float> y_distribution(-2.f, 6.f);
+    std::uniform_real_distribution <float> z_distribution(-60.f, 4.f);
+    std::uniform_real_distribution <float> radius_distribution(1.f, 3.f);
+    std::uniform_real_distribution <float> ndc_distribution(-1.f, 1.f);
+    std::uniform_real_distribution <float> depth_distribution(std::log(0.1f), std::log(100.f));
+
+    for (const std::size_t lights_num : {8, 64, 256, 1024, 4096}) {
+        std::vector <PointLightBlock> lights(lights_num);
+        for (PointLightBlock &light : lights)
+            light.position = glm::vec4(x_distribution(random), y_distribution(random),
+                                       z_distribution(random), radius_distribution(random));
+
+        LightClusters clusters;
+        clusters.setProjection(fov_y, aspect, 0.1f, 100.f);
+        const double assign_ms = measure([&]() { clusters.assign(lights, view); });
+        const std::vector <std::uint32_t> serial_indices = clusters.getIndices();
+        const double parallel_ms = measure([&]() { clusters.assign(lights, view, &pool); });
+        bool mismatch = clusters.getIndices() != serial_indices;
+
+        const float tan_y = std::tan(fov_y / 2.f);
+        for (std::size_t i = 0; i < points_num && !mismatch; ++i) {
+            const float depth = std::exp(depth_distribution(random));
+            const glm::vec3 point(ndc_distribution(random) * tan_y * aspect * depth,
+                                  ndc_distribution(random) * tan_y * depth, -depth);
+            const LightClusters::Range &range = clusters.getRanges()[clusters.clusterOf(point)];
+            const auto first = clusters.getIndices().begin() + range.offset;
+            for (std::size_t light = 0; light < lights_num; ++light) {
+                const glm::vec3 offset = glm::vec3(view * glm::vec4(glm::vec3(lights[light].position),
+                                                                    1.f)) - point;
+                if (glm::dot(offset, offset) <= lights[light].position.w * lights[light].position.w &&
+                    std::find(first, first + range.count, light) == first + range.count)
+                    mismatch = true;
+            }
+        }
+
+        const LightClusters::Stats &stats = clusters.getStats();
+        std::cout << std::setw(8) << lights_num << std::setw(11) << assign_ms
+                  << std::setw(11) << parallel_ms << std::setw(10) << stats.indices
+                  << std::setw(14) << stats.lit_clusters << std::setw(17)
+                  << (stats.lit_clusters > 0 ? static_cast <double>(stats.indices) /
+                                               stats.lit_clusters : 0.0)
+                  << std::setw(6) << stats.max_cluster_lights;
+        if (mismatch)
+            std::cout << " (MISMATCH)";
+        std::cout << '\n';
+    }
+}
+
+// ------------------------------
+// a bumpy sphere of about 90k triangles seen by a 256x256 pinhole
+// camera, each 2x2 pixels are one packet for intersect4()
+void triangleBVH()
+{
+    constexpr int rings = 150;
+    constexpr int segments = 300;
+    constexpr int image_size = 256;
+    ThreadPool &pool = ThreadPool::shared();
+
+    std::vector <Vertex> vertices;
+    std::vector <unsigned> indices;
+    vertices.reserve((rings + 1) * (segments + 1));
+    indices.reserve(rings * segments * 6);
+    for (int i = 0; i <= rings; ++i) {
+        for (int j = 0; j <= segments; ++j) {
+            const float theta = glm::radians(180.f * i / rings);
+            const float phi = glm::radians(360.f * j / segments);
+            const float radius = 1.f + 0.05f * std::sin(7.f * theta) * std::cos(5.f * phi);
+            Vertex vertex{};
+            vertex.position = radius * glm::vec3(std::sin(theta) * std::cos(phi),
+                                                 std::cos(theta),
+                                                 std::sin(theta) * std::sin(phi));
+            vertices.push_back(vertex);
+        }
+    }
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            const unsigned corner = static_cast <unsigned>(i * (segments + 1) + j);
+            const unsigned below = corner + segments + 1;
+            indices.insert(indices.end(), {corner, below, corner + 1, corner + 1, below, below + 1});
+        }
+    }
+
+    TriangleBVH bvh;
+    const double serial_build_ms = measure([&]() { bvh.build(vertices, indices); });
+    const double pool_build_ms = measure([&]() { bvh.build(vertices, indices, &pool); });
+
+    const glm::vec3 eye(0.3f, 0.4f, 3.f);
+    std::vector <glm::vec3> directions(image_size * image_size);
+    for (int y = 0; y < image_size; ++y) {
+        for (int x = 0; x < image_size; ++x) {
+            const float u = (x + 0.5f) / image_size - 0.5f;
+            const float v = (y + 0.5f) / image_size - 0.5f;
+            directions[y * image_size + x] = glm::normalize(glm::vec3(u, v, -1.f) - eye / 3.f);
+        }
+    }
+    // ------------------------------
+    // the 4 rays of packet i
+    auto packetDirections = [&directions](const std::size_t i, glm::vec3 packet[4])
+    {
+        const std::size_t x = i % (image_size / 2) * 2;
+        const std::size_t y = i / (image_size / 2) * 2;
+        packet[0] = directions[y * image_size + x];
+        packet[1] = directions[y * image_size + x + 1];
+        packet[2] = directions[(y + 1) * image_size + x];
+        packet[3] = directions[(y + 1) * image_size + x + 1];
+    };
+    const std::size_t rays_num = directions.size();
+    const std::size_t packets_num = rays_num / 4;
+
+    std::vector <RayHit> single_hits(rays_num);
+    const double single_ms = measure([&]()
+    {
+        for (std::size_t i = 0; i < packets_num; ++i) {
+            glm::vec3 packet[4];
+            packetDirections(i, packet);
+            for (int j = 0; j < 4; ++j)
+                bvh.intersect(eye, packet[j], single_hits[i * 4 + j]);
+        }
+    });
+
+    std::vector <RayHit> packet_hits(rays_num);
+    const glm::vec3 origins[4] = {eye, eye, eye, eye};
+    const double packet_ms = measure([&]()
+    {
+        for (std::size_t i = 0; i < packets_num; ++i) {
+            glm::vec3 packet[4];
+            packetDirections(i, packet);
+            bvh.intersect4(origins, packet, &packet_hits[i * 4]);
+        }
+    });
+
+    std::vector <RayHit> parallel_hits(rays_num);
+    const double parallel_ms = measure([&]()
+    {
+        pool.parallelFor(packets_num, 64, [&](const std::size_t begin, const std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i) {
+                glm::vec3 packet[4];
+                packetDirections(i, packet);
+                bvh.intersect4(origins, packet, &parallel_hits[i * 4]);
+            }
+        });
+    });
+
+    bool mismatch = false;
+    std::size_t hits_num = 0;
+    for (std::size_t i = 0; i < rays_num; ++i) {
+        hits_num += single_hits[i].triangle != TriangleBVH::no_triangle;
+        mismatch = mismatch || packet_hits[i].triangle != single_hits[i].triangle ||
+                   parallel_hits[i].triangle != single_hits[i].triangle;
+    }
+
+    auto mrays = [rays_num](const double ms) { return rays_num / (ms * 1000.0); };
+    std::cout << "triangle BVH: " << indices.size() / 3 << " triangles, " << bvh.getNodesNum()
+              << " nodes, " << rays_num << " rays, " << hits_num << " hit\n"
+              << "build " << serial_build_ms << " ms, on " << pool.getThreadsNum()
+              << " threads " << pool_build_ms << " ms\n"
+              << std::setw(10) << "" << std::setw(10) << "ms" << std::setw(12) << "Mrays/s"
+              << std::setw(18) << "Mrays/s per core\n"
+              << std::setw(10) << "single" << std::setw(10) << single_ms
+              << std::setw(12) << mrays(single_ms) << std::setw(17) << mrays(single_ms) << '\n'
+              << std::setw(10) << "packet" << std::setw(10) << packet_ms
+              << std::setw(12) << mrays(packet_ms) << std::setw(17) << mrays(packet_ms) << '\n'
+              << std::setw(10) << "parallel" << std::setw(10) << parallel_ms
+              << std::setw(12) << mrays(parallel_ms)
+              << std::setw(17) << mrays(parallel_ms) / pool.getThreadsNum();
+    if (mismatch)
+        std::cout << " (MISMATCH)";
+    std::cout << '\n';
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)();
+};
+
+const Benchmark benchmarks[] = {
+    {"render_queue", renderQueue},
+    {"frustum_culling", frustumCulling},
+    {"light_clusters", lightClusters},
+    {"spatial_index", spatialIndex},
+    {"scene_graph", sceneGraph},
+    {"triangle_bvh", triangleBVH}
+};
+}
+
+int main(int argc, char **argv)
+{
+    bool found = false;
+    for (const Bench::Benchmark &benchmark : Bench::benchmarks) {
+        if (argc > 1 && std::strcmp(argv[1], benchmark.name) != 0)
+            continue;
+        found = true;
+        benchmark.run();
+        std::cout << '\n';
+    }
+    if (!found) {
+        std::cout << "unknown benchmark " << argv[1] << ", available:";
+        for (const Bench::Benchmark &benchmark : Bench::benchmarks)
+            std::cout << ' ' << benchmark.name;
+        std::cout << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#version 430 core
+
+//-----------------------------------
+// culling of the meshlets of a model, see GPUClusterCuller.hpp. One
+// invocation per meshlet writes its draw command, with no indices if
+// the bounding sphere is outside the frustum or the viewer sees the
+// back of every triangle (the normal cone test of Meshlets.hpp).
+layout (local_size_x = 64) in;
+
+struct Cluster
+{
+    //-----------------------------------
+    // center xyz, radius w
+    vec4 sphere;
+    //-----------------------------------
+    // axis xyz, sine of the half angle w
+    vec4 cone;
+    //-----------------------------------
+    // count, first index, base vertex
+    uvec4 draw;
+};
+
+//-----------------------------------
+// DrawElementsIndirectCommand, 20 bytes in std430
+struct Command
+{
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout (std430, binding = 0) readonly buffer Clusters
+{
+    Cluster clusters[];
+};
+
+layout (std430, binding = 1) writeonly buffer Commands
+{
+    Command commands[];
+};
+
+//-----------------------------------
+// model space planes, pointing inside and normalized
+uniform vec4 planes[6];
+//-----------------------------------
+// model space viewer position
+uniform vec3 viewer_pos;
+uniform int clusters_num;
+uniform int first_command;
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(clusters_num))
+        return;
+
+    Cluster cluster = clusters[index];
+    bool visible = true;
+    for (int i = 0; i < 6; ++i) {
+        if (dot(planes[i].xyz, cluster.sphere.xyz) + planes[i].w < -cluster.sphere.w)
+            visible = false;
+    }
+    vec3 to_center = cluster.sphere.xyz - viewer_pos;
+    if (dot(to_center, cluster.cone.xyz) >= cluster.cone.w * length(to_center) + cluster.sphere.w)
+        visible = false;
+
+    Command command;
+    command.count = visible ? cluster.draw.x : 0u;
+    command.instance_count = 1u;
+    command.first_index = cluster.draw.y;
+    command.base_vertex = int(cluster.draw.z);
+    command.base_instance = 0u;
+    commands[first_command + int(index)] = command;
+}
@@ -0,0 +1,77 @@
+#version 430 core
+
+//-----------------------------------
+// frustum culling of instances, see GPUCuller.hpp. One invocation per
+// (instance, mesh) pair tests the bounding sphere of the mesh against
+// the frustum and appends the visible instance to the region of the
+// mesh in visible_instances, starting at its command's base_instance,
+// counting it in that command.
+layout (local_size_x = 64) in;
+
+struct Instance
+{
+    mat4 model;
+    vec4 tint;
+};
+
+//-----------------------------------
+// DrawElementsIndirectCommand, 20 bytes in std430
+struct Command
+{
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+layout (std430, binding = 1) writeonly buffer VisibleInstances
+{
+    Instance visible_instances[];
+};
+
+layout (std430, binding = 2) buffer Commands
+{
+    Command commands[];
+};
+
+//-----------------------------------
+// model space bounding spheres of the meshes, center xyz and radius w,
+// one per command
+layout (std430, binding = 3) readonly buffer MeshBounds
+{
+    vec4 bounds[];
+};
+
+//-----------------------------------
+// planes point inside and are normalized
+uniform vec4 planes[6];
+uniform int instances_num;
+uniform int commands_num;
+
+void main()
+{
+    uint pair = gl_GlobalInvocationID.x;
+    if (pair >= uint(instances_num * commands_num))
+        return;
+    uint index = pair / uint(commands_num);
+    uint mesh = pair % uint(commands_num);
+
+    mat4 model = instances[index].model;
+    vec4 sphere = bounds[mesh];
+    vec3 center = vec3(model * vec4(sphere.xyz, 1));
+    float scale = sqrt(max(dot(model[0].xyz, model[0].xyz),
+                           max(dot(model[1].xyz, model[1].xyz), dot(model[2].xyz, model[2].xyz))));
+    float radius = sphere.w * scale;
+    for (int i = 0; i < 6; ++i) {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius)
+            return;
+    }
+    uint slot = atomicAdd(commands[mesh].instance_count, 1u);
+    visible_instances[commands[mesh].base_instance + slot] = instances[index];
+}
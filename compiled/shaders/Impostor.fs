@@ -0,0 +1,119 @@
+#version 330 core
+
+//-----------------------------------
+// shades an impostor from the blended views of the atlases, see
+// Impostor.vs. Lighting is the diffuse and ambient part of
+// SylvanasFS.fs, there is no specular map in the atlases.
+// Variant defines as in SylvanasFS.fs: POINT_LIGHTS_NUM, DIR_LIGHT.
+// CLUSTERED_LIGHTS is ignored: distant impostors are lit by the lights
+// in LightData only.
+#ifndef DIR_LIGHT
+#define DIR_LIGHT 1
+#endif
+
+out vec4 frag_color;
+in vec2 frame_uvs[4];
+flat in ivec2 frames[4];
+flat in vec4 frame_weights;
+in vec3 frag_pos;
+flat in mat3 rotation;
+flat in float radius;
+in vec4 tint;
+
+struct DirLight
+{
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    vec3 direction;
+};
+
+struct PointLight
+{
+    vec3 position;
+    vec3 attenuation;
+    vec3 diffuse;
+    vec3 ambient;
+    vec3 specular;
+};
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewer_pos;
+};
+
+layout (std140) uniform LightData
+{
+    PointLight plight[32];
+    DirLight dlight;
+    ivec4 light_counts;
+};
+
+uniform sampler2D albedo_atlas;
+uniform sampler2D normal_depth_atlas;
+uniform float grid_size;
+
+void main()
+{
+    vec4 albedo = vec4(0);
+    vec4 normal_depth = vec4(0);
+    float weight_sum = 0;
+    for (int i = 0; i < 4; ++i) {
+        vec2 uv = frame_uvs[i];
+        if (any(lessThan(uv, vec2(0))) || any(greaterThan(uv, vec2(1))))
+            continue;
+        vec2 atlas_uv = (vec2(frames[i]) + uv) / grid_size;
+        albedo += frame_weights[i] * texture(albedo_atlas, atlas_uv);
+        normal_depth += frame_weights[i] * texture(normal_depth_atlas, atlas_uv);
+        weight_sum += frame_weights[i];
+    }
+    //-----------------------------------
+    // frames whose uvs fall off the quad drop out, the others are
+    // renormalized so coverage and depth keep their scale
+    if (weight_sum == 0)
+        discard;
+    albedo /= weight_sum;
+    normal_depth /= weight_sum;
+    if (albedo.a < 0.5)
+        discard;
+
+    //-----------------------------------
+    // uncovered texels are black, so the color is premultiplied by
+    // the coverage; the zero normal of uncovered texels only shortens
+    // the blended one
+    vec3 diffuse_color = albedo.rgb / albedo.a;
+    vec3 norm = normalize(rotation * (normal_depth.xyz * 2 - 1));
+
+    //-----------------------------------
+    // the baked depth is the distance from the plane touching the
+    // sphere in front of its center, over the diameter
+    vec3 view_dir = normalize(viewer_pos.xyz - frag_pos);
+    float depth = normal_depth.a;
+    vec3 position = frag_pos + view_dir * radius * (1 - 2 * depth);
+    vec4 clip = projection * view * vec4(position, 1);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+#if DIR_LIGHT
+    vec3 light_dir = normalize(-dlight.direction);
+    vec3 result = (dlight.ambient + max(dot(light_dir, norm), 0) * dlight.diffuse) *
+                  diffuse_color;
+#else
+    vec3 result = vec3(0);
+#endif
+
+#ifdef POINT_LIGHTS_NUM
+    for (int i = 0; i < POINT_LIGHTS_NUM; ++i) {
+#else
+    for (int i = 0; i < light_counts.x; ++i) {
+#endif
+        vec3 to_light = plight[i].position - position;
+        float distance = length(to_light);
+        float attenuation = 1.f / (plight[i].attenuation.x + plight[i].attenuation.y * distance +
+                                   plight[i].attenuation.z * (distance * distance));
+        float diff = max(dot(norm, to_light / distance), 0.0);
+        result += (plight[i].ambient + plight[i].diffuse * diff) * diffuse_color * attenuation;
+    }
+    frag_color = vec4(result * tint.rgb, 1);
+}
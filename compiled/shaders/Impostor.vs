@@ -0,0 +1,97 @@
+#version 330 core
+
+//-----------------------------------
+// camera facing quad of an impostor, see ImpostorRenderer in
+// Impostor.hpp. The quad covers the bounding sphere of the instance.
+// The view direction is taken to the model space of the instance and
+// placed on the hemi-octahedral grid of the atlas; the four views
+// around it are blended bilinearly. For every one of them the corner is
+// projected onto the image plane of the view, which gives its texture
+// coordinates inside the frame.
+layout (location = 0) in vec2 aCorner;
+
+//-----------------------------------
+// per-instance attributes (divisor 1), see InstanceSet.hpp
+layout (location = 5) in mat4 aModel;
+layout (location = 9) in vec4 aTint;
+
+out vec2 frame_uvs[4];
+flat out ivec2 frames[4];
+flat out vec4 frame_weights;
+out vec3 frag_pos;
+flat out mat3 rotation;
+flat out float radius;
+out vec4 tint;
+
+//-----------------------------------
+// per-frame data, shared by every program through binding point 0.
+// Updated once per frame (see FrameBlock in UniformBuffer.hpp).
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewer_pos;
+};
+
+//-----------------------------------
+// model space sphere the views were framed on: center xyz, radius w
+uniform vec4 sphere;
+//-----------------------------------
+// views per side of the grid
+uniform float grid_size;
+
+//-----------------------------------
+// direction of the upper hemisphere to a point of [-1, 1]^2, see
+// ImpostorAtlas::frameDirection() for the inverse. Directions below
+// the horizon are taken to it.
+vec2 hemiOctEncode(vec3 d)
+{
+    d.y = max(d.y, 0);
+    d /= max(abs(d.x) + d.y + abs(d.z), 1e-6);
+    return vec2(d.x + d.z, d.x - d.z);
+}
+
+vec3 hemiOctDecode(const vec2 octahedral)
+{
+    vec2 p = vec2(octahedral.x + octahedral.y, octahedral.x - octahedral.y) * 0.5;
+    return normalize(vec3(p.x, 1 - abs(p.x) - abs(p.y), p.y));
+}
+
+void main()
+{
+    float scale = length(aModel[0].xyz);
+    rotation = mat3(aModel) / scale;
+    radius = sphere.w * scale;
+    tint = aTint;
+
+    vec3 center = vec3(aModel * vec4(sphere.xyz, 1));
+    vec3 to_viewer = normalize(viewer_pos.xyz - center);
+    vec3 up_ref = abs(to_viewer.y) > 0.999 ? vec3(0, 0, -1) : vec3(0, 1, 0);
+    vec3 right = normalize(cross(up_ref, to_viewer));
+    vec3 up = cross(to_viewer, right);
+    frag_pos = center + (right * aCorner.x + up * aCorner.y) * radius;
+    gl_Position = projection * view * vec4(frag_pos, 1);
+
+    //-----------------------------------
+    // the corner relative to the sphere center and the view direction,
+    // both in model space
+    vec3 corner = transpose(rotation) * (frag_pos - center) / scale;
+    vec3 view_dir = transpose(rotation) * to_viewer;
+
+    vec2 grid = (hemiOctEncode(view_dir) * 0.5 + 0.5) * (grid_size - 1);
+    vec2 base = clamp(floor(grid), vec2(0), vec2(grid_size - 2));
+    vec2 f = clamp(grid - base, vec2(0), vec2(1));
+    frame_weights = vec4((1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y);
+
+    for (int i = 0; i < 4; ++i) {
+        frames[i] = ivec2(base) + ivec2(i & 1, i >> 1);
+        vec3 direction = hemiOctDecode(vec2(frames[i]) / (grid_size - 1) * 2 - 1);
+        //-----------------------------------
+        // the basis of glm::lookAt() in ImpostorAtlas::renderViews()
+        vec3 frame_up_ref = abs(direction.y) > 0.999 ? vec3(0, 0, -1) : vec3(0, 1, 0);
+        vec3 frame_right = normalize(cross(-direction, frame_up_ref));
+        vec3 frame_up = cross(frame_right, -direction);
+        frame_uvs[i] = vec2(dot(corner, frame_right), dot(corner, frame_up)) /
+                       (2 * sphere.w) + 0.5;
+    }
+}
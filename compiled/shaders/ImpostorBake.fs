@@ -0,0 +1,28 @@
+#version 330 core
+
+//-----------------------------------
+// albedo with coverage in alpha, and the model space normal (scaled to
+// 0..1) with the depth of the orthographic view in alpha
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec4 normal_depth;
+
+in vec2 tex_coords;
+in vec3 normal;
+
+struct Material
+{
+    sampler2D texture_diffuse1;
+};
+
+uniform Material material;
+
+void main()
+{
+    vec4 diffuse_color = texture(material.texture_diffuse1, tex_coords);
+    //-----------------------------------
+    // the same alpha test as SylvanasFS.fs
+    if (diffuse_color.a < 0.1f)
+        discard;
+    albedo = vec4(diffuse_color.rgb, 1);
+    normal_depth = vec4(normalize(normal) * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,39 @@
+#version 330 core
+
+//-----------------------------------
+// renders one view of the impostor atlases, see ImpostorAtlas in
+// Impostor.hpp. The model is drawn in its own space.
+layout (location = 0) in vec3 aPos;
+//-----------------------------------
+// xyz is the normal for the float vertex layout, the compact layout
+// stores the QTangent of the tangent frame here instead
+layout (location = 1) in vec4 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 tex_coords;
+out vec3 normal;
+
+uniform mat4 view_projection;
+
+//-----------------------------------
+// dequantization constants of the compact layout, see SylvanasVS.vs
+uniform vec3 pos_offset;
+uniform vec3 pos_scale;
+uniform bool qtangent_normals;
+
+//-----------------------------------
+// normal is the z axis of the tangent frame rotated by quaternion q
+vec3 qtangentToNormal(const vec4 q)
+{
+    return vec3(2 * (q.x * q.z + q.w * q.y),
+                2 * (q.y * q.z - q.w * q.x),
+                1 - 2 * (q.x * q.x + q.y * q.y));
+}
+
+void main()
+{
+    vec3 position = pos_offset + aPos * pos_scale;
+    tex_coords = aTexCoords;
+    normal = qtangent_normals ? qtangentToNormal(normalize(aNormal)) : aNormal.xyz;
+    gl_Position = view_projection * vec4(position, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+//-----------------------------------
+// color and depth writes are off while the boxes are drawn, only the
+// samples passing the depth test are counted by the query
+out vec4 frag_color;
+
+void main()
+{
+    frag_color = vec4(1.0);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+
+//-----------------------------------
+// corners of the unit cube, see OcclusionBoxRenderer in
+// OcclusionQueries.hpp
+layout (location = 0) in vec3 aPos;
+
+//-----------------------------------
+// model transform of the object times the placement of its box: the
+// unit cube is moved to the box min corner and scaled to its size
+uniform mat4 box_transform;
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewer_pos;
+};
+
+void main()
+{
+    gl_Position = projection * view * box_transform * vec4(aPos, 1.0);
+}
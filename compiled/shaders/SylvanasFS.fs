@@ -1,15 +1,36 @@
 #version 330 core
 
+//-----------------------------------
+// variant defines, injected after #version by ShaderVariants:
+// POINT_LIGHTS_NUM - number of point lights. The light loop gets a
+//   constant bound and is unrolled; without it the loop runs over
+//   light_counts.x.
+// CLUSTERED_LIGHTS - 1 to take the point lights from the list of the
+//   fragment's cluster (see LightClusters.hpp) instead of LightData,
+//   with no limit on their number.
+// DIR_LIGHT - 0 if the directional light is not set.
+// SPECULAR_MAP - 0 if the material has no specular map. The diffuse map
+//   is used instead, which is what the unset sampler (unit 0) read.
+#ifndef DIR_LIGHT
+#define DIR_LIGHT 1
+#endif
+#ifndef SPECULAR_MAP
+#define SPECULAR_MAP 1
+#endif
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 0
+#endif
+
 out vec4 frag_color;
 in vec2 tex_coords;
 in vec3 frag_pos;
 in vec3 normal;
+in vec4 tint;
 
 struct Material
 {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
-    float shininess;
 };
 
 struct DirLight
@@ -30,80 +51,173 @@ struct PointLight
 };
 
 uniform Material material;
-uniform vec3 viewer_pos;
 
-uniform DirLight dlight;
+//-----------------------------------
+// the blocks below live in uniform buffers shared by every program
+// (see UniformBuffer.hpp for the C++ side and the binding points).
+// vec3 members take 16 bytes in std140, the C++ mirrors use vec4.
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewer_pos;
+};
 
 //-----------------------------------
-// we create a static array of light positions.
-// so upper bound of light sources number is
-// 32
-uniform PointLight plight[32];
+// upper bound of point light sources number is 32.
+// light_counts.x is the number of point lights in use, it
+// should never be more then 32. Clustered lighting has no bound.
+layout (std140) uniform LightData
+{
+    PointLight plight[32];
+    DirLight dlight;
+    ivec4 light_counts;
+};
+
 //-----------------------------------
-// current lights value will change every time
-// we use "setUpForShader()" function of class
-// LightCaster. It should never be more then
-// 32
-uniform int current_lights_num;
+// the range of the material buffer holding the material of the
+// mesh being drawn is bound before each draw
+layout (std140) uniform MaterialData
+{
+    float shininess;
+};
+
+#if CLUSTERED_LIGHTS
+//-----------------------------------
+// the cluster grid: grid_size.xyz clusters across the screen width,
+// height and depth. The slice of view depth d is
+// log(d) * cluster_params.x + cluster_params.y, the tile of a fragment
+// is gl_FragCoord.xy * cluster_params.zw.
+layout (std140) uniform ClusterData
+{
+    ivec4 grid_size;
+    vec4 cluster_params;
+};
+
+//-----------------------------------
+// offset and count of the lights of every cluster in cluster_lights,
+// which holds indices of lights in light_data. A light is 5 texels,
+// in the order of struct PointLight.
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_lights;
+uniform samplerBuffer light_data;
+
+PointLight fetchPointLight(const int index)
+{
+    int texel = index * 5;
+    return PointLight(texelFetch(light_data, texel).xyz,
+                      texelFetch(light_data, texel + 1).xyz,
+                      texelFetch(light_data, texel + 2).xyz,
+                      texelFetch(light_data, texel + 3).xyz,
+                      texelFetch(light_data, texel + 4).xyz);
+}
+#endif
 
 //-----------------------------------
 // function calculates the direcional light component of exact direcional
 // light source, using normal parameter for diffuse lighting component
-// calculating and view_dir parameter for specular.
-vec4 calcDirLight(const DirLight dlight, const vec3 normal, const vec3 view_dir);
+// calculating and view_dir parameter for specular. Texture colors are
+// sampled once in main() and passed in.
+vec4 calcDirLight(const DirLight dlight, const vec3 normal, const vec3 view_dir,
+                  const vec4 diffuse_color, const vec4 specular_color);
 
 //-----------------------------------
 // function calculates point light component
 vec4 calcPointLight(const PointLight light, const vec3 normal,
-                    const vec3 frag_pos, const vec3 view_dir);
+                    const vec3 frag_pos, const vec3 view_dir,
+                    const vec4 diffuse_color, const vec4 specular_color);
 
 void main()
 {
-    vec3 view_dir = normalize(viewer_pos - frag_pos);
+    vec3 view_dir = normalize(viewer_pos.xyz - frag_pos);
     vec3 norm = normalize(normal);
-	vec4 result = calcDirLight(dlight, norm, view_dir);
-    for (int i = 0; i < current_lights_num; ++i) {
-        result += calcPointLight(plight[i], norm, frag_pos, view_dir);
+
+    //-----------------------------------
+    // the maps are sampled once per fragment, not once per light
+    vec4 diffuse_color = texture(material.texture_diffuse1, tex_coords);
+#if SPECULAR_MAP
+    vec4 specular_color = texture(material.texture_specular1, tex_coords);
+#else
+    vec4 specular_color = diffuse_color;
+#endif
+
+#if DIR_LIGHT
+    vec4 result = calcDirLight(dlight, norm, view_dir, diffuse_color, specular_color);
+#else
+    //-----------------------------------
+    // an unset directional light only contributes the alpha of its
+    // ambient term. It is kept, so the discard below does not change.
+    vec4 result = vec4(0, 0, 0, diffuse_color.a);
+#endif
+
+#if CLUSTERED_LIGHTS
+    //-----------------------------------
+    // only the lights that reach the cluster of the fragment
+    float depth = -(view * vec4(frag_pos, 1)).z;
+    int slice = clamp(int(log(depth) * cluster_params.x + cluster_params.y), 0,
+                      grid_size.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy * cluster_params.zw), ivec2(0),
+                       grid_size.xy - 1);
+    uvec2 range = texelFetch(cluster_ranges,
+                             (slice * grid_size.y + tile.y) * grid_size.x + tile.x).xy;
+    for (uint i = 0u; i < range.y; ++i) {
+        int light = int(texelFetch(cluster_lights, int(range.x + i)).x);
+        result += calcPointLight(fetchPointLight(light), norm, frag_pos, view_dir,
+                                 diffuse_color, specular_color);
+    }
+#else
+#ifdef POINT_LIGHTS_NUM
+    for (int i = 0; i < POINT_LIGHTS_NUM; ++i) {
+#else
+    for (int i = 0; i < light_counts.x; ++i) {
+#endif
+        result += calcPointLight(plight[i], norm, frag_pos, view_dir,
+                                 diffuse_color, specular_color);
     }
+#endif
     if (result.a < 0.1f)
         discard;
-	frag_color = result;
+    //-----------------------------------
+    // the tint only scales the color, alpha testing is not affected
+    frag_color = vec4(result.rgb * tint.rgb, result.a);
 }
 
-vec4 calcDirLight(const DirLight dlight, const vec3 normal, const vec3 view_dir)
+vec4 calcDirLight(const DirLight dlight, const vec3 normal, const vec3 view_dir,
+                  const vec4 diffuse_color, const vec4 specular_color)
 {
     // ambient component
-    vec4 ambient = vec4(dlight.ambient, 1) * texture(material.texture_diffuse1, tex_coords);
+    vec4 ambient = vec4(dlight.ambient, 1) * diffuse_color;
     
     // calculate light dir. It is required for diffuse component calculating.
     vec3 light_dir = normalize(-dlight.direction);
-    vec4 diffuse = max(dot(light_dir, normal), 0) * vec4(dlight.diffuse, 1) * texture(material.texture_diffuse1, tex_coords);
+    vec4 diffuse = max(dot(light_dir, normal), 0) * vec4(dlight.diffuse, 1) * diffuse_color;
     
     //calculating reflect direction required for next specular component calc.
     vec3 reflect_dir = reflect(-light_dir, normal);
-    float spec = pow(max(dot(reflect_dir, view_dir), 0), material.shininess);
-    vec4 specular = texture(material.texture_specular1, tex_coords) * spec * vec4(dlight.specular, 1);
+    float spec = pow(max(dot(reflect_dir, view_dir), 0), shininess);
+    vec4 specular = specular_color * spec * vec4(dlight.specular, 1);
     
     return ambient + diffuse + specular;
 }
 
 vec4 calcPointLight(const PointLight plight, const vec3 normal,
-                    const vec3 frag_pos, const vec3 view_dir)
+                    const vec3 frag_pos, const vec3 view_dir,
+                    const vec4 diffuse_color, const vec4 specular_color)
 {
     vec3 light_dir = normalize(plight.position - frag_pos);
     // diffuse shading
     float diff = max(dot(normal, light_dir), 0.0);
     // specular shading
     vec3 reflect_dir = reflect(-light_dir, normal);
-    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
     // attenuation
     float distance = length(plight.position - frag_pos);
     float attenuation = 1.f / (plight.attenuation.x + plight.attenuation.y * distance +
   			                   plight.attenuation.z * (distance * distance));
     // combine results
-    vec4 ambient  = vec4(plight.ambient, 1) * texture(material.texture_diffuse1, tex_coords);
-    vec4 diffuse  = vec4(plight.diffuse, 1) * diff * texture(material.texture_diffuse1, tex_coords);
-    vec4 specular = vec4(plight.specular, 1) * spec * texture(material.texture_specular1, tex_coords);
+    vec4 ambient  = vec4(plight.ambient, 1) * diffuse_color;
+    vec4 diffuse  = vec4(plight.diffuse, 1) * diff * diffuse_color;
+    vec4 specular = vec4(plight.specular, 1) * spec * specular_color;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
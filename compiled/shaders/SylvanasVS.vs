@@ -1,22 +1,55 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+//-----------------------------------
+// xyz is the normal for the float vertex layout, the compact layout
+// stores the QTangent of the tangent frame here instead
+layout (location = 1) in vec4 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 tex_coords;
 out vec3 frag_pos;
 out vec3 normal;
+//-----------------------------------
+// color multiplier, white here. Instanced draws take it per instance.
+out vec4 tint;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+//-----------------------------------
+// per-frame data, shared by every program through binding point 0.
+// Updated once per frame (see FrameBlock in UniformBuffer.hpp).
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewer_pos;
+};
+
+//-----------------------------------
+// dequantization constants of the compact layout:
+// position = pos_offset + aPos * pos_scale.
+// They are (0, 0, 0) and (1, 1, 1) for the float layout.
+uniform vec3 pos_offset;
+uniform vec3 pos_scale;
+uniform bool qtangent_normals;
+
+//-----------------------------------
+// normal is the z axis of the tangent frame rotated by quaternion q
+vec3 qtangentToNormal(const vec4 q)
+{
+    return vec3(2 * (q.x * q.z + q.w * q.y),
+                2 * (q.y * q.z - q.w * q.x),
+                1 - 2 * (q.x * q.x + q.y * q.y));
+}
 
 void main()
 {
+    vec3 position = pos_offset + aPos * pos_scale;
     tex_coords = aTexCoords;
-    normal = aNormal;
-    frag_pos = vec3(model * vec4(aPos, 1));
+    tint = vec4(1);
+    normal = qtangent_normals ? qtangentToNormal(normalize(aNormal)) : aNormal.xyz;
+    frag_pos = vec3(model * vec4(position, 1));
     
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * model * vec4(position, 1.0);
 }
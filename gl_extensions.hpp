@@ -0,0 +1,174 @@
+// Copyright 2018 Tihran Katolikian
+// namespace GLExt - entry points beyond the OpenGL 3.3 core profile that
+// glad was generated for. They are loaded at runtime with the same
+// loader as glad and are used only if the context supports them (as a
+// core feature of the context version or as an extension), so the
+// program still runs on a plain 3.3 context:
+// @ program binaries (GL 4.1, ARB_get_program_binary);
+// @ parallel shader compilation (KHR/ARB_parallel_shader_compile);
+// @ multi draw indirect (GL 4.3, ARB_multi_draw_indirect);
+// @ compute shaders with shader storage buffers (GL 4.3,
+//   ARB_compute_shader + ARB_shader_storage_buffer_object);
+// @ conservative occlusion queries (GL 4.3, ARB_ES3_compatibility), an
+//   enum only.
+
+#ifndef GL_EXTENSIONS_HPP
+#define GL_EXTENSIONS_HPP
+
+#include <cstring>
+
+#include <glad/glad.h>
+
+// ------------------------------
+// enums not present in the 3.3 core headers
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+#define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A
+#endif
+
+namespace GLExt
+{
+using GetProgramBinaryProc = void (APIENTRYP)(GLuint program, GLsizei buf_size, GLsizei *length,
+                                              GLenum *binary_format, void *binary);
+using ProgramBinaryProc = void (APIENTRYP)(GLuint program, GLenum binary_format,
+                                           const void *binary, GLsizei length);
+using ProgramParameteriProc = void (APIENTRYP)(GLuint program, GLenum pname, GLint value);
+using MaxShaderCompilerThreadsProc = void (APIENTRYP)(GLuint count);
+using MultiDrawElementsIndirectProc = void (APIENTRYP)(GLenum mode, GLenum type,
+                                                       const void *indirect,
+                                                       GLsizei draw_count, GLsizei stride);
+using DispatchComputeProc = void (APIENTRYP)(GLuint groups_x, GLuint groups_y, GLuint groups_z);
+using MemoryBarrierProc = void (APIENTRYP)(GLbitfield barriers);
+
+// ------------------------------
+// command layout read by multiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+// ------------------------------
+// entry points, nullptr if not supported
+inline GetProgramBinaryProc getProgramBinary = nullptr;
+inline ProgramBinaryProc programBinary = nullptr;
+inline ProgramParameteriProc programParameteri = nullptr;
+inline MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+inline MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+inline DispatchComputeProc dispatchCompute = nullptr;
+inline MemoryBarrierProc memoryBarrier = nullptr;
+
+// ------------------------------
+// feature flags, valid after load()
+inline bool has_program_binary = false;
+inline bool has_parallel_shader_compile = false;
+inline bool has_multi_draw_indirect = false;
+inline bool has_compute_shader = false;
+inline bool has_conservative_occlusion_query = false;
+
+inline GLint context_version = 0;  // major * 10 + minor
+
+// ------------------------------
+// checks the extension string list of the current context
+inline bool isExtensionSupported(const char *name)
+{
+    GLint extensions_num = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions_num);
+    for (GLint i = 0; i < extensions_num; ++i) {
+        const char *extension = reinterpret_cast <const char *>(
+                                glGetStringi(GL_EXTENSIONS, static_cast <GLuint>(i)));
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// ------------------------------
+// loads the entry points for the current context. Call once after
+// gladLoadGLLoader, with the same loader.
+inline void load(GLADloadproc loader)
+{
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    context_version = major * 10 + minor;
+
+    if (context_version >= 41 || isExtensionSupported("GL_ARB_get_program_binary")) {
+        getProgramBinary = reinterpret_cast <GetProgramBinaryProc>(loader("glGetProgramBinary"));
+        programBinary = reinterpret_cast <ProgramBinaryProc>(loader("glProgramBinary"));
+        programParameteri = reinterpret_cast <ProgramParameteriProc>(loader("glProgramParameteri"));
+
+        // ------------------------------
+        // a driver may expose the API but accept no binary format
+        GLint formats_num = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats_num);
+        has_program_binary = getProgramBinary && programBinary && programParameteri &&
+                             formats_num > 0;
+    }
+
+    if (isExtensionSupported("GL_KHR_parallel_shader_compile"))
+        maxShaderCompilerThreads = reinterpret_cast <MaxShaderCompilerThreadsProc>(
+                                   loader("glMaxShaderCompilerThreadsKHR"));
+    else if (isExtensionSupported("GL_ARB_parallel_shader_compile"))
+        maxShaderCompilerThreads = reinterpret_cast <MaxShaderCompilerThreadsProc>(
+                                   loader("glMaxShaderCompilerThreadsARB"));
+    has_parallel_shader_compile = maxShaderCompilerThreads != nullptr;
+    // ------------------------------
+    // let the driver use as many threads as it wants
+    if (has_parallel_shader_compile)
+        maxShaderCompilerThreads(0xFFFFFFFFu);
+
+    if (context_version >= 43 || isExtensionSupported("GL_ARB_multi_draw_indirect"))
+        multiDrawElementsIndirect = reinterpret_cast <MultiDrawElementsIndirectProc>(
+                                    loader("glMultiDrawElementsIndirect"));
+    has_multi_draw_indirect = multiDrawElementsIndirect != nullptr;
+
+    if (context_version >= 43 || (isExtensionSupported("GL_ARB_compute_shader") &&
+                                  isExtensionSupported("GL_ARB_shader_storage_buffer_object"))) {
+        dispatchCompute = reinterpret_cast <DispatchComputeProc>(loader("glDispatchCompute"));
+        memoryBarrier = reinterpret_cast <MemoryBarrierProc>(loader("glMemoryBarrier"));
+    }
+    has_compute_shader = dispatchCompute && memoryBarrier;
+
+    has_conservative_occlusion_query = context_version >= 43 ||
+                                       isExtensionSupported("GL_ARB_ES3_compatibility");
+}
+}
+
+#endif  // GL_EXTENSIONS_HPP
@@ -11,15 +11,32 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <random>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "gl_extensions.hpp"
+#include "GeometryArena.hpp"
+#include "GPUClusterCuller.hpp"
+#include "GPUCuller.hpp"
+#include "GLState.hpp"
+#include "Impostor.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
+#include "CrowdScene.hpp"
+#include "Frustum.hpp"
 #include "Model.hpp"
 #include "LightCaster.h"
+#include "LightClusters.hpp"
+#include "RenderQueue.hpp"
+#include "SceneGraph.hpp"
+#include "ShaderVariants.hpp"
+#include "ThreadPool.hpp"
+#include "UniformBuffer.hpp"
 
 namespace GL
 {  
@@ -32,6 +49,10 @@ void processInput(GLFWwindow *window);
 // screen settings
 unsigned int screen_w = 800;
 unsigned int screen_h = 600;
+// clip planes of the projection, also used for the depth buckets of
+// the render queue and the depth slices of the light clusters
+const float near_plane = 0.1f;
+const float far_plane = 100.f;
 
 // initialize FPS-like camera in a position
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -56,12 +77,96 @@ std::vector <glm::vec3> light_positions({glm::vec3(1.2f, 1.0f, 2),
 glm::vec3 light_direction(-1, -1, -1);
 }
 
-int main() 
+// ------------------------------
+// command line:
+// --crowd N          draw a crowd of N instances instead of the three
+//                    Sylvanases and report CPU submit and frame time
+// --no-instancing    draw the crowd with one draw per instance
+// --arena            suballocate every mesh from one geometry arena
+//                    instead of giving it its own buffers and VAO. The
+//                    arena keeps every float stream, so it leaves out
+//                    the stream stripping of the default upload. GPU
+//                    culling and GPU cluster culling need it and turn
+//                    it on.
+// --gpu-culling      cull the instanced crowd with a compute shader;
+//                    asks for a 4.3 context and falls back to CPU
+//                    culling if it cannot get one
+// --octree           frustum culls the crowd through a loose octree of
+//                    its bounding spheres instead of testing them all
+// --occlusion        software occlusion culling of the crowd on the CPU
+// --occlusion-queries
+//                    hardware occlusion queries on the crowd's bounding
+//                    boxes; asks for a 4.3 context for conservative
+//                    queries and falls back to exact ones
+// --lod-bias X       scales the screen space error allowed to the
+//                    crowd's levels of detail, above 1 coarser
+// --no-lod           draws the crowd at full detail
+// --impostors D      draws crowd members farther than D as impostors
+// --compare-impostors
+//                    switches the impostors off every other second and
+//                    reports the frame time they save
+// --cluster-culling  culls the meshlets of the three Sylvanases by the
+//                    frustum and their normal cones; with a 4.3
+//                    context in a compute shader, otherwise on the CPU
+// --point-lights N   scatters N more small point lights over the scene
+// --clustered-lights lights fragments with the lights of their cluster
+//                    only (see LightClusters.hpp); always on with more
+//                    point lights than LightData holds
+// A left click picks the triangle at the center of the screen and
+// prints it.
+int main(int argc, char **argv)
 {
+    std::size_t crowd_size = 0;
+    bool crowd_instancing = true;
+    bool use_arena = false;
+    bool gpu_culling = false;
+    bool spatial_index = false;
+    bool occlusion_culling = false;
+    bool occlusion_queries = false;
+    bool crowd_lod = true;
+    bool cluster_culling = false;
+    float impostor_distance = 0.f;
+    bool compare_impostors = false;
+    std::size_t extra_lights_num = 0;
+    bool clustered_lights = false;
+    LodSettings lod_settings;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--crowd") == 0 && i + 1 < argc)
+            crowd_size = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--no-instancing") == 0)
+            crowd_instancing = false;
+        else if (std::strcmp(argv[i], "--arena") == 0)
+            use_arena = true;
+        else if (std::strcmp(argv[i], "--gpu-culling") == 0)
+            gpu_culling = true;
+        else if (std::strcmp(argv[i], "--octree") == 0)
+            spatial_index = true;
+        else if (std::strcmp(argv[i], "--occlusion") == 0)
+            occlusion_culling = true;
+        else if (std::strcmp(argv[i], "--occlusion-queries") == 0)
+            occlusion_queries = true;
+        else if (std::strcmp(argv[i], "--lod-bias") == 0 && i + 1 < argc)
+            lod_settings.bias = std::strtof(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--no-lod") == 0)
+            crowd_lod = false;
+        else if (std::strcmp(argv[i], "--cluster-culling") == 0)
+            cluster_culling = true;
+        else if (std::strcmp(argv[i], "--impostors") == 0 && i + 1 < argc)
+            impostor_distance = std::strtof(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--compare-impostors") == 0)
+            compare_impostors = true;
+        else if (std::strcmp(argv[i], "--point-lights") == 0 && i + 1 < argc)
+            extra_lights_num = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--clustered-lights") == 0)
+            clustered_lights = true;
+    }
+    const bool wants_gl43 = gpu_culling || occlusion_queries || cluster_culling;
+    use_arena = use_arena || gpu_culling || cluster_culling;
+
     // ------------------------------
     // glfw: initialize and configure
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, wants_gl43 ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -69,6 +174,11 @@ int main()
     // glfw window creation
     GLFWwindow* window = glfwCreateWindow(GL::screen_w, GL::screen_h,
                                           "Rendering Sylvanas Windrunner", NULL, NULL);
+    if (window == NULL && wants_gl43) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(GL::screen_w, GL::screen_h,
+                                  "Rendering Sylvanas Windrunner", NULL, NULL);
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window\n";
         glfwTerminate();
@@ -90,19 +200,47 @@ int main()
         std::cout << "Failed to initialize GLAD\n";
         return 0;
     }
+    // ------------------------------
+    // entry points newer than OpenGL 3.3, used when available
+    GLExt::load((GLADloadproc)glfwGetProcAddress);
 
     //-------------------------------
-    // enable stencill test
-    glEnable(GL_DEPTH_TEST);
+    // enable stencill test. State changes go through the state cache,
+    // which drops the redundant ones.
+    GLState::enable(GL_DEPTH_TEST);
+
+    // ------------------------------
+    // shader program objects for sylvanas, specialized for the current
+    // set of lights and the material (see ShaderVariants.hpp)
+    ShaderVariants sylvanas_shaders("SylvanasVS.vs", "SylvanasFS.fs");
+    ShaderVariants sylvanas_instanced_shaders("SylvanasInstancedVS.vs", "SylvanasFS.fs");
+    ShaderVariants impostor_shaders("Impostor.vs", "Impostor.fs");
+    ShaderFeatures features;
 
     // ------------------------------
-    // create shader program object for sylvanas
-    Shader sylvanas_shader("SylvanasVS.vs", "SylvanasFS.fs");
+    // per-frame and light data live in uniform buffers shared by all
+    // programs, each one is updated with a single call per frame
+    UniformBuffer <FrameBlock> frame_buffer(UniformBlocks::frame_binding);
+    UniformBuffer <LightsBlock> lights_buffer(UniformBlocks::lights_binding);
     
     // ------------------------------
     // this is out Sylvanas model, loaded via
-    // assimp
-    Model sylvanas_model("resources/sylvanas.obj");
+    // assimp. Only the vertex streams the vertex shader declares are
+    // uploaded, read from its source so that no variant is compiled
+    // before the frame knows which one it needs.
+    // With the geometry arena (--arena) all meshes share one vertex
+    // buffer, one index buffer and one VAO, and the arena keeps every
+    // stream.
+    std::unique_ptr <GeometryArena <StandardVertexFormat>> geometry_arena;
+    if (use_arena)
+        geometry_arena.reset(new GeometryArena <StandardVertexFormat>());
+    ModelLoadOptions load_options;
+    load_options.attribute_mask = Shader::declaredAttributeMask("SylvanasVS.vs");
+    load_options.arena = geometry_arena.get();
+    load_options.build_meshlets = cluster_culling;
+    const std::string sylvanas_path = "resources/sylvanas.obj";
+    Model sylvanas_model(sylvanas_path, false, load_options);
+    features.specular_map = sylvanas_model.hasSpecularMaps();
     
     
     LightCaster lc1;
@@ -119,20 +257,119 @@ int main()
     lc2.setDiffuse({0.f, 0.f, 1.f});
     lc2.setSpecular({0.f, 0.f, 1.f});
     
-    lc1.setUpForShader(sylvanas_shader, 0);
-    lc2.setUpForShader(sylvanas_shader, 1);
-    
     //-------------------------------
-    // we should inform out fragment shader about
-    // the actual number of light casters we use
-    sylvanas_shader.setInt("current_lights_num", 2);
+    // the extra lights are dim and fade out within a few units, so
+    // each one reaches only a part of the scene
+    std::vector <LightCaster> extra_lights(extra_lights_num);
+    std::mt19937 random(7);
+    std::uniform_real_distribution <float> spread(-10.f, 10.f);
+    std::uniform_real_distribution <float> height(-0.5f, 2.f);
+    std::uniform_real_distribution <float> channel(0.f, 0.5f);
+    for (LightCaster &light : extra_lights) {
+        const glm::vec3 color(channel(random), channel(random), channel(random));
+        light.setPosition({spread(random), height(random), spread(random)});
+        light.setAttenuation({1, 2, 20});
+        light.setAmbient(color * 0.1f);
+        light.setDiffuse(color);
+        light.setSpecular(color);
+    }
+    std::vector <PointLightBlock> point_lights({lc1.toBlock(), lc2.toBlock()});
+    for (const LightCaster &light : extra_lights)
+        point_lights.push_back(light.toBlock());
+
+    //-------------------------------
+    // LightData takes the first max_point_lights lights, the cluster
+    // lists take them all. The directional light stays zeroed, as
+    // before.
+    LightsBlock lights = {};
+    const std::size_t block_lights = std::min <std::size_t>(point_lights.size(),
+                                                            LightsBlock::max_point_lights);
+    std::copy(point_lights.begin(), point_lights.begin() + block_lights, lights.plight);
+    lights.light_counts.x = static_cast <int>(block_lights);
+    std::unique_ptr <ClusteredLighting> clustered_lighting;
+    if (clustered_lights || point_lights.size() > LightsBlock::max_point_lights)
+        clustered_lighting.reset(new ClusteredLighting());
+    features.clustered_lights = clustered_lighting != nullptr;
+    double light_assign_ms = 0.0;
 
     //-------------------------------
     // set clear color to dark gray
     glClearColor(0.1f, 0.1f, 0.1f, 1.f);
+    // ------------------------------
+    // draws are collected every frame and issued sorted by state and
+    // depth, see RenderQueue.hpp
+    RenderQueue render_queue;
+    render_queue.setDepthRange(GL::near_plane, GL::far_plane);
+
+    // ------------------------------
+    // crowd benchmark. The camera is lifted to see the whole grid, and
+    // vsync is off so the frame time is not capped.
+    std::unique_ptr <CrowdScene> crowd;
+    std::unique_ptr <GPUCuller> gpu_culler;
+    std::unique_ptr <ImpostorAtlas> impostor_atlas;
+    std::unique_ptr <ImpostorRenderer> impostor_renderer;
+    if (crowd_size > 0) {
+        crowd.reset(new CrowdScene(crowd_size, crowd_instancing,
+                                   sylvanas_model.getBoundingSphere()));
+        if (gpu_culling && crowd_instancing) {
+            if (GPUCuller::isSupported(sylvanas_model))
+                gpu_culler.reset(new GPUCuller(sylvanas_model));
+            else
+                std::cout << "GPU culling needs GL 4.3 and the geometry arena, "
+                          << "culling on the CPU\n";
+            crowd->setGPUCuller(gpu_culler.get());
+        }
+        if (spatial_index)
+            crowd->enableSpatialIndex();
+        if (occlusion_culling)
+            crowd->enableOcclusionCulling(sylvanas_model);
+        if (occlusion_queries)
+            crowd->enableOcclusionQueries();
+        if (crowd_lod)
+            crowd->enableLod(sylvanas_model, lod_settings);
+        if (impostor_distance > 0.f) {
+            impostor_atlas.reset(new ImpostorAtlas(sylvanas_model, sylvanas_path));
+            impostor_renderer.reset(new ImpostorRenderer(*impostor_atlas));
+            crowd->enableImpostors(*impostor_renderer, impostor_distance, compare_impostors);
+        }
+        GL::camera = Camera(glm::vec3(0.0f, 4.0f, 6.0f));
+        glfwSwapInterval(0);
+    }
+
+    // ------------------------------
+    // cluster culling of the three Sylvanases
+    std::unique_ptr <GPUClusterCuller> gpu_cluster_culler;
+    ClusterCuller::Stats cluster_stats = ClusterCuller::Stats();
+    if (cluster_culling && !crowd && GPUClusterCuller::isSupported(sylvanas_model))
+        gpu_cluster_culler.reset(new GPUClusterCuller(sylvanas_model));
+
+    // ------------------------------
+    // the three Sylvanases are instances of the model in the scene
+    // graph, the second one placed relative to the first. World
+    // matrices are recomputed only for the nodes that moved.
+    SceneGraph scene_graph;
+    std::vector <SceneGraph::NodeId> sylvanases;
+    Transform placement;
+    placement.translation = glm::vec3(0.f, -0.5f, 0.f);
+    const SceneGraph::NodeId first_placement = scene_graph.addNode(SceneGraph::no_parent,
+                                                                   placement);
+    sylvanases.push_back(sylvanas_model.instantiate(scene_graph, first_placement));
+    placement.translation = glm::vec3(-1.f, 0.f, 0.f);
+    placement.rotation = glm::angleAxis(glm::radians(90.f), glm::vec3(0.f, 1.f, 0.f));
+    sylvanases.push_back(sylvanas_model.instantiate(scene_graph,
+                         scene_graph.addNode(first_placement, placement)));
+    placement.translation = glm::vec3(1.f, -0.5f, 0.f);
+    placement.rotation = glm::angleAxis(glm::radians(180.f), glm::vec3(0.f, 1.f, 0.f));
+    sylvanases.push_back(sylvanas_model.instantiate(scene_graph,
+                         scene_graph.addNode(SceneGraph::no_parent, placement)));
+
     // ------------------------------
     // render loop starts here
+    unsigned long frames_num = 0;
+    bool pick_held = false;
+    GLState::resetCounters();
     while (!glfwWindowShouldClose(window)) {
+        ++frames_num;
         // ------------------------------
         // per-frame time logic
         float currentFrame = glfwGetTime();
@@ -141,8 +378,8 @@ int main()
 
         GL::processInput(window);
 
-        glEnable(GL_DEPTH_TEST);
-        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        GLState::enable(GL_DEPTH_TEST);
+        GLState::stencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
         // ------------------------------
@@ -153,36 +390,119 @@ int main()
                                                 (GL::screen_w) /
                                                 static_cast <float>
                                                 (GL::screen_h),
-                                                0.1f, 100.0f);
+                                                GL::near_plane, GL::far_plane);
         glm::mat4 view = GL::camera.getViewMatrix();
+        const Frustum frustum = Frustum::fromMatrix(projection * view);
+
+        FrameBlock frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewer_pos = glm::vec4(GL::camera.getPosition(), 1.f);
+        frame_buffer.update(frame);
+        lights_buffer.update(lights);
+        if (clustered_lighting) {
+            const double assign_start = glfwGetTime();
+            clustered_lighting->update(point_lights, view, glm::radians(GL::camera.getZoom()),
+                                       GL::screen_w, GL::screen_h,
+                                       GL::near_plane, GL::far_plane,
+                                       &ThreadPool::shared());
+            light_assign_ms += (glfwGetTime() - assign_start) * 1000.0;
+        }
 
-        glm::mat4 model;
-        model = glm::translate(model, {0, -0.5f, 0});
-        
         // ------------------------------
-        // rendering the sylvanas
-        sylvanas_shader.use();
-        sylvanas_shader.setVec3("viewer_pos", GL::camera.getPosition());
-        sylvanas_shader.setFloat("material.shininess", 8.f);
-
-        sylvanas_shader.setMVP(model, view, projection);
-
-        glStencilMask(0x00);
-        
-        sylvanas_model.draw(sylvanas_shader);
-        
-        model = glm::translate(model, {-1, 0, 0});
-        model = glm::rotate(model, glm::radians(90.f), {0, 1, 0});
-        sylvanas_shader.setMat4("model", model);
-        
-        sylvanas_model.draw(sylvanas_shader);
-        
-        model = glm::mat4();
-        model = glm::translate(model, {1, -0.5f, 0});
-        model = glm::rotate(model, glm::radians(180.f), {0, 1, 0});
-        sylvanas_shader.setMat4("model", model);
-
-        sylvanas_model.draw(sylvanas_shader);
+        // rendering the sylvanas with the variant matching the lights
+        // alive. The directional light is not set. A variant that is
+        // not compiled yet compiles in the background while the last
+        // one keeps drawing.
+        features.point_lights = LightCaster::getLightCastersNum();
+        features.dir_light = false;
+        Shader &sylvanas_shader = sylvanas_shaders.getLatest(features);
+        if (clustered_lighting)
+            clustered_lighting->bind(sylvanas_shader);
+        const glm::vec3 viewer_pos = GL::camera.getPosition();
+
+        GLState::stencilMask(0x00);
+
+        if (crowd) {
+            Shader &sylvanas_instanced_shader = sylvanas_instanced_shaders.getLatest(features);
+            if (clustered_lighting)
+                clustered_lighting->bind(sylvanas_instanced_shader);
+            crowd->update(GL::delta_time);
+            crowd->setLodView(viewer_pos, glm::radians(GL::camera.getZoom()),
+                              static_cast <float>(GL::screen_h));
+            crowd->render(sylvanas_model, sylvanas_instanced_shader, sylvanas_shader,
+                          render_queue, viewer_pos, frustum, projection * view,
+                          impostor_renderer ? &impostor_shaders.getLatest(features) : nullptr);
+            crowd->frameDone(GL::delta_time);
+        }
+        else {
+            // ------------------------------
+            // with cluster culling the Sylvanases are drawn right away,
+            // the visible meshlets only, otherwise through the queue
+            scene_graph.update(&ThreadPool::shared());
+            if (gpu_cluster_culler)
+                gpu_cluster_culler->beginFrame();
+            auto draw_sylvanas = [&](const SceneGraph::NodeId sylvanas)
+            {
+                if (!cluster_culling) {
+                    sylvanas_model.submit(render_queue, sylvanas_shader, scene_graph, sylvanas,
+                                          viewer_pos, RenderQueue::OPAQUE_PASS, &frustum);
+                    return;
+                }
+                const glm::mat4 &transform = scene_graph.getWorld(sylvanas);
+                static constexpr UniformName model_name("model");
+                sylvanas_shader.use();
+                sylvanas_shader.setMat4(model_name, transform);
+                if (gpu_cluster_culler)
+                    gpu_cluster_culler->draw(sylvanas_shader, projection * view, transform,
+                                             viewer_pos);
+                else
+                    sylvanas_model.drawClusters(sylvanas_shader, projection * view, transform,
+                                                viewer_pos, &cluster_stats);
+            };
+
+            for (const SceneGraph::NodeId sylvanas : sylvanases)
+                draw_sylvanas(sylvanas);
+
+            render_queue.flush();
+        }
+
+        // ------------------------------
+        // picking with the triangle BVHs of the model, along the view
+        // direction up to the far plane
+        const bool pick_pressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        if (pick_pressed && !pick_held) {
+            const glm::vec3 pick_direction = GL::camera.getFront();
+            ModelHit hit;
+            std::uint32_t picked = 0;
+            bool found = false;
+            if (crowd) {
+                found = crowd->pick(sylvanas_model, viewer_pos, pick_direction, GL::far_plane,
+                                    picked, hit);
+            }
+            else {
+                hit.hit.distance = GL::far_plane;
+                for (std::size_t i = 0; i < sylvanases.size(); ++i) {
+                    const glm::mat4 inverse = glm::inverse(scene_graph.getWorld(sylvanases[i]));
+                    ModelHit sylvanas_hit;
+                    if (sylvanas_model.intersect(glm::vec3(inverse * glm::vec4(viewer_pos, 1.f)),
+                                                 glm::mat3(inverse) * pick_direction,
+                                                 sylvanas_hit, hit.hit.distance)) {
+                        hit = sylvanas_hit;
+                        picked = static_cast <std::uint32_t>(i);
+                        found = true;
+                    }
+                }
+            }
+            if (found)
+                std::cout << "Picked " << (crowd ? "crowd member " : "Sylvanas ") << picked
+                          << ": mesh " << hit.mesh << ", triangle " << hit.hit.triangle
+                          << " at " << hit.hit.distance << " (barycentrics " << hit.hit.u
+                          << ", " << hit.hit.v << ")\n";
+            else
+                std::cout << "Picked nothing\n";
+        }
+        pick_held = pick_pressed;
 
         // ------------------------------
         // glfw: swap buffers and poll IO events (keys pressed/released,
@@ -191,6 +511,33 @@ int main()
         glfwPollEvents();
     }
 
+    if (frames_num > 0) {
+        std::cout << "GLState: " << GLState::getCounters().issued / frames_num
+                  << " state calls issued, " << GLState::getCounters().elided / frames_num
+                  << " elided per frame\n";
+    }
+    if (frames_num > 0 && clustered_lighting) {
+        const LightClusters::Stats &light_stats = clustered_lighting->getClusters().getStats();
+        std::cout << "Clustered lighting: " << light_stats.lights << " point lights, "
+                  << light_stats.indices << " light indices in " << light_stats.lit_clusters
+                  << " of " << LightClusters::clusters_num << " clusters, at most "
+                  << light_stats.max_cluster_lights << " per cluster, assigned in "
+                  << light_assign_ms / frames_num << " ms per frame\n";
+    }
+    if (frames_num > 0 && cluster_culling && !crowd) {
+        if (gpu_cluster_culler) {
+            std::cout << "Clusters: " << gpu_cluster_culler->getClustersNum()
+                      << " meshlets culled in a compute shader\n";
+        }
+        else {
+            std::cout << "Clusters: " << cluster_stats.frustum_culled / frames_num << " of "
+                      << cluster_stats.meshlets / frames_num << " meshlets culled by the frustum, "
+                      << cluster_stats.cone_culled / frames_num << " by their normal cones, "
+                      << cluster_stats.drawn_triangles / frames_num << " of "
+                      << cluster_stats.triangles / frames_num << " triangles drawn per frame\n";
+        }
+    }
+
     // ------------------------------
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
@@ -3,7 +3,12 @@
    Modified by Tihran Katolikian 06.07.2018
    Updates:
    - code style changed;
-   - member values incapsulated, getters and setters created;*/
+   - member values incapsulated, getters and setters created;
+   - active attributes and uniforms are reflected at link time, uniform
+     names are looked up by hash and redundant uniform writes are skipped;
+   - linked programs are cached as program binaries, compilation can be
+     asynchronous (KHR_parallel_shader_compile);
+   - compute programs (GL 4.3);*/
 
 #ifndef SHADER_HPP
 #define SHADER_HPP
@@ -11,219 +16,211 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include "gl_extensions.hpp"
+#include "GLState.hpp"
+#include "Hash.hpp"
+#include "Uniform.hpp"
+
 class Shader
 {
 public:
     // ------------------------
-    // constructor generates the shader on the fly
-    Shader(const char *vs_name, const char *fs_name, const char *gs_name = nullptr)
-    {
-        std::string vs_code;
-        std::string fs_code;
-        std::string gs_code;
-        
-        std::ifstream vs_source;
-        std::ifstream fs_source;
-        std::ifstream gs_source;
-        
-        // --------------------------
-        // ensure ifstream objects can throw exceptions:
-        vs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try {
-            // ---------------------
-            // open files
-            vs_source.open(std::string("shaders/") + vs_name);
-            fs_source.open(std::string("shaders/") + fs_name);
-            
-            std::stringstream vs_stream, fs_stream;
-            
-            // --------------------------
-            // read file's buffer contents into streams
-            vs_stream << vs_source.rdbuf();
-            fs_stream << fs_source.rdbuf();	
-
-            // --------------------
-            // close file handlers
-            vs_source.close();
-            fs_source.close();
-            
-            // ------------------- 
-            // convert stream into string
-            vs_code = vs_stream.str();
-            fs_code = fs_stream.str();			
-            
-            // -------------------
-            // if geometry shader path is present, also load a geometry shader
-            if(gs_name != nullptr) {
-                gs_source.open(std::string("shaders") + gs_name);
-                std::stringstream gs_stream;
-                gs_stream << gs_source.rdbuf();
-                gs_source.close();
-                gs_code = gs_stream.str();
-            }
-        }
-        catch (std::ifstream::failure &e) {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ\n"
-                      << e.what() << '\n';
-        }
+    // BLOCKING links the program in the constructor. ASYNC only starts
+    // compilation: with KHR_parallel_shader_compile the driver compiles
+    // on its own threads and isReady() polls for completion, so the
+    // caller can keep rendering meanwhile. Without the extension ASYNC
+    // behaves as BLOCKING.
+    enum CompileMode {BLOCKING, ASYNC};
 
-        // --------------------
-        // compile shaders
-        unsigned int vertex, fragment;
-
-        // --------------
-        // vertex shader
-        const GLchar *vs_str = vs_code.c_str();
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vs_str, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, VERTEX);
-        
-        // --------------
-        // fragment Shader
-        const GLchar *fs_str = fs_code.c_str();
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fs_str, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, FRAGMENT);
-        
+    // ------------------------
+    // constructor generates the shader on the fly. A program binary
+    // cached by a previous run is used instead of the sources when it
+    // matches them and the driver still accepts it.
+    // defines ("#define NAME value" lines) are inserted into every stage
+    // right after its #version line.
+    Shader(const char *vs_name, const char *fs_name, const char *gs_name = nullptr,
+           const CompileMode mode = BLOCKING, const std::string &defines = std::string())
+    :   start_time(std::chrono::steady_clock::now())
+    {
+        std::vector <Source> sources;
+        sources.push_back({GL_VERTEX_SHADER, VERTEX, injectDefines(readSource(vs_name), defines)});
+        sources.push_back({GL_FRAGMENT_SHADER, FRAGMENT,
+                           injectDefines(readSource(fs_name), defines)});
+        name = std::string(vs_name) + '+' + fs_name;
         // -----------------------
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
-        
         if (gs_name != nullptr) {
-            const GLchar *gs_str = gs_code.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gs_str, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, GEOMETRY);
+            sources.push_back({GL_GEOMETRY_SHADER, GEOMETRY,
+                               injectDefines(readSource(gs_name), defines)});
+            name += std::string("+") + gs_name;
         }
-        
-        // ------------------
-        // shader Program
-        id = glCreateProgram();
-        glAttachShader(id, vertex);
-        glAttachShader(id, fragment);
-        
-        if (gs_name != nullptr)
-            glAttachShader(id, geometry);
-        
-        glLinkProgram(id);
-        checkCompileErrors(id, PROGRAM);
-        
-        // -----------------------
-        // delete the shaders as they're linked into our program now
-        // and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (gs_name != nullptr)
-            glDeleteShader(geometry);
+        build(sources, defines, mode);
+    }
+
+    // ------------------------
+    // compute program, needs GLExt::has_compute_shader. Always linked
+    // in the constructor.
+    enum ComputeStage {COMPUTE_STAGE};
+    Shader(const ComputeStage, const char *cs_name, const std::string &defines = std::string())
+    :   start_time(std::chrono::steady_clock::now())
+    {
+        name = cs_name;
+        build({{GL_COMPUTE_SHADER, COMPUTE, injectDefines(readSource(cs_name), defines)}},
+              defines, BLOCKING);
     }
     
     ~Shader() = default;
+
+    // --------------------
+    // true once the program is linked and reflected. Never blocks
+    // when the driver compiles in parallel.
+    bool isReady() const
+    {
+        if (!link_pending)
+            return true;
+        if (GLExt::has_parallel_shader_compile) {
+            GLint completed = GL_FALSE;
+            glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed)
+                return false;
+        }
+        finishLink();
+        return true;
+    }
+
+    // --------------------
+    // blocks until the program is linked
+    void wait() const
+    {
+        if (link_pending)
+            finishLink();
+    }
     
     // --------------------
-    // activate the shader
+    // activate the shader. A program still compiling is waited for.
     void use() const
     { 
-        glUseProgram(id); 
+        wait();
+        GLState::useProgram(id);
     }
     
     // ---------------------------
-    // utility uniform functions
-    void setBool(const std::string &name, const bool value) const
+    // utility uniform functions. Names are looked up in the table of
+    // active uniforms built at link time, and the last written value
+    // of every uniform is cached, so setting the same value again
+    // issues no GL call.
+    void setBool(const UniformName &name, const bool value) const
     {         
-        glUniform1i(glGetUniformLocation(id, name.c_str()),
-                    static_cast <int>(value)); 
+        setValue(findUniform(name), static_cast <int>(value));
     }
     // --------------------------
-    void setInt(const std::string &name, const int value) const
+    void setInt(const UniformName &name, const int value) const
     { 
-        glUniform1i(glGetUniformLocation(id, name.c_str()), value);
+        setValue(findUniform(name), value);
     }
     // --------------------------
-    void setFloat(const std::string &name, const float value) const
+    void setFloat(const UniformName &name, const float value) const
     { 
-        glUniform1f(glGetUniformLocation(id, name.c_str()), value);
+        setValue(findUniform(name), value);
     }
     
 #ifdef OPENGL_SHADER_DOUBLE_PRESISION
     // --------------------------
     // WARNING! Double-presision on GPU only supported in versions 4 and higher!
-    void setDouble(const std::string &name, const double &value)
+    void setDouble(const UniformName &name, const double &value)
     {
         //may not work in versions lesser then 4
-        glUniform1d(glGetUniformLocation(id, name.c_str()), value);
+        glUniform1d(locationOf(name), value);
     }
     
-    void setVec2d(const std::string &name, const double &a, const double &b)
+    void setVec2d(const UniformName &name, const double &a, const double &b)
     {
         //may not work in versions lesser then 4
-        glUniform2d(glGetUniformLocation(id, name.c_str()), a, b);
+        glUniform2d(locationOf(name), a, b);
     }
 #endif
     
     // -------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const UniformName &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]); 
+        setValue(findUniform(name), value);
     }
-    void setVec2(const std::string &name, const float x, const float y) const
+    void setVec2(const UniformName &name, const float x, const float y) const
     { 
-        glUniform2f(glGetUniformLocation(id, name.c_str()), x, y);
+        setValue(findUniform(name), glm::vec2(x, y));
     }
     // -------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const UniformName &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+        setValue(findUniform(name), value);
     }
-    void setVec3(const std::string &name, const float x, 
+    void setVec3(const UniformName &name, const float x, 
                  const float y, const float z) const
     {
-        glUniform3f(glGetUniformLocation(id, name.c_str()), x, y, z);
+        setValue(findUniform(name), glm::vec3(x, y, z));
     }
     // -------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const UniformName &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+        setValue(findUniform(name), value);
     }
-    void setVec4(const std::string &name, const float x, const float y,
+    void setVec4(const UniformName &name, const float x, const float y,
                  const float z, const float w) 
     {
-        glUniform4f(glGetUniformLocation(id, name.c_str()), x, y, z, w); 
+        setValue(findUniform(name), glm::vec4(x, y, z, w));
     }
     // -------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(const UniformName &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setValue(findUniform(name), mat);
     }
     // -------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(const UniformName &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setValue(findUniform(name), mat);
     }
     // -------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(const UniformName &name, const glm::mat4 &mat) const
+    {
+        setValue(findUniform(name), mat);
+    }
+
+    // -------------------------
+    // typed handles: resolve once, set many times without any lookup
+    template <class T>
+    UniformHandle <T> getUniform(const UniformName &name) const
+    {
+        return UniformHandle <T>(findUniform(name));
+    }
+
+    template <class T>
+    void set(const UniformHandle <T> &handle, const T &value) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setValue(handle.slot, value);
     }
     
     void setMVP(const glm::mat4 &m, const glm::mat4 &v, const glm::mat4 &p)
     {
-        setMat4("model", m);
-        setMat4("view", v);
-        setMat4("projection", p);
+        static constexpr UniformName model_name("model");
+        static constexpr UniformName view_name("view");
+        static constexpr UniformName projection_name("projection");
+        setMat4(model_name, m);
+        setMat4(view_name, v);
+        setMat4(projection_name, p);
     }
     
     // -----------------
@@ -233,14 +230,487 @@ public:
         return id;
     }
 
+    // -----------------
+    // bit N is set if the program reads vertex attribute location N
+    unsigned getAttributeMask() const
+    {
+        wait();
+        return attribute_mask;
+    }
+
+    // -----------------
+    // the same mask read from the "layout (location = N) in" inputs a
+    // vertex shader file declares, for when the mask is needed before
+    // any program using the shader is built. Unlike getAttributeMask()
+    // it also counts inputs the compiler would find unused.
+    static unsigned declaredAttributeMask(const char *vertex_file_name)
+    {
+        std::istringstream source(readSource(vertex_file_name));
+        unsigned mask = 0;
+        std::string line;
+        while (std::getline(source, line)) {
+            line = line.substr(0, line.find("//"));
+            const std::size_t layout = line.find("layout");
+            const std::size_t location = line.find("location", layout);
+            const std::size_t equals = line.find('=', location);
+            const std::size_t close = line.find(')', equals);
+            if (layout == std::string::npos || location == std::string::npos ||
+                equals == std::string::npos || close == std::string::npos)
+                continue;
+            std::istringstream declaration(line.substr(close + 1));
+            std::string qualifier, type;
+            if (!(declaration >> qualifier >> type) || qualifier != "in")
+                continue;
+            const int first = std::atoi(line.c_str() + equals + 1);
+            int columns = 1;
+            if (type == "mat2")
+                columns = 2;
+            else if (type == "mat3")
+                columns = 3;
+            else if (type == "mat4")
+                columns = 4;
+            for (int slot = first; slot < first + columns && slot < 32; ++slot)
+                mask |= 1u << slot;
+        }
+        return mask;
+    }
+
+    // -----------------
+    // true if the program was restored from the program binary cache
+    bool isFromBinaryCache() const
+    {
+        return from_binary;
+    }
+
+    // -----------------
+    // glUniform* calls issued and skipped because the value was
+    // already set
+    std::size_t getUniformUploads() const
+    {
+        return uniform_uploads;
+    }
+
+    std::size_t getUniformUploadsElided() const
+    {
+        return uniform_uploads_elided;
+    }
+
 private:
-    enum Type {PROGRAM, VERTEX, FRAGMENT, GEOMETRY};
+    enum Type {PROGRAM, VERTEX, FRAGMENT, GEOMETRY, COMPUTE};
+
+    struct Source
+    {
+        GLenum stage_type;
+        Type type;
+        std::string code;
+    };
 
     // -----------------------
     // shader program id
     unsigned int id;
+
+    // -----------------------
+    // program binary cache: one file per combination of shader files,
+    // its content is keyed by the sources and the driver
+    std::string name;
+    std::string binary_path;
+    std::uint64_t binary_key = 0;
+    bool from_binary = false;
+
+    // -----------------------
+    // shaders of a link that has not been finished yet. The link is
+    // finished lazily by const queries, hence mutable.
+    struct Stage
+    {
+        unsigned id;
+        Type type;
+    };
+    mutable std::vector <Stage> stages;
+    mutable bool link_pending = false;
+    std::chrono::steady_clock::time_point start_time;
+
+    // -----------------------
+    // active vertex attribute locations of the linked program
+    mutable unsigned attribute_mask = 0;
+
+    // -----------------------
+    // active uniform of the linked program with its last written value
+    struct UniformSlot
+    {
+        std::uint64_t hash;
+        GLint location;
+        GLenum type;
+        bool cached;
+        unsigned char value[sizeof(glm::mat4)];
+    };
+
+    // -----------------------
+    // uniform_table is an open addressing hash table (power of two
+    // size, linear probing) of indices into uniforms; -1 is empty
+    mutable std::vector <UniformSlot> uniforms;
+    mutable std::vector <int> uniform_table;
+    mutable std::size_t uniform_uploads = 0;
+    mutable std::size_t uniform_uploads_elided = 0;
+
+    int findUniform(const UniformName &name) const
+    {
+        wait();
+        if (uniform_table.empty())
+            return -1;
+        const std::uint64_t hash = name.getHash();
+        const std::size_t mask = uniform_table.size() - 1;
+        for (std::size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+            const int index = uniform_table[slot];
+            if (index < 0 || uniforms[index].hash == hash)
+                return index;
+        }
+    }
+
+    GLint locationOf(const UniformName &name) const
+    {
+        const int index = findUniform(name);
+        return index < 0 ? -1 : uniforms[index].location;
+    }
+
+    template <class T>
+    void setValue(const int index, const T &value) const
+    {
+        static_assert(sizeof(T) <= sizeof(UniformSlot::value), "uniform value is too big");
+        if (index < 0)
+            return;
+        UniformSlot &uniform = uniforms[index];
+        if (uniform.cached && std::memcmp(uniform.value, &value, sizeof(T)) == 0) {
+            ++uniform_uploads_elided;
+            return;
+        }
+        std::memcpy(uniform.value, &value, sizeof(T));
+        uniform.cached = true;
+        ++uniform_uploads;
+        upload(uniform.location, value);
+    }
+
+    static void upload(const GLint location, const int value)
+    {
+        glUniform1i(location, value);
+    }
+    static void upload(const GLint location, const float value)
+    {
+        glUniform1f(location, value);
+    }
+    static void upload(const GLint location, const glm::vec2 &value)
+    {
+        glUniform2fv(location, 1, &value[0]);
+    }
+    static void upload(const GLint location, const glm::vec3 &value)
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+    static void upload(const GLint location, const glm::vec4 &value)
+    {
+        glUniform4fv(location, 1, &value[0]);
+    }
+    static void upload(const GLint location, const glm::mat2 &mat)
+    {
+        glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+    static void upload(const GLint location, const glm::mat3 &mat)
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+    static void upload(const GLint location, const glm::mat4 &mat)
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // -----------------------
+    // reads a shader file from the shaders directory
+    static std::string readSource(const char *file_name)
+    {
+        std::ifstream source;
+        // --------------------------
+        // ensure ifstream objects can throw exceptions:
+        source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try {
+            source.open(std::string("shaders/") + file_name);
+            std::stringstream stream;
+            stream << source.rdbuf();
+            source.close();
+            return stream.str();
+        }
+        catch (std::ifstream::failure &e) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << file_name
+                      << '\n' << e.what() << '\n';
+        }
+        return std::string();
+    }
+
+    static std::string injectDefines(std::string code, const std::string &defines)
+    {
+        if (defines.empty())
+            return code;
+        const std::size_t version = code.find("#version");
+        std::size_t line_end = version == std::string::npos ? std::string::npos :
+                               code.find('\n', version);
+        line_end = line_end == std::string::npos ? 0 : line_end + 1;
+        code.insert(line_end, defines);
+        return code;
+    }
+
+    // -----------------------
+    // loads the cached binary of the sources or compiles and links them
+    void build(const std::vector <Source> &sources, const std::string &defines,
+               const CompileMode mode)
+    {
+        binary_path = "shaders/" + toHex(Hash::fnv1a(defines, Hash::fnv1a(name))) + ".progbin";
+        binary_key = binaryKey(sources);
+
+        id = glCreateProgram();
+        if (loadProgramBinary()) {
+            finishLink();
+            return;
+        }
+
+        // --------------------
+        // compile shaders. With parallel compilation these calls
+        // return immediately, errors are checked in finishLink().
+        for (const Source &source : sources)
+            stages.push_back({compileStage(source.stage_type, source.code), source.type});
+
+        // ------------------
+        // shader Program
+        for (const Stage &stage : stages)
+            glAttachShader(id, stage.id);
+        if (GLExt::has_program_binary)
+            GLExt::programParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(id);
+
+        link_pending = true;
+        if (mode == BLOCKING || !GLExt::has_parallel_shader_compile)
+            finishLink();
+    }
+
+    static unsigned compileStage(const GLenum stage_type, const std::string &code)
+    {
+        const GLchar *code_str = code.c_str();
+        const unsigned shader = glCreateShader(stage_type);
+        glShaderSource(shader, 1, &code_str, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    // -----------------------
+    // checks the link result (waiting for it if the driver is still
+    // compiling), reflects the program and bakes its binary
+    void finishLink() const
+    {
+        link_pending = false;
+        if (!from_binary) {
+            for (const Stage &stage : stages)
+                checkCompileErrors(stage.id, stage.type);
+            const bool linked = checkCompileErrors(id, PROGRAM);
+            // -----------------------
+            // delete the shaders as they're linked into our program now
+            // and no longer necessery
+            for (const Stage &stage : stages) {
+                glDetachShader(id, stage.id);
+                glDeleteShader(stage.id);
+            }
+            stages.clear();
+            if (linked)
+                storeProgramBinary();
+        }
+        reflectAttributes();
+        reflectUniforms();
+
+        std::cout << "Shader: " << name
+                  << (from_binary ? " loaded from program binary in " : " compiled in ")
+                  << std::chrono::duration <double, std::milli>(
+                     std::chrono::steady_clock::now() - start_time).count() << " ms\n";
+    }
+
+    // -----------------------
+    // program binaries are only valid for the driver that produced
+    // them, so the driver strings are part of the key
+    static std::uint64_t binaryKey(const std::vector <Source> &sources)
+    {
+        std::uint64_t key = Hash::fnv_offset;
+        for (const Source &source : sources)
+            key = Hash::fnv1a(source.code, key);
+        for (const GLenum driver_string : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const GLubyte *value = glGetString(driver_string);
+            if (value)
+                key = Hash::fnv1aString(reinterpret_cast <const char *>(value), key);
+        }
+        return key;
+    }
+
+    static std::string toHex(const std::uint64_t value)
+    {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast <unsigned long long>(value));
+        return hex;
+    }
+
+    struct BinaryHeader
+    {
+        char magic[8];
+        std::uint64_t key;
+        std::uint32_t format;
+        std::uint32_t length;
+    };
+
+    // -----------------------
+    // returns false if there is no cached binary for these sources or
+    // the driver rejects it; the program is then built from source
+    bool loadProgramBinary()
+    {
+        if (!GLExt::has_program_binary)
+            return false;
+        std::ifstream in(binary_path, std::ios::binary);
+        BinaryHeader header;
+        if (!in.read(reinterpret_cast <char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0 ||
+            header.key != binary_key)
+            return false;
+        std::vector <char> binary(header.length);
+        if (!in.read(binary.data(), binary.size()))
+            return false;
+
+        GLExt::programParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        GLExt::programBinary(id, header.format, binary.data(),
+                             static_cast <GLsizei>(binary.size()));
+        GLint success = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &success);
+        if (!success) {
+            // -----------------------
+            // e.g. the driver was updated without changing its version
+            // string: start over with a fresh program object
+            std::cout << "Shader: program binary of " << name
+                      << " rejected by the driver, recompiling\n";
+            glDeleteProgram(id);
+            id = glCreateProgram();
+            return false;
+        }
+        from_binary = true;
+        return true;
+    }
+
+    void storeProgramBinary() const
+    {
+        if (!GLExt::has_program_binary)
+            return;
+        GLint length = 0;
+        glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector <char> binary(length);
+        GLenum format = 0;
+        GLExt::getProgramBinary(id, length, &length, &format, binary.data());
+
+        BinaryHeader header;
+        std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+        header.key = binary_key;
+        header.format = format;
+        header.length = static_cast <std::uint32_t>(length);
+        std::ofstream out(binary_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast <const char *>(&header), sizeof(header));
+        out.write(binary.data(), length);
+        if (!out)
+            std::cout << "WARNING::SHADER:: cannot write " << binary_path << '\n';
+    }
+
+    static constexpr char binary_magic[8] = {'S', 'Y', 'L', 'P', 'R', 'O', 'G', '\0'};
+
+    // -----------------------
+    // enumerates the active uniforms once after linking. Arrays are
+    // reported by GL as "name[0]" of size N: the plain name and every
+    // element are registered. Uniform block members have no location
+    // and are skipped.
+    void reflectUniforms() const
+    {
+        GLint uniforms_num = 0;
+        glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &uniforms_num);
+        for (GLint i = 0; i < uniforms_num; ++i) {
+            char name[256];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(id, static_cast <GLuint>(i), sizeof(name), &length,
+                               &size, &type, name);
+            const GLint location = glGetUniformLocation(id, name);
+            if (location < 0)
+                continue;
+
+            std::string uniform_name(name, length);
+            addUniform(uniform_name, location, type);
+            const std::size_t bracket = uniform_name.size() > 3 ?
+                                        uniform_name.size() - 3 : std::string::npos;
+            if (bracket != std::string::npos &&
+                uniform_name.compare(bracket, 3, "[0]") == 0) {
+                const std::string array_name = uniform_name.substr(0, bracket);
+                addUniform(array_name, location, type);
+                for (GLint element = 1; element < size; ++element) {
+                    const std::string element_name = array_name + '[' +
+                                                     std::to_string(element) + ']';
+                    addUniform(element_name,
+                               glGetUniformLocation(id, element_name.c_str()), type);
+                }
+            }
+        }
+
+        std::size_t table_size = 1;
+        while (table_size < uniforms.size() * 2)
+            table_size <<= 1;
+        uniform_table.assign(table_size, -1);
+        for (std::size_t i = 0; i < uniforms.size(); ++i) {
+            std::size_t slot = uniforms[i].hash & (table_size - 1);
+            while (uniform_table[slot] >= 0)
+                slot = (slot + 1) & (table_size - 1);
+            uniform_table[slot] = static_cast <int>(i);
+        }
+    }
+
+    void addUniform(const std::string &name, const GLint location, const GLenum type) const
+    {
+        UniformSlot uniform;
+        uniform.hash = UniformName(name).getHash();
+        uniform.location = location;
+        uniform.type = type;
+        uniform.cached = false;
+        uniforms.push_back(uniform);
+    }
+    
+    // -----------------------
+    // collects the locations of all active attributes. Matrix
+    // attributes occupy one location per column.
+    void reflectAttributes() const
+    {
+        GLint attributes_num = 0;
+        glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &attributes_num);
+        for (GLint i = 0; i < attributes_num; ++i) {
+            char name[256];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveAttrib(id, static_cast <GLuint>(i), sizeof(name), &length,
+                              &size, &type, name);
+            const GLint location = glGetAttribLocation(id, name);
+            if (location < 0)   // built-ins like gl_VertexID
+                continue;
+
+            GLint columns = 1;
+            if (type == GL_FLOAT_MAT2)
+                columns = 2;
+            else if (type == GL_FLOAT_MAT3)
+                columns = 3;
+            else if (type == GL_FLOAT_MAT4)
+                columns = 4;
+            for (GLint slot = 0; slot < size * columns && location + slot < 32; ++slot)
+                attribute_mask |= 1u << (location + slot);
+        }
+    }
     
-    std::string getTypeName(const Type type) const noexcept(false)
+    static std::string getTypeName(const Type type) noexcept(false)
     {
         switch(type) {
             case PROGRAM:
@@ -249,6 +719,10 @@ private:
             return "FRAGMENT";
             case VERTEX:
             return "VERTEX";
+            case GEOMETRY:
+            return "GEOMETRY";
+            case COMPUTE:
+            return "COMPUTE";
             default:
             throw std::runtime_error("Unidentified type\n");
         }
@@ -256,7 +730,7 @@ private:
     
     // -----------------------
     // utility function for checking shader compilation/linking errors.
-    void checkCompileErrors(const unsigned shader, const Type type)
+    static bool checkCompileErrors(const unsigned shader, const Type type)
     {
         int success;
         char info_log[1024];
@@ -279,6 +753,7 @@ private:
                           << "\n-------------------------------------\n";
             }
         }
+        return success;
     }
 };
 